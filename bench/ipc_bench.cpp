@@ -0,0 +1,304 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "os_includes.h"
+#include "ipc_channel.h"
+#include "ipc_codec.h"
+#include "ipc_metrics.h"
+#include "ipc_test_helpers.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Microbenchmarks of the codec and the channel. Each one encodes, decodes or sends a message
+// with a single argument of some wire type and payload size. The results go to stdout, one
+// JSON object per line:
+//
+//   {"bench":"decode","type":"string8","size":256,"wire_bytes":320,"iterations":262144,
+//    "ns_per_op":122.6,"mb_per_s":2610.5,"allocs_per_op":5.00}
+//
+// |mb_per_s| counts the encoded bytes. |allocs_per_op| counts every operator new, in the
+// library or in the standard library it uses.
+//
+//   bench [--filter text] [--min-time-ms N]
+
+namespace {
+
+long g_allocs = 0;
+
+}  // namespace.
+
+#if __cplusplus >= 201103L
+#define IPC_BENCH_NOTHROW noexcept
+#else
+#define IPC_BENCH_NOTHROW throw()
+#endif
+
+void* operator new(size_t size) {
+  ++g_allocs;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  ++g_allocs;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) IPC_BENCH_NOTHROW {
+  free(p);
+}
+
+void operator delete[](void* p) IPC_BENCH_NOTHROW {
+  free(p);
+}
+
+// C++14 compilers can call the sized forms instead, which must then free from malloc() too.
+#if __cplusplus >= 201402L
+void operator delete(void* p, size_t) IPC_BENCH_NOTHROW {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) IPC_BENCH_NOTHROW {
+  free(p);
+}
+#endif
+
+namespace {
+
+const int kMsgId = 7;
+const size_t kMaxPipePayload = 4096;
+
+// Keeps the size of the last message and nothing else.
+class NullTransport {
+ public:
+  NullTransport() : last_size_(0) {}
+
+  size_t Send(const void*, size_t size) {
+    last_size_ = size;
+    return ipc::RcOK;
+  }
+
+  char* Receive(size_t*) {
+    return NULL;
+  }
+
+  size_t last_size_;
+};
+
+typedef ipc::Channel<NullTransport, ipc::Encoder, ipc::Decoder> NullChannel;
+typedef ipc::Channel<TestTransport, ipc::Encoder, ipc::Decoder> TestChannel;
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+// Ends Receive() after each message.
+template <class ChannelT>
+class StopDispatch {
+ public:
+  StopDispatch* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int, ChannelT*, const ipc::WireType* const[], int) {
+    return ipc::OnMsgReady;
+  }
+};
+
+// One argument of some type and size, and its encoding.
+struct Payload {
+  Payload(const char* type, size_t size, const ipc::WireView& view)
+      : type(type), size(size), view(view) {
+    TestTransport transport;
+    TestChannel channel(&transport);
+    channel.Send(kMsgId, &this->view, 1);
+    size_t wire_size = 0;
+    const char* buf = transport.Receive(&wire_size);
+    wire.assign(buf, buf + wire_size);
+  }
+
+  const char* type;
+  size_t size;
+  ipc::WireView view;
+  std::vector<char> wire;
+};
+
+struct Options {
+  const char* filter;
+  long long min_time_ns;
+};
+
+typedef bool (*BenchFn)(Payload* payload, void* ctx);
+
+bool Encode(Payload* payload, void* ctx) {
+  NullChannel* channel = static_cast<NullChannel*>(ctx);
+  return channel->Send(kMsgId, &payload->view, 1) == ipc::RcOK;
+}
+
+bool Decode(Payload* payload, void*) {
+  NullChannel::RxHandler handler;
+  ipc::Decoder<NullChannel::RxHandler> decoder(&handler);
+  if (decoder.OnData(&payload->wire[0], payload->wire.size()))
+    return false;
+  return decoder.Success() && (handler.GetArgCount() == 1);
+}
+
+// TestTransport keeps what was sent, so Receive() reads it back.
+bool SendReceiveTest(Payload* payload, void* ctx) {
+  TestChannel* channel = static_cast<TestChannel*>(ctx);
+  channel->Send(kMsgId, &payload->view, 1);
+  StopDispatch<TestChannel> dispatch;
+  return channel->Receive(&dispatch) == ipc::OnMsgReady;
+}
+
+struct PipeEnds {
+  PipeChannel* client;
+  PipeChannel* server;
+};
+
+bool SendReceivePipe(Payload* payload, void* ctx) {
+  PipeEnds* ends = static_cast<PipeEnds*>(ctx);
+  if (ends->client->Send(kMsgId, &payload->view, 1) != ipc::RcOK)
+    return false;
+  StopDispatch<PipeChannel> dispatch;
+  return ends->server->Receive(&dispatch) == ipc::OnMsgReady;
+}
+
+bool RunLoop(BenchFn fn, Payload* payload, void* ctx, long long iterations) {
+  for (long long ix = 0; ix != iterations; ++ix) {
+    if (!fn(payload, ctx))
+      return false;
+  }
+  return true;
+}
+
+// Doubles the iterations until a run takes at least |min_time_ns| and reports that run.
+void Run(const Options& options, const char* bench, BenchFn fn, Payload* payload, void* ctx) {
+  char name[128];
+  snprintf(name, sizeof(name), "%s/%s/%d", bench, payload->type,
+           static_cast<int>(payload->size));
+  if (options.filter && !strstr(name, options.filter))
+    return;
+
+  long long iterations = 1;
+  long long elapsed = 0;
+  long allocs = 0;
+  for (;;) {
+    allocs = g_allocs;
+    const long long start = ipc::ChannelMetrics::Now();
+    if (!RunLoop(fn, payload, ctx, iterations)) {
+      fprintf(stderr, "bench: %s failed\n", name);
+      return;
+    }
+    elapsed = ipc::ChannelMetrics::Now() - start;
+    allocs = g_allocs - allocs;
+    if (elapsed >= options.min_time_ns)
+      break;
+    iterations *= 2;
+  }
+
+  const double ns_per_op = static_cast<double>(elapsed) / iterations;
+  const double mb_per_s = (payload->wire.size() * 1000.0) / ns_per_op;
+  printf("{\"bench\":\"%s\",\"type\":\"%s\",\"size\":%d,\"wire_bytes\":%d,"
+         "\"iterations\":%lld,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f,\"allocs_per_op\":%.2f}\n",
+         bench, payload->type, static_cast<int>(payload->size),
+         static_cast<int>(payload->wire.size()), iterations, ns_per_op, mb_per_s,
+         static_cast<double>(allocs) / iterations);
+  fflush(stdout);
+}
+
+void RunAll(const Options& options, Payload* payload) {
+  NullTransport null_transport;
+  NullChannel encode_channel(&null_transport);
+  Run(options, "encode", Encode, payload, &encode_channel);
+  Run(options, "decode", Decode, payload, NULL);
+
+  TestTransport test_transport;
+  TestChannel test_channel(&test_transport);
+  Run(options, "channel_test_transport", SendReceiveTest, payload, &test_channel);
+
+  // Both ends are in this thread, so the message has to fit in the pipe.
+  if (payload->size <= kMaxPipePayload) {
+    PipePair pp;
+    PipeTransport server_transport;
+    server_transport.OpenServer(pp.fd1());
+    PipeTransport client_transport;
+    client_transport.OpenClient(pp.fd2());
+    PipeChannel server(&server_transport);
+    PipeChannel client(&client_transport);
+    PipeEnds ends = { &client, &server };
+    Run(options, "channel_pipe", SendReceivePipe, payload, &ends);
+  }
+}
+
+}  // namespace.
+
+int main(int argc, char* argv[]) {
+  Options options = { NULL, 200 * 1000 * 1000 };
+  for (int ix = 1; ix != argc; ++ix) {
+    if (!strcmp(argv[ix], "--filter") && (ix + 1 != argc)) {
+      options.filter = argv[++ix];
+    } else if (!strcmp(argv[ix], "--min-time-ms") && (ix + 1 != argc)) {
+      options.min_time_ns = atoi(argv[++ix]) * 1000000LL;
+    } else {
+      fprintf(stderr, "usage: bench [--filter text] [--min-time-ms N]\n");
+      return 2;
+    }
+  }
+
+  const size_t kSizes[] = { 16, 256, 4096, 65536 };
+  std::string texts[countof(kSizes)];
+  std::wstring wtexts[countof(kSizes)];
+  const std::vector<char> bytes(kSizes[countof(kSizes) - 1], 'x');
+  const std::vector<int> ints(kSizes[countof(kSizes) - 1] / sizeof(int), 7);
+
+  std::vector<Payload*> payloads;
+  payloads.push_back(new Payload("int32", sizeof(int), ipc::WireView(7)));
+  payloads.push_back(new Payload("int64", sizeof(long long), ipc::WireView(7LL)));
+  payloads.push_back(new Payload("float64", sizeof(double), ipc::WireView(7.0)));
+  for (size_t ix = 0; ix != countof(kSizes); ++ix) {
+    const size_t size = kSizes[ix];
+    texts[ix].assign(size, 'x');
+    wtexts[ix].assign(size / sizeof(wchar_t), L'x');
+    payloads.push_back(new Payload("string8", size, ipc::WireView(texts[ix].c_str())));
+    payloads.push_back(new Payload("string16", size, ipc::WireView(wtexts[ix].c_str())));
+    payloads.push_back(new Payload("bytes", size,
+                                   ipc::WireView(ipc::ByteArray(size, &bytes[0]))));
+    payloads.push_back(new Payload("int32array", size,
+                                   ipc::WireView(ipc::Int32Array(size / sizeof(int), &ints[0]))));
+  }
+
+  for (size_t ix = 0; ix != payloads.size(); ++ix) {
+    RunAll(options, payloads[ix]);
+    delete payloads[ix];
+  }
+  return 0;
+}
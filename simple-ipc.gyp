@@ -1,5 +1,30 @@
 # TODO(vtl): lots of stuff
 {
+  'variables': {
+    'unit_test_sources': [
+      'test/ipc_capture_unittest.cpp',
+      'test/ipc_codec_unittest.cpp',
+      'test/ipc_coro_unittest.cpp',
+      'test/ipc_dispatch_unnitest.cpp',
+      'test/ipc_flow_control_unittest.cpp',
+      'test/ipc_lanes_unittest.cpp',
+      'test/ipc_memdet_unittest.cpp',
+      'test/ipc_metrics_unittest.cpp',
+      'test/ipc_mux_unittest.cpp',
+      'test/ipc_pool_dispatch_unittest.cpp',
+      'test/ipc_pubsub_unittest.cpp',
+      'test/ipc_response_cache_unittest.cpp',
+      'test/ipc_roundtrip_unittest.cpp',
+      'test/ipc_send_queue_unittest.cpp',
+      'test/ipc_service_pool_unittest.cpp',
+      'test/ipc_stats_unittest.cpp',
+      'test/ipc_test_helpers.h',
+      'test/ipc_trace_unittest.cpp',
+      'test/ipc_transport_unix_unittest.cpp',
+      'test/ipc_transport_win_unittest.cpp',
+      'test/test_main.cpp',
+    ],
+  },
   'target_defaults': {
     'conditions': [
       ['OS=="win"', {
@@ -16,15 +41,43 @@
       'type': 'static_library',
       'msvs_guid': '61E911C1-F921-4F20-BA75-5F49424FCE79',
       'sources': [
+        'src/ipc_async_calls.h',
+        'src/ipc_capture.h',
         'src/ipc_channel.h',
         'src/ipc_codec.h',
+        'src/ipc_coro.h',
+        'src/ipc_lanes.h',
+        'src/ipc_metrics.h',
         'src/ipc_msg_dispatch.h',
+        'src/ipc_msg_registry.h',
+        'src/ipc_mux.h',
+        'src/ipc_pool_dispatch.h',
+        'src/ipc_pubsub.h',
+        'src/ipc_response_cache.h',
+        'src/ipc_send_queue.h',
+        'src/ipc_service_pool.h',
+        'src/ipc_stats.h',
+        'src/ipc_sync.h',
+        'src/ipc_trace.h',
         'src/ipc_wire_types.h',
+        'src/mapped_file_unix.cpp',
+        'src/mapped_file_unix.h',
+        'src/mapped_memory_unix.cpp',
+        'src/mapped_memory_unix.h',
         'src/os_includes.h',
         'src/pipe_unix.cpp',
         'src/pipe_unix.h',
         'src/pipe_win.cpp',
         'src/pipe_win.h',
+        'src/shared_mem_unix.cpp',
+        'src/shared_mem_unix.h',
+      ],
+      'conditions': [
+        ['OS=="linux"', {
+          'link_settings': {
+            'libraries': [ '-lrt', ],
+          },
+        }],
       ],
     },
     {
@@ -35,17 +88,74 @@
         'ipc_lib',
       ],
       'sources': [
-        'test/ipc_codec_unittest.cpp',
-        'test/ipc_dispatch_unnitest.cpp',
-        'test/ipc_roundtrip_unittest.cpp',
-        'test/ipc_test_helpers.h',
-        'test/ipc_transport_unix_unittest.cpp',
-        'test/ipc_transport_win_unittest.cpp',
-        'test/test_main.cpp',
+        '<@(unit_test_sources)',
+      ],
+      'defines': [
+        'IPC_MEMDET_HOOKS',
       ],
       'include_dirs': [
         'src',
       ],
     },
+    {
+      # The unit tests again, built as C++20 so that the coroutine tests really run.
+      'target_name': 'unit_test_cxx20',
+      'type': 'executable',
+      'dependencies': [
+        'ipc_lib',
+      ],
+      'sources': [
+        '<@(unit_test_sources)',
+      ],
+      'defines': [
+        'IPC_MEMDET_HOOKS',
+        'IPC_REQUIRE_COROUTINES',
+      ],
+      'include_dirs': [
+        'src',
+      ],
+      'cflags_cc': [ '-std=gnu++20', ],
+      'xcode_settings': {
+        'CLANG_CXX_LANGUAGE_STANDARD': 'gnu++20',
+      },
+      'msvs_settings': {
+        'VCCLCompilerTool': {
+          'AdditionalOptions': [ '/std:c++20', ],
+        },
+      },
+    },
+    {
+      'target_name': 'bench',
+      'type': 'executable',
+      'dependencies': [
+        'ipc_lib',
+      ],
+      'sources': [
+        'bench/ipc_bench.cpp',
+      ],
+      'include_dirs': [
+        'src',
+        'test',
+      ],
+    },
+  ],
+  'conditions': [
+    ['OS!="win"', {
+      'targets': [
+        {
+          'target_name': 'ipc_replay',
+          'type': 'executable',
+          'dependencies': [
+            'ipc_lib',
+          ],
+          'sources': [
+            'tools/ipc_replay.cpp',
+          ],
+          'include_dirs': [
+            'src',
+          ],
+        },
+      ],
+    }],  # OS!="win"
   ],
 }
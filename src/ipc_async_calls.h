@@ -0,0 +1,158 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_ASYNC_CALLS_H_
+#define SIMPLE_IPC_ASYNC_CALLS_H_
+
+#include "ipc_constants.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// AsyncCalls lets a client have many requests in flight over the same channel instead of the
+// usual send-then-Receive() lockstep. Each request gets a call id which travels in the message
+// header, and the reply is matched to its request by that id, so replies can arrive in any
+// order.
+//
+// The server side needs no changes: Channel::Send() called from inside a message handler tags
+// the reply with the call id of the request being handled.
+//
+// A typical client:
+//
+//   class SumReply : public ipc::AsyncCalls<ChannelT>::Completion,
+//                    public ipc::MsgIn<kSumReply, SumReply, ChannelT> {
+//     virtual size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int n) {
+//       return OnMsgInX(msg_id, ch, args, n);
+//     }
+//     size_t OnMsg(ChannelT*, int sum) { ... return ipc::OnMsgReady; }
+//   };
+//
+//   ipc::AsyncCalls<ChannelT> calls(&channel);
+//   int id1, id2;
+//   calls.Call(&reply1, kSum, args1, 2, &id1);
+//   calls.Call(&reply2, kSum, args2, 2, &id2);
+//   calls.Wait(id2);     // Might complete reply1 as well.
+//   calls.WaitAll();
+//
+// The Completion object must stay alive until the call completes. Like the Channel, this
+// class is not thread safe.
+
+namespace ipc {
+
+template <class ChannelT>
+class AsyncCalls {
+ public:
+  // Receives the reply of a call. OnMsgIn() should return OnMsgReady or OnMsgLoopNext,
+  // any other value is an error that stops Wait() and is returned by it.
+  class Completion {
+   public:
+    virtual ~Completion() {}
+    virtual size_t OnMsgIn(int msg_id, ChannelT* ch,
+                           const WireType* const args[], int count) = 0;
+  };
+
+  explicit AsyncCalls(ChannelT* channel)
+      : channel_(channel), last_call_id_(0), wait_call_id_(0) {}
+
+  // Sends the request message and returns without waiting for the reply. On success
+  // |call_id| receives the id of the call, which can be used with Wait().
+  size_t Call(Completion* done, int msg_id, const WireType* const args[], int n_args,
+              int* call_id) {
+    const int id = NextCallId(&last_call_id_);
+    size_t rc = channel_->Send(msg_id, args, n_args, id);
+    if (rc != RcOK)
+      return rc;
+    PendingCall pc = { id, done };
+    pending_.push_back(pc);
+    *call_id = id;
+    return RcOK;
+  }
+
+  // Blocks until the call |call_id| completes. Replies to other calls that arrive in
+  // the meantime are completed as well.
+  size_t Wait(int call_id) {
+    if (!IsPending(call_id))
+      return RcOK;
+    wait_call_id_ = call_id;
+    size_t rc = channel_->Receive(this);
+    wait_call_id_ = 0;
+    return (rc == OnMsgReady) ? RcOK : rc;
+  }
+
+  // Blocks until all the calls in flight complete.
+  size_t WaitAll() {
+    if (!pending_.size())
+      return RcOK;
+    size_t rc = channel_->Receive(this);
+    return (rc == OnMsgReady) ? RcOK : rc;
+  }
+
+  bool IsPending(int call_id) const {
+    return (Find(call_id) != kNotFound);
+  }
+
+  size_t PendingCount() const { return pending_.size(); }
+
+  // These implement the DispatchT contract of Channel::Receive().
+  AsyncCalls* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    size_t ix = Find(ch->LastRecvCallId());
+    if (ix == kNotFound)
+      return RcErrBadCallId;
+    Completion* done = pending_[ix].done;
+    // Unordered removal; the last one takes the slot of the completed call.
+    pending_[ix] = pending_[pending_.size() - 1];
+    pending_.pop_back();
+
+    size_t rc = done->OnMsgIn(msg_id, ch, args, count);
+    if ((rc != OnMsgReady) && (rc != OnMsgLoopNext))
+      return rc;
+    if (wait_call_id_)
+      return IsPending(wait_call_id_) ? OnMsgLoopNext : OnMsgReady;
+    return pending_.size() ? OnMsgLoopNext : OnMsgReady;
+  }
+
+ private:
+  struct PendingCall {
+    int call_id;
+    Completion* done;
+  };
+
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  size_t Find(int call_id) const {
+    for (size_t ix = 0; ix != pending_.size(); ++ix) {
+      if (pending_[ix].call_id == call_id)
+        return ix;
+    }
+    return kNotFound;
+  }
+
+  ChannelT* channel_;
+  PodVector<PendingCall> pending_;
+  int last_call_id_;
+  int wait_call_id_;
+
+  AsyncCalls(const AsyncCalls&);
+  AsyncCalls& operator=(const AsyncCalls&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_ASYNC_CALLS_H_
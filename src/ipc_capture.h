@@ -0,0 +1,274 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_CAPTURE_H_
+#define SIMPLE_IPC_CAPTURE_H_
+
+#include <string.h>
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+#include "ipc_metrics.h"
+#include "ipc_sync.h"
+
+#if !defined(WIN32)
+#include <time.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Wire capture and replay. CaptureTransport wraps a transport and appends every buffer it
+// sends or receives, with a timestamp, to a CaptureLog. The log lives in memory that the
+// caller provides, usually a file mapped with MappedFile, so capturing is a copy and an
+// atomic add, with no system call:
+//
+//   MappedFile file;
+//   file.Create("broker.capture", 64 * 1024 * 1024);
+//   ipc::CaptureLog log;
+//   log.Init(file.memory(), file.size());
+//   ipc::CaptureTransport<PipeTransport> capture(&pipe, &log);
+//   ipc::Channel<ipc::CaptureTransport<PipeTransport>, ipc::Encoder, ipc::Decoder> ch(&capture);
+//
+// ReplayTransport plays the received side of a capture back, so the same dispatcher and
+// decoder run on the real mix of messages, either as fast as possible or with the gaps
+// that the capture had:
+//
+//   ipc::CaptureReader reader;
+//   reader.Attach(file.memory(), file.size());
+//   ipc::ReplayTransport replay(&reader, ipc::REPLAY_PACED);
+//   ipc::Channel<ipc::ReplayTransport, ipc::Encoder, ipc::Decoder> ch(&replay);
+//   ch.Receive(&dispatcher);    // Returns RcErrTransportRead at the end of the capture.
+//
+// The frames are the buffers as the transport returned them, which can hold part of a
+// message or several messages. When the log is full new frames are dropped and counted.
+// If the process dies while writing a frame the log ends before that frame.
+
+namespace ipc {
+
+enum CaptureDirection {
+  CAPTURE_IN = 1,
+  CAPTURE_OUT = 2
+};
+
+enum ReplayPacing {
+  REPLAY_FAST,
+  REPLAY_PACED
+};
+
+// The layout of the captured memory.
+class CaptureFormat {
+ protected:
+  enum {
+    kMark = 0x70616377,   // 'wcap'
+    kVersion = 1
+  };
+
+  struct Header {
+    unsigned int mark;
+    unsigned int version;
+    long capacity;
+    volatile long end;
+    volatile long dropped;
+  };
+
+  // The size is stored last, so a frame with size 0 is not complete.
+  struct Frame {
+    long long time;
+    long direction;
+    volatile long size;
+  };
+
+  static long Padded(long size) {
+    return (size + 7) & ~7L;
+  }
+
+  static char* Data(Header* header) {
+    return reinterpret_cast<char*>(header) + Padded(sizeof(Header));
+  }
+};
+
+class CaptureLog : public CaptureFormat {
+ public:
+  CaptureLog() : header_(NULL) {}
+
+  // Starts an empty log in |mem|, which has to be zero-filled, as a new file or shared
+  // memory region is.
+  bool Init(void* mem, size_t size) {
+    if (size < static_cast<size_t>(Padded(sizeof(Header)) + Padded(sizeof(Frame))))
+      return false;
+    header_ = static_cast<Header*>(mem);
+    header_->version = kVersion;
+    header_->capacity = static_cast<long>(size - Padded(sizeof(Header)));
+    header_->end = 0;
+    header_->dropped = 0;
+    header_->mark = kMark;
+    return true;
+  }
+
+  // Thread safe.
+  void Append(int direction, const void* buf, size_t size) {
+    const long need = Padded(sizeof(Frame)) + Padded(static_cast<long>(size));
+    long pos;
+    do {
+      pos = AtomicLoad(&header_->end);
+      if (header_->capacity - pos < need) {
+        AtomicIncrement(&header_->dropped);
+        return;
+      }
+    } while (AtomicCompareExchange(&header_->end, pos + need, pos) != pos);
+
+    Frame* frame = reinterpret_cast<Frame*>(Data(header_) + pos);
+    frame->time = ChannelMetrics::Now();
+    frame->direction = direction;
+    memcpy(reinterpret_cast<char*>(frame) + Padded(sizeof(Frame)), buf, size);
+    AtomicExchange(&frame->size, static_cast<long>(size));
+  }
+
+  long Dropped() const { return header_ ? AtomicLoad(&header_->dropped) : 0; }
+
+ private:
+  Header* header_;
+};
+
+// Wraps a transport and captures what goes through it. Both ends of a channel work
+// unchanged whether or not one of them captures.
+template <class TransportT>
+class CaptureTransport {
+ public:
+  CaptureTransport(TransportT* transport, CaptureLog* log) : transport_(transport), log_(log) {}
+
+  size_t Send(const void* buf, size_t size) {
+    log_->Append(CAPTURE_OUT, buf, size);
+    return transport_->Send(buf, size);
+  }
+
+  char* Receive(size_t* size) {
+    char* buf = transport_->Receive(size);
+    if (buf && *size)
+      log_->Append(CAPTURE_IN, buf, *size);
+    return buf;
+  }
+
+ private:
+  TransportT* transport_;
+  CaptureLog* log_;
+};
+
+class CaptureReader : public CaptureFormat {
+ public:
+  struct Item {
+    long long time;
+    int direction;
+    const char* data;
+    size_t size;
+  };
+
+  CaptureReader() : header_(NULL), pos_(0) {}
+
+  bool Attach(void* mem, size_t size) {
+    Header* header = static_cast<Header*>(mem);
+    if ((size < static_cast<size_t>(Padded(sizeof(Header)))) || (header->mark != kMark) ||
+        (header->version != kVersion) ||
+        (header->capacity > static_cast<long>(size - Padded(sizeof(Header)))))
+      return false;
+    header_ = header;
+    pos_ = 0;
+    return true;
+  }
+
+  // Gets the next complete frame. Returns false at the end of the log. Only reads |mem|, so
+  // it can be mapped read-only.
+  bool Next(Item* item) {
+    const long end = AtomicLoadAcquire(&header_->end);
+    if (pos_ >= end)
+      return false;
+    Frame* frame = reinterpret_cast<Frame*>(Data(header_) + pos_);
+    const long size = AtomicLoadAcquire(&frame->size);
+    if (!size)
+      return false;
+    item->time = frame->time;
+    item->direction = static_cast<int>(frame->direction);
+    item->data = reinterpret_cast<char*>(frame) + Padded(sizeof(Frame));
+    item->size = size;
+    pos_ += Padded(sizeof(Frame)) + Padded(size);
+    return true;
+  }
+
+  void Rewind() { pos_ = 0; }
+
+  long Dropped() const { return header_->dropped; }
+
+ private:
+  Header* header_;
+  long pos_;
+};
+
+// A transport that plays back the frames a CaptureTransport received. What is sent to
+// it is thrown away, so the replies of the handlers go nowhere.
+class ReplayTransport {
+ public:
+  ReplayTransport(CaptureReader* reader, ReplayPacing pacing)
+      : reader_(reader), pacing_(pacing), first_frame_(0), started_at_(0) {}
+
+  size_t Send(const void*, size_t) {
+    return RcOK;
+  }
+
+  // Goes back to the start of the capture, to play it again.
+  void Restart() {
+    reader_->Rewind();
+    started_at_ = 0;
+  }
+
+  // Returns NULL at the end of the capture.
+  char* Receive(size_t* size) {
+    CaptureReader::Item item;
+    do {
+      if (!reader_->Next(&item))
+        return NULL;
+    } while (item.direction != CAPTURE_IN);
+
+    if (pacing_ == REPLAY_PACED) {
+      if (!started_at_) {
+        first_frame_ = item.time;
+        started_at_ = ChannelMetrics::Now();
+      }
+      const long long wait = (item.time - first_frame_) - (ChannelMetrics::Now() - started_at_);
+      if (wait > 0)
+        SleepNs(wait);
+    }
+    *size = item.size;
+    return const_cast<char*>(item.data);
+  }
+
+ private:
+  static void SleepNs(long long ns) {
+#if defined(WIN32)
+    ::Sleep(static_cast<DWORD>(ns / 1000000));
+#else
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000);
+    nanosleep(&ts, NULL);
+#endif
+  }
+
+  CaptureReader* reader_;
+  ReplayPacing pacing_;
+  long long first_frame_;
+  long long started_at_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_CAPTURE_H_
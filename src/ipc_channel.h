@@ -16,6 +16,9 @@
 #define SIMPLE_IPC_CHANNEL_H_
 
 #include "ipc_constants.h"
+#include "ipc_send_queue.h"
+#include "ipc_stats.h"
+#include "ipc_sync.h"
 #include "ipc_utils.h"
 #include "ipc_wire_types.h"
 
@@ -29,18 +32,24 @@
 // The unit of communication of a channel is the message. The channel does not differenciate
 // sender or receiver and assumes that the transport is bi-directional.
 // 
-// For outgoing messages, a message is just defined as an array of WireType pointers along with
-// a message id. The encoder and decoder are loosely coupled with the message and it is the job
-// of the channel to interface them.
+// For outgoing messages, a message is just defined as an array of WireType pointers, or of
+// WireView values, along with a message id. The encoder and decoder are loosely coupled with
+// the message and it is the job of the channel to interface them.
 //
 // Sending Requirements
 //  Encoder should implement:
 //    bool Open(int n_args)
+//    bool SetCallId(int call_id)
+//    bool SetSendTime(long long ns)
 //    bool Close()
 //    void SetMsgId(int msg_id)
 //    bool OnWord(void* bits, int tag)
+//    bool OnWord64(const void* bits, int tag)
+//    bool OnArray(const void* data, size_t byte_sz, int tag)
 //    bool OnString8(const string& s, int tag)
+//    bool OnString8(const char* s, size_t len, int tag)
 //    bool OnString16(const wstring& s, int tag)
+//    bool OnString16(const wchar_t* s, size_t len, int tag)
 //    bool OnUnixFd(int fd, int tag)
 //    bool OnWinHandle(void* handle, int tag)
 //    const void* GetBuffer(size_t* sz)
@@ -49,45 +58,343 @@
 //  Decoder<Handler> should implement:
 //    bool OnData(const char* buff, size_t sz)
 //    bool Success()
+//    void Discard()
+//    size_t Buffered()
 //  Decoder<Handler> should call:
 //    bool Handler::OnMessageStart(int id, int n_args)
+//    bool Handler::OnCallId(int call_id)
+//    bool Handler::OnSendTime(long long ns)
 //    bool Handler::OnWord(const void* bits, int type_id)
+//    bool Handler::OnArray(const void* data, size_t byte_sz, int type_id)
 //    bool Handler::OnString8(string& str, int type_id) 
 //    bool Handler::OnString16(wstring& str, int type_id)
 //
 
 namespace ipc {
 
-template <class TransportT, class EncoderT, template <class> class DecoderT>
+// Per-thread record of the message being handled so that Channel::Send() can tag
+// replies with its call id.
+struct DispatchContext {
+  const void* channel;
+  int call_id;
+};
+
+inline DispatchContext& CurrentDispatch() {
+  static IPC_THREAD_LOCAL DispatchContext context = { NULL, 0 };
+  return context;
+}
+
+// Marks the current thread as handling a message with |call_id| that came from
+// |channel|. Channel::Receive() uses it around every handler; code that runs
+// handlers on other threads should do the same.
+class DispatchScope {
+ public:
+  DispatchScope(const void* channel, int call_id) : outer_(CurrentDispatch()) {
+    CurrentDispatch().channel = channel;
+    CurrentDispatch().call_id = call_id;
+  }
+
+  ~DispatchScope() {
+    CurrentDispatch() = outer_;
+  }
+
+ private:
+  DispatchContext outer_;
+
+  DispatchScope(const DispatchScope&);
+  DispatchScope& operator=(const DispatchScope&);
+};
+
+// Gets the control messages that the channel does not handle itself, see
+// Channel::SetControlObserver(). Called from inside Receive().
+class ControlObserver {
+ public:
+  virtual ~ControlObserver() {}
+  virtual void OnControlMsg(const WireType* const args[], int count) = 0;
+};
+
+// The parts of sending and receiving a message that Channel times for MetricsT::OnSpan().
+// A span of a transport receive has no message id.
+enum TraceSpan {
+  SPAN_ENCODE,
+  SPAN_TRANSPORT_SEND,
+  SPAN_TRANSPORT_RECEIVE,
+  SPAN_DECODE,
+  SPAN_DISPATCH
+};
+
+// The default instrumentation policy of Channel: it records nothing and, since every call
+// to it is behind kEnabled or kTraceSpans, it costs nothing. See ipc::ChannelMetrics for
+// counters and histograms and ipc::ChromeTracer for spans.
+struct NoMetrics {
+  enum { kEnabled = 0, kTraceSpans = 0 };
+
+  static long long Now() { return 0; }
+  void OnSend(int, int, bool, size_t) {}
+  void OnReceive(int, int, size_t, long long, long long, long long, long long) {}
+  void OnSpan(int, int, long long, long long) {}
+  void AddStats(ChannelStats*) {}
+};
+
+// |MaxArgs| is the largest number of arguments of a message. Sending more fails with
+// RcErrEncoderArgs and Receive() rejects more with RcErrDecoderFormat, so both ends should
+// use the same value. The wire format holds up to 65535 arguments. |MetricsT| is told
+// about every message sent and received, see NoMetrics.
+template <class TransportT, class EncoderT, template <class> class DecoderT,
+          size_t MaxArgs = 10, class MetricsT = NoMetrics>
 class Channel {
  public:
-  static const size_t kMaxNumArgs = 10;
-  Channel(TransportT* transport) : transport_(transport), last_msg_id_(-1) {}
+  static const size_t kMaxNumArgs = MaxArgs;
+
+  // How Send() gets the encoded message to the transport:
+  // SEND_DIRECT: the caller writes to the transport. Not thread safe; this is the default.
+  // SEND_COMBINED: Send() is thread safe. The callers encode in parallel and queue the
+  //   buffers; whoever wins the flush token writes everything queued so far.
+  // SEND_WRITER: Send() is thread safe and only queues. Some other thread, usually a
+  //   dedicated writer, must call FlushSendQueue().
+  enum SendMode {
+    SEND_DIRECT,
+    SEND_COMBINED,
+    SEND_WRITER
+  };
+
+  // What Send() does when the other end has not granted enough credit, see
+  // SetReceiveWindow():
+  // FLOW_NONE: there is no flow control; this is the default.
+  // FLOW_FAIL: Send() returns RcErrWouldBlock.
+  // FLOW_BLOCK: Send() waits for credit. If no thread is inside Receive() the sender
+  //   reads the grants from the transport itself, which only works if the other end
+  //   sends nothing else, as in a one-way stream.
+  enum FlowMode {
+    FLOW_NONE,
+    FLOW_FAIL,
+    FLOW_BLOCK
+  };
+
+  Channel(TransportT* transport)
+      : transport_(transport), last_msg_id_(-1), last_call_id_(0), last_send_time_(0),
+        send_timestamps_(false), send_mode_(SEND_DIRECT), send_error_(0), posting_(false),
+        control_observer_(NULL), flow_mode_(FLOW_NONE), credit_msgs_(0), credit_bytes_(0),
+        credit_waiters_(0), readers_(0), control_reader_(false), window_msgs_(0), window_bytes_(0), consumed_msgs_(0),
+        consumed_bytes_(0), created_at_(MonotonicNs()), rx_high_water_(0), stats_reply_(NULL),
+        encoder_busy_(0), rx_decoder_(&rx_handler_), rx_busy_(0) {}
+
+  ~Channel() {
+    StopPostWriter();
+  }
+
+  // Must be called before the channel is shared between threads.
+  void SetSendMode(SendMode mode) { send_mode_ = mode; }
+
+  SendMode GetSendMode() const { return send_mode_; }
+
+  // Stamps every message sent with the time of Send() on the monotonic clock, so the other
+  // end can tell how long it took to get there; with ChannelMetrics it keeps that one-way
+  // latency per message id. Both ends must be on the same machine for the clocks to agree.
+  // Must be called before the channel is shared between threads.
+  void SetSendTimestamps(bool stamp) { send_timestamps_ = stamp; }
+
+  MetricsT* metrics() { return &metrics_; }
+
+  // |observer| gets the kMessagePrivControl messages with a subtype that the channel
+  // does not handle itself. NULL to stop.
+  void SetControlObserver(ControlObserver* observer) { control_observer_ = observer; }
+
+  // Turns on flow control for the messages sent by this end. The channel starts with no
+  // credit, so nothing can be sent until the other end calls SetReceiveWindow(). Must be
+  // called before the channel is shared between threads.
+  void SetFlowControl(FlowMode mode) { flow_mode_ = mode; }
+
+  // Grants the other end, which must use SetFlowControl(), a window of |msgs| messages and
+  // |bytes| bytes of encoded data, 0 meaning no limit. Receive() gives the credit back as
+  // the handlers finish with the messages, so at most a window worth of data is ever in
+  // the transport or waiting in the decoder. A message is sent as long as there is some
+  // byte credit left, so the byte window can be overrun by at most one message.
+  size_t SetReceiveWindow(long msgs, long bytes) {
+    window_msgs_ = msgs;
+    window_bytes_ = bytes;
+    const long unlimited = static_cast<long>(kUnlimitedCredit);
+    return SendCredit(msgs ? msgs : unlimited, bytes ? bytes : unlimited);
+  }
+
+  // Blocks until there is credit to send a message. Only needed with FLOW_FAIL, and it
+  // works under the same conditions as FLOW_BLOCK.
+  size_t WaitForCredit() {
+    AutoLock lock(&rx_lock_);
+    ++credit_waiters_;
+    size_t rc = WaitControl(&Channel::HasCredit);
+    --credit_waiters_;
+    return rc;
+  }
+
+  // Asks the other end for its ChannelStats and waits for the answer, which the other end
+  // sends from inside its Receive(). Like WaitForCredit(), it reads the control messages
+  // that come meanwhile and any other message is an error, so it is meant for a channel
+  // that only monitors. No other thread can be in Receive() at the same time.
+  size_t QueryStats(ChannelStats* stats) {
+    {
+      AutoLock lock(&rx_lock_);
+      stats_reply_ = stats;
+    }
+    const WireView query[] = { WireView(kControlStatsQuery) };
+    size_t rc = Send(kMessagePrivControl, query, 1, 0);
+    AutoLock lock(&rx_lock_);
+    if (rc == RcOK)
+      rc = WaitControl(&Channel::HasStatsReply);
+    stats_reply_ = NULL;
+    return rc;
+  }
 
   // This is the last message that was received. Or at least the header was
   // correct so we could extract the message id.
   int LastRecvMsgId() const { return last_msg_id_; }
 
+  // This is the call id carried by the last message that was received, or 0 if it
+  // did not have one. See ipc::AsyncCalls.
+  int LastRecvCallId() const { return last_call_id_; }
+
+  // This is when the other end sent the last message that was received, or 0 if it was
+  // not stamped. See SetSendTimestamps().
+  long long LastRecvSendTime() const { return last_send_time_; }
+
   // Sends the message (|args| + msg_id) to the other end of the connected
   // |transport| passed to the constructor. This call can block or not depending
   // on the transport implementation.
+  //
+  // When called from inside a message handler during Receive() (or from a thread
+  // inside a DispatchScope) the message carries the call id of the message being
+  // handled, so replies are matched to requests without the handler having to know
+  // about call ids.
   size_t Send(int msg_id, const WireType* const args[], int n_args)  {
-    EncoderT encoder;
-    encoder.Open(n_args);
-    for (int ix = 0; ix != n_args; ++ix) {
-      if (!AddMsgElement(&encoder, *args[ix]))
-        return RcErrEncoderType;
+    const DispatchContext& dc = CurrentDispatch();
+    return Send(msg_id, args, n_args, (dc.channel == this) ? dc.call_id : 0);
+  }
+
+  // Same as above but the message carries |call_id| in its header. A |call_id| of
+  // 0 means no call id.
+  //
+  // In the queued send modes a failure to write some other thread's message is sticky
+  // and reported by every Send() afterwards.
+  size_t Send(int msg_id, const WireType* const args[], int n_args, int call_id)  {
+    WireTypeArgs fill = { args, n_args };
+    return SendEncoded(msg_id, call_id, n_args, fill);
+  }
+
+  // Same as the two above but the arguments are views, which do not own or copy their
+  // strings and arrays. Since both forms take a pointer, a message with no arguments
+  // needs a typed NULL for |args|.
+  size_t Send(int msg_id, const WireView args[], int n_args)  {
+    const DispatchContext& dc = CurrentDispatch();
+    return Send(msg_id, args, n_args, (dc.channel == this) ? dc.call_id : 0);
+  }
+
+  size_t Send(int msg_id, const WireView args[], int n_args, int call_id)  {
+    WireViewArgs fill = { args, n_args };
+    return SendEncoded(msg_id, call_id, n_args, fill);
+  }
+
+#if defined(IPC_HAS_VARIADIC)
+  // Sends a message with any number of arguments. Each argument can be of any type that
+  // WireType has a constructor for, or a WireType, and it is encoded straight from the
+  // C++ value. The call id is chosen like in Send().
+  template <typename... ArgsT>
+  size_t SendArgs(int msg_id, const ArgsT&... args) {
+    const DispatchContext& dc = CurrentDispatch();
+    return SendArgsWithCallId(msg_id, (dc.channel == this) ? dc.call_id : 0, args...);
+  }
+
+  template <typename... ArgsT>
+  size_t SendArgsWithCallId(int msg_id, int call_id, const ArgsT&... args) {
+    return SendEncoded(msg_id, call_id, static_cast<int>(sizeof...(ArgsT)),
+                       [&](EncoderT* encoder) { return EncodeArgs(encoder, args...); });
+  }
+#endif
+
+  // Writes to the transport all the messages queued by Send() in the SEND_COMBINED or
+  // SEND_WRITER modes. If another thread is already flushing it returns right away and
+  // that thread writes them instead. Safe to call from any thread.
+  size_t FlushSendQueue() {
+    while (send_queue_.TryAcquireFlush()) {
+      typename SendQueueT::Node* node = send_queue_.PopAll();
+      while (node) {
+        typename SendQueueT::Node* next = node->next;
+        size_t size;
+        const void* buf = node->encoder.GetBuffer(&size);
+        if (!AtomicLoad(&send_error_)) {
+          const long long start = SpanStart();
+          if (transport_->Send(buf, size) != RcOK)
+            AtomicCompareExchange(&send_error_, 1, 0);
+          if (MetricsT::kTraceSpans)
+            SpanEnd(SPAN_TRANSPORT_SEND, EncoderT::PeekMsgId(buf, size), start);
+        }
+        SendQueueT::DeleteNode(node);
+        node = next;
+      }
+      send_queue_.ReleaseFlush();
+      // A message pushed after PopAll() whose sender lost the token race would be
+      // stranded if we did not look again.
+      if (send_queue_.IsEmpty())
+        break;
     }
+    return AtomicLoad(&send_error_) ? RcErrTransportWrite : RcOK;
+  }
 
-    encoder.SetMsgId(msg_id);
-    if (!encoder.Close())
-      return RcErrEncoderClose;
+  // Starts a thread that writes the messages given to Post(), which queues up to |max_queued|
+  // of them and then follows |policy|. The channel switches to SEND_COMBINED unless it
+  // already uses a thread-safe send mode, so Send() keeps working from any thread. Must be
+  // called before the channel is shared between threads.
+  bool StartPostWriter(size_t max_queued, PostFullPolicy policy) {
+    if (posting_)
+      return false;
+    if (send_mode_ == SEND_DIRECT)
+      send_mode_ = SEND_COMBINED;
+    post_queue_.Configure(max_queued, policy);
+    posting_ = post_thread_.Start(PostWriterMain, this);
+    return posting_;
+  }
 
-    size_t size;
-    const void* buf = encoder.GetBuffer(&size);
-    if (!buf)
-      return RcErrEncoderBuffer;
-    return transport_->Send(buf, size);
+  // Writes what is left in the queue and stops the writer thread. The destructor calls it.
+  // Returns the sticky write error.
+  size_t StopPostWriter() {
+    if (posting_) {
+      post_queue_.Close();
+      post_thread_.Join();
+      posting_ = false;
+    }
+    return AtomicLoad(&send_error_) ? RcErrTransportWrite : RcOK;
+  }
+
+  // Fire-and-forget version of Send() for notifications. The message is encoded in the
+  // calling thread and queued for the writer thread, so Post() does not wait for the
+  // transport or for flow control credit. The message carries no call id. Returns
+  // RcErrWouldBlock if the queue is full and the policy is POST_FAIL, and the sticky write
+  // error once a write has failed. Without a writer thread it is the same as Send().
+  //
+  // The messages posted from one thread are written in order, but a Send() can overtake
+  // the messages posted before it; call Drain() in between when the order matters.
+  size_t Post(int msg_id, const WireType* const args[], int n_args) {
+    WireTypeArgs fill = { args, n_args };
+    return PostEncoded(msg_id, n_args, fill);
+  }
+
+  size_t Post(int msg_id, const WireView args[], int n_args) {
+    WireViewArgs fill = { args, n_args };
+    return PostEncoded(msg_id, n_args, fill);
+  }
+
+  // Blocks until every message posted before the call has been written, or dropped by
+  // POST_DROP_OLDEST. A message can still be on its way if a Send() from another thread
+  // took over the writing of the send queue. Returns the sticky write error, so a clean
+  // shutdown is Drain() and then closing the transport.
+  size_t Drain() {
+    if (posting_)
+      post_queue_.WaitFinished();
+    return AtomicLoad(&send_error_) ? RcErrTransportWrite : RcOK;
+  }
+
+  // Number of posted messages dropped by POST_DROP_OLDEST.
+  long PostDropped() {
+    return post_queue_.Dropped();
   }
 
   // Blocking wait for a message to arrive to from the other end of the
@@ -116,65 +423,29 @@ class Channel {
   // The costume is to use ipc::OnMsgLoopNext (0) to loop and ipc::OnMsgReady (1)
   // to terminate with no error condtion. This is desirable but not necessary.
   //
+  // Messages with id kMessagePrivControl are handled by the channel itself and are
+  // never seen by |top_dispatch|.
+  //
+  // Messages that were read together with the one that ended the loop are handled by the
+  // next call, unless two threads are in Receive() at the same time.
+  //
+  // If a thread in WaitForCredit() or QueryStats() is reading the transport because no
+  // one else was, Receive() waits until it is done.
+  //
   template <class DispatchT>
   size_t Receive(DispatchT* top_dispatch) {
-
-    RxHandler handler;
-    DecoderT<RxHandler> decoder(&handler);
-
-    // There are two do/while nested loops. The inner one runs until a full message
-    // has been decoded and the outer one runs until a dispatcher returns anything
-    // but a 0. The inner loop has two modes, in one it requires more external data
-    // and in the other it can keep processing what has been read so far. They are
-    // required to handle the case of reading less than a full message and when
-    // reading more than one message.
-    size_t retv = 0;
-    do {
-      size_t received = 0;
-       const char* buf = NULL;
-      do {
-        if (decoder.NeedsMoreData()) {
-          buf = transport_->Receive(&received);
-          if (!buf) {
-            // read failed.
-            return RcErrTransportRead;
-          }
-        } else {
-          buf = NULL;
-        }
-      } while (decoder.OnData(buf, received));
-
-      last_msg_id_ = handler.MsgId();
-
-      if(!decoder.Success())
-        return RcErrDecoderFormat;
-
-      size_t np = handler.GetArgCount();
-      if (np > kMaxNumArgs)
-        return RcErrDecoderArgs;
-
-      const WireType* args[kMaxNumArgs];
-      for (size_t ix = 0; ix != np; ++ix) {
-        args[ix] = &handler.GetArg(ix);
-      }
-
-      if ((handler.MsgId() == kMessagePrivNewTransport) &&
-          (np == 1) && (args[0]->GetAsBits() == NULL)) {
-        // Got special rpc to create a new transport. On the receiving side we handle it entirely
-        // here by calling OnNewTransport and then sending the reply, but on the sending side it
-        // is handled by a NewTransportHandler object so it actually uses top_dispatch->MsgHandler().
-        void* handle = top_dispatch->OnNewTransport();
-        retv = handle ? SendNewTransportMsg(handle) : ipc::OnMsgLoopNext;
-      } else {
-        // Got one regular message. Now dispatch it.
-        retv = top_dispatch->MsgHandler(handler.MsgId())->OnMsgIn(handler.MsgId(), this, args, np);
-      }
-
-      handler.Clear();
-      decoder.Reset();
-    } while(ipc::OnMsgLoopNext == retv);
-
-    return retv;
+    {
+      AutoLock lock(&rx_lock_);
+      while (control_reader_)
+        rx_cond_.Wait(&rx_lock_);
+      ++readers_;
+    }
+    size_t rc = ReceiveImpl(top_dispatch, false);
+    AutoLock lock(&rx_lock_);
+    // The last reader to leave lets a thread waiting for credit read instead.
+    if (!--readers_)
+      rx_cond_.Broadcast();
+    return rc;
   }
 
   // Issues an rpc to the remote side, usually the server to get a new transport identifier, it is
@@ -198,7 +469,7 @@ class Channel {
   // convenience. Treat it as private though.
   class RxHandler {
    public:
-    RxHandler() : msg_id_(-1) {} 
+    RxHandler() : msg_id_(-1), call_id_(0), send_time_(0) {}
 
     // Called when a valid message preamble is received.
     bool OnMessageStart(int id, int n_args) {
@@ -208,6 +479,18 @@ class Channel {
       return true;
     }
 
+    // Called when the message header carries a call id.
+    bool OnCallId(int call_id) {
+      call_id_ = call_id;
+      return true;
+    }
+
+    // Called when the message header carries the time it was sent.
+    bool OnSendTime(long long ns) {
+      send_time_ = ns;
+      return true;
+    }
+
     // Handles the word-sized 'value' decoded types.
     bool OnWord(const void* bits, int type_id) {
       switch (type_id) {
@@ -223,6 +506,28 @@ class Channel {
         case ipc::TYPE_ULONG32:
           list_.push_back(WireType(*reinterpret_cast<const unsigned long*>(bits)));
           break;
+        case ipc::TYPE_LONG64:
+          if (sizeof(long) != 8)
+            return false;
+          list_.push_back(WireType(LoadAs<long>(bits)));
+          break;
+        case ipc::TYPE_ULONG64:
+          if (sizeof(unsigned long) != 8)
+            return false;
+          list_.push_back(WireType(LoadAs<unsigned long>(bits)));
+          break;
+        case ipc::TYPE_INT64:
+          list_.push_back(WireType(LoadAs<long long>(bits)));
+          break;
+        case ipc::TYPE_UINT64:
+          list_.push_back(WireType(LoadAs<unsigned long long>(bits)));
+          break;
+        case ipc::TYPE_FLOAT32:
+          list_.push_back(WireType(LoadAs<float>(bits)));
+          break;
+        case ipc::TYPE_FLOAT64:
+          list_.push_back(WireType(LoadAs<double>(bits)));
+          break;
         case ipc::TYPE_CHAR8:
           list_.push_back(WireType(*reinterpret_cast<const char*>(bits)));
           break;
@@ -242,40 +547,77 @@ class Channel {
         case ipc::TYPE_NULLBARRAY:
           list_.push_back(WireType(ipc::ByteArray(0, NULL)));
           break;
+        case ipc::TYPE_NULLINT32ARRAY:
+          list_.push_back(WireType(ipc::Int32Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLUINT32ARRAY:
+          list_.push_back(WireType(ipc::UInt32Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLINT64ARRAY:
+          list_.push_back(WireType(ipc::Int64Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLUINT64ARRAY:
+          list_.push_back(WireType(ipc::UInt64Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLFLT32ARRAY:
+          list_.push_back(WireType(ipc::Float32Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLFLT64ARRAY:
+          list_.push_back(WireType(ipc::Float64Array(0, NULL)));
+          break;
         default:
           return false;
       }
       return true;
     }
 
+    // Handles the numeric arrays. The decoder guarantees that |data| is aligned
+    // to Encoder::ENC_ALIGNB so the elements are read in place.
+    bool OnArray(const void* data, size_t byte_sz, int type_id) {
+      switch (type_id) {
+        case ipc::TYPE_INT32ARRAY:
+          return AddArray<int>(type_id, data, byte_sz);
+        case ipc::TYPE_UINT32ARRAY:
+          return AddArray<unsigned int>(type_id, data, byte_sz);
+        case ipc::TYPE_INT64ARRAY:
+          return AddArray<long long>(type_id, data, byte_sz);
+        case ipc::TYPE_UINT64ARRAY:
+          return AddArray<unsigned long long>(type_id, data, byte_sz);
+        case ipc::TYPE_FLT32ARRAY:
+          return AddArray<float>(type_id, data, byte_sz);
+        case ipc::TYPE_FLT64ARRAY:
+          return AddArray<double>(type_id, data, byte_sz);
+        default:
+          return false;
+      }
+    }
+
     // Handles the byte-sized arrays.
     bool OnString8(IPCString& str, int type_id) {
       switch (type_id) {
         case ipc::TYPE_STRING8:
-          list_.push_back(WireType(str.c_str()));
-          break;
         case ipc::TYPE_BARRAY:
-          list_.push_back(WireType(ByteArray(str.size(), str.c_str())));
-          break;
+          return AddCopy(type_id, str.c_str(), str.size(), sizeof(char));
         default: 
           return false;
       }
-      return true;
     }
 
     // Handles the wchar-sized arrays.
     bool OnString16(IPCWString& str, int type_id) {
       switch (type_id) {
         case ipc::TYPE_STRING16:
-          list_.push_back(WireType(str.c_str()));
-          break;
+          return AddCopy(type_id, str.c_str(), str.size(), sizeof(wchar_t));
         default: 
           return false;
       }
-      return true;
     }
 
     int MsgId() const { return msg_id_; }
+
+    int CallId() const { return call_id_; }
+
+    long long SendTime() const { return send_time_; }
     
     const WireType& GetArg(size_t ix) {
       return list_[ix];
@@ -283,15 +625,73 @@ class Channel {
 
     size_t GetArgCount() const { return list_.size(); }
 
+    // Ends the message. The strings and arrays of its arguments are freed.
     void Clear() {
       list_.clear();
+      arena_.Reset();
       msg_id_ = -1;
+      call_id_ = 0;
+      send_time_ = 0;
     }
 
   private:
+    // The 64-bit values are only guaranteed to be aligned to the machine word.
+    template <typename T>
+    static T LoadAs(const void* bits) {
+      T v;
+      memcpy(&v, bits, sizeof(v));
+      return v;
+    }
+
+    template <typename T>
+    bool AddArray(int type_id, const void* data, size_t byte_sz) {
+      if (byte_sz % sizeof(T))
+        return false;
+      if (!byte_sz) {
+        list_.push_back(WireType(NumArray<T>(0, static_cast<const T*>(data))));
+        return true;
+      }
+      void* copy = arena_.Alloc(byte_sz);
+      memcpy(copy, data, byte_sz);
+      return AddBorrowed(type_id, copy, byte_sz);
+    }
+
+    // Copies a string of |count| characters of |char_sz| bytes, and its null, or a
+    // byte array to the arena. The empty ones are held by the WireType, which does
+    // not allocate for them.
+    bool AddCopy(int type_id, const void* data, size_t count, size_t char_sz) {
+      if (!count) {
+        if (type_id == ipc::TYPE_STRING16)
+          list_.push_back(WireType(L""));
+        else if (type_id == ipc::TYPE_STRING8)
+          list_.push_back(WireType(""));
+        else
+          list_.push_back(WireType(ByteArray(0, "")));
+        return true;
+      }
+      const size_t byte_sz = count * char_sz;
+      char* copy = static_cast<char*>(arena_.Alloc(byte_sz + char_sz));
+      memcpy(copy, data, byte_sz);
+      memset(copy + byte_sz, 0, char_sz);
+      return AddBorrowed(type_id, copy, (type_id == ipc::TYPE_BARRAY) ? byte_sz : count);
+    }
+
+    // Constructs the argument in the list, since a copy would own the data.
+    bool AddBorrowed(int type_id, const void* data, size_t size) {
+      void* slot = list_.AddRaw();
+      if (!slot)
+        return false;
+      new(slot) WireType(type_id, data, size);
+      return true;
+    }
+
     typedef FixedArray<WireType, (kMaxNumArgs + 1)> RxList;
     RxList list_;
+    // Where the strings and arrays of the arguments are copied to.
+    Arena arena_;
     int msg_id_;
+    int call_id_;
+    long long send_time_;
   };
 
 private:
@@ -319,14 +719,608 @@ private:
     void* t_handle_;
   };
 
+  // The body of Receive(). With |stop_on_control| it also returns OnMsgReady after a
+  // credit grant or a stats reply, which is how WaitForCredit() and QueryStats() read.
+  template <class DispatchT>
+  size_t ReceiveImpl(DispatchT* top_dispatch, bool stop_on_control) {
+    if (AtomicCompareExchange(&rx_busy_, 1, 0) != 0) {
+      RxHandler handler;
+      DecoderT<RxHandler> decoder(&handler);
+      return ReceiveWith(top_dispatch, stop_on_control, handler, decoder);
+    }
+    // What was read past the last message is kept in |rx_decoder_| for the next call.
+    size_t rc = ReceiveWith(top_dispatch, stop_on_control, rx_handler_, rx_decoder_);
+    AtomicCompareExchange(&rx_busy_, 0, 1);
+    return rc;
+  }
+
+  template <class DispatchT>
+  size_t ReceiveWith(DispatchT* top_dispatch, bool stop_on_control, RxHandler& handler,
+                     DecoderT<RxHandler>& decoder) {
+    // There are two do/while nested loops. The inner one runs until a full message
+    // has been decoded and the outer one runs until a dispatcher returns anything
+    // but a 0. The inner loop has two modes, in one it requires more external data
+    // and in the other it can keep processing what has been read so far. They are
+    // required to handle the case of reading less than a full message and when
+    // reading more than one message.
+    size_t retv = 0;
+    bool control = false;
+    do {
+      size_t received = 0;
+       const char* buf = NULL;
+      long long decode_ns = 0;
+      do {
+        if (decoder.NeedsMoreData()) {
+          const long long start = SpanStart();
+          buf = transport_->Receive(&received);
+          SpanEnd(SPAN_TRANSPORT_RECEIVE, -1, start);
+          if (!buf) {
+            // read failed.
+            return Abandon(handler, decoder, RcErrTransportRead);
+          }
+        } else {
+          buf = NULL;
+        }
+      } while (DecodeData(&decoder, handler, buf, received, &decode_ns));
+
+      last_msg_id_ = handler.MsgId();
+      last_call_id_ = handler.CallId();
+      last_send_time_ = handler.SendTime();
+
+      if(!decoder.Success())
+        return Abandon(handler, decoder, RcErrDecoderFormat);
+
+      size_t np = handler.GetArgCount();
+      if (np > kMaxNumArgs)
+        return Abandon(handler, decoder, RcErrDecoderArgs);
+
+      const WireType* args[kMaxNumArgs];
+      for (size_t ix = 0; ix != np; ++ix) {
+        args[ix] = &handler.GetArg(ix);
+      }
+
+      if ((handler.MsgId() == kMessagePrivControl) && (np >= 1) &&
+          (args[0]->Id() == ipc::TYPE_INT32)) {
+        // Control messages are for the channel itself and never reach |top_dispatch|.
+        control |= OnControlMsg(args, np);
+        retv = ipc::OnMsgLoopNext;
+      } else if ((handler.MsgId() == kMessagePrivNewTransport) &&
+          (np == 1) && (args[0]->GetAsBits() == NULL)) {
+        // Got special rpc to create a new transport. On the receiving side we handle it
+        // entirely here by calling OnNewTransport and then sending the reply, but on the
+        // sending side it is handled by a NewTransportHandler object so it actually uses
+        // top_dispatch->MsgHandler().
+        void* handle = top_dispatch->OnNewTransport();
+        retv = handle ? SendNewTransportMsg(handle) : ipc::OnMsgLoopNext;
+      } else {
+        // Got one regular message. Now dispatch it. Anything sent by the handler is
+        // tagged with the incoming call id.
+        const bool timed = MetricsT::kEnabled || MetricsT::kTraceSpans;
+        const long long decoded_at = timed ? MetricsT::Now() : 0;
+        {
+          DispatchScope scope(this, last_call_id_);
+          memdet::MsgScope msg_scope(handler.MsgId());
+          retv = top_dispatch->MsgHandler(handler.MsgId())->OnMsgIn(handler.MsgId(), this,
+                                                                    args, np);
+        }
+        const long long handled_at = timed ? MetricsT::Now() : 0;
+        if (MetricsT::kEnabled) {
+          metrics_.OnReceive(handler.MsgId(), last_call_id_, decoder.MessageSize(), decode_ns,
+                             decoded_at, handled_at - decoded_at, last_send_time_);
+        }
+        if (MetricsT::kTraceSpans)
+          metrics_.OnSpan(SPAN_DISPATCH, handler.MsgId(), decoded_at, handled_at);
+        if (window_msgs_ || window_bytes_) {
+          size_t rc = ReturnCredit(decoder.MessageSize());
+          if (rc != RcOK)
+            return Abandon(handler, decoder, rc);
+        }
+      }
+
+      handler.Clear();
+      decoder.Reset();
+      // Grants come in bursts, so stop only when everything read so far is decoded.
+      if (stop_on_control && control && decoder.NeedsMoreData())
+        retv = ipc::OnMsgReady;
+    } while(ipc::OnMsgLoopNext == retv);
+
+    return retv;
+  }
+
+  // Drops the message being received and anything read after it, so that the next
+  // Receive() starts afresh after an error.
+  static size_t Abandon(RxHandler& handler, DecoderT<RxHandler>& decoder, size_t rc) {
+    handler.Clear();
+    decoder.Discard();
+    return rc;
+  }
+
+  // Feeds |decoder| like DecoderT::OnData() and adds the time it took to |decode_ns|.
+  template <class DecT>
+  bool DecodeData(DecT* decoder, const RxHandler& handler, const char* buf, size_t received,
+                  long long* decode_ns) {
+    if (buf && (decoder->Buffered() + received > rx_high_water_))
+      rx_high_water_ = decoder->Buffered() + received;
+    if (!MetricsT::kEnabled && !MetricsT::kTraceSpans)
+      return decoder->OnData(buf, received);
+    const long long start = MetricsT::Now();
+    const bool more = decoder->OnData(buf, received);
+    const long long end = MetricsT::Now();
+    *decode_ns += end - start;
+    if (MetricsT::kTraceSpans)
+      metrics_.OnSpan(SPAN_DECODE, handler.MsgId(), start, end);
+    return more;
+  }
+
+  static long long SpanStart() {
+    return MetricsT::kTraceSpans ? MetricsT::Now() : 0;
+  }
+
+  void SpanEnd(int span, int msg_id, long long start) {
+    if (MetricsT::kTraceSpans)
+      metrics_.OnSpan(span, msg_id, start, MetricsT::Now());
+  }
+
+  // Reads the control messages on behalf of WaitForCredit() and QueryStats(). Anything
+  // else is an error.
+  class CreditWaiter {
+   public:
+    CreditWaiter* MsgHandler(int) {
+      return this;
+    }
+
+    size_t OnMsgIn(int, Channel*, const WireType* const[], int) {
+      return RcErrBadMessageId;
+    }
+
+    void* OnNewTransport() { return NULL; }
+  };
+
+  // Large enough to never run out, small enough that adding a window to it never
+  // overflows.
+  enum { kUnlimitedCredit = 0x3fffffff };
+
+  // Returns true if the message was a credit grant or the stats reply that QueryStats()
+  // waits for.
+  bool OnControlMsg(const WireType* const args[], size_t np) {
+    const int type = args[0]->LoadInt32();
+    if (type == kControlStatsQuery) {
+      // A failed send shows up in the next Send() or Receive() of the channel.
+      SendStats();
+      return false;
+    }
+    if (type == kControlStatsReply) {
+      AutoLock lock(&rx_lock_);
+      if (stats_reply_ && stats_reply_->FromControlMsg(args, static_cast<int>(np))) {
+        stats_reply_ = NULL;
+        rx_cond_.Broadcast();
+        return true;
+      }
+    }
+    if (type != kControlCredit) {
+      if (control_observer_)
+        control_observer_->OnControlMsg(args, static_cast<int>(np));
+      return false;
+    }
+    if ((np != 3) ||
+        !args[1]->MatchesSig(WireType::kSigInt32) || !args[2]->MatchesSig(WireType::kSigInt32))
+      return false;
+    AutoLock lock(&rx_lock_);
+    credit_msgs_ += args[1]->LoadInt32();
+    credit_bytes_ += args[2]->LoadInt32();
+    rx_cond_.Broadcast();
+    return true;
+  }
+
+  // Must be called with |rx_lock_| held.
+  bool HasCredit() const {
+    return (credit_msgs_ > 0) && (credit_bytes_ > 0);
+  }
+
+  // Must be called with |rx_lock_| held.
+  bool HasStatsReply() const {
+    return !stats_reply_;
+  }
+
+  // Must be called with |rx_lock_| held. Waits until |done| returns true. Meanwhile the
+  // control messages are read by the threads in Receive() or, if there are none, by this
+  // thread, with |rx_lock_| released while it reads.
+  size_t WaitControl(bool (Channel::*done)() const) {
+    while (!(this->*done)()) {
+      if (readers_ || control_reader_) {
+        rx_cond_.Wait(&rx_lock_);
+        continue;
+      }
+      control_reader_ = true;
+      rx_lock_.Unlock();
+      CreditWaiter waiter;
+      size_t rc = ReceiveImpl(&waiter, true);
+      rx_lock_.Lock();
+      control_reader_ = false;
+      rx_cond_.Broadcast();
+      if (rc != OnMsgReady)
+        return rc;
+    }
+    return RcOK;
+  }
+
+  // Spends the credit for a message of |size| bytes. The channel's own messages need none:
+  // the receiving end handles them itself and never gives their credit back.
+  size_t TakeCredit(int msg_id, size_t size) {
+    if ((flow_mode_ == FLOW_NONE) || (msg_id == kMessagePrivControl) ||
+        (msg_id == kMessagePrivNewTransport))
+      return RcOK;
+    for (;;) {
+      {
+        AutoLock lock(&rx_lock_);
+        if (HasCredit()) {
+          --credit_msgs_;
+          credit_bytes_ -= static_cast<long>(size);
+          return RcOK;
+        }
+      }
+      if (flow_mode_ == FLOW_FAIL)
+        return RcErrWouldBlock;
+      size_t rc = WaitForCredit();
+      if (rc != RcOK)
+        return rc;
+    }
+  }
+
+  // Grants the credit of the consumed messages back in batches of half a window.
+  size_t ReturnCredit(size_t size) {
+    ++consumed_msgs_;
+    consumed_bytes_ += static_cast<long>(size);
+    if ((window_msgs_ && (consumed_msgs_ >= (window_msgs_ + 1) / 2)) ||
+        (window_bytes_ && (consumed_bytes_ >= (window_bytes_ + 1) / 2))) {
+      // What does not fit in one grant goes with the next.
+      const long msgs = ClampCredit(consumed_msgs_);
+      const long bytes = ClampCredit(consumed_bytes_);
+      consumed_msgs_ -= msgs;
+      consumed_bytes_ -= bytes;
+      return SendCredit(msgs, bytes);
+    }
+    return RcOK;
+  }
+
+  // A grant is sent as an int, so it is capped at kUnlimitedCredit, which already means
+  // no limit.
+  static long ClampCredit(long credit) {
+    const long limit = static_cast<long>(kUnlimitedCredit);
+    return (credit < limit) ? credit : limit;
+  }
+
+  size_t SendStats() {
+    ChannelStats stats;
+    stats.time_ns = MonotonicNs();
+    stats.uptime_ns = stats.time_ns - created_at_;
+    stats.decoder_high_water = rx_high_water_;
+    stats.post_queued = post_queue_.Queued();
+    stats.post_dropped = post_queue_.Dropped();
+    {
+      AutoLock lock(&rx_lock_);
+      stats.credit_waiters = credit_waiters_;
+    }
+    metrics_.AddStats(&stats);
+    long long values[ChannelStats::kFields];
+    stats.ToArray(values);
+    const WireView args[] = {
+      WireView(kControlStatsReply), WireView(Int64Array(ChannelStats::kFields, values))
+    };
+    return Send(kMessagePrivControl, args, 2, 0);
+  }
+
+  size_t SendCredit(long msgs, long bytes) {
+    const WireView args[] = {
+      WireView(kControlCredit),
+      WireView(static_cast<int>(ClampCredit(msgs))),
+      WireView(static_cast<int>(ClampCredit(bytes)))
+    };
+    return Send(kMessagePrivControl, args, 3, 0);
+  }
+
+  typedef SendQueue<EncoderT> SendQueueT;
+
+  // Encodes the arguments of a message given as an array of WireType.
+  struct WireTypeArgs {
+    const WireType* const* args;
+    int n_args;
+
+    bool operator()(EncoderT* encoder) const {
+      for (int ix = 0; ix != n_args; ++ix) {
+        if (!AddMsgElement(encoder, *args[ix]))
+          return false;
+      }
+      return true;
+    }
+  };
+
+  // Encodes the arguments of a message given as an array of WireView.
+  struct WireViewArgs {
+    const WireView* args;
+    int n_args;
+
+    bool operator()(EncoderT* encoder) const {
+      for (int ix = 0; ix != n_args; ++ix) {
+        if (!AddViewElement(encoder, args[ix]))
+          return false;
+      }
+      return true;
+    }
+  };
+
+  // |fill| is called with the encoder to add the |n_args| arguments of the message.
+  template <class FillT>
+  size_t SendEncoded(int msg_id, int call_id, int n_args, const FillT& fill) {
+    memdet::MsgScope msg_scope(msg_id);
+    if (send_mode_ != SEND_DIRECT)
+      return SendQueued(msg_id, call_id, n_args, fill);
+
+    // A Send() that finds the channel's encoder in use, because it was called from a
+    // handler or from another thread, encodes with its own.
+    EncoderT local;
+    const bool own = AtomicCompareExchange(&encoder_busy_, 1, 0) == 0;
+    size_t rc = SendDirect(own ? &encoder_ : &local, msg_id, call_id, n_args, fill);
+    if (own)
+      AtomicCompareExchange(&encoder_busy_, 0, 1);
+    return rc;
+  }
+
+  template <class FillT>
+  size_t SendDirect(EncoderT* encoder, int msg_id, int call_id, int n_args,
+                    const FillT& fill) {
+    const long long encode_start = SpanStart();
+    size_t rc = Encode(encoder, msg_id, call_id, n_args, fill);
+    SpanEnd(SPAN_ENCODE, msg_id, encode_start);
+    if (rc != RcOK)
+      return rc;
+
+    size_t size;
+    const void* buf = encoder->GetBuffer(&size);
+    if (!buf)
+      return RcErrEncoderBuffer;
+    rc = TakeCredit(msg_id, size);
+    if (rc != RcOK)
+      return rc;
+    RecordSend(msg_id, call_id, size);
+    const long long send_start = SpanStart();
+    rc = transport_->Send(buf, size);
+    SpanEnd(SPAN_TRANSPORT_SEND, msg_id, send_start);
+    return rc;
+  }
+
+  void RecordSend(int msg_id, int call_id, size_t size) {
+    if (!MetricsT::kEnabled)
+      return;
+    const DispatchContext& dc = CurrentDispatch();
+    metrics_.OnSend(msg_id, call_id, call_id && (dc.channel == this) && (dc.call_id == call_id),
+                    size);
+  }
+
+  template <class FillT>
+  size_t Encode(EncoderT* encoder, int msg_id, int call_id, int n_args,
+                const FillT& fill) const {
+    if ((static_cast<size_t>(n_args) > kMaxNumArgs) || !encoder->Open(n_args))
+      return RcErrEncoderArgs;
+    if (call_id && !encoder->SetCallId(call_id))
+      return RcErrEncoderBuffer;
+    if (send_timestamps_ && !encoder->SetSendTime(MonotonicNs()))
+      return RcErrEncoderBuffer;
+    if (!fill(encoder))
+      return RcErrEncoderType;
+
+    encoder->SetMsgId(msg_id);
+    if (!encoder->Close())
+      return RcErrEncoderClose;
+    return RcOK;
+  }
+
+  // The encoding happens in the calling thread, into a buffer that belongs to the
+  // queue node, so there is no copy when the node is written.
+  template <class FillT>
+  size_t SendQueued(int msg_id, int call_id, int n_args, const FillT& fill) {
+    typename SendQueueT::Node* node = SendQueueT::NewNode();
+    const long long start = SpanStart();
+    size_t rc = Encode(&node->encoder, msg_id, call_id, n_args, fill);
+    SpanEnd(SPAN_ENCODE, msg_id, start);
+    if (rc == RcOK) {
+      size_t size;
+      node->encoder.GetBuffer(&size);
+      rc = TakeCredit(msg_id, size);
+      if (rc == RcOK)
+        RecordSend(msg_id, call_id, size);
+    }
+    if (rc != RcOK) {
+      SendQueueT::DeleteNode(node);
+      return rc;
+    }
+    send_queue_.Push(node);
+    if (send_mode_ == SEND_COMBINED)
+      return FlushSendQueue();
+    return AtomicLoad(&send_error_) ? RcErrTransportWrite : RcOK;
+  }
+
+  template <class FillT>
+  size_t PostEncoded(int msg_id, int n_args, const FillT& fill) {
+    if (!posting_)
+      return SendEncoded(msg_id, 0, n_args, fill);
+    if (AtomicLoad(&send_error_))
+      return RcErrTransportWrite;
+    typename SendQueueT::Node* node = SendQueueT::NewNode();
+    const long long start = SpanStart();
+    size_t rc = Encode(&node->encoder, msg_id, 0, n_args, fill);
+    SpanEnd(SPAN_ENCODE, msg_id, start);
+    if (rc == RcOK)
+      rc = post_queue_.Push(node) ? RcOK : RcErrWouldBlock;
+    if (rc != RcOK)
+      SendQueueT::DeleteNode(node);
+    return rc;
+  }
+
+  static void PostWriterMain(void* ctx) {
+    reinterpret_cast<Channel*>(ctx)->PostWriterLoop();
+  }
+
+  // Moves the posted messages to the send queue one at a time, taking their credit here
+  // rather than in the thread that posted them.
+  void PostWriterLoop() {
+    while (typename SendQueueT::Node* node = post_queue_.Pop()) {
+      size_t size;
+      const void* buf = node->encoder.GetBuffer(&size);
+      const int msg_id = EncoderT::PeekMsgId(buf, size);
+      size_t rc;
+      while ((rc = TakeCredit(msg_id, size)) == RcErrWouldBlock) {
+        if (WaitForCredit() != RcOK)
+          break;
+      }
+      if (rc == RcOK) {
+        RecordSend(msg_id, 0, size);
+        send_queue_.Push(node);
+        FlushSendQueue();
+      } else {
+        AtomicCompareExchange(&send_error_, 1, 0);
+        SendQueueT::DeleteNode(node);
+      }
+      post_queue_.Finish();
+    }
+  }
+
   size_t SendNewTransportMsg(void* handle) {
-    WireType wt(handle);
-    const WireType* const arg[] = { &wt };
+    const WireView arg[] = { WireView(handle) };
     return Send(kMessagePrivNewTransport, arg, 1);
   }
 
+#if defined(IPC_HAS_VARIADIC)
+  static bool EncodeArgs(EncoderT*) {
+    return true;
+  }
+
+  template <typename T, typename... RestT>
+  static bool EncodeArgs(EncoderT* encoder, const T& first, const RestT&... rest) {
+    return EncodeArg(encoder, first) && EncodeArgs(encoder, rest...);
+  }
+#endif
+
+  // The EncodeArg() overloads encode one C++ value the same way AddMsgElement() encodes
+  // the WireType built from it, minus the copy into the WireType.
+  template <typename T>
+  static void* WordBits(T v) {
+    union {
+      void* bits;
+      T v;
+    } word;
+    word.bits = NULL;
+    word.v = v;
+    return word.bits;
+  }
+
+  static bool EncodeArg(EncoderT* encoder, int v) {
+    return encoder->OnWord(WordBits(v), ipc::TYPE_INT32);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, unsigned int v) {
+    return encoder->OnWord(WordBits(v), ipc::TYPE_UINT32);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, long v) {
+    if (sizeof(long) == 8)
+      return encoder->OnWord64(&v, ipc::TYPE_LONG64);
+    return encoder->OnWord(WordBits(v), ipc::TYPE_LONG32);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, unsigned long v) {
+    if (sizeof(unsigned long) == 8)
+      return encoder->OnWord64(&v, ipc::TYPE_ULONG64);
+    return encoder->OnWord(WordBits(v), ipc::TYPE_ULONG32);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, long long v) {
+    return encoder->OnWord64(&v, ipc::TYPE_INT64);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, unsigned long long v) {
+    return encoder->OnWord64(&v, ipc::TYPE_UINT64);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, float v) {
+    return encoder->OnWord(WordBits(v), ipc::TYPE_FLOAT32);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, double v) {
+    return encoder->OnWord64(&v, ipc::TYPE_FLOAT64);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, char v) {
+    return encoder->OnWord(WordBits(v), ipc::TYPE_CHAR8);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, wchar_t v) {
+    return encoder->OnWord(WordBits(v), ipc::TYPE_CHAR16);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const void* v) {
+    return encoder->OnWord(const_cast<void*>(v), ipc::TYPE_VOIDPTR);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const char* v) {
+    if (!v)
+      return encoder->OnWord(WordBits(-1), ipc::TYPE_NULLSTRING8);
+    return encoder->OnString8(v, strlen(v), ipc::TYPE_STRING8);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const wchar_t* v) {
+    if (!v)
+      return encoder->OnWord(WordBits(-1), ipc::TYPE_NULLSTRING16);
+    return encoder->OnString16(v, wcslen(v), ipc::TYPE_STRING16);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const ByteArray& v) {
+    if (!v.buf_)
+      return encoder->OnWord(WordBits(-1), ipc::TYPE_NULLBARRAY);
+    return encoder->OnString8(v.buf_, v.sz_, ipc::TYPE_BARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const Int32Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_INT32ARRAY, ipc::TYPE_NULLINT32ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const UInt32Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_UINT32ARRAY, ipc::TYPE_NULLUINT32ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const Int64Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_INT64ARRAY, ipc::TYPE_NULLINT64ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const UInt64Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_UINT64ARRAY, ipc::TYPE_NULLUINT64ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const Float32Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_FLT32ARRAY, ipc::TYPE_NULLFLT32ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const Float64Array& v) {
+    return EncodeArray(encoder, v, ipc::TYPE_FLT64ARRAY, ipc::TYPE_NULLFLT64ARRAY);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const WireType& v) {
+    return AddMsgElement(encoder, v);
+  }
+
+  static bool EncodeArg(EncoderT* encoder, const WireView& v) {
+    return AddViewElement(encoder, v);
+  }
+
+  template <typename T>
+  static bool EncodeArray(EncoderT* encoder, const NumArray<T>& v, int type, int null_type) {
+    if (!v.buf_)
+      return encoder->OnWord(WordBits(-1), null_type);
+    return encoder->OnArray(v.buf_, v.sz_ * sizeof(T), type);
+  }
+
   // Uses |EncoderT| to encode one message element in the outgoing buffer.
-  bool AddMsgElement(EncoderT* encoder, const WireType& wtype) {
+  static bool AddMsgElement(EncoderT* encoder, const WireType& wtype) {
     switch (wtype.Id()) {
       case ipc::TYPE_NONE:
         return false;
@@ -353,9 +1347,36 @@ private:
           return encoder->OnString16(wtemp, wtype.Id());
         }
 
+      case ipc::TYPE_FLOAT32:
+          return encoder->OnWord(wtype.GetAsBits(), wtype.Id());
+
+      case ipc::TYPE_INT64:
+      case ipc::TYPE_UINT64:
+      case ipc::TYPE_LONG64:
+      case ipc::TYPE_ULONG64:
+      case ipc::TYPE_FLOAT64:
+          return encoder->OnWord64(wtype.GetAs64Bits(), wtype.Id());
+
+      case ipc::TYPE_INT32ARRAY:
+      case ipc::TYPE_UINT32ARRAY:
+      case ipc::TYPE_INT64ARRAY:
+      case ipc::TYPE_UINT64ARRAY:
+      case ipc::TYPE_FLT32ARRAY:
+      case ipc::TYPE_FLT64ARRAY: {
+          IPCString atemp;
+          wtype.GetString8(&atemp);
+          return encoder->OnArray(atemp.c_str(), atemp.size(), wtype.Id());
+        }
+
       case ipc::TYPE_NULLSTRING8:
       case ipc::TYPE_NULLSTRING16:
       case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+      case ipc::TYPE_NULLFLT32ARRAY:
+      case ipc::TYPE_NULLFLT64ARRAY:
         return encoder->OnWord(wtype.GetAsBits(), wtype.Id());
 
       default:
@@ -363,10 +1384,150 @@ private:
     }
   }
 
+  // Like AddMsgElement() but the strings and arrays are encoded from the memory the
+  // view points to.
+  static bool AddViewElement(EncoderT* encoder, const WireView& view) {
+    switch (view.Id()) {
+      case ipc::TYPE_INT32:
+      case ipc::TYPE_UINT32:
+      case ipc::TYPE_CHAR8:
+      case ipc::TYPE_CHAR16:
+      case ipc::TYPE_LONG32:
+      case ipc::TYPE_ULONG32:
+      case ipc::TYPE_VOIDPTR:
+      case ipc::TYPE_FLOAT32:
+      case ipc::TYPE_NULLSTRING8:
+      case ipc::TYPE_NULLSTRING16:
+      case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+      case ipc::TYPE_NULLFLT32ARRAY:
+      case ipc::TYPE_NULLFLT64ARRAY:
+        return encoder->OnWord(view.GetAsBits(), view.Id());
+
+      case ipc::TYPE_INT64:
+      case ipc::TYPE_UINT64:
+      case ipc::TYPE_LONG64:
+      case ipc::TYPE_ULONG64:
+      case ipc::TYPE_FLOAT64:
+        return encoder->OnWord64(view.GetAs64Bits(), view.Id());
+
+      case ipc::TYPE_STRING8:
+      case ipc::TYPE_BARRAY:
+        return encoder->OnString8(static_cast<const char*>(view.Data()), view.Size(),
+                                  view.Id());
+
+      case ipc::TYPE_STRING16:
+        return encoder->OnString16(static_cast<const wchar_t*>(view.Data()), view.Size(),
+                                   view.Id());
+
+      case ipc::TYPE_INT32ARRAY:
+      case ipc::TYPE_UINT32ARRAY:
+      case ipc::TYPE_INT64ARRAY:
+      case ipc::TYPE_UINT64ARRAY:
+      case ipc::TYPE_FLT32ARRAY:
+      case ipc::TYPE_FLT64ARRAY:
+        return encoder->OnArray(view.Data(), view.Size(), view.Id());
+
+      default:
+        return false;
+    }
+  }
+
   TransportT* transport_;
   int last_msg_id_;
+  int last_call_id_;
+  long long last_send_time_;
+  bool send_timestamps_;
+  SendMode send_mode_;
+  SendQueueT send_queue_;
+  volatile long send_error_;
+
+  // Post(). The writer thread runs while |posting_| is true.
+  typedef PostQueue<EncoderT> PostQueueT;
+  PostQueueT post_queue_;
+  Thread post_thread_;
+  bool posting_;
+
+  ControlObserver* control_observer_;
+  MetricsT metrics_;
+
+  // Flow control, sending side. The credit is what the other end has granted and has
+  // not been spent yet. |rx_lock_| also decides who reads the transport: |readers_|
+  // counts the threads inside Receive() and |control_reader_| is set while a thread in
+  // WaitForCredit() or QueryStats() reads instead. |rx_cond_| is signalled when credit or
+  // the stats reply arrives and when the reading stops.
+  FlowMode flow_mode_;
+  Mutex rx_lock_;
+  CondVar rx_cond_;
+  long credit_msgs_;
+  long credit_bytes_;
+  long credit_waiters_;
+  long readers_;
+  bool control_reader_;
+
+  // Flow control, receiving side. Only used by the thread in Receive().
+  long window_msgs_;
+  long window_bytes_;
+  long consumed_msgs_;
+  long consumed_bytes_;
+
+  // Stats queries. |rx_high_water_| is only used by the thread in Receive() and
+  // |stats_reply_| is set while QueryStats() waits.
+  const long long created_at_;
+  size_t rx_high_water_;
+  ChannelStats* stats_reply_;
+
+  // Kept between calls so that their buffers are reused; a call takes them by setting
+  // the busy flag.
+  EncoderT encoder_;
+  volatile long encoder_busy_;
+  RxHandler rx_handler_;
+  DecoderT<RxHandler> rx_decoder_;
+  volatile long rx_busy_;
+};
+
+// Handles one message for DispatchOne(): passes it to the real dispatcher and then makes
+// Channel::Receive() return.
+template <class ChannelT, class DispatchT>
+class OneShotDispatch {
+ public:
+  explicit OneShotDispatch(DispatchT* dispatch) : dispatch_(dispatch), rc_(0), handled_(false) {}
+
+  OneShotDispatch* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return dispatch_->OnNewTransport(); }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    rc_ = dispatch_->MsgHandler(msg_id)->OnMsgIn(msg_id, ch, args, count);
+    handled_ = true;
+    return OnMsgReady;
+  }
+
+  bool Handled() const { return handled_; }
+  size_t Result() const { return rc_; }
+
+ private:
+  DispatchT* dispatch_;
+  size_t rc_;
+  bool handled_;
 };
 
+// Receives on |channel| until one message reaches |dispatch| and returns what its handler
+// returned, or the error from Channel::Receive(). Messages read together with that one stay
+// in the channel and are handled by the next call, as with Receive(), so it works with any
+// transport as long as a single thread receives.
+template <class ChannelT, class DispatchT>
+size_t DispatchOne(ChannelT* channel, DispatchT* dispatch) {
+  OneShotDispatch<ChannelT, DispatchT> one(dispatch);
+  size_t rc = channel->Receive(&one);
+  return one.Handled() ? one.Result() : rc;
+}
+
 }  // namespace ipc.
 
 #endif // SIMPLE_IPC_CHANNEL_H_
@@ -25,8 +25,9 @@
 // bytes what
 // 0     start of header mark
 // 4     msg id
-// 8     element count (1 to N)
+// 8     element count (1 to N) and header flags
 // 12    data count (in 4 byte units
+//       optional call id (if ENC_HFCALL flag)
 // 16    first element tag
 // 20    second element tag
 // +4    .......
@@ -40,6 +41,16 @@
 // As you can see the element tags are not interleaved with the element value, all the tags
 // are within the header, and all values follow afterwards.
 //
+// The header flags live in the upper bits of the element count. Currently only ENC_HFCALL is
+// defined, which means that an extra header element with the call id follows the data count.
+// Messages without flags keep the original format.
+//
+// Values that are 64 bits wide (tag enhanced with ENC_WORD64) take 8 bytes, that is two
+// elements on a 32 bit machine. Numeric arrays (tag enhanced with ENC_ARRAY8) are a byte
+// count followed by the raw elements memcpy'd as a single block. The block always starts
+// at an offset that is a multiple of ENC_ALIGNB from the start of the message, padding with
+// one zero element if needed, so the receiving side can read the elements in place.
+//
 // This code does not assume any knowledge of the Channel type. For example is unaware of WireType
 // so it takes a generic |tag| that in the case of using it with the standard ipc::Channel they
 // would be ipc::TYPE_XXXXX. However, arrays (bytes and strings) are treated differently in which
@@ -53,14 +64,24 @@ public:
     ENC_HEADER = 0x4d4f524b,
     ENC_STARTD = 0x4b524f4d,
     ENC_ENDDAT = 0x474e4142,
+    ENC_ARRAY8 = 1<<28,
+    ENC_WORD64 = 1<<29,
     ENC_STRN08 = 1<<30,
-    ENC_STRN16 = 1<<31
+    ENC_STRN16 = 1<<31,
+    ENC_ALIGNB = 8,
+    ENC_CNTMSK = 0xffff,
+    ENC_HFCALL = 1<<16,
+    ENC_HFTIME = 1<<17,
+    ENC_TIMEWD = (8 + sizeof(void*) - 1) / sizeof(void*)
   };
 
   Encoder() : index_(-1) {}
 
+  // The buffer of the previous message is reused. The count has to fit in ENC_CNTMSK.
   bool Open(int count) {
-    data_.clear();
+    if ((count < 0) || (count > ENC_CNTMSK))
+      return false;
+    data_.resize(0);
     data_.reserve(count * 5);
     data_.resize(count + 5);
     index_ = -1;
@@ -71,6 +92,29 @@ public:
     return true;
   }
 
+  // Adds the call id to the header. It must be called right after Open().
+  bool SetCallId(int call_id) {
+    if (index_ != 3)
+      return false;
+    data_.resize(data_.size() + 1);
+    SetHeaderNext(call_id);
+    SetHeaderFlag(ENC_HFCALL);
+    return true;
+  }
+
+  // Adds the time the message is sent, in nanoseconds of the monotonic clock, to the
+  // header. It must be called right after Open() or SetCallId().
+  bool SetSendTime(long long ns) {
+    const int call_words = (reinterpret_cast<size_t>(data_[2]) & ENC_HFCALL) ? 1 : 0;
+    if (index_ != 3 + call_words)
+      return false;
+    data_.resize(data_.size() + ENC_TIMEWD);
+    memcpy(&data_[index_ + 1], &ns, sizeof(ns));
+    index_ += ENC_TIMEWD;
+    SetHeaderFlag(ENC_HFTIME);
+    return true;
+  }
+
   bool Close() {
     SetHeaderNext(ENC_STARTD);
     PushBack(ENC_ENDDAT);
@@ -84,17 +128,42 @@ public:
     return true;
   };
 
+  bool OnWord64(const void* bits, int tag) {
+    SetHeaderNext(tag | ENC_WORD64);
+    AddBlock(bits, 8);
+    return true;
+  }
+
+  bool OnArray(const void* data, size_t byte_sz, int tag) {
+    SetHeaderNext(tag | ENC_ARRAY8);
+    PushBack(byte_sz);
+    if ((data_.size() * sizeof(void*)) % ENC_ALIGNB)
+      PushBack(0);
+    if (byte_sz) AddBlock(data, byte_sz);
+    return true;
+  }
+
   bool OnString8(const IPCString& s, int tag) {
+    return OnString8(s.c_str(), s.size(), tag);
+  }
+
+  bool OnString16(const IPCWString& s, int tag) {
+    return OnString16(s.c_str(), s.size(), tag);
+  }
+
+  // These two take the characters from any buffer, so the caller does not need
+  // to build a string object first.
+  bool OnString8(const char* s, size_t len, int tag) {
     SetHeaderNext(tag | ENC_STRN08);
-    PushBack(s.size());
-    if (s.size()) AddStr(s);
+    PushBack(len);
+    if (len) AddStr(s, len);
     return true;
   }
 
-  bool OnString16(const IPCWString& s, int tag) {
+  bool OnString16(const wchar_t* s, size_t len, int tag) {
     SetHeaderNext(tag | ENC_STRN16);
-    PushBack(s.size());
-    if (s.size()) AddStr(s);
+    PushBack(len);
+    if (len) AddStr(s, len);
     return true;
   }
 
@@ -119,12 +188,47 @@ public:
     data_[1] = reinterpret_cast<void*>(id);
   }
 
+  // Returns the message id of the encoded message in |buf| or -1 if |buf| does not start
+  // with a message header. Transports use it to treat messages differently by id.
+  static int PeekMsgId(const void* buf, size_t sz) {
+    if (sz < 2 * sizeof(void*))
+      return -1;
+    const void* const* words = static_cast<const void* const*>(buf);
+    if (static_cast<int>(reinterpret_cast<size_t>(words[0])) != ENC_HEADER)
+      return -1;
+    return static_cast<int>(reinterpret_cast<size_t>(words[1]));
+  }
+
+  // Reads the size in bytes of the encoded message that starts at |buf| into |msg_sz|, or
+  // 0 if |sz| bytes are not enough to tell. Returns false if |buf| does not start with a
+  // message header. Transports use it to find where messages end.
+  static bool PeekMsgSize(const void* buf, size_t sz, size_t* msg_sz) {
+    *msg_sz = 0;
+    const void* const* words = static_cast<const void* const*>(buf);
+    if (sz < sizeof(void*))
+      return true;
+    if (static_cast<int>(reinterpret_cast<size_t>(words[0])) != ENC_HEADER)
+      return false;
+    if (sz < 4 * sizeof(void*))
+      return true;
+    // Same limits as the decoder.
+    const size_t count = reinterpret_cast<size_t>(words[3]);
+    if ((count < 5) || (count > (8 * 1024 * 1024)))
+      return false;
+    *msg_sz = count * sizeof(void*);
+    return true;
+  }
+
 private:
 
   void SetHeaderNext(int v) {
     data_[++index_] = reinterpret_cast<void*>(v);
   }
 
+  void SetHeaderFlag(int flag) {
+    data_[2] = reinterpret_cast<void*>(reinterpret_cast<size_t>(data_[2]) | flag);
+  }
+
   void SetDataSizeHeader() {
     data_[3] = reinterpret_cast<void*>(data_.size());
   }
@@ -133,28 +237,36 @@ private:
     data_.push_back(reinterpret_cast<void*>(v));
   }
 
-  void PushBack(unsigned int v) {
+  void PushBack(size_t v) {
     data_.push_back(reinterpret_cast<void*>(v));
   }
 
-  template <typename StringT> 
-  void AddStr(const StringT& s ) {
+  // Copies |byte_sz| bytes as-is at the end of the buffer. The tail of the
+  // last element is zero-filled.
+  void AddBlock(const void* src, size_t byte_sz) {
+    size_t start = data_.size();
+    data_.resize(start + (byte_sz + sizeof(void*) - 1) / sizeof(void*));
+    memcpy(&data_[start], src, byte_sz);
+  }
+
+  template <typename CharT>
+  void AddStr(const CharT* s, size_t len) {
     const int times = sizeof(IPCVoidPtrVector::value_type) / sizeof(s[0]);
     size_t it = 0;
     do {
-      unsigned int v = 0;
+      size_t v = 0;
       for (int ix = 0; ix != times; ++ix) {
-        if (it == s.size())
+        if (it == len)
           break;
         v |= PackChar(s[it], ix);
         ++it;
       }
       PushBack(v);
-    } while (it != s.size());
+    } while (it != len);
   }
 
-  unsigned int PackChar(char c, int offset) const {
-    return static_cast<unsigned char>(c) << (offset * 8);
+  size_t PackChar(char c, int offset) const {
+    return static_cast<size_t>(static_cast<unsigned char>(c)) << (offset * 8);
   }
 
 #if 0
@@ -164,7 +276,7 @@ private:
   }
 #endif
 
-  unsigned int PackChar(wchar_t c, int offset) const {
+  size_t PackChar(wchar_t c, int offset) const {
     const char* t = reinterpret_cast<const char*>(&c);
     return  (PackChar(t[0], 0) | PackChar(t[1], 1)) << (offset * 16);
   }
@@ -177,7 +289,7 @@ private:
 template <typename HandlerT>
 class Decoder {
 public:
-  Decoder(HandlerT* handler) : handler_(handler) {
+  Decoder(HandlerT* handler) : handler_(handler), msg_size_(0) {
     Reset();
   }
 
@@ -195,6 +307,12 @@ public:
 
   bool Success() { return state_ == DEC_S_DONE; }
 
+  // Size in bytes of the last message decoded, as it was on the wire.
+  size_t MessageSize() const { return msg_size_; }
+
+  // Bytes received and not decoded yet.
+  size_t Buffered() const { return data_.size(); }
+
   bool NeedsMoreData() const {
     return (data_.size() == 0) || (res_ == DEC_MOREDATA); 
   }
@@ -202,11 +320,19 @@ public:
   void Reset() {
     state_ = DEC_S_START;
     e_count_ = -1;
+    h_flags_ = 0;
     d_count_ = static_cast<size_t>(-1);
     next_char_ = 0;
     res_ = DEC_NONE;
   }
 
+  // Drops the data that was not decoded yet, but keeps the buffer for the next message.
+  void Discard() {
+    data_.resize(0);
+    items_.resize(0);
+    Reset();
+  }
+
 private:
   // States of the decoder state machine, for a single message
   // they are basically traveled from the first to the last and
@@ -261,8 +387,13 @@ private:
     int msg_id = ReadNextInt();
     if (msg_id < 0)
       return DEC_ERROR;
-    e_count_ = ReadNextInt();
-    if ((e_count_ < 1) || (e_count_ > 100))
+    int count_word = ReadNextInt();
+    // How many arguments are too many is up to the handler, see OnMessageStart().
+    e_count_ = count_word & Encoder::ENC_CNTMSK;
+    if (e_count_ < 1)
+      return DEC_ERROR;
+    h_flags_ = count_word & ~Encoder::ENC_CNTMSK;
+    if (h_flags_ & ~(Encoder::ENC_HFCALL | Encoder::ENC_HFTIME))
       return DEC_ERROR;
     d_count_ = ReadNextInt();
     if ((d_count_ < 5) || (d_count_ > (8 * 1024 * 1024)))
@@ -279,8 +410,21 @@ private:
   }
 
   Result StateHeader() {
-    if (!HasEnoughUnProcessed(e_count_ + 1))
+    const int ext_count = ((h_flags_ & Encoder::ENC_HFCALL) ? 1 : 0) +
+                          ((h_flags_ & Encoder::ENC_HFTIME) ? Encoder::ENC_TIMEWD : 0);
+    if (!HasEnoughUnProcessed(ext_count + e_count_ + 1))
       return DEC_MOREDATA;
+    if (h_flags_ & Encoder::ENC_HFCALL) {
+      if (!handler_->OnCallId(ReadNextInt()))
+        return DEC_ERROR;
+    }
+    if (h_flags_ & Encoder::ENC_HFTIME) {
+      long long ns;
+      memcpy(&ns, &data_[next_char_], sizeof(ns));
+      next_char_ += Encoder::ENC_TIMEWD * sizeof(void*);
+      if (!handler_->OnSendTime(ns))
+        return DEC_ERROR;
+    }
     //items_.reserve(e_count_);
     for (int ix = 0; ix != e_count_; ++ix) {
       items_.push_back(ReadNextInt());
@@ -289,7 +433,7 @@ private:
     if (i0 != Encoder::ENC_STARTD)
       return DEC_ERROR;
     // Done with all the header
-    d_count_ -= e_count_ + 1;
+    d_count_ -= ext_count + e_count_ + 1;
     if (!items_.size()) {
       // That's it, no data.
       state_ = DEC_S_STOP;
@@ -320,6 +464,14 @@ private:
         } else if (tag & Encoder::ENC_STRN16) {
           tag &= ~Encoder::ENC_STRN16;
           ReadNextStr16(tag);
+        } else if (tag & Encoder::ENC_WORD64) {
+          tag &= ~Encoder::ENC_WORD64;
+          if (!ReadNextWord64(tag))
+            return DEC_ERROR;
+        } else if (tag & Encoder::ENC_ARRAY8) {
+          tag &= ~Encoder::ENC_ARRAY8;
+          if (!ReadNextArray(tag))
+            return DEC_ERROR;
         } else {
           --d_count_;
           if (!handler_->OnWord(ReadNextVoidPtr(), tag)) {
@@ -328,7 +480,7 @@ private:
         }
         ++ix;
         if (items_.size() == ix) {
-          items_.clear();
+          items_.resize(0);
           state_ = DEC_S_STOP;
           if (HasEnoughUnProcessed(1))
             return DEC_LOOPAGAIN;
@@ -346,6 +498,7 @@ private:
     if (Encoder::ENC_ENDDAT != it0)
       return DEC_ERROR;
 
+    msg_size_ = next_char_;
     data_.erase(data_.begin(), data_.begin() + next_char_);
     state_ = DEC_S_DONE;
     return DEC_DONE;
@@ -363,10 +516,9 @@ private:
     if(!HasEnoughUnProcessed(sz_rounded))
       return false;
     const char* beg = &data_[next_char_];
-    IPCString str;
-    str.assign(beg, str_sz);
+    str8_.assign(beg, str_sz);
     next_char_ += sz_rounded * sizeof(void*);
-    handler_->OnString8(str, tag);
+    handler_->OnString8(str8_, tag);
     return true;
   }
 
@@ -377,13 +529,36 @@ private:
     if(!HasEnoughUnProcessed(sz_rounded))
       return false;
     const wchar_t* beg = reinterpret_cast<wchar_t*>(&data_[next_char_]);
-    IPCWString str;
-    str.assign(beg, str_sz);
+    str16_.assign(beg, str_sz);
     next_char_ += sz_rounded * sizeof(void*);
-    handler_->OnString16(str, tag);
+    handler_->OnString16(str16_, tag);
     return true;
   }
 
+  bool ReadNextWord64(int tag) {
+    const size_t words = RoundUpToNextVoidPtr(8);
+    if (!HasEnoughUnProcessed(words))
+      return false;
+    const void* bits = &data_[next_char_];
+    next_char_ += words * sizeof(void*);
+    d_count_ -= words;
+    return handler_->OnWord(bits, tag);
+  }
+
+  bool ReadNextArray(int tag) {
+    size_t byte_sz = ReadNextInt();
+    if (byte_sz > (d_count_ * sizeof(void*)))
+      return false;
+    size_t pad = (next_char_ % Encoder::ENC_ALIGNB) ? 1 : 0;
+    size_t sz_rounded = RoundUpToNextVoidPtr(byte_sz);
+    if (!HasEnoughUnProcessed(sz_rounded + pad))
+      return false;
+    next_char_ += pad * sizeof(void*);
+    const void* beg = &data_[next_char_];
+    next_char_ += sz_rounded * sizeof(void*);
+    return handler_->OnArray(beg, byte_sz, tag);
+  }
+
   void* ReadNextVoidPtr() {
     void* v = &data_[next_char_];
     next_char_ += sizeof(void*);
@@ -406,11 +581,16 @@ private:
 
   IPCCharVector data_;
   IPCIntVector items_;
+  // What the strings are decoded to. They keep their buffers from message to message.
+  IPCString str8_;
+  IPCWString str16_;
 
   State state_;
   int e_count_;
+  int h_flags_;
   size_t d_count_;
   int next_char_;
+  size_t msg_size_;
   Result res_;
 };
 
@@ -31,6 +31,10 @@ const size_t RcErrDecoderFormat     = static_cast<size_t>(-7);
 const size_t RcErrDecoderArgs       = static_cast<size_t>(-8);
 const size_t RcErrNewTransport      = static_cast<size_t>(-9);
 const size_t RcErrBadMessageId      = static_cast<size_t>(-10);
+const size_t RcErrBadCallId         = static_cast<size_t>(-11);
+const size_t RcErrDuplicateMsgId    = static_cast<size_t>(-12);
+const size_t RcErrWouldBlock        = static_cast<size_t>(-13);
+const size_t RcErrEncoderArgs       = static_cast<size_t>(-14);
 
 // For the return on obj.OnMsg() when calling Channel::Receive(obj) there
 // are two critical values:
@@ -58,6 +62,18 @@ const int kMessagePrivNewTransport   = 1;
 const int kMessagePrivControl        = 2;
 const int kMessagePrivLastId         = 3;
 
+// The first argument of a kMessagePrivControl message says what it is:
+// - kControlCredit: (kControlCredit, messages, bytes) grants send credits,
+//   see Channel::SetReceiveWindow().
+// - kControlInvalidate: (kControlInvalidate, msg_id) drops the cached replies to
+//   |msg_id|, or all of them if it is 0, see ipc::ResponseCache.
+// - kControlStatsQuery: (kControlStatsQuery) asks for the ChannelStats of the other end,
+//   which answers with (kControlStatsReply, Int64Array), see Channel::QueryStats().
+const int kControlCredit             = 1;
+const int kControlInvalidate         = 2;
+const int kControlStatsQuery         = 3;
+const int kControlStatsReply         = 4;
+
 
 }  // namespace ipc.
 
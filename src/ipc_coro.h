@@ -0,0 +1,382 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_CORO_H_
+#define SIMPLE_IPC_CORO_H_
+
+#include "ipc_channel.h"
+#include "ipc_constants.h"
+#include "ipc_msg_dispatch.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+// Everything in this file needs C++20 coroutines.
+#if defined(__cpp_impl_coroutine) && defined(IPC_HAS_VARIADIC)
+#include <coroutine>
+#define IPC_HAS_COROUTINES 1
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Coroutine versions of the client and server sides of a conversation, so that one thread can
+// keep many conversations going without blocking on any of them.
+//
+// On the client, CoCalls works like AsyncCalls but each call is awaited instead of completed
+// through a callback:
+//
+//   ipc::CoTask Conversation(ipc::CoCalls<ChannelT>* calls) {
+//     auto sum = co_await calls->Call<kSumReply>(kSum, 2, 3);
+//     if (sum.Error() != ipc::RcOK)
+//       co_return sum.Error();
+//     auto mult = co_await calls->Call<kMultReply>(kMult, sum.Get<0>(), 7);
+//     ...
+//   }
+//
+//   ipc::CoCalls<ChannelT> calls(&channel);
+//   for (int ix = 0; ix != 1000; ++ix)
+//     Conversation(&calls);
+//   calls.WaitAll();
+//
+// A call sends the request right away and suspends the coroutine. WaitAll() reads the replies
+// and resumes each coroutine when its reply arrives; the coroutine then runs until it awaits
+// its next call or finishes. The reply is checked against the converter of |ReplyId|, see
+// DEFINE_IPC_MSG_CONV, and its values are read with Get<N>().
+//
+// On the server, a MsgIn handler can be a coroutine by returning CoTask from OnMsg():
+//
+//   class SumMsg : public ipc::MsgIn<kSum, SumMsg, ChannelT> {
+//    public:
+//     ipc::CoTask OnMsg(ChannelT* ch, int a, int b) {
+//       co_await something;
+//       co_return SendMsg(kSumReply, ch, a + b);
+//     }
+//   };
+//
+// The handler runs until its first suspension inside Channel::Receive() and, if it finishes
+// there, its co_return value is the return value of OnMsgIn() as usual. If it suspends,
+// OnMsgIn() returns OnMsgLoopNext and the handler completes later; whatever it co_returns
+// then is dropped. Replies sent after a suspension still carry the call id of the request.
+// The arguments are only valid until the first suspension, so strings and arrays must be
+// copied before that.
+//
+// If WaitAll() fails, every coroutine still waiting is resumed with the error in its reply,
+// so it can finish and free its frame, and from then on every call fails right away with the
+// same error. Destroying a CoCalls with calls still in flight does the same.
+//
+// Like AsyncCalls, CoCalls treats every message that arrives on its channel as a reply and is
+// not thread safe. Waiting is still a blocking read on the transport: the conversations share
+// the thread that calls WaitAll(), which does not return until they are all done or the
+// channel fails. There is no way yet to await the transport itself, so a CoCalls can't be
+// driven from an event loop that also waits on other handles.
+
+#if defined(IPC_HAS_COROUTINES)
+
+namespace ipc {
+
+// Return type for coroutines that are started and left to finish on their own, which
+// includes the coroutine message handlers. The coroutine starts running right away and
+// frees itself when it finishes.
+class CoTask {
+ public:
+  class promise_type {
+   public:
+    promise_type()
+        : context_(CurrentDispatch()), rc_(OnMsgLoopNext), running_(false), detached_(false) {
+      outer_.channel = NULL;
+      outer_.call_id = 0;
+    }
+
+    CoTask get_return_object() {
+      return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+
+    // Stays suspended at the end only while a CoTask still refers to the frame.
+    struct FinalAwaiter {
+      bool detached;
+      bool await_ready() const noexcept { return detached; }
+      void await_suspend(std::coroutine_handle<>) const noexcept {}
+      void await_resume() const noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+      Leave();
+      FinalAwaiter fa = { detached_ };
+      return fa;
+    }
+
+    void return_value(size_t rc) { rc_ = rc; }
+
+    void unhandled_exception() { abort(); }
+
+    // Every co_await goes through here so the coroutine sees its own dispatch context,
+    // the one of the message that started it, whoever resumes it.
+    template <class AwaiterT>
+    struct ScopedAwaiter {
+      AwaiterT inner;
+      promise_type* promise;
+
+      bool await_ready() { return inner.await_ready(); }
+
+      auto await_suspend(std::coroutine_handle<> h) {
+        promise->Leave();
+        return inner.await_suspend(h);
+      }
+
+      auto await_resume() {
+        promise->Enter();
+        return inner.await_resume();
+      }
+    };
+
+    template <class AwaiterT>
+    ScopedAwaiter<AwaiterT> await_transform(AwaiterT awaiter) {
+      ScopedAwaiter<AwaiterT> sa = { static_cast<AwaiterT&&>(awaiter), this };
+      return sa;
+    }
+
+   private:
+    friend class CoTask;
+
+    void Enter() {
+      if (running_)
+        return;
+      outer_ = CurrentDispatch();
+      CurrentDispatch() = context_;
+      running_ = true;
+    }
+
+    void Leave() {
+      if (!running_)
+        return;
+      CurrentDispatch() = outer_;
+      running_ = false;
+    }
+
+    const DispatchContext context_;
+    DispatchContext outer_;
+    size_t rc_;
+    bool running_;
+    bool detached_;
+  };
+
+  ~CoTask() {
+    if (!handle_)
+      return;
+    if (handle_.done())
+      handle_.destroy();
+    else
+      handle_.promise().detached_ = true;
+  }
+
+  bool Done() const { return !handle_ || handle_.done(); }
+
+  // This is what makes a CoTask usable as the return value of a MsgIn handler.
+  operator size_t() const {
+    return (handle_ && handle_.done()) ? handle_.promise().rc_ : OnMsgLoopNext;
+  }
+
+ private:
+  explicit CoTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+
+  CoTask(const CoTask&);
+  CoTask& operator=(const CoTask&);
+};
+
+// The reply to a CoCalls::Call(). Error() is RcOK if the reply arrived and matches the
+// converter of |ReplyId|, in which case Get<N>() returns its Nth value.
+template <class ChannelT, int ReplyId>
+class CoReply {
+ public:
+  typedef MsgParamConverter<ReplyId> PC;
+
+  CoReply(size_t rc, int msg_id, const WireType* const args[], int count) : rc_(rc) {
+    if (rc_ != RcOK)
+      return;
+    if (msg_id != ReplyId) {
+      rc_ = RcErrBadMessageId;
+      return;
+    }
+    if ((count != PC::kNumParams) || MsgIn<ReplyId, CoReply, ChannelT>::CheckArgs(args)) {
+      rc_ = RcErrDecoderArgs;
+      return;
+    }
+    for (int ix = 0; ix != count; ++ix)
+      args_.push_back(*args[ix]);
+  }
+
+  size_t Error() const { return rc_; }
+
+  template <int I>
+  auto Get() {
+    return PC::Get(&args_[I], Int2Type<I>());
+  }
+
+ private:
+  size_t rc_;
+  FixedArray<WireType, PC::kNumParams + 1> args_;
+
+  CoReply(const CoReply&);
+  CoReply& operator=(const CoReply&);
+};
+
+template <class ChannelT>
+class CoCalls {
+ private:
+  // Where OnMsgIn() leaves the reply for the awaiting coroutine.
+  struct Incoming {
+    size_t rc;
+    int msg_id;
+    const WireType* const* args;
+    int count;
+  };
+
+ public:
+  template <int ReplyId>
+  class CallAwaiter {
+   public:
+    CallAwaiter(CoCalls* calls, size_t rc, int call_id)
+        : calls_(calls), rc_(rc), call_id_(call_id) {
+      in_.rc = rc;
+      in_.msg_id = -1;
+      in_.args = NULL;
+      in_.count = 0;
+    }
+
+    bool await_ready() const { return rc_ != RcOK; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      calls_->AddPending(call_id_, h, &in_);
+    }
+
+    // Runs inside CoCalls::OnMsgIn() so the arguments are still there to be copied.
+    CoReply<ChannelT, ReplyId> await_resume() {
+      return CoReply<ChannelT, ReplyId>(in_.rc, in_.msg_id, in_.args, in_.count);
+    }
+
+   private:
+    CoCalls* calls_;
+    size_t rc_;
+    int call_id_;
+    Incoming in_;
+  };
+
+  explicit CoCalls(ChannelT* channel) : channel_(channel), last_call_id_(0), error_(RcOK) {}
+
+  ~CoCalls() {
+    Fail(RcErrTransportRead);
+  }
+
+  // Sends |msg_id| with |args| and returns an object to co_await for the reply, which must
+  // be |ReplyId|. If the send fails the co_await does not suspend and the reply has the
+  // error.
+  template <int ReplyId, typename... ArgsT>
+  CallAwaiter<ReplyId> Call(int msg_id, const ArgsT&... args) {
+    const int id = NextCallId(&last_call_id_);
+    if (error_ != RcOK)
+      return CallAwaiter<ReplyId>(this, error_, id);
+    size_t rc = channel_->SendArgsWithCallId(msg_id, id, args...);
+    return CallAwaiter<ReplyId>(this, rc, id);
+  }
+
+  // Blocks, resuming coroutines as their replies arrive, until no call is in flight.
+  size_t WaitAll() {
+    if (error_ != RcOK)
+      return error_;
+    if (!pending_.size())
+      return RcOK;
+    size_t rc = channel_->Receive(this);
+    if (rc == OnMsgReady)
+      return RcOK;
+    Fail(rc);
+    return rc;
+  }
+
+  size_t PendingCount() const { return pending_.size(); }
+
+  // These implement the DispatchT contract of Channel::Receive().
+  CoCalls* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    size_t ix = Find(ch->LastRecvCallId());
+    if (ix == kNotFound)
+      return RcErrBadCallId;
+    PendingCall pc = pending_[ix];
+    pending_[ix] = pending_[pending_.size() - 1];
+    pending_.pop_back();
+
+    pc.in->rc = RcOK;
+    pc.in->msg_id = msg_id;
+    pc.in->args = args;
+    pc.in->count = count;
+    // The coroutine can make new calls before it suspends again.
+    std::coroutine_handle<>::from_address(pc.handle).resume();
+    return pending_.size() ? OnMsgLoopNext : OnMsgReady;
+  }
+
+ private:
+  struct PendingCall {
+    int call_id;
+    void* handle;
+    Incoming* in;
+  };
+
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  void AddPending(int call_id, std::coroutine_handle<> h, Incoming* in) {
+    PendingCall pc = { call_id, h.address(), in };
+    pending_.push_back(pc);
+  }
+
+  // Resumes every waiting coroutine with |rc| as its reply. The calls they make meanwhile
+  // fail without suspending, so they all run to the end.
+  void Fail(size_t rc) {
+    if (error_ == RcOK)
+      error_ = rc;
+    while (pending_.size()) {
+      PendingCall pc = pending_[pending_.size() - 1];
+      pending_.pop_back();
+      pc.in->rc = error_;
+      std::coroutine_handle<>::from_address(pc.handle).resume();
+    }
+  }
+
+  size_t Find(int call_id) const {
+    for (size_t ix = 0; ix != pending_.size(); ++ix) {
+      if (pending_[ix].call_id == call_id)
+        return ix;
+    }
+    return kNotFound;
+  }
+
+  ChannelT* channel_;
+  PodVector<PendingCall> pending_;
+  int last_call_id_;
+  size_t error_;
+
+  CoCalls(const CoCalls&);
+  CoCalls& operator=(const CoCalls&);
+};
+
+}  // namespace ipc.
+
+#endif  // defined(IPC_HAS_COROUTINES)
+
+#endif  // SIMPLE_IPC_CORO_H_
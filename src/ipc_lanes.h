@@ -0,0 +1,382 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_LANES_H_
+#define SIMPLE_IPC_LANES_H_
+
+#include "ipc_codec.h"
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// LaneTransport wraps a transport so that a large message does not hold up the small urgent
+// ones sent after it. Every message goes on one of |NumLanes| priority lanes, lane 0 being the
+// most urgent, and is cut into frames of at most SetFrameSize() bytes. Frames of different
+// lanes are interleaved on the wrapped transport, always picking the next frame from the most
+// urgent lane that has one. The receiving end reassembles the messages of each lane and hands
+// out the complete ones, most urgent first.
+//
+// It implements the transport contract of ipc::Channel, and both ends must use it:
+//
+//   PipeTransport pipe;
+//   ipc::LaneTransport<PipeTransport> lanes(&pipe);
+//   lanes.SetMsgLane(kUploadFile, 1);
+//   ipc::Channel<ipc::LaneTransport<PipeTransport>, ipc::Encoder, ipc::Decoder> channel(&lanes);
+//
+// The lane of a message is picked by its id, read from the encoded header with
+// EncoderT::PeekMsgId(). Messages with no lane set, and the library's own messages, go on
+// lane 0.
+//
+// Send() is thread safe and blocks until the whole message has been written. Frames are only
+// interleaved between messages sent from different threads, so the channel should be left in
+// SEND_DIRECT mode and the bulk messages sent from their own thread; the queued send modes
+// write one message at a time. A sender whose message is done hands the writing over to the
+// owner of the next pending message. Within a lane the messages go out in order and a lane can
+// be starved by the more urgent ones. Across lanes there is no order: a message can overtake
+// a less urgent one that was sent before it.
+//
+// Each frame starts with a FrameHeader: a mark, the lane and the last-frame flag, and the size
+// of the data that follows. Receive() is not thread safe, like the receive side of the other
+// transports. The buffer it returns is valid until the next call.
+
+namespace ipc {
+
+template <class TransportT, class EncoderT = Encoder, int NumLanes = 4>
+class LaneTransport {
+ public:
+  static const int kNumLanes = NumLanes;
+
+  enum {
+    kDefaultFrameSize = 16 * 1024,
+    kMaxFrameSize = 1024 * 1024
+  };
+
+  explicit LaneTransport(TransportT* transport)
+      : transport_(transport), frame_size_(kDefaultFrameSize), queued_(0), writing_(false),
+        write_error_(false), current_(NULL) {
+    for (int ix = 0; ix != NumLanes; ++ix) {
+      tx_lanes_[ix].head = NULL;
+      tx_lanes_[ix].tail = NULL;
+      rx_lanes_[ix].head = NULL;
+      rx_lanes_[ix].tail = NULL;
+    }
+  }
+
+  ~LaneTransport() {
+    DeleteMessage(current_);
+    for (int ix = 0; ix != NumLanes; ++ix) {
+      while (rx_lanes_[ix].head)
+        DeleteMessage(PopMessage(ix));
+    }
+  }
+
+  // Messages with id |msg_id| go on |lane|. Must be called before the transport is shared
+  // between threads.
+  bool SetMsgLane(int msg_id, int lane) {
+    if ((lane < 0) || (lane >= NumLanes) || (msg_id < kMessagePrivLastId))
+      return false;
+    for (size_t ix = 0; ix != msg_lanes_.size(); ++ix) {
+      if (msg_lanes_[ix].msg_id == msg_id) {
+        msg_lanes_[ix].lane = lane;
+        return true;
+      }
+    }
+    MsgLane ml = { msg_id, lane };
+    msg_lanes_.push_back(ml);
+    return true;
+  }
+
+  // Largest number of message bytes per frame. A smaller size lets urgent messages in
+  // sooner at the cost of more writes. Only affects the sending side.
+  bool SetFrameSize(size_t size) {
+    if ((size == 0) || (size > kMaxFrameSize))
+      return false;
+    frame_size_ = size;
+    return true;
+  }
+
+  // Number of messages given to Send() that are not completely written yet.
+  size_t QueuedCount() {
+    AutoLock lock(&send_lock_);
+    return queued_;
+  }
+
+  size_t Send(const void* buf, size_t sz) {
+    Pending me;
+    me.next = NULL;
+    me.buf = static_cast<const char*>(buf);
+    me.size = sz;
+    me.offset = 0;
+    me.rc = RcOK;
+    me.done = false;
+    me.writer = false;
+
+    const int lane = LaneOf(buf, sz);
+    bool wait;
+    {
+      AutoLock lock(&send_lock_);
+      if (write_error_)
+        return RcErrTransportWrite;
+      PushPending(lane, &me);
+      wait = writing_;
+      writing_ = true;
+    }
+    if (wait) {
+      me.wake.Wait();
+      if (!me.writer)
+        return me.rc;
+    }
+    WriteFrames(&me);
+    return me.rc;
+  }
+
+  char* Receive(size_t* size) {
+    DeleteMessage(current_);
+    current_ = NULL;
+    for (;;) {
+      for (int ix = 0; ix != NumLanes; ++ix) {
+        if (rx_lanes_[ix].head) {
+          current_ = PopMessage(ix);
+          *size = current_->data.size();
+          return current_->data.get();
+        }
+      }
+      size_t received = 0;
+      const char* buf = transport_->Receive(&received);
+      if (!buf)
+        return NULL;
+      in_.Add(buf, received);
+      if (!ParseFrames())
+        return NULL;
+    }
+  }
+
+ private:
+  struct FrameHeader {
+    unsigned int mark;
+    unsigned int info;
+    unsigned int size;
+  };
+
+  enum {
+    kFrameMark = 0x454d5246,
+    kFrameLaneMask = 0xff,
+    kFrameLast = 1 << 8
+  };
+
+  struct MsgLane {
+    int msg_id;
+    int lane;
+  };
+
+  // A message being sent. It lives on the stack of the thread that called Send().
+  struct Pending {
+    Pending* next;
+    const char* buf;
+    size_t size;
+    size_t offset;
+    size_t rc;
+    bool done;
+    bool writer;
+    Semaphore wake;
+  };
+
+  struct TxLane {
+    Pending* head;
+    Pending* tail;
+  };
+
+  // A message received in full.
+  struct Message {
+    Message* next;
+    PodVector<char> data;
+  };
+
+  struct RxLane {
+    PodVector<char> partial;
+    Message* head;
+    Message* tail;
+  };
+
+  int LaneOf(const void* buf, size_t sz) const {
+    const int msg_id = EncoderT::PeekMsgId(buf, sz);
+    for (size_t ix = 0; ix != msg_lanes_.size(); ++ix) {
+      if (msg_lanes_[ix].msg_id == msg_id)
+        return msg_lanes_[ix].lane;
+    }
+    return 0;
+  }
+
+  // Must be called with |send_lock_| held.
+  void PushPending(int lane, Pending* p) {
+    TxLane& tx = tx_lanes_[lane];
+    if (tx.tail)
+      tx.tail->next = p;
+    else
+      tx.head = p;
+    tx.tail = p;
+    ++queued_;
+  }
+
+  // Must be called with |send_lock_| held.
+  Pending* FirstPending(int* lane) {
+    for (int ix = 0; ix != NumLanes; ++ix) {
+      if (tx_lanes_[ix].head) {
+        *lane = ix;
+        return tx_lanes_[ix].head;
+      }
+    }
+    return NULL;
+  }
+
+  // Must be called with |send_lock_| held.
+  void PopPending(int lane) {
+    TxLane& tx = tx_lanes_[lane];
+    tx.head = tx.head->next;
+    if (!tx.head)
+      tx.tail = NULL;
+    --queued_;
+  }
+
+  // Runs in the one thread that is writing, which keeps going until its own message |me|
+  // is out and then wakes the owner of the next pending message to take over.
+  void WriteFrames(Pending* me) {
+    for (;;) {
+      int lane = 0;
+      Pending* p;
+      bool failed;
+      {
+        AutoLock lock(&send_lock_);
+        failed = write_error_;
+        p = FirstPending(&lane);
+        if (me->done) {
+          if (p)
+            p->writer = true;
+          else
+            writing_ = false;
+        }
+      }
+      if (me->done) {
+        if (p)
+          p->wake.Post();
+        return;
+      }
+
+      size_t rc = failed ? RcErrTransportWrite : WriteFrame(p, lane);
+      bool finished;
+      {
+        AutoLock lock(&send_lock_);
+        if (rc != RcOK) {
+          write_error_ = true;
+          p->rc = rc;
+        }
+        finished = (rc != RcOK) || (p->offset == p->size);
+        if (finished) {
+          PopPending(lane);
+          p->done = true;
+        }
+      }
+      // The owner returns from Send() as soon as it wakes up, so |p| is gone after this.
+      if (finished && (p != me))
+        p->wake.Post();
+    }
+  }
+
+  size_t WriteFrame(Pending* p, int lane) {
+    const size_t left = p->size - p->offset;
+    const size_t n = (left < frame_size_) ? left : frame_size_;
+    FrameHeader hdr;
+    hdr.mark = kFrameMark;
+    hdr.info = static_cast<unsigned int>(lane) | ((n == left) ? kFrameLast : 0);
+    hdr.size = static_cast<unsigned int>(n);
+    frame_.Set(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    frame_.Add(p->buf + p->offset, n);
+    size_t rc = transport_->Send(frame_.get(), frame_.size());
+    p->offset += n;
+    return rc;
+  }
+
+  // Moves every complete frame in |in_| to its lane. Returns false if the data does not
+  // look like frames.
+  bool ParseFrames() {
+    size_t pos = 0;
+    while ((in_.size() - pos) >= sizeof(FrameHeader)) {
+      FrameHeader hdr;
+      memcpy(&hdr, &in_[pos], sizeof(hdr));
+      const int lane = hdr.info & kFrameLaneMask;
+      if ((hdr.mark != kFrameMark) || (lane >= NumLanes) || (hdr.size > kMaxFrameSize))
+        return false;
+      if ((in_.size() - pos - sizeof(hdr)) < hdr.size)
+        break;
+      RxLane& rx = rx_lanes_[lane];
+      rx.partial.Add(&in_[pos + sizeof(hdr)], hdr.size);
+      pos += sizeof(hdr) + hdr.size;
+      if ((hdr.info & kFrameLast) && rx.partial.size())
+        PushMessage(lane);
+    }
+    in_.RemoveFront(pos);
+    return true;
+  }
+
+  void PushMessage(int lane) {
+    RxLane& rx = rx_lanes_[lane];
+    Message* msg = memdet::new_impl<Message>(1);
+    msg->next = NULL;
+    msg->data.Swap(rx.partial);
+    if (rx.tail)
+      rx.tail->next = msg;
+    else
+      rx.head = msg;
+    rx.tail = msg;
+  }
+
+  Message* PopMessage(int lane) {
+    RxLane& rx = rx_lanes_[lane];
+    Message* msg = rx.head;
+    rx.head = msg->next;
+    if (!rx.head)
+      rx.tail = NULL;
+    return msg;
+  }
+
+  static void DeleteMessage(Message* msg) {
+    if (msg)
+      memdet::delete_impl(msg);
+  }
+
+  TransportT* transport_;
+  PodVector<MsgLane> msg_lanes_;
+  size_t frame_size_;
+
+  // Sending side. |frame_| belongs to the thread that is writing.
+  Mutex send_lock_;
+  TxLane tx_lanes_[NumLanes];
+  size_t queued_;
+  bool writing_;
+  bool write_error_;
+  PodVector<char> frame_;
+
+  // Receiving side.
+  PodVector<char> in_;
+  RxLane rx_lanes_[NumLanes];
+  Message* current_;
+
+  LaneTransport(const LaneTransport&);
+  LaneTransport& operator=(const LaneTransport&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_LANES_H_
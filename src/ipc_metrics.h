@@ -0,0 +1,437 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_METRICS_H_
+#define SIMPLE_IPC_METRICS_H_
+
+#include "os_includes.h"
+#include "ipc_stats.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+#if !defined(WIN32)
+#include <string.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// ChannelMetrics is the instrumentation policy of Channel, the last template parameter. It
+// keeps, per message id, how many messages were sent and received and their encoded bytes,
+// and histograms of the time spent decoding, in the handler and waiting for a reply.
+//
+//   typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChannelMetrics>
+//       MeteredChannel;
+//   ipc::PodVector<ipc::MsgMetrics> report;
+//   channel.metrics()->Collect(&report);
+//
+// The round trip is measured for requests that carry a call id, from Send() to the moment
+// the reply with the same call id is decoded, and it is kept under the id of the request.
+// Up to kPendingStripes * kPendingSlots requests are tracked at a time; when there are more
+// the oldest ones are not measured, see PendingCollisions().
+// When the other end stamps its messages, see Channel::SetSendTimestamps(), the one-way
+// latency of each message is kept too, so the request and the reply legs of a call show
+// up separately under their own ids.
+//
+// Every thread records into its own set of counters so threads do not share cache lines.
+// Collect() adds them up. The default policy, NoMetrics, records nothing and compiles away.
+
+namespace ipc {
+
+// A log-linear histogram of nanosecond values, in the style of HDR histograms. Values
+// below 32 have a bucket each and above that each power of two has 16 buckets, so the
+// value of a bucket is within 6.25% of the values in it. Values larger than about
+// 36 minutes are counted as that. It is a plain struct so it can live in a PodVector, which
+// means it starts with garbage: call Clear() or zero it before use.
+class LatencyHistogram {
+ public:
+  enum {
+    kSubBits = 4,
+    kSubBuckets = 1 << kSubBits,
+    kMaxShift = 36,
+    kBuckets = kSubBuckets * (kMaxShift + 2)
+  };
+
+  void Clear() {
+    memset(this, 0, sizeof(*this));
+  }
+
+  void Record(long long value) {
+    if (value < 0)
+      value = 0;
+    ++buckets_[BucketOf(value)];
+    ++count_;
+    sum_ += value;
+    if (value > max_)
+      max_ = value;
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    for (int ix = 0; ix != kBuckets; ++ix)
+      buckets_[ix] += other.buckets_[ix];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.max_ > max_)
+      max_ = other.max_;
+  }
+
+  long long Count() const { return count_; }
+  long long Max() const { return max_; }
+  long long Mean() const { return count_ ? sum_ / count_ : 0; }
+
+  // Returns the value that |percentile| percent of the values are at or below, rounded up
+  // to the end of its bucket.
+  long long ValueAtPercentile(double percentile) const {
+    if (!count_)
+      return 0;
+    long long wanted = static_cast<long long>(percentile * count_ / 100.0 + 0.5);
+    if (wanted < 1)
+      wanted = 1;
+    long long seen = 0;
+    for (int ix = 0; ix != kBuckets; ++ix) {
+      seen += buckets_[ix];
+      if (seen >= wanted) {
+        const long long high = HighestOf(ix);
+        return (high < max_) ? high : max_;
+      }
+    }
+    return max_;
+  }
+
+  static int BucketOf(long long value) {
+    const unsigned long long v = static_cast<unsigned long long>(value);
+    if (v < 2 * kSubBuckets)
+      return static_cast<int>(v);
+    int shift = Log2(v) - kSubBits;
+    if (shift > kMaxShift)
+      return kBuckets - 1;
+    return shift * kSubBuckets + static_cast<int>(v >> shift);
+  }
+
+  static long long HighestOf(int bucket) {
+    if (bucket < 2 * kSubBuckets)
+      return bucket;
+    const int shift = bucket / kSubBuckets - 1;
+    const long long sub = bucket % kSubBuckets + kSubBuckets;
+    return ((sub + 1) << shift) - 1;
+  }
+
+ private:
+  static int Log2(unsigned long long v) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bits = 0;
+    while (v >>= 1)
+      ++bits;
+    return bits;
+#endif
+  }
+
+  long long buckets_[kBuckets];
+  long long count_;
+  long long sum_;
+  long long max_;
+};
+
+struct MsgMetrics {
+  int msg_id;
+  long long sent;
+  long long sent_bytes;
+  long long received;
+  long long received_bytes;
+  LatencyHistogram decode;
+  LatencyHistogram handler;
+  LatencyHistogram round_trip;
+  LatencyHistogram one_way;
+};
+
+class ChannelMetrics {
+ public:
+  enum { kEnabled = 1, kTraceSpans = 0 };
+
+  enum {
+    kPendingStripes = 16,
+    kPendingSlots = 16
+  };
+
+  ChannelMetrics() : serial_(NextSerial()), shards_(NULL) {
+    for (int ix = 0; ix != kPendingStripes; ++ix) {
+      memset(pending_[ix].slots, 0, sizeof(pending_[ix].slots));
+      pending_[ix].collisions = 0;
+    }
+  }
+
+  ~ChannelMetrics() {
+    while (shards_) {
+      Shard* shard = shards_;
+      shards_ = shard->next;
+      for (size_t ix = 0; ix != shard->msgs.size(); ++ix)
+        memdet::delete_impl(shard->msgs[ix]);
+      memdet::delete_impl(shard);
+    }
+  }
+
+  // Monotonic time in nanoseconds.
+  static long long Now() {
+    return MonotonicNs();
+  }
+
+  // Called by Channel for every message sent. |reply| is true if |call_id| is the one of
+  // the message being handled, so it does not start a round trip.
+  void OnSend(int msg_id, int call_id, bool reply, size_t bytes) {
+    if (call_id && !reply)
+      AddPending(call_id, msg_id, Now());
+    Shard* shard = ThreadShard();
+    AutoLock lock(&shard->lock);
+    MsgMetrics* metrics = shard->Get(msg_id);
+    ++metrics->sent;
+    metrics->sent_bytes += bytes;
+  }
+
+  // Called by Channel for every message dispatched. |decoded_at| is when the decoder
+  // finished with it and |sent_at| when the other end sent it, or 0 if it does not say.
+  void OnReceive(int msg_id, int call_id, size_t bytes, long long decode_ns,
+                 long long decoded_at, long long handler_ns, long long sent_at) {
+    Pending request;
+    const bool matched = call_id && TakePending(call_id, &request);
+    Shard* shard = ThreadShard();
+    AutoLock lock(&shard->lock);
+    MsgMetrics* metrics = shard->Get(msg_id);
+    ++metrics->received;
+    metrics->received_bytes += bytes;
+    metrics->decode.Record(decode_ns);
+    metrics->handler.Record(handler_ns);
+    if (sent_at)
+      metrics->one_way.Record(decoded_at - sent_at);
+    if (matched)
+      shard->Get(request.msg_id)->round_trip.Record(decoded_at - request.sent_at);
+  }
+
+  // Requests that made room for newer ones because more calls were in flight than there
+  // are slots. Their round trips are not measured.
+  long long PendingCollisions() {
+    long long collisions = 0;
+    for (int ix = 0; ix != kPendingStripes; ++ix) {
+      AutoLock lock(&pending_[ix].lock);
+      collisions += pending_[ix].collisions;
+    }
+    return collisions;
+  }
+
+  void OnSpan(int, int, long long, long long) {}
+
+  // Adds the totals of all the message ids to the answer to a stats query.
+  void AddStats(ChannelStats* stats) {
+    PodVector<MsgMetrics> report;
+    Collect(&report);
+    LatencyHistogram handler;
+    handler.Clear();
+    for (size_t ix = 0; ix != report.size(); ++ix) {
+      stats->sent += report[ix].sent;
+      stats->sent_bytes += report[ix].sent_bytes;
+      stats->received += report[ix].received;
+      stats->received_bytes += report[ix].received_bytes;
+      handler.Merge(report[ix].handler);
+    }
+    stats->handler_p50_ns = handler.ValueAtPercentile(50);
+    stats->handler_p99_ns = handler.ValueAtPercentile(99);
+    stats->handler_max_ns = handler.Max();
+  }
+
+  // Replaces |report| with the totals of all the threads, sorted by message id.
+  void Collect(PodVector<MsgMetrics>* report) {
+    report->clear();
+    AutoLock lock(&shards_lock_);
+    for (Shard* shard = shards_; shard; shard = shard->next) {
+      AutoLock shard_lock(&shard->lock);
+      for (size_t ix = 0; ix != shard->msgs.size(); ++ix)
+        Add(report, *shard->msgs[ix]);
+    }
+  }
+
+  // Returns the entry for |msg_id| in a report from Collect(), or NULL.
+  static const MsgMetrics* Find(const PodVector<MsgMetrics>& report, int msg_id) {
+    for (size_t ix = 0; ix != report.size(); ++ix) {
+      if (report[ix].msg_id == msg_id)
+        return &report[ix];
+    }
+    return NULL;
+  }
+
+ private:
+  enum {
+    kCachedShards = 4
+  };
+
+  // The counters of one thread. Only that thread writes them; the lock is there for
+  // Collect() and is otherwise uncontended.
+  struct Shard {
+    Shard() : next(NULL), thread(NULL), last(0) {}
+
+    MsgMetrics* Get(int msg_id) {
+      if ((last < msgs.size()) && (msgs[last]->msg_id == msg_id))
+        return msgs[last];
+      for (last = 0; last != msgs.size(); ++last) {
+        if (msgs[last]->msg_id == msg_id)
+          return msgs[last];
+      }
+      MsgMetrics* metrics = memdet::new_impl<MsgMetrics>(1);
+      memset(metrics, 0, sizeof(*metrics));
+      metrics->msg_id = msg_id;
+      msgs.push_back(metrics);
+      return metrics;
+    }
+
+    Shard* next;
+    const char* thread;
+    Mutex lock;
+    PodVector<MsgMetrics*> msgs;
+    size_t last;
+  };
+
+  // A request waiting for its reply, by call id.
+  struct Pending {
+    int call_id;
+    int msg_id;
+    long long sent_at;
+  };
+
+  // The requests whose call id falls in this stripe. A free slot has a call id of 0.
+  // Consecutive call ids go to different stripes, so the threads making calls and the
+  // ones reading the replies seldom wait for each other.
+  struct PendingStripe {
+    Mutex lock;
+    Pending slots[kPendingSlots];
+    long long collisions;
+  };
+
+  struct CachedShard {
+    long serial;
+    Shard* shard;
+  };
+
+  static long NextSerial() {
+    static volatile long serial = 0;
+    return AtomicIncrement(&serial);
+  }
+
+  // Different for every thread that is alive.
+  static const char* ThreadToken() {
+    static IPC_THREAD_LOCAL char token = 0;
+    return &token;
+  }
+
+  // Each thread remembers its shard in the last few ChannelMetrics it used. The serial
+  // tells a new object from a deleted one at the same address.
+  Shard* ThreadShard() {
+    static IPC_THREAD_LOCAL CachedShard cache[kCachedShards];
+    static IPC_THREAD_LOCAL int next_slot = 0;
+    for (int ix = 0; ix != kCachedShards; ++ix) {
+      if (cache[ix].serial == serial_)
+        return cache[ix].shard;
+    }
+    Shard* shard = FindShard(ThreadToken());
+    cache[next_slot].serial = serial_;
+    cache[next_slot].shard = shard;
+    next_slot = (next_slot + 1) % kCachedShards;
+    return shard;
+  }
+
+  // A thread that is gone can leave its token to a new thread, which then adds to the
+  // same counters. Nothing is lost.
+  Shard* FindShard(const char* thread) {
+    AutoLock lock(&shards_lock_);
+    for (Shard* shard = shards_; shard; shard = shard->next) {
+      if (shard->thread == thread)
+        return shard;
+    }
+    Shard* shard = memdet::new_impl<Shard>(1);
+    shard->thread = thread;
+    shard->next = shards_;
+    shards_ = shard;
+    return shard;
+  }
+
+  PendingStripe& StripeOf(int call_id) {
+    return pending_[static_cast<unsigned int>(call_id) % kPendingStripes];
+  }
+
+  // When the stripe is full the oldest request in it, which most likely never gets a
+  // reply, makes room and is counted as a collision.
+  void AddPending(int call_id, int msg_id, long long sent_at) {
+    PendingStripe& stripe = StripeOf(call_id);
+    AutoLock lock(&stripe.lock);
+    Pending* slot = &stripe.slots[0];
+    for (int ix = 0; ix != kPendingSlots; ++ix) {
+      Pending* candidate = &stripe.slots[ix];
+      if (!candidate->call_id) {
+        slot = candidate;
+        break;
+      }
+      if (candidate->sent_at < slot->sent_at)
+        slot = candidate;
+    }
+    if (slot->call_id)
+      ++stripe.collisions;
+    slot->call_id = call_id;
+    slot->msg_id = msg_id;
+    slot->sent_at = sent_at;
+  }
+
+  bool TakePending(int call_id, Pending* request) {
+    PendingStripe& stripe = StripeOf(call_id);
+    AutoLock lock(&stripe.lock);
+    for (int ix = 0; ix != kPendingSlots; ++ix) {
+      if (stripe.slots[ix].call_id == call_id) {
+        *request = stripe.slots[ix];
+        stripe.slots[ix].call_id = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void Add(PodVector<MsgMetrics>* report, const MsgMetrics& metrics) {
+    size_t pos = 0;
+    while ((pos != report->size()) && ((*report)[pos].msg_id < metrics.msg_id))
+      ++pos;
+    if ((pos == report->size()) || ((*report)[pos].msg_id != metrics.msg_id)) {
+      report->resize(report->size() + 1);
+      memmove(&(*report)[pos + 1], &(*report)[pos],
+              (report->size() - pos - 1) * sizeof(MsgMetrics));
+      (*report)[pos] = metrics;
+      return;
+    }
+    MsgMetrics& total = (*report)[pos];
+    total.sent += metrics.sent;
+    total.sent_bytes += metrics.sent_bytes;
+    total.received += metrics.received;
+    total.received_bytes += metrics.received_bytes;
+    total.decode.Merge(metrics.decode);
+    total.handler.Merge(metrics.handler);
+    total.round_trip.Merge(metrics.round_trip);
+    total.one_way.Merge(metrics.one_way);
+  }
+
+  const long serial_;
+  Mutex shards_lock_;
+  Shard* shards_;
+  PendingStripe pending_[kPendingStripes];
+
+  ChannelMetrics(const ChannelMetrics&);
+  ChannelMetrics& operator=(const ChannelMetrics&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_METRICS_H_
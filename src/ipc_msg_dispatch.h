@@ -28,6 +28,39 @@ template<int MsgId>
 class MsgParamConverter;
 
 namespace ipc {
+
+// Int2Type is a handy template that given an integer generates a unique type. It is
+// used to dispatch a message to the right overload of DispatchImpl based on the
+// number of parameters without having to use printf-style elipsis calling which
+// loses the original type.
+template <int v> struct Int2Type {
+  enum { value = v };
+};
+
+#if defined(IPC_HAS_VARIADIC)
+// MakeIndexSeq<N>::type is IndexSeq<0, 1, ..., N - 1>. Used to expand the parameters
+// of a message of any arity.
+template <int... I>
+struct IndexSeq {};
+
+template <int N, int... I>
+struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...> {};
+
+template <int... I>
+struct MakeIndexSeq<0, I...> {
+  typedef IndexSeq<I...> type;
+};
+#endif
+
+// Base of every MsgParamConverter. The IPC_MSG_Px macros hide these with the signature of
+// each declared parameter; see WireType::MatchesSig().
+struct MsgParamSignature {
+  enum {
+    kSig0 = 0, kSig1 = 0, kSig2 = 0, kSig3 = 0, kSig4 = 0,
+    kSig5 = 0, kSig6 = 0, kSig7 = 0, kSig8 = 0, kSig9 = 0
+  };
+};
+
 //
 // Receives a message with id=|MsgId| and calls the appropiate overload of
 // OnMsg on the derived |DerivedT| class. To use this class you need to define
@@ -37,14 +70,6 @@ namespace ipc {
 template <int MsgId, class DerivedT, typename ChannelT>
 class MsgIn {
 public:
-  // Int2Type is a handy template that given an integer generates a unique type. It is
-  // used to dispatch a message to the right overload of DispatchImpl based on the
-  // number of parameters without having to use printf-style elipsis calling which
-  // loses the original type.
-  template <int v> struct Int2Type {
-    enum { value = v };
-  };
-
   enum { MSG_ID = MsgId };
 
   typedef MsgParamConverter<MsgId> PC;
@@ -55,12 +80,35 @@ public:
     }
     if (count != PC::kNumParams)
       return static_cast<DerivedT*>(this)->OnMsgArgCountError(count);
-    try {
-      return DispatchImpl(Int2Type<PC::kNumParams>(), ch, args);
-    } catch(int& code) {
-      return static_cast<DerivedT*>(this)->OnMsgArgConvertError(code);
+    const int bad_type = CheckArgs(args);
+    if (bad_type)
+      return static_cast<DerivedT*>(this)->OnMsgArgConvertError(bad_type);
+#if defined(IPC_HAS_VARIADIC)
+    return DispatchImpl(typename MakeIndexSeq<PC::kNumParams>::type(), ch, args);
+#else
+    return DispatchImpl(Int2Type<PC::kNumParams>(), ch, args);
+#endif
+  }
+
+  // Checks the type of every argument against the signature of the message. Returns 0
+  // if they all match or the expected type id of the first one that does not.
+#if defined(IPC_HAS_VARIADIC)
+  static int CheckArgs(const WireType* const args[]) {
+    return CheckArgsImpl(args, typename MakeIndexSeq<PC::kNumParams>::type());
+  }
+#else
+  static int CheckArgs(const WireType* const args[]) {
+    static const int signature[] = {
+      PC::kSig0, PC::kSig1, PC::kSig2, PC::kSig3, PC::kSig4,
+      PC::kSig5, PC::kSig6, PC::kSig7, PC::kSig8, PC::kSig9
+    };
+    for (int ix = 0; ix != PC::kNumParams; ++ix) {
+      if (!args[ix]->MatchesSig(signature[ix]))
+        return WireType::SigType(signature[ix]);
     }
+    return 0;
   }
+#endif
 
   // This function is meant simplify the scope specifier when calling OnMsgIn.
   // We use it when we have to override OnMsgIn and we need to call the original. 
@@ -73,6 +121,23 @@ public:
   }
 
 protected:
+#if defined(IPC_HAS_VARIADIC)
+  template <int... I>
+  static int CheckArgsImpl(const WireType* const args[], IndexSeq<I...>) {
+    // The trailing 0 keeps the array from being empty.
+    static const int signature[] = { PC::Sig(Int2Type<I>())..., 0 };
+    for (int ix = 0; ix != PC::kNumParams; ++ix) {
+      if (!args[ix]->MatchesSig(signature[ix]))
+        return WireType::SigType(signature[ix]);
+    }
+    return 0;
+  }
+
+  template <int... I>
+  size_t DispatchImpl(IndexSeq<I...>, ChannelT* ch, const WireType* const args[]) {
+    return static_cast<DerivedT*>(this)->OnMsg(ch, PC::Get(args[I], Int2Type<I>())...);
+  }
+#else
   size_t DispatchImpl(const Int2Type<0>&, ChannelT* ch, const WireType* const args[]) {
     return static_cast<DerivedT*>(this)->OnMsg(ch);
   }
@@ -128,81 +193,162 @@ protected:
                                                PC(args[6]).p6(), PC(args[7]).p7(), PC(args[8]).p8(),
                                                PC(args[9]).p9());
   }
-
+#endif  // defined(IPC_HAS_VARIADIC)
 };
 
 // Sends a message with id=|msg_id|. Basically wraps the tedious task of creating the
-// appropiate WireType array and calling the channel::Send with the correct number of params.
+// appropiate WireView array and calling the channel::Send with the correct number of params.
+// Either way the arguments are encoded from the caller's memory without copies.
 template <typename ChannelT>
 class MsgOut {
  protected:
+#if defined(IPC_HAS_VARIADIC)
+  // Takes any number of arguments and encodes them without going through WireType. The
+  // receiving channel must accept at least that many; see Channel's |MaxArgs|.
+  template <typename... ArgsT>
+  size_t SendMsg(int msg_id, ChannelT* ch, const ArgsT&... args) {
+    return ch->SendArgs(msg_id, args...);
+  }
+#else
   size_t SendMsg(int msg_id, ChannelT* ch)  {
-    return ch->Send(msg_id, NULL, 0);
+    return ch->Send(msg_id, static_cast<const WireView*>(NULL), 0);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0) {
-    const WireType* const args[] = { &a0 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0) {
+    const WireView args[] = { a0 };
     return ch->Send(msg_id, args, 1);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1) {
-    const WireType* const args[] = { &a0, &a1 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1) {
+    const WireView args[] = { a0, a1 };
     return ch->Send(msg_id, args, 2);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1,
-    const WireType& a2) {
-    const WireType* const args[] = { &a0, &a1, &a2 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1,
+    const WireView& a2) {
+    const WireView args[] = { a0, a1, a2 };
     return ch->Send(msg_id, args, 3);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3) {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3) {
+    const WireView args[] = { a0, a1, a2, a3 };
     return ch->Send(msg_id, args, 4);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4) {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4) {
+    const WireView args[] = { a0, a1, a2, a3, a4 };
     return ch->Send(msg_id, args, 5);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4, const WireType& a5)  {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4, const WireView& a5)  {
+    const WireView args[] = { a0, a1, a2, a3, a4, a5 };
     return ch->Send(msg_id, args, 6);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4, const WireType& a5, const WireType& a6)  {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4, const WireView& a5, const WireView& a6)  {
+    const WireView args[] = { a0, a1, a2, a3, a4, a5, a6 };
     return ch->Send(msg_id, args, 7);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4, const WireType& a5, const WireType& a6,
-      const WireType& a7)  {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4, const WireView& a5, const WireView& a6,
+      const WireView& a7)  {
+    const WireView args[] = { a0, a1, a2, a3, a4, a5, a6, a7 };
     return ch->Send(msg_id, args, 8);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4, const WireType& a5, const WireType& a6,
-      const WireType& a7, const WireType& a8)  {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4, const WireView& a5, const WireView& a6,
+      const WireView& a7, const WireView& a8)  {
+    const WireView args[] = { a0, a1, a2, a3, a4, a5, a6, a7, a8 };
     return ch->Send(msg_id, args, 9);
   }
 
-  size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0, const WireType& a1, const WireType& a2,
-      const WireType& a3, const WireType& a4, const WireType& a5, const WireType& a6,
-      const WireType& a7, const WireType& a8, const WireType& a9)  {
-    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9 };
+  size_t SendMsg(int msg_id, ChannelT* ch, const WireView& a0, const WireView& a1, const WireView& a2,
+      const WireView& a3, const WireView& a4, const WireView& a5, const WireView& a6,
+      const WireView& a7, const WireView& a8, const WireView& a9)  {
+    const WireView args[] = { a0, a1, a2, a3, a4, a5, a6, a7, a8, a9 };
     return ch->Send(msg_id, args, 10);
   }
 
   // Note: If you are adding more SendMsg() functions, update Channel::kMaxNumArgs accordingly.
+#endif  // defined(IPC_HAS_VARIADIC)
+};
+
+#if defined(IPC_HAS_VARIADIC)
+// One of these for each WireType loader. They describe a parameter to MsgArgs.
+namespace arg {
+
+#define IPC_ARG_TRAITS(rt, tname)                                   \
+struct tname {                                                      \
+  typedef rt value_type;                                            \
+  enum { kSig = ipc::WireType::kSig##tname };                       \
+  static rt Load(const ipc::WireType* wt) {                         \
+    return wt->Load##tname();                                       \
+  }                                                                 \
+};
+
+IPC_ARG_TRAITS(int, Int32)
+IPC_ARG_TRAITS(unsigned int, UInt32)
+IPC_ARG_TRAITS(long, Long32)
+IPC_ARG_TRAITS(unsigned long, ULong32)
+IPC_ARG_TRAITS(long, Long64)
+IPC_ARG_TRAITS(unsigned long, ULong64)
+IPC_ARG_TRAITS(long, Long)
+IPC_ARG_TRAITS(unsigned long, ULong)
+IPC_ARG_TRAITS(long long, Int64)
+IPC_ARG_TRAITS(unsigned long long, UInt64)
+IPC_ARG_TRAITS(float, Float32)
+IPC_ARG_TRAITS(double, Float64)
+IPC_ARG_TRAITS(char, Char8)
+IPC_ARG_TRAITS(wchar_t, Char16)
+IPC_ARG_TRAITS(void*, VoidPtr)
+IPC_ARG_TRAITS(const char*, String8)
+IPC_ARG_TRAITS(const wchar_t*, String16)
+IPC_ARG_TRAITS(const ipc::ByteArray, ByteArray)
+IPC_ARG_TRAITS(const ipc::Int32Array, Int32Array)
+IPC_ARG_TRAITS(const ipc::UInt32Array, UInt32Array)
+IPC_ARG_TRAITS(const ipc::Int64Array, Int64Array)
+IPC_ARG_TRAITS(const ipc::UInt64Array, UInt64Array)
+IPC_ARG_TRAITS(const ipc::Float32Array, Float32Array)
+IPC_ARG_TRAITS(const ipc::Float64Array, Float64Array)
+
+#undef IPC_ARG_TRAITS
+
+}  // namespace arg.
+
+template <int N, typename... ArgsT>
+struct ArgAt;
+
+template <typename FirstT, typename... RestT>
+struct ArgAt<0, FirstT, RestT...> {
+  typedef FirstT type;
+};
+
+template <int N, typename FirstT, typename... RestT>
+struct ArgAt<N, FirstT, RestT...> : ArgAt<N - 1, RestT...> {};
+
+// Parameter converter for messages of any arity, see DEFINE_IPC_MSG_ARGS.
+template <typename... ArgsT>
+class MsgArgs {
+ public:
+  enum { kNumParams = sizeof...(ArgsT) };
+
+  template <int I>
+  static constexpr int Sig(Int2Type<I>) {
+    return ArgAt<I, ArgsT...>::type::kSig;
+  }
+
+  template <int I>
+  static typename ArgAt<I, ArgsT...>::type::value_type Get(const WireType* wt, Int2Type<I>) {
+    return ArgAt<I, ArgsT...>::type::Load(wt);
+  }
 };
+#endif  // defined(IPC_HAS_VARIADIC)
 
 template <bool>
 struct CompileCheck;
@@ -233,18 +379,23 @@ struct CompileCheck<true> {};
 // approximately:
 //
 //  template<>
-//  class MsgParamConverter<5> {
+//  class MsgParamConverter<5> : public ipc::MsgParamSignature {
 //   public:
 //    enum { kNumParams = 2 };
 //    MsgParamConverter(const ipc::WireType* wt) : wt_(wt) {}
-//    int  p0() const { return wt_->RecoverInt32() }
-//    char p1() const { return wt_->RecoverChar8() }
+//    enum { kSig0 = ipc::WireType::kSigInt32 };
+//    int  p0() const { return wt_->LoadInt32() }
+//    enum { kSig1 = ipc::WireType::kSigChar8 };
+//    char p1() const { return wt_->LoadChar8() }
 //  };
 //
+// MsgIn checks the arguments against the kSigN values before calling any of the
+// pN() functions, which is why they can use the unchecked WireType loaders.
 
 #define DEFINE_IPC_MSG_CONV(msg_id, n_params)               \
 template<>                                                  \
-class MsgParamConverter<msg_id> {                           \
+class MsgParamConverter<msg_id>                             \
+    : public ipc::MsgParamSignature {                       \
  private:                                                   \
  const ipc::WireType* wt_;                                  \
  public:                                                    \
@@ -253,63 +404,144 @@ class MsgParamConverter<msg_id> {                           \
 
 #define IPC_MSG_P1(rt, tname)                               \
   }                                                         \
+  enum { kSig0 = ipc::WireType::kSig##tname };              \
   rt p0() const {                                           \
     COMPILE_CHK(1 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<0>) {          \
+    return kSig0;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<0>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P2(rt, tname)                               \
+  enum { kSig1 = ipc::WireType::kSig##tname };              \
   rt p1() const {                                           \
     COMPILE_CHK(2 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<1>) {          \
+    return kSig1;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<1>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P3(rt, tname)                               \
+  enum { kSig2 = ipc::WireType::kSig##tname };              \
   rt p2() const {                                           \
     COMPILE_CHK(3 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<2>) {          \
+    return kSig2;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<2>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P4(rt, tname)                               \
+  enum { kSig3 = ipc::WireType::kSig##tname };              \
   rt p3() const {                                           \
     COMPILE_CHK(4 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<3>) {          \
+    return kSig3;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<3>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P5(rt, tname)                               \
+  enum { kSig4 = ipc::WireType::kSig##tname };              \
   rt p4() const {                                           \
     COMPILE_CHK(5 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<4>) {          \
+    return kSig4;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<4>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P6(rt, tname)                               \
+  enum { kSig5 = ipc::WireType::kSig##tname };              \
   rt p5() const {                                           \
     COMPILE_CHK(6 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<5>) {          \
+    return kSig5;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<5>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P7(rt, tname)                               \
+  enum { kSig6 = ipc::WireType::kSig##tname };              \
   rt p6() const {                                           \
     COMPILE_CHK(7 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<6>) {          \
+    return kSig6;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<6>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P8(rt, tname)                               \
+  enum { kSig7 = ipc::WireType::kSig##tname };              \
   rt p7() const {                                           \
     COMPILE_CHK(8 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<7>) {          \
+    return kSig7;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<7>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P9(rt, tname)                               \
+  enum { kSig8 = ipc::WireType::kSig##tname };              \
   rt p8() const {                                           \
     COMPILE_CHK(9 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<8>) {          \
+    return kSig8;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<8>) {\
+    return wt->Load##tname();                               \
   }
 
 #define IPC_MSG_P10(rt, tname)                              \
+  enum { kSig9 = ipc::WireType::kSig##tname };              \
   rt p9() const {                                           \
     COMPILE_CHK(10 <= kNumParams);                          \
-    return wt_->Recover##tname();                           \
+    return wt_->Load##tname();                              \
+  }                                                         \
+  static IPC_CONSTEXPR int Sig(ipc::Int2Type<9>) {          \
+    return kSig9;                                           \
+  }                                                         \
+  static rt Get(const ipc::WireType* wt, ipc::Int2Type<9>) {\
+    return wt->Load##tname();                               \
   }
 
+#if defined(IPC_HAS_VARIADIC)
+// Defines the converter for a message with any number of parameters. Each parameter is
+// given by one of the ipc::arg types, which are named after the WireType loaders:
+//
+// DEFINE_IPC_MSG_ARGS(12, ipc::arg::Int32, ipc::arg::String8, ipc::arg::Float64);
+//
+#define DEFINE_IPC_MSG_ARGS(msg_id, ...)                                  \
+template<>                                                                \
+class MsgParamConverter<msg_id> : public ipc::MsgArgs<__VA_ARGS__> {}
+#endif  // defined(IPC_HAS_VARIADIC)
+
 #endif  // SIMPLE_IPC_MSG_DISPATCH_H_
@@ -0,0 +1,240 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MSG_REGISTRY_H_
+#define SIMPLE_IPC_MSG_REGISTRY_H_
+
+#include "ipc_constants.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// MsgRegistry maps message ids to handlers with a table lookup instead of a switch or a chain
+// of ifs followed by a virtual call. It is a complete DispatchT for Channel::Receive():
+//
+//   ipc::MsgRegistry<ChannelT> registry;
+//   registry.Register(&open_file_handler);     // Handlers derived from ipc::MsgIn<>.
+//   registry.Register(&close_file_handler);
+//   registry.Register(kSomeMsg, &custom);      // Anything with a compatible OnMsgIn().
+//   channel.Receive(&registry);
+//
+// Each entry holds the handler object and a thunk generated for the handler's class, so the
+// call to OnMsgIn() is direct and can be inlined into the thunk; no virtual functions are
+// needed in the handlers.
+//
+// The table is rebuilt on every Register(), which is meant to happen at startup. When the
+// registered ids are close to each other the table is dense and indexed by (id - lowest id).
+// When they are sparse the table size is the smallest modulus that sends every id to its own
+// slot, which is a perfect hash. Either way a lookup is one subtraction, at most one modulo
+// and one compare against the id stored in the slot. Only when no perfect modulus of a
+// reasonable size exists do colliding ids get placed by linear probing.
+//
+// Registering the same id twice fails with RcErrDuplicateMsgId. Messages with an id that has
+// no handler go to the handler set by SetDefault(), or Receive() returns RcErrBadMessageId.
+
+namespace ipc {
+
+template <class ChannelT>
+class MsgRegistry {
+ public:
+  MsgRegistry()
+      : base_(0), modulus_(1), max_probe_(0), default_handler_(NULL), default_thunk_(NULL),
+        transport_handler_(NULL), transport_thunk_(NULL) {
+    Rebuild();
+  }
+
+  // Registers |handler| for messages with id |msg_id|. HandlerT must have
+  //   size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count);
+  template <class HandlerT>
+  size_t Register(int msg_id, HandlerT* handler) {
+    for (size_t ix = 0; ix != entries_.size(); ++ix) {
+      if (entries_[ix].msg_id == msg_id)
+        return RcErrDuplicateMsgId;
+    }
+    Entry entry = { msg_id, handler, &Thunk<HandlerT> };
+    entries_.push_back(entry);
+    Rebuild();
+    return RcOK;
+  }
+
+  // Registers a handler derived from ipc::MsgIn<> under its own message id.
+  template <class HandlerT>
+  size_t Register(HandlerT* handler) {
+    return Register(HandlerT::MSG_ID, handler);
+  }
+
+  // Receives the messages that have no registered handler.
+  template <class HandlerT>
+  void SetDefault(HandlerT* handler) {
+    default_handler_ = handler;
+    default_thunk_ = &Thunk<HandlerT>;
+  }
+
+  // Answers the new transport requests. HandlerT must have: void* OnNewTransport();
+  template <class HandlerT>
+  void SetNewTransportHandler(HandlerT* handler) {
+    transport_handler_ = handler;
+    transport_thunk_ = &NewTransportThunk<HandlerT>;
+  }
+
+  bool IsRegistered(int msg_id) const {
+    return (NULL != Lookup(msg_id));
+  }
+
+  // Number of slots in the lookup table.
+  size_t TableSize() const { return modulus_; }
+
+  // These implement the DispatchT contract of Channel::Receive().
+  MsgRegistry* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() {
+    return transport_thunk_ ? transport_thunk_(transport_handler_) : NULL;
+  }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    const Entry* entry = Lookup(msg_id);
+    if (entry)
+      return entry->thunk(entry->handler, msg_id, ch, args, count);
+    if (default_thunk_)
+      return default_thunk_(default_handler_, msg_id, ch, args, count);
+    return RcErrBadMessageId;
+  }
+
+ private:
+  typedef size_t (*ThunkFn)(void* handler, int msg_id, ChannelT* ch,
+                            const WireType* const args[], int count);
+  typedef void* (*NewTransportFn)(void* handler);
+
+  struct Entry {
+    int msg_id;
+    void* handler;
+    ThunkFn thunk;
+  };
+
+  // Tables up to this size are allowed to have holes. Past it the registry looks for
+  // a perfect hash modulus.
+  static const size_t kMaxDenseSize = 1024;
+  static const size_t kMaxSearch = 64 * 1024;
+
+  template <class HandlerT>
+  static size_t Thunk(void* handler, int msg_id, ChannelT* ch,
+                      const WireType* const args[], int count) {
+    return static_cast<HandlerT*>(handler)->OnMsgIn(msg_id, ch, args, count);
+  }
+
+  template <class HandlerT>
+  static void* NewTransportThunk(void* handler) {
+    return static_cast<HandlerT*>(handler)->OnNewTransport();
+  }
+
+  static unsigned int Offset(int msg_id, int base) {
+    return static_cast<unsigned int>(msg_id) - static_cast<unsigned int>(base);
+  }
+
+  const Entry* Lookup(int msg_id) const {
+    size_t ix = Offset(msg_id, base_);
+    if (ix >= modulus_)
+      ix %= modulus_;
+    for (size_t probe = 0; ; ++probe) {
+      const Entry& entry = table_[ix];
+      if (entry.thunk && (entry.msg_id == msg_id))
+        return &entry;
+      if (probe == max_probe_)
+        return NULL;
+      if (++ix == modulus_)
+        ix = 0;
+    }
+  }
+
+  void Rebuild() {
+    base_ = 0;
+    modulus_ = 1;
+    if (entries_.size()) {
+      int high = entries_[0].msg_id;
+      base_ = high;
+      for (size_t ix = 1; ix != entries_.size(); ++ix) {
+        if (entries_[ix].msg_id < base_)
+          base_ = entries_[ix].msg_id;
+        if (entries_[ix].msg_id > high)
+          high = entries_[ix].msg_id;
+      }
+      const size_t span = static_cast<size_t>(Offset(high, base_)) + 1;
+      modulus_ = (span <= kMaxDenseSize) ? span : FindModulus(span);
+    }
+
+    // Collisions only happen if FindModulus() gave up; they are resolved by probing
+    // the next slots.
+    Entry empty = { 0, NULL, NULL };
+    table_.clear();
+    for (size_t ix = 0; ix != modulus_; ++ix)
+      table_.push_back(empty);
+    max_probe_ = 0;
+    for (size_t ix = 0; ix != entries_.size(); ++ix) {
+      size_t slot = Offset(entries_[ix].msg_id, base_) % modulus_;
+      size_t probe = 0;
+      while (table_[slot].thunk) {
+        if (++slot == modulus_)
+          slot = 0;
+        ++probe;
+      }
+      table_[slot] = entries_[ix];
+      if (probe > max_probe_)
+        max_probe_ = probe;
+    }
+  }
+
+  // Returns the smallest table size where no two registered ids share a slot. If there is
+  // none below kMaxSearch it returns a table with room to spare for probing.
+  size_t FindModulus(size_t span) const {
+    const size_t count = entries_.size();
+    const size_t limit = (span < kMaxSearch) ? span : kMaxSearch;
+    PodVector<char> used;
+    used.resize(limit);
+    memset(&used[0], 0, limit);
+    for (size_t m = count; m < limit; ++m) {
+      size_t ix = 0;
+      for (; ix != count; ++ix) {
+        char& slot = used[Offset(entries_[ix].msg_id, base_) % m];
+        if (slot)
+          break;
+        slot = 1;
+      }
+      if (ix == count)
+        return m;
+      // Undo the marks so |used| is all zeros again.
+      for (size_t jx = 0; jx != ix; ++jx)
+        used[Offset(entries_[jx].msg_id, base_) % m] = 0;
+    }
+    return (span < 2 * count) ? span : 2 * count;
+  }
+
+  PodVector<Entry> entries_;
+  PodVector<Entry> table_;
+  int base_;
+  size_t modulus_;
+  size_t max_probe_;
+  void* default_handler_;
+  ThunkFn default_thunk_;
+  void* transport_handler_;
+  NewTransportFn transport_thunk_;
+
+  MsgRegistry(const MsgRegistry&);
+  MsgRegistry& operator=(const MsgRegistry&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_MSG_REGISTRY_H_
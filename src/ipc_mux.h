@@ -0,0 +1,401 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MUX_H_
+#define SIMPLE_IPC_MUX_H_
+
+#include "ipc_channel.h"
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// MuxTransport carries many logical streams over one transport, so a new conversation costs
+// neither a new transport nor a new thread the way InitNewTransport() does. Each stream is a
+// transport of its own and gets its own ipc::Channel, with its own dispatcher and its own
+// LastRecvMsgId():
+//
+//   ipc::MuxTransport<PipeTransport> mux(&pipe);
+//   typedef ipc::Channel<ipc::MuxTransport<PipeTransport>::Stream, ipc::Encoder, ipc::Decoder>
+//       StreamChannel;
+//   StreamChannel channel(mux.OpenStream(7));
+//   channel.Send(...);
+//
+// Opening a stream sends nothing; the other end learns about it from its first message. The
+// stream id is picked by the side that opens it and if both sides open streams they should
+// pick from different ranges. Ids should not be reused since a close from the other end can
+// still be on its way.
+//
+// Closing a stream sends a close frame, which the other end answers with its own close when it
+// closes the stream too, or right away if it never saw the stream. Until the answer arrives the
+// id is remembered and late frames for it are dropped instead of opening it again. The other
+// end can have at most |max_streams| streams open at a time; a frame that would open one more
+// is dropped and the stream closed.
+//
+// Every message goes in one frame: a FrameHeader with a mark, the stream id, the flags and the
+// size of the message, followed by the message. Sending is thread safe.
+//
+// Receiving works two ways, and a stream should only be used one way at a time:
+// - Stream::Receive(), usually from Channel::Receive(), blocks until a message for that stream
+//   arrives. Whichever thread is waiting reads the transport and queues what belongs to other
+//   streams, so several threads can each wait on their own stream.
+// - WaitAny() blocks until some stream has a message and returns it; streams opened by the
+//   other end show up here first. Together with DispatchOne() one thread serves all the
+//   streams:
+//
+//     while (Stream* stream = mux.WaitAny()) {
+//       Session* session = FindOrCreateSession(stream);
+//       if (ipc::DispatchOne(&session->channel, &session->dispatch) != ipc::OnMsgLoopNext) {
+//         mux.CloseStream(stream);
+//         DeleteSession(session);
+//       }
+//     }
+//
+// When the other end closes a stream, WaitAny() returns it once more with nothing queued and
+// Stream::Receive() then fails with RcErrTransportRead. Streams are looked up by a linear scan,
+// which is fine for hundreds of streams.
+
+namespace ipc {
+
+template <class TransportT>
+class MuxTransport {
+ private:
+  // A message received in full.
+  struct Message {
+    Message* next;
+    PodVector<char> data;
+  };
+
+ public:
+  // One logical stream. Implements the transport contract of ipc::Channel.
+  class Stream {
+   public:
+    Stream()
+        : mux_(NULL), id_(0), head_(NULL), tail_(NULL), current_(NULL), receiving_(false),
+          peer_closed_(false), close_reported_(false) {}
+
+    ~Stream() {
+      DeleteMessage(current_);
+      while (head_)
+        DeleteMessage(PopMessage());
+    }
+
+    int Id() const { return id_; }
+
+    size_t Send(const void* buf, size_t sz) {
+      return mux_->SendFrame(id_, 0, buf, sz);
+    }
+
+    char* Receive(size_t* size) {
+      return mux_->ReceiveFor(this, size);
+    }
+
+   private:
+    friend class MuxTransport;
+
+    void PushMessage(Message* msg) {
+      if (tail_)
+        tail_->next = msg;
+      else
+        head_ = msg;
+      tail_ = msg;
+    }
+
+    Message* PopMessage() {
+      Message* msg = head_;
+      head_ = msg->next;
+      if (!head_)
+        tail_ = NULL;
+      return msg;
+    }
+
+    MuxTransport* mux_;
+    int id_;
+    Message* head_;
+    Message* tail_;
+    Message* current_;
+    bool receiving_;
+    bool peer_closed_;
+    bool close_reported_;
+
+    Stream(const Stream&);
+    Stream& operator=(const Stream&);
+  };
+
+  explicit MuxTransport(TransportT* transport, size_t max_streams = 1024)
+      : transport_(transport), max_streams_(max_streams), reading_(false), rx_error_(false),
+        next_ready_(0) {}
+
+  ~MuxTransport() {
+    for (size_t ix = 0; ix != streams_.size(); ++ix)
+      memdet::delete_impl(streams_[ix]);
+  }
+
+  // Opens stream |id| on this end. Returns NULL if it is already open or if |max_streams|
+  // streams are open.
+  Stream* OpenStream(int id) {
+    AutoLock lock(&lock_);
+    if (FindStream(id) || (streams_.size() >= max_streams_))
+      return NULL;
+    return NewStream(id);
+  }
+
+  // Tells the other end that |stream| is closed and deletes it. Its queued messages are
+  // dropped. No thread can be inside its Receive().
+  size_t CloseStream(Stream* stream) {
+    const int id = stream->id_;
+    {
+      AutoLock lock(&lock_);
+      if (!stream->peer_closed_)
+        closed_.push_back(id);
+      for (size_t ix = 0; ix != streams_.size(); ++ix) {
+        if (streams_[ix] == stream) {
+          streams_[ix] = streams_[streams_.size() - 1];
+          streams_.pop_back();
+          break;
+        }
+      }
+    }
+    memdet::delete_impl(stream);
+    return SendFrame(id, kFrameClose, NULL, 0);
+  }
+
+  // Blocks until a stream that no thread is receiving on has a message queued, or has just
+  // been closed by the other end, and returns it. Returns NULL if the transport fails.
+  Stream* WaitAny() {
+    lock_.Lock();
+    for (;;) {
+      Stream* stream = FindReady();
+      if (stream || rx_error_) {
+        lock_.Unlock();
+        return stream;
+      }
+      ReadOrWait();
+    }
+  }
+
+ private:
+  struct FrameHeader {
+    unsigned int mark;
+    unsigned int stream;
+    unsigned int flags;
+    unsigned int size;
+  };
+
+  enum {
+    kFrameMark = 0x5855424d,
+    kFrameClose = 1
+  };
+
+  // Must be called with |lock_| held.
+  Stream* FindStream(int id) {
+    for (size_t ix = 0; ix != streams_.size(); ++ix) {
+      if (streams_[ix]->id_ == id)
+        return streams_[ix];
+    }
+    return NULL;
+  }
+
+  // Must be called with |lock_| held. Forgets |id| if it was closed on this end and returns
+  // true if it was.
+  bool TakeClosed(int id) {
+    for (size_t ix = 0; ix != closed_.size(); ++ix) {
+      if (closed_[ix] == id) {
+        closed_[ix] = closed_[closed_.size() - 1];
+        closed_.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Must be called with |lock_| held.
+  bool IsClosed(int id) {
+    for (size_t ix = 0; ix != closed_.size(); ++ix) {
+      if (closed_[ix] == id)
+        return true;
+    }
+    return false;
+  }
+
+  // Must be called with |lock_| held.
+  Stream* NewStream(int id) {
+    Stream* stream = memdet::new_impl<Stream>(1);
+    stream->mux_ = this;
+    stream->id_ = id;
+    streams_.push_back(stream);
+    return stream;
+  }
+
+  // Must be called with |lock_| held. Takes turns between the streams so a busy one does
+  // not starve the others.
+  Stream* FindReady() {
+    const size_t count = streams_.size();
+    for (size_t n = 0; n != count; ++n) {
+      const size_t ix = (next_ready_ + n) % count;
+      Stream* stream = streams_[ix];
+      if (stream->receiving_)
+        continue;
+      if (stream->head_ || (stream->peer_closed_ && !stream->close_reported_)) {
+        if (!stream->head_)
+          stream->close_reported_ = true;
+        next_ready_ = ix + 1;
+        return stream;
+      }
+    }
+    return NULL;
+  }
+
+  size_t SendFrame(int id, unsigned int flags, const void* buf, size_t sz) {
+    FrameHeader hdr;
+    hdr.mark = kFrameMark;
+    hdr.stream = static_cast<unsigned int>(id);
+    hdr.flags = flags;
+    hdr.size = static_cast<unsigned int>(sz);
+    AutoLock lock(&send_lock_);
+    frame_.Set(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    frame_.Add(static_cast<const char*>(buf), sz);
+    return transport_->Send(frame_.get(), frame_.size());
+  }
+
+  char* ReceiveFor(Stream* stream, size_t* size) {
+    lock_.Lock();
+    DeleteMessage(stream->current_);
+    stream->current_ = NULL;
+    stream->receiving_ = true;
+    for (;;) {
+      if (stream->head_) {
+        stream->current_ = stream->PopMessage();
+        break;
+      }
+      if (stream->peer_closed_ || rx_error_)
+        break;
+      ReadOrWait();
+    }
+    stream->receiving_ = false;
+    lock_.Unlock();
+    if (!stream->current_)
+      return NULL;
+    *size = stream->current_->data.size();
+    return stream->current_->data.get();
+  }
+
+  // Called with |lock_| held and returns with it held. If no other thread is reading, reads
+  // once from the transport and queues the frames; otherwise waits for that thread to do it.
+  // Either way the callers look at their streams again afterwards.
+  void ReadOrWait() {
+    if (reading_) {
+      Semaphore wake;
+      waiters_.push_back(&wake);
+      lock_.Unlock();
+      wake.Wait();
+      lock_.Lock();
+      return;
+    }
+    reading_ = true;
+    lock_.Unlock();
+    size_t received = 0;
+    const char* buf = transport_->Receive(&received);
+    lock_.Lock();
+    reading_ = false;
+    if (!buf) {
+      rx_error_ = true;
+    } else {
+      in_.Add(buf, received);
+      if (!ParseFrames())
+        rx_error_ = true;
+    }
+    for (size_t ix = 0; ix != waiters_.size(); ++ix)
+      waiters_[ix]->Post();
+    waiters_.resize(0);
+    if (owed_.size()) {
+      // Sending can block, so it is done without |lock_|.
+      PodVector<int> owed;
+      owed.Swap(owed_);
+      lock_.Unlock();
+      for (size_t ix = 0; ix != owed.size(); ++ix)
+        SendFrame(owed[ix], kFrameClose, NULL, 0);
+      lock_.Lock();
+    }
+  }
+
+  // Must be called with |lock_| held. Queues every complete frame in |in_| on its stream,
+  // opening the streams that are new unless they were closed here or there are too many.
+  // Returns false if the data does not look like frames.
+  bool ParseFrames() {
+    size_t pos = 0;
+    while ((in_.size() - pos) >= sizeof(FrameHeader)) {
+      FrameHeader hdr;
+      memcpy(&hdr, &in_[pos], sizeof(hdr));
+      if (hdr.mark != kFrameMark)
+        return false;
+      if ((in_.size() - pos - sizeof(hdr)) < hdr.size)
+        break;
+      const int id = static_cast<int>(hdr.stream);
+      Stream* stream = FindStream(id);
+      if (hdr.flags & kFrameClose) {
+        if (stream)
+          stream->peer_closed_ = true;
+        else if (!TakeClosed(id))
+          owed_.push_back(id);
+      } else if (hdr.size && (stream || !IsClosed(id))) {
+        if (!stream && (streams_.size() >= max_streams_)) {
+          closed_.push_back(id);
+          owed_.push_back(id);
+          pos += sizeof(hdr) + hdr.size;
+          continue;
+        }
+        if (!stream)
+          stream = NewStream(id);
+        Message* msg = memdet::new_impl<Message>(1);
+        msg->next = NULL;
+        msg->data.Set(&in_[pos + sizeof(hdr)], hdr.size);
+        stream->PushMessage(msg);
+      }
+      pos += sizeof(hdr) + hdr.size;
+    }
+    in_.RemoveFront(pos);
+    return true;
+  }
+
+  static void DeleteMessage(Message* msg) {
+    if (msg)
+      memdet::delete_impl(msg);
+  }
+
+  TransportT* transport_;
+  const size_t max_streams_;
+
+  Mutex send_lock_;
+  PodVector<char> frame_;
+
+  // The receiving side and the stream list.
+  Mutex lock_;
+  PodVector<Stream*> streams_;
+  PodVector<int> closed_;   // Closed here, waiting for the close from the other end.
+  PodVector<int> owed_;     // Streams that the other end should be told are closed.
+  PodVector<Semaphore*> waiters_;
+  PodVector<char> in_;
+  bool reading_;
+  bool rx_error_;
+  size_t next_ready_;
+
+  MuxTransport(const MuxTransport&);
+  MuxTransport& operator=(const MuxTransport&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_MUX_H_
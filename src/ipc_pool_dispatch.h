@@ -0,0 +1,299 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_POOL_DISPATCH_H_
+#define SIMPLE_IPC_POOL_DISPATCH_H_
+
+#include "ipc_channel.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// PoolDispatch runs the message handlers of a channel on a pool of worker threads. The thread
+// that calls Channel::Receive() only reads and decodes; each decoded message is copied into a
+// task and handed to the pool.
+//
+// Messages are ordered by key: the KeyT policy maps every message to a key and messages with
+// the same key run one at a time in arrival order, while messages with different keys can run
+// in parallel. The default policy keys on the message id. A key equal to kRunInline makes the
+// message run directly on the receiving thread, which is the way to have a message that stops
+// the Receive() loop.
+//
+// Internally keys are hashed into 64 strands. A strand holds the tasks of its keys and is
+// scheduled on at most one worker at a time, so different keys that land on the same strand
+// are also run one at a time and at most 64 keys make progress in parallel, whatever the
+// number of threads. Each worker has its own deque of
+// runnable strands; it takes from the back of its own deque and steals from the front of the
+// others when it runs dry.
+//
+// Handlers can reply with Channel::Send() as usual: the reply is tagged with the call id of the
+// message being handled. The channel is switched to the SEND_COMBINED mode unless it already
+// uses a thread-safe send mode.
+//
+// Typical use on the server:
+//
+//   ipc::PoolDispatch<ChannelT, AppDispatch> pool(&channel, &app_dispatch, 4);
+//   size_t rc = channel.Receive(&pool);
+//   pool.Stop();
+//
+// A handler that returns something other than OnMsgLoopNext or OnMsgReady is counted as an
+// error and its return value stops the Receive() loop when the next message arrives.
+
+namespace ipc {
+
+const size_t kRunInline = static_cast<size_t>(-1);
+
+// Orders all the messages with the same id.
+struct OrderByMsgId {
+  static size_t Key(int msg_id, const WireType* const[], int) {
+    return static_cast<size_t>(msg_id);
+  }
+};
+
+// Orders all the messages whose first argument is the same number, for example a session
+// or an object id.
+struct OrderByFirstArg {
+  static size_t Key(int, const WireType* const args[], int count) {
+    if (!count)
+      return 0;
+    size_t key = reinterpret_cast<size_t>(args[0]->GetAsBits());
+    return (key == kRunInline) ? 0 : key;
+  }
+};
+
+template <class ChannelT, class DispatchT, class KeyT = OrderByMsgId>
+class PoolDispatch {
+ public:
+  PoolDispatch(ChannelT* channel, DispatchT* dispatch, int n_threads)
+      : channel_(channel), dispatch_(dispatch), n_workers_(n_threads > 0 ? n_threads : 1),
+        next_worker_(0), pending_(0), stop_(0), error_count_(0), first_error_(0) {
+    if (channel_->GetSendMode() == ChannelT::SEND_DIRECT)
+      channel_->SetSendMode(ChannelT::SEND_COMBINED);
+    workers_ = memdet::new_impl<Worker>(n_workers_);
+    for (int ix = 0; ix != n_workers_; ++ix) {
+      workers_[ix].pool = this;
+      workers_[ix].index = ix;
+      workers_[ix].thread.Start(WorkerMain, &workers_[ix]);
+    }
+  }
+
+  ~PoolDispatch() {
+    Stop();
+    memdet::delete_impl(workers_);
+  }
+
+  // Blocks until every message handed to the pool so far has been handled.
+  void WaitIdle() {
+    while (AtomicLoad(&pending_))
+      idle_.Wait();
+  }
+
+  // Runs the remaining messages and then stops the workers. Must not be called while
+  // another thread is inside Channel::Receive() with this object.
+  void Stop() {
+    if (AtomicLoad(&stop_))
+      return;
+    WaitIdle();
+    AtomicIncrement(&stop_);
+    for (int ix = 0; ix != n_workers_; ++ix)
+      runnable_.Post();
+    for (int ix = 0; ix != n_workers_; ++ix)
+      workers_[ix].thread.Join();
+  }
+
+  long ErrorCount() { return AtomicLoad(&error_count_); }
+
+  // These implement the DispatchT contract of Channel::Receive(). OnMsgIn() is called
+  // on the receiving thread.
+  PoolDispatch* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() {
+    return dispatch_->OnNewTransport();
+  }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    const size_t key = KeyT::Key(msg_id, args, count);
+    if (key == kRunInline)
+      return dispatch_->MsgHandler(msg_id)->OnMsgIn(msg_id, ch, args, count);
+
+    Task* task = memdet::new_impl<Task>(1);
+    task->next = NULL;
+    task->msg_id = msg_id;
+    task->call_id = ch->LastRecvCallId();
+    for (int ix = 0; ix != count; ++ix)
+      task->args.push_back(*args[ix]);
+
+    AtomicIncrement(&pending_);
+    Strand* strand = &strands_[key % kNumStrands];
+    bool schedule;
+    {
+      AutoLock lock(&strand->mutex);
+      if (strand->tail)
+        strand->tail->next = task;
+      else
+        strand->head = task;
+      strand->tail = task;
+      schedule = !strand->scheduled;
+      strand->scheduled = true;
+    }
+    if (schedule) {
+      Schedule(strand, next_worker_);
+      next_worker_ = (next_worker_ + 1) % n_workers_;
+    }
+
+    size_t error = static_cast<size_t>(AtomicLoad(&first_error_));
+    return error ? error : OnMsgLoopNext;
+  }
+
+ private:
+  static const int kNumStrands = 64;
+
+  struct Task {
+    Task* next;
+    int msg_id;
+    int call_id;
+    FixedArray<WireType, ChannelT::kMaxNumArgs> args;
+  };
+
+  struct Strand {
+    Strand() : head(NULL), tail(NULL), scheduled(false) {}
+    Mutex mutex;
+    Task* head;
+    Task* tail;
+    bool scheduled;
+  };
+
+  struct Worker {
+    PoolDispatch* pool;
+    int index;
+    Mutex mutex;
+    PodVector<Strand*> runnable;
+    Thread thread;
+  };
+
+  static void WorkerMain(void* ctx) {
+    Worker* worker = reinterpret_cast<Worker*>(ctx);
+    worker->pool->WorkerLoop(worker->index);
+  }
+
+  void WorkerLoop(int self) {
+    for (;;) {
+      runnable_.Wait();
+      if (AtomicLoad(&stop_))
+        return;
+      // Every Post() matches one strand in some deque, but a strand pushed to a deque
+      // that was already looked at can be missed. Looking again with the pushes held off
+      // always finds it, because the other workers only take as many as they were posted.
+      Strand* strand = Take(self);
+      if (!strand) {
+        AutoLock lock(&schedule_mutex_);
+        strand = Take(self);
+      }
+      Run(strand, self);
+    }
+  }
+
+  void Schedule(Strand* strand, int worker) {
+    {
+      AutoLock schedule_lock(&schedule_mutex_);
+      AutoLock lock(&workers_[worker].mutex);
+      workers_[worker].runnable.push_back(strand);
+    }
+    runnable_.Post();
+  }
+
+  Strand* Take(int self) {
+    for (int ix = 0; ix != n_workers_; ++ix) {
+      Worker& worker = workers_[(self + ix) % n_workers_];
+      AutoLock lock(&worker.mutex);
+      const size_t size = worker.runnable.size();
+      if (!size)
+        continue;
+      Strand* strand;
+      if (ix == 0) {
+        strand = worker.runnable[size - 1];
+        worker.runnable.resize(size - 1);
+      } else {
+        strand = worker.runnable[0];
+        worker.runnable.RemoveFront(1);
+      }
+      return strand;
+    }
+    return NULL;
+  }
+
+  // Runs one task of |strand| and puts the strand back if it has more, so a busy key
+  // does not hold a worker forever.
+  void Run(Strand* strand, int self) {
+    Task* task;
+    {
+      AutoLock lock(&strand->mutex);
+      task = strand->head;
+      strand->head = task->next;
+      if (!strand->head)
+        strand->tail = NULL;
+    }
+
+    const WireType* args[ChannelT::kMaxNumArgs];
+    const int count = static_cast<int>(task->args.size());
+    for (int ix = 0; ix != count; ++ix)
+      args[ix] = &task->args[ix];
+
+    size_t rc;
+    {
+      DispatchScope scope(channel_, task->call_id);
+      rc = dispatch_->MsgHandler(task->msg_id)->OnMsgIn(task->msg_id, channel_, args, count);
+    }
+    if ((rc != OnMsgLoopNext) && (rc != OnMsgReady)) {
+      AtomicIncrement(&error_count_);
+      AtomicCompareExchange(&first_error_, static_cast<long>(rc), 0);
+    }
+    memdet::delete_impl(task);
+
+    bool more;
+    {
+      AutoLock lock(&strand->mutex);
+      more = (NULL != strand->head);
+      strand->scheduled = more;
+    }
+    if (more)
+      Schedule(strand, self);
+
+    if (!AtomicDecrement(&pending_))
+      idle_.Post();
+  }
+
+  ChannelT* channel_;
+  DispatchT* dispatch_;
+  const int n_workers_;
+  Worker* workers_;
+  Strand strands_[kNumStrands];
+  int next_worker_;
+  Mutex schedule_mutex_;
+  Semaphore runnable_;
+  Semaphore idle_;
+  volatile long pending_;
+  volatile long stop_;
+  volatile long error_count_;
+  volatile long first_error_;
+
+  PoolDispatch(const PoolDispatch&);
+  PoolDispatch& operator=(const PoolDispatch&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_POOL_DISPATCH_H_
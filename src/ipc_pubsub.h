@@ -0,0 +1,352 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_PUBSUB_H_
+#define SIMPLE_IPC_PUBSUB_H_
+
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+// The waiting is done by polling with sched_yield() and usleep(), so for now this file is
+// only for posix.
+#if !defined(WIN32)
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#define IPC_HAS_PUBSUB 1
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Publish/subscribe over a log in shared memory. The publisher encodes each message once and
+// appends it to the log; every subscriber, usually in another process, reads the log at its
+// own cursor. Broadcasting to N subscribers costs one encode and one copy instead of N encodes
+// and N writes.
+//
+// Both ends are transports for ipc::Channel, so messages are sent with Channel::Send() or
+// MsgOut and received with Channel::Receive() and the usual MsgIn dispatch:
+//
+//   SharedMemory shm;                               // See shared_mem_unix.h.
+//   shm.Create("/my-events", 1024 * 1024);
+//   ipc::PubSubPublisher publisher;
+//   publisher.Init(shm.memory(), shm.size(), ipc::SLOW_BACKPRESSURE);
+//   ipc::Channel<ipc::PubSubPublisher, ipc::Encoder, ipc::Decoder> out(&publisher);
+//
+//   // In each subscriber process:
+//   shm.Open("/my-events");
+//   ipc::PubSubSubscriber subscriber;
+//   subscriber.Attach(shm.memory(), shm.size());
+//   ipc::Channel<ipc::PubSubSubscriber, ipc::Encoder, ipc::Decoder> in(&subscriber);
+//   in.Receive(&dispatch);
+//
+// A subscriber sees the messages published after it attached. There is one publisher and its
+// Send() is not thread safe; use one of the thread-safe send modes of the channel to publish
+// from several threads. Subscribers only read, so a subscriber's Channel::Send() fails.
+//
+// The log is a ring so the publisher eventually comes back to where a slow subscriber is still
+// reading. What happens then is the SlowSubscriberPolicy given to Init(). A subscriber that
+// goes away without Detach() keeps its cursor, which stalls a SLOW_BACKPRESSURE publisher.
+//
+// Receive() blocks by polling, yielding at first and then sleeping a little, and returns
+// NULL once the publisher has called Close() and everything before it has been read. The
+// message is copied out of the log, so the buffer stays good until the next Receive() even if
+// the publisher overwrites that part of the log.
+
+namespace ipc {
+
+#if defined(IPC_HAS_PUBSUB)
+
+// What happens when the publisher is about to overwrite a message that some subscriber has
+// not read yet.
+enum SlowSubscriberPolicy {
+  SLOW_BACKPRESSURE,  // The publisher waits for the slowest subscriber.
+  SLOW_DETECT,        // The publisher goes on; the subscriber fails and Lagged() says why.
+  SLOW_SKIP           // The publisher goes on; the subscriber jumps to the newest message.
+};
+
+// The parts shared by both ends. Positions count the bytes published since Init() and
+// the offset in the log is the position modulo the capacity. They are unsigned so they can
+// wrap around, and the capacity is a power of two so the offsets stay in step when they do.
+class PubSubLog {
+ public:
+  static const int kMaxSubscribers = 32;
+
+ protected:
+  // At the start of the shared memory, followed by the log.
+  struct Header {
+    volatile long mark;
+    volatile long policy;
+    volatile long capacity;
+    volatile long reserve_pos;           // The publisher may be writing up to here.
+    volatile long write_pos;             // Everything up to here is published.
+    volatile long last_pos;              // Where the newest message starts.
+    volatile long closed;
+    volatile long cursors[kMaxSubscribers];  // kFreeSlot or the subscriber's position.
+  };
+
+  // Every message in the log starts with one, and so does the unused end of the ring before
+  // it goes back to the start.
+  struct Record {
+    unsigned int size;
+    unsigned int flags;
+  };
+
+  enum {
+    kMark = 0x42555350,
+    kRecordWrap = 1,
+    kAlign = 8
+  };
+
+  static const long kFreeSlot = -1;
+
+  PubSubLog() : hdr_(NULL), log_(NULL), capacity_(0) {}
+
+  static unsigned long Load(volatile long* src) {
+    return static_cast<unsigned long>(AtomicLoad(src));
+  }
+
+  static void Store(volatile long* dest, unsigned long value) {
+    AtomicExchange(dest, static_cast<long>(value));
+  }
+
+  static size_t RecordSize(size_t sz) {
+    return (sizeof(Record) + sz + kAlign - 1) & ~static_cast<size_t>(kAlign - 1);
+  }
+
+  static void Backoff(int spins) {
+    if (spins < 64)
+      sched_yield();
+    else
+      usleep(100);
+  }
+
+  Header* hdr_;
+  char* log_;
+  unsigned long capacity_;
+};
+
+class PubSubPublisher : public PubSubLog {
+ public:
+  PubSubPublisher() : pos_(0) {}
+
+  // Lays out an empty log in |mem|. Must be done before any subscriber attaches. The log
+  // gets the largest power of two that fits after the header.
+  bool Init(void* mem, size_t size, SlowSubscriberPolicy policy) {
+    if (size < sizeof(Header) + 16 * kAlign)
+      return false;
+    hdr_ = static_cast<Header*>(mem);
+    log_ = static_cast<char*>(mem) + sizeof(Header);
+    capacity_ = 16 * kAlign;
+    while (capacity_ * 2 <= size - sizeof(Header))
+      capacity_ *= 2;
+    pos_ = 0;
+    hdr_->policy = policy;
+    hdr_->capacity = static_cast<long>(capacity_);
+    hdr_->reserve_pos = 0;
+    hdr_->write_pos = 0;
+    hdr_->last_pos = 0;
+    hdr_->closed = 0;
+    for (int ix = 0; ix != kMaxSubscribers; ++ix)
+      hdr_->cursors[ix] = kFreeSlot;
+    // Subscribers look at the mark first.
+    Store(&hdr_->mark, kMark);
+    return true;
+  }
+
+  // Appends one encoded message to the log. A message can take at most half the log.
+  size_t Send(const void* buf, size_t sz) {
+    const size_t need = RecordSize(sz);
+    if (!hdr_ || (need > capacity_ / 2))
+      return RcErrTransportWrite;
+    const unsigned long offset = pos_ % capacity_;
+    const unsigned long waste = (capacity_ - offset < need) ? capacity_ - offset : 0;
+    const unsigned long end = pos_ + waste + need;
+    if (hdr_->policy == SLOW_BACKPRESSURE)
+      WaitForSubscribers(end);
+
+    Store(&hdr_->reserve_pos, end);
+    if (waste) {
+      Record wrap = { 0, kRecordWrap };
+      memcpy(log_ + offset, &wrap, sizeof(wrap));
+    }
+    Record rec = { static_cast<unsigned int>(sz), 0 };
+    char* dest = log_ + (pos_ + waste) % capacity_;
+    memcpy(dest, &rec, sizeof(rec));
+    memcpy(dest + sizeof(rec), buf, sz);
+    Store(&hdr_->last_pos, pos_ + waste);
+    Store(&hdr_->write_pos, end);
+    pos_ = end;
+    return RcOK;
+  }
+
+  // The publisher never receives.
+  char* Receive(size_t*) {
+    return NULL;
+  }
+
+  // Tells the subscribers that nothing else is coming.
+  void Close() {
+    if (hdr_)
+      Store(&hdr_->closed, 1);
+  }
+
+  int SubscriberCount() const {
+    int count = 0;
+    for (int ix = 0; ix != kMaxSubscribers; ++ix) {
+      if (AtomicLoad(&hdr_->cursors[ix]) != kFreeSlot)
+        ++count;
+    }
+    return count;
+  }
+
+ private:
+  // Waits until writing up to |end| overwrites nothing that a subscriber still has to read.
+  void WaitForSubscribers(unsigned long end) {
+    for (int ix = 0; ix != kMaxSubscribers; ++ix) {
+      for (int spins = 0; ; ++spins) {
+        const long cursor = AtomicLoad(&hdr_->cursors[ix]);
+        if ((cursor == kFreeSlot) || (end - static_cast<unsigned long>(cursor) <= capacity_))
+          break;
+        Backoff(spins);
+      }
+    }
+  }
+
+  unsigned long pos_;
+};
+
+class PubSubSubscriber : public PubSubLog {
+ public:
+  PubSubSubscriber() : slot_(-1), pos_(0), policy_(SLOW_DETECT), lagged_(false), skips_(0) {}
+
+  ~PubSubSubscriber() {
+    Detach();
+  }
+
+  // Starts reading the log that a publisher laid out in |mem|, from the next message
+  // published. Fails if there is no log there yet or every subscriber slot is taken.
+  bool Attach(void* mem, size_t size) {
+    Detach();
+    Header* hdr = static_cast<Header*>(mem);
+    if ((size < sizeof(Header)) || (AtomicLoad(&hdr->mark) != kMark))
+      return false;
+    const unsigned long capacity = Load(&hdr->capacity);
+    if (size < sizeof(Header) + capacity)
+      return false;
+    // The slot first holds a position at or before the one we start at, so a publisher
+    // that is waiting for subscribers never passes it.
+    for (int ix = 0; ix != kMaxSubscribers; ++ix) {
+      const long pos = AtomicLoad(&hdr->write_pos);
+      if (AtomicCompareExchange(&hdr->cursors[ix], pos, kFreeSlot) == kFreeSlot) {
+        slot_ = ix;
+        break;
+      }
+    }
+    if (slot_ == -1)
+      return false;
+    hdr_ = hdr;
+    log_ = static_cast<char*>(mem) + sizeof(Header);
+    capacity_ = capacity;
+    policy_ = static_cast<SlowSubscriberPolicy>(AtomicLoad(&hdr->policy));
+    pos_ = Load(&hdr->write_pos);
+    Store(&hdr->cursors[slot_], pos_);
+    lagged_ = false;
+    return true;
+  }
+
+  // Gives back the subscriber slot.
+  void Detach() {
+    if (slot_ == -1)
+      return;
+    AtomicExchange(&hdr_->cursors[slot_], kFreeSlot);
+    slot_ = -1;
+    hdr_ = NULL;
+  }
+
+  // Subscribers only read.
+  size_t Send(const void*, size_t) {
+    return RcErrTransportWrite;
+  }
+
+  // Blocks until the next message is published and returns a copy of it. Returns NULL
+  // when the publisher has closed the log and it was all read, or when this subscriber
+  // lagged a whole log behind with SLOW_DETECT.
+  char* Receive(size_t* size) {
+    if (slot_ == -1 || lagged_)
+      return NULL;
+    for (int spins = 0; ; ++spins) {
+      const unsigned long write_pos = Load(&hdr_->write_pos);
+      if (write_pos == pos_) {
+        if (AtomicLoad(&hdr_->closed))
+          return NULL;
+        Backoff(spins);
+        continue;
+      }
+      spins = 0;
+
+      Record rec;
+      const unsigned long offset = pos_ % capacity_;
+      memcpy(&rec, log_ + offset, sizeof(rec));
+      unsigned long next;
+      if (rec.flags & kRecordWrap) {
+        next = pos_ + (capacity_ - offset);
+      } else if (RecordSize(rec.size) <= capacity_ - offset) {
+        msg_.Set(log_ + offset + sizeof(rec), rec.size);
+        next = pos_ + RecordSize(rec.size);
+      } else {
+        next = 0;
+      }
+      // What was just read is only good if the publisher has not started to write over it,
+      // so the copy must be done before |reserve_pos| is read.
+      AtomicFence();
+      if (!next || (Load(&hdr_->reserve_pos) - pos_ > capacity_)) {
+        if (policy_ != SLOW_SKIP) {
+          lagged_ = true;
+          return NULL;
+        }
+        ++skips_;
+        pos_ = Load(&hdr_->last_pos);
+        Store(&hdr_->cursors[slot_], pos_);
+        continue;
+      }
+      pos_ = next;
+      Store(&hdr_->cursors[slot_], pos_);
+      if (!(rec.flags & kRecordWrap)) {
+        *size = msg_.size();
+        return msg_.get();
+      }
+    }
+  }
+
+  // True once this subscriber fell a whole log behind with SLOW_DETECT. It has to attach
+  // again to go on.
+  bool Lagged() const { return lagged_; }
+
+  // Number of times this subscriber jumped ahead with SLOW_SKIP, losing what it had not read.
+  long Skips() const { return skips_; }
+
+ private:
+  int slot_;
+  unsigned long pos_;
+  SlowSubscriberPolicy policy_;
+  bool lagged_;
+  long skips_;
+  PodVector<char> msg_;
+};
+
+#endif  // defined(IPC_HAS_PUBSUB)
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_PUBSUB_H_
@@ -0,0 +1,291 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_RESPONSE_CACHE_H_
+#define SIMPLE_IPC_RESPONSE_CACHE_H_
+
+#include "ipc_channel.h"
+#include "ipc_codec.h"
+#include "ipc_constants.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+#if !defined(WIN32)
+#include <string.h>
+#include <time.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// ResponseCache answers repeated queries on the client side of a channel without a round
+// trip. It is opt-in per request message id: SetPolicy() says for how long the replies to a
+// request stay good and how many different requests are kept. A request is the same as
+// another if it has the same id and encodes to the same bytes.
+//
+//   ipc::ResponseCache<ChannelT> cache(&channel);
+//   cache.SetPolicy(kQueryOption, 5000, 64);
+//   const ipc::WireView args[] = { ipc::WireView(option) };
+//   size_t rc = cache.Call(kQueryOption, args, 1, &reply);
+//
+// Call() either sends the request and runs Channel::Receive() with |reply|, or calls the
+// handler in |reply| with a copy of the reply it got the last time. Only the message whose
+// handler returned OnMsgReady is kept, since that is the one that ended the call. Requests
+// with no policy are always sent.
+//
+// The server can drop cached replies with SendInvalidate(), which sends a kMessagePrivControl
+// message. The client sees it the next time its channel receives, so a client that only gets
+// hits keeps using them until they expire. The cache takes over the control observer of the
+// channel. Like the channel, it is not thread safe.
+
+namespace ipc {
+
+template <class ChannelT, class EncoderT = Encoder>
+class ResponseCache : public ControlObserver {
+ public:
+  explicit ResponseCache(ChannelT* channel)
+      : channel_(channel), key_channel_(&key_transport_), hits_(0), misses_(0) {
+    channel_->SetControlObserver(this);
+  }
+
+  virtual ~ResponseCache() {
+    channel_->SetControlObserver(NULL);
+    Invalidate(0);
+  }
+
+  // Keeps the replies to requests |msg_id| for |ttl_ms| milliseconds, for at most
+  // |max_entries| different requests. When full, the one used the longest time ago goes.
+  void SetPolicy(int msg_id, unsigned int ttl_ms, size_t max_entries) {
+    Policy* policy = FindPolicy(msg_id);
+    if (!policy) {
+      Policy np = { msg_id, 0, 0, 0, NULL };
+      policies_.push_back(np);
+      policy = &policies_[policies_.size() - 1];
+    }
+    policy->ttl_ms = ttl_ms;
+    policy->max_entries = max_entries ? max_entries : 1;
+    while (policy->count > policy->max_entries)
+      DeleteEntry(policy, RemoveLast(policy));
+  }
+
+  // Sends request |msg_id| and receives the reply with |reply|, or hands |reply| the
+  // cached reply. Returns what Channel::Receive() or the handler returned.
+  template <class DispatchT>
+  size_t Call(int msg_id, const WireView args[], int n_args, DispatchT* reply) {
+    Policy* policy = FindPolicy(msg_id);
+    if (!policy) {
+      size_t rc = channel_->Send(msg_id, args, n_args);
+      return (rc == RcOK) ? channel_->Receive(reply) : rc;
+    }
+
+    size_t rc = key_channel_.Send(msg_id, args, n_args, 0);
+    if (rc != RcOK)
+      return rc;
+    const long long now = NowMs();
+    Entry* entry = Lookup(policy, now);
+    if (entry) {
+      ++hits_;
+      const WireType* reply_args[ChannelT::kMaxNumArgs];
+      const int count = static_cast<int>(entry->args.size());
+      for (int ix = 0; ix != count; ++ix)
+        reply_args[ix] = &entry->args[ix];
+      return reply->MsgHandler(entry->reply_id)->OnMsgIn(entry->reply_id, channel_,
+                                                         reply_args, count);
+    }
+
+    ++misses_;
+    Entry* fresh = memdet::new_impl<Entry>(1);
+    fresh->key.Swap(key_transport_.bytes);
+    rc = channel_->Send(msg_id, args, n_args);
+    if (rc == RcOK) {
+      Capture<DispatchT> capture(reply, fresh);
+      rc = channel_->Receive(&capture);
+    }
+    // The policy can not go away, but Receive() can have run an invalidation.
+    policy = FindPolicy(msg_id);
+    if ((rc == OnMsgReady) && (fresh->reply_id != -1)) {
+      fresh->expires = now + policy->ttl_ms;
+      Insert(policy, fresh);
+    } else {
+      memdet::delete_impl(fresh);
+    }
+    return rc;
+  }
+
+  // Drops the cached replies to requests |msg_id|, or all of them if it is 0.
+  void Invalidate(int msg_id) {
+    for (size_t ix = 0; ix != policies_.size(); ++ix) {
+      Policy* policy = &policies_[ix];
+      if (msg_id && (policy->msg_id != msg_id))
+        continue;
+      while (policy->head)
+        DeleteEntry(policy, RemoveLast(policy));
+    }
+  }
+
+  long Hits() const { return hits_; }
+  long Misses() const { return misses_; }
+
+  // For the server: tells the cache at the other end of |channel| to drop the replies to
+  // requests |msg_id|, or all of them if it is 0.
+  static size_t SendInvalidate(ChannelT* channel, int msg_id) {
+    const WireView args[] = { WireView(kControlInvalidate), WireView(msg_id) };
+    return channel->Send(kMessagePrivControl, args, 2, 0);
+  }
+
+  // ControlObserver.
+  virtual void OnControlMsg(const WireType* const args[], int count) {
+    if ((count == 2) && (args[0]->LoadInt32() == kControlInvalidate) &&
+        args[1]->MatchesSig(WireType::kSigInt32))
+      Invalidate(args[1]->LoadInt32());
+  }
+
+ private:
+  // A cached reply, in a list per policy with the most recently used first.
+  struct Entry {
+    Entry() : next(NULL), expires(0), reply_id(-1) {}
+    Entry* next;
+    PodVector<char> key;
+    long long expires;
+    int reply_id;
+    FixedArray<WireType, ChannelT::kMaxNumArgs> args;
+  };
+
+  struct Policy {
+    int msg_id;
+    unsigned int ttl_ms;
+    size_t max_entries;
+    size_t count;
+    Entry* head;
+  };
+
+  // Keeps the bytes of the last message sent, which is how a request becomes a key.
+  class KeyTransport {
+   public:
+    size_t Send(const void* buf, size_t sz) {
+      bytes.Set(static_cast<const char*>(buf), sz);
+      return RcOK;
+    }
+
+    char* Receive(size_t*) {
+      return NULL;
+    }
+
+    PodVector<char> bytes;
+  };
+
+  typedef Channel<KeyTransport, EncoderT, Decoder> KeyChannel;
+
+  // Passes the reply to the real dispatcher and copies the one that ends the call.
+  template <class DispatchT>
+  class Capture {
+   public:
+    Capture(DispatchT* dispatch, Entry* entry) : dispatch_(dispatch), entry_(entry) {}
+
+    Capture* MsgHandler(int) {
+      return this;
+    }
+
+    void* OnNewTransport() { return dispatch_->OnNewTransport(); }
+
+    size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+      size_t rc = dispatch_->MsgHandler(msg_id)->OnMsgIn(msg_id, ch, args, count);
+      if (rc == OnMsgReady) {
+        entry_->reply_id = msg_id;
+        for (int ix = 0; ix != count; ++ix)
+          entry_->args.push_back(*args[ix]);
+      }
+      return rc;
+    }
+
+   private:
+    DispatchT* dispatch_;
+    Entry* entry_;
+  };
+
+  static long long NowMs() {
+#if defined(WIN32)
+    return ::GetTickCount();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#endif
+  }
+
+  Policy* FindPolicy(int msg_id) {
+    for (size_t ix = 0; ix != policies_.size(); ++ix) {
+      if (policies_[ix].msg_id == msg_id)
+        return &policies_[ix];
+    }
+    return NULL;
+  }
+
+  // Finds the entry for the request in |key_transport_| and moves it to the front. Drops
+  // the expired entries it walks over.
+  Entry* Lookup(Policy* policy, long long now) {
+    const PodVector<char>& key = key_transport_.bytes;
+    Entry** link = &policy->head;
+    while (Entry* entry = *link) {
+      if (entry->expires <= now) {
+        *link = entry->next;
+        DeleteEntry(policy, entry);
+        continue;
+      }
+      if ((entry->key.size() == key.size()) &&
+          !memcmp(entry->key.get(), key.get(), key.size())) {
+        *link = entry->next;
+        entry->next = policy->head;
+        policy->head = entry;
+        return entry;
+      }
+      link = &entry->next;
+    }
+    return NULL;
+  }
+
+  void Insert(Policy* policy, Entry* entry) {
+    if (policy->count == policy->max_entries)
+      DeleteEntry(policy, RemoveLast(policy));
+    entry->next = policy->head;
+    policy->head = entry;
+    ++policy->count;
+  }
+
+  static Entry* RemoveLast(Policy* policy) {
+    Entry** link = &policy->head;
+    while ((*link)->next)
+      link = &(*link)->next;
+    Entry* last = *link;
+    *link = NULL;
+    return last;
+  }
+
+  static void DeleteEntry(Policy* policy, Entry* entry) {
+    --policy->count;
+    memdet::delete_impl(entry);
+  }
+
+  ChannelT* channel_;
+  KeyTransport key_transport_;
+  KeyChannel key_channel_;
+  PodVector<Policy> policies_;
+  long hits_;
+  long misses_;
+
+  ResponseCache(const ResponseCache&);
+  ResponseCache& operator=(const ResponseCache&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_RESPONSE_CACHE_H_
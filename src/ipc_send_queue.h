@@ -0,0 +1,292 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SEND_QUEUE_H_
+#define SIMPLE_IPC_SEND_QUEUE_H_
+
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// SendQueue is the multi-producer, single-consumer queue behind the thread-safe send modes of
+// ipc::Channel. Each producer encodes a message into the encoder of its own node and pushes
+// the node with a single CAS on the list head; producers never block each other.
+//
+// There is one consumer at a time: whoever wins the flush token with TryAcquireFlush() takes
+// the whole list with PopAll() and writes each buffer to the transport in full, which keeps
+// the bytes of every message contiguous on the stream. The head is a LIFO so PopAll() reverses
+// it to give back the messages in push order.
+//
+// Because PopAll() swaps the entire list out there is no ABA problem on the head.
+//
+// PostQueue, further down, is the bounded queue that Channel::Post() fills for its writer
+// thread.
+
+namespace ipc {
+
+template <class EncoderT>
+class SendQueue {
+ public:
+  struct Node {
+    Node* next;
+    EncoderT encoder;
+  };
+
+  SendQueue() : head_(NULL), flush_token_(0) {}
+
+  ~SendQueue() {
+    Node* node = PopAll();
+    while (node) {
+      Node* next = node->next;
+      DeleteNode(node);
+      node = next;
+    }
+  }
+
+  static Node* NewNode() {
+    Node* node = memdet::new_impl<Node>(1);
+    node->next = NULL;
+    return node;
+  }
+
+  static void DeleteNode(Node* node) {
+    memdet::delete_impl(node);
+  }
+
+  // Can be called from any thread.
+  void Push(Node* node) {
+    void* old_head;
+    do {
+      old_head = AtomicLoadPtr(&head_);
+      node->next = static_cast<Node*>(old_head);
+    } while (AtomicCompareExchangePtr(&head_, node, old_head) != old_head);
+  }
+
+  // Returns all the queued nodes in the order they were pushed. Only the owner of
+  // the flush token should call this.
+  Node* PopAll() {
+    Node* node = static_cast<Node*>(AtomicExchangePtr(&head_, NULL));
+    Node* fifo = NULL;
+    while (node) {
+      Node* next = node->next;
+      node->next = fifo;
+      fifo = node;
+      node = next;
+    }
+    return fifo;
+  }
+
+  bool IsEmpty() {
+    return (NULL == AtomicLoadPtr(&head_));
+  }
+
+  bool TryAcquireFlush() {
+    return (0 == AtomicCompareExchange(&flush_token_, 1, 0));
+  }
+
+  void ReleaseFlush() {
+    AtomicCompareExchange(&flush_token_, 0, 1);
+  }
+
+ private:
+  void* volatile head_;
+  volatile long flush_token_;
+
+  SendQueue(const SendQueue&);
+  SendQueue& operator=(const SendQueue&);
+};
+
+// What PostQueue::Push() does when the queue is full.
+enum PostFullPolicy {
+  POST_BLOCK,         // Waits for the writer to make room.
+  POST_DROP_OLDEST,   // Drops the oldest queued node to make room.
+  POST_FAIL           // Fails.
+};
+
+// PostQueue is the bounded FIFO behind Channel::Post(). Any thread pushes nodes that are
+// already encoded and one writer thread pops them. Each node is counted when it is pushed
+// and again when it is finished, that is when the writer is done with it or it is dropped,
+// so WaitFinished() can tell when everything pushed before some point is gone.
+template <class EncoderT>
+class PostQueue {
+ public:
+  typedef typename SendQueue<EncoderT>::Node Node;
+
+  PostQueue()
+      : max_queued_(1), policy_(POST_BLOCK), head_(NULL), tail_(NULL), queued_(0), pushed_(0),
+        finished_(0), dropped_(0), closed_(false), space_waiters_(0), finish_waiters_(0) {}
+
+  ~PostQueue() {
+    while (head_)
+      SendQueue<EncoderT>::DeleteNode(PopHead());
+  }
+
+  // Sets the size and the policy, and opens the queue again if it was closed. Must be called
+  // while no other thread uses the queue.
+  void Configure(size_t max_queued, PostFullPolicy policy) {
+    max_queued_ = max_queued ? max_queued : 1;
+    policy_ = policy;
+    closed_ = false;
+  }
+
+  // Takes |node| unless it returns false, which happens if the queue is closed or it is
+  // full and the policy is POST_FAIL.
+  bool Push(Node* node) {
+    Node* dropped = NULL;
+    lock_.Lock();
+    for (;;) {
+      if (closed_ || ((queued_ == max_queued_) && (policy_ == POST_FAIL))) {
+        lock_.Unlock();
+        return false;
+      }
+      if (queued_ < max_queued_)
+        break;
+      if (policy_ == POST_DROP_OLDEST) {
+        dropped = PopHead();
+        ++dropped_;
+        ++finished_;
+        break;
+      }
+      ++space_waiters_;
+      lock_.Unlock();
+      space_.Wait();
+      lock_.Lock();
+    }
+    node->next = NULL;
+    if (tail_)
+      tail_->next = node;
+    else
+      head_ = node;
+    tail_ = node;
+    ++queued_;
+    ++pushed_;
+    lock_.Unlock();
+
+    if (dropped) {
+      SendQueue<EncoderT>::DeleteNode(dropped);
+      WakeFinishWaiters();
+    }
+    items_.Post();
+    return true;
+  }
+
+  // Blocks until there is a node to write. Returns NULL once the queue is closed and empty.
+  Node* Pop() {
+    for (;;) {
+      items_.Wait();
+      AutoLock lock(&lock_);
+      if (head_) {
+        Node* node = PopHead();
+        if (space_waiters_) {
+          --space_waiters_;
+          space_.Post();
+        }
+        return node;
+      }
+      if (closed_)
+        return NULL;
+    }
+  }
+
+  // The writer is done with the last node returned by Pop().
+  void Finish() {
+    {
+      AutoLock lock(&lock_);
+      ++finished_;
+    }
+    WakeFinishWaiters();
+  }
+
+  // Blocks until every node pushed before the call is finished.
+  void WaitFinished() {
+    lock_.Lock();
+    const long target = pushed_;
+    while (finished_ < target) {
+      ++finish_waiters_;
+      lock_.Unlock();
+      finish_.Wait();
+      lock_.Lock();
+    }
+    lock_.Unlock();
+  }
+
+  // Makes Push() fail from now on. Pop() still returns the nodes that are queued.
+  void Close() {
+    long waiters;
+    {
+      AutoLock lock(&lock_);
+      closed_ = true;
+      waiters = space_waiters_;
+      space_waiters_ = 0;
+    }
+    while (waiters--)
+      space_.Post();
+    items_.Post();
+  }
+
+  long Dropped() {
+    AutoLock lock(&lock_);
+    return dropped_;
+  }
+
+  size_t Queued() {
+    AutoLock lock(&lock_);
+    return queued_;
+  }
+
+ private:
+  // Must be called with |lock_| held.
+  Node* PopHead() {
+    Node* node = head_;
+    head_ = node->next;
+    if (!head_)
+      tail_ = NULL;
+    --queued_;
+    return node;
+  }
+
+  void WakeFinishWaiters() {
+    long waiters;
+    {
+      AutoLock lock(&lock_);
+      waiters = finish_waiters_;
+      finish_waiters_ = 0;
+    }
+    while (waiters--)
+      finish_.Post();
+  }
+
+  size_t max_queued_;
+  PostFullPolicy policy_;
+  Mutex lock_;
+  Node* head_;
+  Node* tail_;
+  size_t queued_;
+  long pushed_;
+  long finished_;
+  long dropped_;
+  bool closed_;
+  Semaphore items_;
+  long space_waiters_;
+  Semaphore space_;
+  long finish_waiters_;
+  Semaphore finish_;
+
+  PostQueue(const PostQueue&);
+  PostQueue& operator=(const PostQueue&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SEND_QUEUE_H_
@@ -0,0 +1,442 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SERVICE_POOL_H_
+#define SIMPLE_IPC_SERVICE_POOL_H_
+
+#include "ipc_channel.h"
+#include "ipc_codec.h"
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+// Waiting for any of many transports to have data needs poll(), so for now this file is
+// only for posix.
+#if !defined(WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#define IPC_HAS_SERVICE_POOL 1
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// ServicePool serves many transports with a fixed number of threads, instead of a thread per
+// transport blocked in Channel::Receive(). It is meant for the OnNewTransport() pattern where
+// the server makes a new transport for each client connection:
+//
+//   void* OnNewTransport() {
+//     PipePair pp;
+//     PipeTransport* transport = new PipeTransport;
+//     transport->OpenServer(pp.fd1());
+//     pool->Add(transport, new Session);
+//     return reinterpret_cast<void*>(pp.fd2());
+//   }
+//
+// A transport with nothing to read is parked: one poller thread waits on all the parked
+// transports at once and queues the ones that become readable for the service threads. A
+// service thread reads what is there and runs the handlers of every whole message it got,
+// then parks the transport again. Since each connection yields its thread between reads, a
+// client that keeps a connection open and idle costs no thread.
+//
+// Each transport gets its own channel, a Channel<ServiceTransport<TransportT>, ...>, and
+// the handlers must be written for that channel type. The SessionT passed to Add() is the
+// dispatcher of the connection, see Channel::Receive(), and must also have:
+//
+//   void OnClose(size_t rc);
+//
+// which is called once, on a pool thread, when a handler returns something other than
+// OnMsgLoopNext (|rc| is that value), the transport fails or is closed by the other end
+// (RcErrTransportRead), or the pool stops (RcOK). The session can delete itself and the
+// transport there. The messages of one connection are always handled one at a time.
+//
+// TransportT must have int fd() to poll on, like PipeTransport. GetStats() reports how long
+// readable connections waited for a service thread.
+
+namespace ipc {
+
+#if defined(IPC_HAS_SERVICE_POOL)
+
+// Wraps a transport so that Receive() hands out exactly one whole message, and only from
+// what Fill() has already read. It never blocks.
+template <class TransportT, class EncoderT = Encoder>
+class ServiceTransport {
+ public:
+  ServiceTransport() : transport_(NULL), consumed_(0), failed_(false) {}
+
+  void Attach(TransportT* transport) { transport_ = transport; }
+
+  TransportT* transport() const { return transport_; }
+
+  size_t Send(const void* buf, size_t sz) {
+    return transport_->Send(buf, sz);
+  }
+
+  // Returns the next whole message or NULL if there is none yet.
+  char* Receive(size_t* size) {
+    Consume();
+    size_t msg_sz;
+    if (!WholeMessage(&msg_sz))
+      return NULL;
+    consumed_ = msg_sz;
+    *size = msg_sz;
+    return &in_[0];
+  }
+
+  // Reads once from the transport. Returns false if it failed or was closed.
+  bool Fill() {
+    Consume();
+    size_t received = 0;
+    const char* buf = transport_->Receive(&received);
+    if (!buf || !received) {
+      failed_ = true;
+      return false;
+    }
+    in_.Add(buf, received);
+    return true;
+  }
+
+  bool HasMessage() {
+    Consume();
+    size_t msg_sz;
+    return WholeMessage(&msg_sz);
+  }
+
+  bool Failed() const { return failed_; }
+
+ private:
+  void Consume() {
+    in_.RemoveFront(consumed_);
+    consumed_ = 0;
+  }
+
+  bool WholeMessage(size_t* msg_sz) {
+    if (failed_)
+      return false;
+    if (!EncoderT::PeekMsgSize(in_.get(), in_.size(), msg_sz)) {
+      failed_ = true;
+      return false;
+    }
+    return (*msg_sz != 0) && (*msg_sz <= in_.size());
+  }
+
+  TransportT* transport_;
+  PodVector<char> in_;
+  size_t consumed_;
+  bool failed_;
+
+  ServiceTransport(const ServiceTransport&);
+  ServiceTransport& operator=(const ServiceTransport&);
+};
+
+template <class TransportT, class SessionT, class EncoderT = Encoder,
+          template <class> class DecoderT = Decoder>
+class ServicePool {
+ public:
+  typedef ServiceTransport<TransportT, EncoderT> Connection;
+  typedef Channel<Connection, EncoderT, DecoderT> ChannelT;
+
+  // The delays are in microseconds.
+  struct Stats {
+    long long connections;          // Added so far.
+    long long open;                 // Not closed yet.
+    long long parked;               // Waiting for data.
+    long long runs;                 // Times a connection was given to a service thread.
+    long long total_queue_delay;    // From readable to running, added over all the runs.
+    long long max_queue_delay;
+  };
+
+  explicit ServicePool(int n_threads)
+      : n_workers_(n_threads > 0 ? n_threads : 1), workers_(NULL), run_head_(NULL),
+        run_tail_(NULL), stopping_(false) {
+    memset(&stats_, 0, sizeof(stats_));
+    wake_[0] = -1;
+    wake_[1] = -1;
+    if (pipe(wake_) != 0)
+      return;
+    // Neither end may block: a full pipe already means the poller will wake up.
+    fcntl(wake_[0], F_SETFL, fcntl(wake_[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_[1], F_SETFL, fcntl(wake_[1], F_GETFL) | O_NONBLOCK);
+    poller_.Start(PollerMain, this);
+    workers_ = memdet::new_impl<Thread>(n_workers_);
+    for (int ix = 0; ix != n_workers_; ++ix)
+      workers_[ix].Start(WorkerMain, this);
+  }
+
+  ~ServicePool() {
+    Stop();
+    memdet::delete_impl(workers_);
+  }
+
+  // Serves |transport| with |session| from now on. Both must stay alive until
+  // session->OnClose() is called. Returns false once the pool is stopping.
+  bool Add(TransportT* transport, SessionT* session) {
+    Conn* conn = memdet::new_impl<Conn>(1);
+    conn->transport.Attach(transport);
+    conn->session = session;
+    AutoLock lock(&lock_);
+    if (stopping_) {
+      memdet::delete_impl(conn);
+      return false;
+    }
+    ++stats_.connections;
+    ++stats_.open;
+    ParkLocked(conn);
+    return true;
+  }
+
+  // Stops the threads and closes every connection that is left with RcOK. Must not be
+  // called from a handler.
+  void Stop() {
+    {
+      AutoLock lock(&lock_);
+      if (stopping_)
+        return;
+      stopping_ = true;
+    }
+    if (wake_[1] == -1)
+      return;
+    Wake();
+    poller_.Join();
+    for (int ix = 0; ix != n_workers_; ++ix)
+      runnable_.Post();
+    for (int ix = 0; ix != n_workers_; ++ix)
+      workers_[ix].Join();
+    // Only this thread is left.
+    for (size_t ix = 0; ix != parked_.size(); ++ix)
+      Close(parked_[ix], RcOK);
+    parked_.resize(0);
+    while (run_head_)
+      Close(PopRunnable(), RcOK);
+    close(wake_[0]);
+    close(wake_[1]);
+  }
+
+  Stats GetStats() {
+    AutoLock lock(&lock_);
+    Stats stats = stats_;
+    stats.parked = static_cast<long long>(parked_.size());
+    return stats;
+  }
+
+ private:
+  // Messages handled in a row before a connection goes to the back of the queue.
+  static const int kBurst = 16;
+
+  struct Conn {
+    Conn() : next(NULL), channel(&transport), session(NULL), ready_at(0) {}
+    Conn* next;
+    Connection transport;
+    ChannelT channel;
+    SessionT* session;
+    long long ready_at;
+  };
+
+  static long long NowMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  static void PollerMain(void* ctx) {
+    reinterpret_cast<ServicePool*>(ctx)->PollerLoop();
+  }
+
+  static void WorkerMain(void* ctx) {
+    reinterpret_cast<ServicePool*>(ctx)->WorkerLoop();
+  }
+
+  void Wake() {
+    char c = 0;
+    while ((write(wake_[1], &c, 1) < 0) && (errno == EINTR)) {}
+  }
+
+  void Park(Conn* conn) {
+    AutoLock lock(&lock_);
+    ParkLocked(conn);
+  }
+
+  // Must be called with |lock_| held. Once the pool is stopping, Stop() closes the parked
+  // connections itself and may have closed the wake pipe already, so it is not written.
+  void ParkLocked(Conn* conn) {
+    parked_.push_back(conn);
+    if (!stopping_)
+      Wake();
+  }
+
+  // Must be called with |lock_| held.
+  void PushRunnable(Conn* conn, long long now) {
+    conn->next = NULL;
+    conn->ready_at = now;
+    if (run_tail_)
+      run_tail_->next = conn;
+    else
+      run_head_ = conn;
+    run_tail_ = conn;
+  }
+
+  // Must be called with |lock_| held.
+  Conn* PopRunnable() {
+    Conn* conn = run_head_;
+    run_head_ = conn->next;
+    if (!run_head_)
+      run_tail_ = NULL;
+    return conn;
+  }
+
+  void MakeRunnable(Conn* conn) {
+    {
+      AutoLock lock(&lock_);
+      PushRunnable(conn, NowMicros());
+    }
+    runnable_.Post();
+  }
+
+  // Waits on the wake pipe and every parked connection, and moves the readable ones
+  // to the run queue.
+  void PollerLoop() {
+    PodVector<pollfd> fds;
+    PodVector<Conn*> conns;
+    for (;;) {
+      {
+        AutoLock lock(&lock_);
+        if (stopping_)
+          return;
+        fds.resize(parked_.size() + 1);
+        conns.resize(parked_.size());
+        fds[0].fd = wake_[0];
+        fds[0].events = POLLIN;
+        for (size_t ix = 0; ix != parked_.size(); ++ix) {
+          conns[ix] = parked_[ix];
+          fds[ix + 1].fd = parked_[ix]->transport.transport()->fd();
+          fds[ix + 1].events = POLLIN;
+        }
+      }
+      for (size_t ix = 0; ix != fds.size(); ++ix)
+        fds[ix].revents = 0;
+      if (poll(fds.get(), fds.size(), -1) < 0)
+        continue;
+      if (fds[0].revents) {
+        char drain[64];
+        for (;;) {
+          const ssize_t got = read(wake_[0], drain, sizeof(drain));
+          if ((got == 0) || ((got < 0) && (errno != EINTR)))
+            break;
+        }
+      }
+
+      int ready = 0;
+      {
+        AutoLock lock(&lock_);
+        const long long now = NowMicros();
+        for (size_t ix = 0; ix != conns.size(); ++ix) {
+          if (!fds[ix + 1].revents)
+            continue;
+          // Everything in |conns| is still parked since only this thread unparks.
+          for (size_t jx = 0; jx != parked_.size(); ++jx) {
+            if (parked_[jx] == conns[ix]) {
+              parked_[jx] = parked_[parked_.size() - 1];
+              parked_.pop_back();
+              break;
+            }
+          }
+          PushRunnable(conns[ix], now);
+          ++ready;
+        }
+      }
+      while (ready--)
+        runnable_.Post();
+    }
+  }
+
+  void WorkerLoop() {
+    for (;;) {
+      runnable_.Wait();
+      Conn* conn;
+      {
+        AutoLock lock(&lock_);
+        if (stopping_ || !run_head_)
+          return;
+        conn = PopRunnable();
+        const long long delay = NowMicros() - conn->ready_at;
+        ++stats_.runs;
+        stats_.total_queue_delay += delay;
+        if (delay > stats_.max_queue_delay)
+          stats_.max_queue_delay = delay;
+      }
+      Serve(conn);
+    }
+  }
+
+  // Reads once, or not at all if a whole message is already there, and handles every
+  // whole message read so far.
+  void Serve(Conn* conn) {
+    Connection& transport = conn->transport;
+    if (!transport.HasMessage() && !transport.Fill()) {
+      Close(conn, RcErrTransportRead);
+      return;
+    }
+    for (int count = 0; transport.HasMessage(); ++count) {
+      if (count == kBurst) {
+        MakeRunnable(conn);
+        return;
+      }
+      size_t rc = DispatchOne(&conn->channel, conn->session);
+      // Messages that the channel handles itself, like a new transport request, do not
+      // reach the session and the channel then finds nothing more to read.
+      if ((rc == RcErrTransportRead) && !transport.Failed())
+        break;
+      if (rc != OnMsgLoopNext) {
+        Close(conn, rc);
+        return;
+      }
+    }
+    if (transport.Failed())
+      Close(conn, RcErrTransportRead);
+    else
+      Park(conn);
+  }
+
+  void Close(Conn* conn, size_t rc) {
+    {
+      AutoLock lock(&lock_);
+      --stats_.open;
+    }
+    conn->session->OnClose(rc);
+    memdet::delete_impl(conn);
+  }
+
+  const int n_workers_;
+  Thread* workers_;
+  Thread poller_;
+  int wake_[2];
+
+  Mutex lock_;
+  Semaphore runnable_;
+  PodVector<Conn*> parked_;
+  Conn* run_head_;
+  Conn* run_tail_;
+  bool stopping_;
+  Stats stats_;
+
+  ServicePool(const ServicePool&);
+  ServicePool& operator=(const ServicePool&);
+};
+
+#endif  // defined(IPC_HAS_SERVICE_POOL)
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SERVICE_POOL_H_
@@ -0,0 +1,94 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_STATS_H_
+#define SIMPLE_IPC_STATS_H_
+
+#include "ipc_constants.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// ChannelStats is what a channel answers to a stats query. A monitoring tool connects to a
+// running process as a peer and asks; the other end answers from inside Receive(), so its
+// dispatcher never sees the query:
+//
+//   ipc::ChannelStats stats;
+//   if (channel.QueryStats(&stats) == ipc::RcOK)
+//     printf("%lld messages in\n", stats.received);
+//
+// Two answers some time apart give the message rates. The message counters and the handler
+// latencies come from the ChannelMetrics policy of the answering end and are 0 without it.
+// On the wire the fields are a single Int64Array, so new ones can be added at the end.
+
+namespace ipc {
+
+struct ChannelStats {
+  enum { kFields = 13 };
+
+  ChannelStats() {
+    Clear();
+  }
+
+  void Clear() {
+    for (int ix = 0; ix != kFields; ++ix)
+      *Field(ix) = 0;
+  }
+
+  // Writes the fields, in wire order, to |values|.
+  void ToArray(long long values[kFields]) const {
+    for (int ix = 0; ix != kFields; ++ix)
+      values[ix] = *const_cast<ChannelStats*>(this)->Field(ix);
+  }
+
+  // Reads a kControlStatsReply. The fields that the other end does not know are left at 0.
+  bool FromControlMsg(const WireType* const args[], int count) {
+    if ((count != 2) || !args[0]->MatchesSig(WireType::kSigInt32) ||
+        (args[0]->LoadInt32() != kControlStatsReply) ||
+        !args[1]->MatchesSig(WireType::kSigInt64Array))
+      return false;
+    Clear();
+    const Int64Array values = args[1]->LoadInt64Array();
+    for (size_t ix = 0; (ix != values.sz_) && (ix != kFields); ++ix)
+      *Field(static_cast<int>(ix)) = values.buf_[ix];
+    return true;
+  }
+
+  long long time_ns;              // When the answer was made, on the monotonic clock.
+  long long uptime_ns;            // Since the channel was created.
+  long long sent;
+  long long sent_bytes;
+  long long received;
+  long long received_bytes;
+  long long handler_p50_ns;
+  long long handler_p99_ns;
+  long long handler_max_ns;
+  long long decoder_high_water;   // The most bytes the decoder held at once.
+  long long post_queued;          // Messages waiting for the Post() writer.
+  long long post_dropped;
+  long long credit_waiters;       // Threads blocked for flow control credit.
+
+ private:
+  long long* Field(int ix) {
+    long long* const fields[kFields] = {
+      &time_ns, &uptime_ns, &sent, &sent_bytes, &received, &received_bytes,
+      &handler_p50_ns, &handler_p99_ns, &handler_max_ns, &decoder_high_water,
+      &post_queued, &post_dropped, &credit_waiters
+    };
+    return fields[ix];
+  }
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_STATS_H_
@@ -0,0 +1,319 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SYNC_H_
+#define SIMPLE_IPC_SYNC_H_
+
+#include "os_includes.h"
+
+#if !defined(WIN32)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#if defined(WIN32)
+#define IPC_THREAD_LOCAL __declspec(thread)
+#else
+#define IPC_THREAD_LOCAL __thread
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Minimal set of atomic operations and threading primitives used by the thread-safe parts
+// of the library. All the atomic operations are full memory barriers.
+//
+
+namespace ipc {
+
+#if defined(WIN32)
+
+// Returns the previous value of |*dest|.
+inline void* AtomicCompareExchangePtr(void* volatile* dest, void* exchange, void* comparand) {
+  return ::InterlockedCompareExchangePointer(dest, exchange, comparand);
+}
+
+inline void* AtomicExchangePtr(void* volatile* dest, void* exchange) {
+  return ::InterlockedExchangePointer(dest, exchange);
+}
+
+inline long AtomicCompareExchange(volatile long* dest, long exchange, long comparand) {
+  return ::InterlockedCompareExchange(dest, exchange, comparand);
+}
+
+inline long AtomicExchange(volatile long* dest, long exchange) {
+  return ::InterlockedExchange(dest, exchange);
+}
+
+inline long AtomicIncrement(volatile long* dest) {
+  return ::InterlockedIncrement(dest);
+}
+
+inline long AtomicDecrement(volatile long* dest) {
+  return ::InterlockedDecrement(dest);
+}
+
+#else
+
+inline void* AtomicCompareExchangePtr(void* volatile* dest, void* exchange, void* comparand) {
+  return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+// __sync_lock_test_and_set() is only an acquire barrier, hence the explicit barrier.
+inline void* AtomicExchangePtr(void* volatile* dest, void* exchange) {
+  __sync_synchronize();
+  return __sync_lock_test_and_set(dest, exchange);
+}
+
+inline long AtomicCompareExchange(volatile long* dest, long exchange, long comparand) {
+  return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+inline long AtomicExchange(volatile long* dest, long exchange) {
+  __sync_synchronize();
+  return __sync_lock_test_and_set(dest, exchange);
+}
+
+inline long AtomicIncrement(volatile long* dest) {
+  return __sync_add_and_fetch(dest, 1);
+}
+
+inline long AtomicDecrement(volatile long* dest) {
+  return __sync_sub_and_fetch(dest, 1);
+}
+
+#endif  // defined(WIN32)
+
+// Keeps the memory accesses before it from being reordered with the ones after it.
+inline void AtomicFence() {
+#if defined(WIN32)
+  ::MemoryBarrier();
+#else
+  __sync_synchronize();
+#endif
+}
+
+// Reads with a full barrier.
+inline void* AtomicLoadPtr(void* volatile* src) {
+  return AtomicCompareExchangePtr(src, NULL, NULL);
+}
+
+inline long AtomicLoad(volatile long* src) {
+  return AtomicCompareExchange(src, 0, 0);
+}
+
+// Reads without writing to |src|, unlike AtomicLoad(), so it also works on read-only memory.
+// The accesses after it are not moved before it.
+inline long AtomicLoadAcquire(const volatile long* src) {
+  const long value = *src;
+  AtomicFence();
+  return value;
+}
+
+// Nanoseconds of the monotonic clock, which all the processes on a machine share.
+inline long long MonotonicNs() {
+#if defined(WIN32)
+  LARGE_INTEGER freq, now;
+  ::QueryPerformanceFrequency(&freq);
+  ::QueryPerformanceCounter(&now);
+  return static_cast<long long>(now.QuadPart / freq.QuadPart) * 1000000000 +
+         (now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<long long>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#if defined(WIN32)
+
+class Mutex {
+ public:
+  Mutex() { ::InitializeCriticalSection(&cs_); }
+  ~Mutex() { ::DeleteCriticalSection(&cs_); }
+  void Lock() { ::EnterCriticalSection(&cs_); }
+  void Unlock() { ::LeaveCriticalSection(&cs_); }
+
+ private:
+  friend class CondVar;
+  CRITICAL_SECTION cs_;
+
+  Mutex(const Mutex&);
+  Mutex& operator=(const Mutex&);
+};
+
+class CondVar {
+ public:
+  CondVar() { ::InitializeConditionVariable(&cv_); }
+  void Wait(Mutex* mutex) { ::SleepConditionVariableCS(&cv_, &mutex->cs_, INFINITE); }
+  void Broadcast() { ::WakeAllConditionVariable(&cv_); }
+
+ private:
+  CONDITION_VARIABLE cv_;
+
+  CondVar(const CondVar&);
+  CondVar& operator=(const CondVar&);
+};
+
+class Semaphore {
+ public:
+  Semaphore() : sem_(::CreateSemaphoreW(NULL, 0, LONG_MAX, NULL)) {}
+  ~Semaphore() { ::CloseHandle(sem_); }
+  void Post() { ::ReleaseSemaphore(sem_, 1, NULL); }
+  void Wait() { ::WaitForSingleObject(sem_, INFINITE); }
+
+ private:
+  HANDLE sem_;
+
+  Semaphore(const Semaphore&);
+  Semaphore& operator=(const Semaphore&);
+};
+
+#else
+
+class Mutex {
+ public:
+  Mutex() { pthread_mutex_init(&mutex_, NULL); }
+  ~Mutex() { pthread_mutex_destroy(&mutex_); }
+  void Lock() { pthread_mutex_lock(&mutex_); }
+  void Unlock() { pthread_mutex_unlock(&mutex_); }
+
+ private:
+  friend class CondVar;
+  friend class Semaphore;
+  pthread_mutex_t mutex_;
+
+  Mutex(const Mutex&);
+  Mutex& operator=(const Mutex&);
+};
+
+// Wait() must be called with |mutex| locked. It can return without a Broadcast(), so the
+// caller checks its condition in a loop.
+class CondVar {
+ public:
+  CondVar() { pthread_cond_init(&cond_, NULL); }
+  ~CondVar() { pthread_cond_destroy(&cond_); }
+  void Wait(Mutex* mutex) { pthread_cond_wait(&cond_, &mutex->mutex_); }
+  void Broadcast() { pthread_cond_broadcast(&cond_); }
+
+ private:
+  pthread_cond_t cond_;
+
+  CondVar(const CondVar&);
+  CondVar& operator=(const CondVar&);
+};
+
+// Unnamed POSIX semaphores are not available on OSX so this one is built on
+// a condition variable.
+class Semaphore {
+ public:
+  Semaphore() : count_(0) { pthread_cond_init(&cond_, NULL); }
+  ~Semaphore() { pthread_cond_destroy(&cond_); }
+
+  void Post() {
+    mutex_.Lock();
+    ++count_;
+    pthread_cond_signal(&cond_);
+    mutex_.Unlock();
+  }
+
+  void Wait() {
+    mutex_.Lock();
+    while (!count_)
+      pthread_cond_wait(&cond_, &mutex_.mutex_);
+    --count_;
+    mutex_.Unlock();
+  }
+
+ private:
+  Mutex mutex_;
+  pthread_cond_t cond_;
+  long count_;
+
+  Semaphore(const Semaphore&);
+  Semaphore& operator=(const Semaphore&);
+};
+
+#endif  // defined(WIN32)
+
+class AutoLock {
+ public:
+  explicit AutoLock(Mutex* mutex) : mutex_(mutex) { mutex_->Lock(); }
+  ~AutoLock() { mutex_->Unlock(); }
+
+ private:
+  Mutex* mutex_;
+
+  AutoLock(const AutoLock&);
+  AutoLock& operator=(const AutoLock&);
+};
+
+// Runs |fn(ctx)| in a new thread. Join() must be called before the object goes away.
+class Thread {
+ public:
+  typedef void (*ThreadFn)(void* ctx);
+
+  Thread() : fn_(NULL), ctx_(NULL), started_(false) {}
+
+  bool Start(ThreadFn fn, void* ctx) {
+    fn_ = fn;
+    ctx_ = ctx;
+#if defined(WIN32)
+    thread_ = ::CreateThread(NULL, 0, Trampoline, this, 0, NULL);
+    started_ = (NULL != thread_);
+#else
+    started_ = (0 == pthread_create(&thread_, NULL, Trampoline, this));
+#endif
+    return started_;
+  }
+
+  void Join() {
+    if (!started_)
+      return;
+#if defined(WIN32)
+    ::WaitForSingleObject(thread_, INFINITE);
+    ::CloseHandle(thread_);
+#else
+    pthread_join(thread_, NULL);
+#endif
+    started_ = false;
+  }
+
+ private:
+#if defined(WIN32)
+  static DWORD WINAPI Trampoline(void* p) {
+    Thread* th = reinterpret_cast<Thread*>(p);
+    th->fn_(th->ctx_);
+    return 0;
+  }
+
+  HANDLE thread_;
+#else
+  static void* Trampoline(void* p) {
+    Thread* th = reinterpret_cast<Thread*>(p);
+    th->fn_(th->ctx_);
+    return NULL;
+  }
+
+  pthread_t thread_;
+#endif
+  ThreadFn fn_;
+  void* ctx_;
+  bool started_;
+
+  Thread(const Thread&);
+  Thread& operator=(const Thread&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SYNC_H_
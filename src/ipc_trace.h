@@ -0,0 +1,242 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_TRACE_H_
+#define SIMPLE_IPC_TRACE_H_
+
+#include <stdio.h>
+
+#include "os_includes.h"
+#include "ipc_channel.h"
+#include "ipc_metrics.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// ChromeTracer is an instrumentation policy of Channel that records a span for every encode,
+// transport send and receive, decode and handler call, and writes them in the Chrome trace
+// event format, which chrome://tracing and Perfetto load.
+//
+//   typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChromeTracer>
+//       TracedChannel;
+//   ipc::ChromeTracer::StartFile("broker.trace");     // Once, before any process appends.
+//   ...
+//   channel.metrics()->AppendTo("broker.trace");      // From every process, as often as needed.
+//
+// The spans go to a fixed size ring buffer per thread with no locking. AppendTo() frees the
+// room of the spans it writes; when a buffer is full of spans not written yet the new spans
+// are dropped and counted. The timestamps come from the monotonic clock, which all
+// the processes on a machine share, so the spans of the broker and of its workers line up
+// in the same file.
+
+namespace ipc {
+
+class ChromeTracer {
+ public:
+  enum { kEnabled = 0, kTraceSpans = 1 };
+
+  // |events_per_thread| is rounded up to a power of two.
+  explicit ChromeTracer(size_t events_per_thread = 8192)
+      : serial_(NextSerial()), capacity_(RoundUpPow2(events_per_thread)), buffers_(NULL),
+        dropped_(0) {}
+
+  ~ChromeTracer() {
+    Buffer* buffer = static_cast<Buffer*>(buffers_);
+    while (buffer) {
+      Buffer* next = buffer->next;
+      memdet::delete_impl(buffer->events);
+      memdet::delete_impl(buffer);
+      buffer = next;
+    }
+  }
+
+  static long long Now() {
+    return ChannelMetrics::Now();
+  }
+
+  void OnSend(int, int, bool, size_t) {}
+  void OnReceive(int, int, size_t, long long, long long, long long, long long) {}
+  void AddStats(ChannelStats*) {}
+
+  void OnSpan(int span, int msg_id, long long begin, long long end) {
+    Buffer* buffer = ThreadBuffer();
+    const unsigned long count = static_cast<unsigned long>(buffer->count);
+    const unsigned long flushed = static_cast<unsigned long>(AtomicLoad(&buffer->flushed));
+    if (count - flushed == capacity_) {
+      AtomicIncrement(&dropped_);
+      return;
+    }
+    Event& event = buffer->events[count & (capacity_ - 1)];
+    event.span = span;
+    event.msg_id = msg_id;
+    event.begin = begin;
+    event.end = end;
+    // Makes the event visible to AppendTo().
+    AtomicExchange(&buffer->count, static_cast<long>(count + 1));
+  }
+
+  // Creates or empties |path| and writes the start of a trace to it.
+  static bool StartFile(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file)
+      return false;
+    const bool ok = fputs("[\n", file) >= 0;
+    return (fclose(file) == 0) && ok;
+  }
+
+  // Writes the spans recorded since the last call to the end of |path|, one per line and
+  // all of them with a single write, so that several processes can append to the same file.
+  // The file is left without the closing bracket, which the trace viewers allow. Only one
+  // thread at a time can call it.
+  bool AppendTo(const char* path) {
+    PodVector<char> out;
+    for (Buffer* buffer = static_cast<Buffer*>(AtomicLoadPtr(&buffers_)); buffer;
+         buffer = buffer->next) {
+      const unsigned long count = static_cast<unsigned long>(AtomicLoad(&buffer->count));
+      for (unsigned long ix = buffer->flushed; ix != count; ++ix)
+        Format(&out, buffer->tid, buffer->events[ix & (capacity_ - 1)]);
+      // Gives the room back to OnSpan().
+      AtomicExchange(&buffer->flushed, static_cast<long>(count));
+    }
+    if (!out.size())
+      return true;
+    FILE* file = fopen(path, "ab");
+    if (!file)
+      return false;
+    setvbuf(file, NULL, _IONBF, 0);
+    const bool ok = fwrite(out.get(), 1, out.size(), file) == out.size();
+    return (fclose(file) == 0) && ok;
+  }
+
+  // The number of spans that did not fit in their thread's buffer.
+  long Dropped() { return AtomicLoad(&dropped_); }
+
+ private:
+  enum { kCachedBuffers = 4 };
+
+  struct Event {
+    int span;
+    int msg_id;
+    long long begin;
+    long long end;
+  };
+
+  // The spans of one thread, a ring indexed by the running counts. Only that thread
+  // writes spans and it publishes them by storing |count|. |flushed| is the count that
+  // AppendTo() has written up to. Both wrap around, which works because the capacity is a
+  // power of two.
+  struct Buffer {
+    Buffer* next;
+    int tid;
+    Event* events;
+    volatile long count;
+    volatile long flushed;
+  };
+
+  struct CachedBuffer {
+    long serial;
+    Buffer* buffer;
+  };
+
+  static long NextSerial() {
+    static volatile long serial = 0;
+    return AtomicIncrement(&serial);
+  }
+
+  static unsigned long RoundUpPow2(size_t n) {
+    unsigned long pow2 = 1;
+    while (pow2 < n)
+      pow2 <<= 1;
+    return pow2;
+  }
+
+  // A small number for the current thread, which the trace shows as its thread id.
+  static int ThreadId() {
+    static volatile long last_id = 0;
+    static IPC_THREAD_LOCAL int id = 0;
+    if (!id)
+      id = static_cast<int>(AtomicIncrement(&last_id));
+    return id;
+  }
+
+  static int ProcessId() {
+#if defined(WIN32)
+    return static_cast<int>(::GetCurrentProcessId());
+#else
+    return static_cast<int>(getpid());
+#endif
+  }
+
+  // Each thread remembers its buffer in the last few tracers it used. A thread that uses
+  // more tracers than that gets a new buffer when it comes back, which only costs memory.
+  Buffer* ThreadBuffer() {
+    static IPC_THREAD_LOCAL CachedBuffer cache[kCachedBuffers];
+    static IPC_THREAD_LOCAL int next_slot = 0;
+    for (int ix = 0; ix != kCachedBuffers; ++ix) {
+      if (cache[ix].serial == serial_)
+        return cache[ix].buffer;
+    }
+    Buffer* buffer = memdet::new_impl<Buffer>(1);
+    buffer->tid = ThreadId();
+    buffer->events = memdet::new_impl<Event>(capacity_);
+    buffer->count = 0;
+    buffer->flushed = 0;
+    void* head;
+    do {
+      head = AtomicLoadPtr(&buffers_);
+      buffer->next = static_cast<Buffer*>(head);
+    } while (AtomicCompareExchangePtr(&buffers_, buffer, head) != head);
+
+    cache[next_slot].serial = serial_;
+    cache[next_slot].buffer = buffer;
+    next_slot = (next_slot + 1) % kCachedBuffers;
+    return buffer;
+  }
+
+  static void Format(PodVector<char>* out, int tid, const Event& event) {
+    static const char* const kNames[] = {
+      "encode", "transport send", "transport receive", "decode", "dispatch"
+    };
+    const long long duration = event.end - event.begin;
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+        "{\"name\":\"%s\",\"cat\":\"ipc\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+        "\"ts\":%lld.%03d,\"dur\":%lld.%03d",
+        kNames[event.span], ProcessId(), tid,
+        event.begin / 1000, static_cast<int>(event.begin % 1000),
+        duration / 1000, static_cast<int>(duration % 1000));
+    if (event.msg_id != -1) {
+      len += snprintf(line + len, sizeof(line) - len, ",\"args\":{\"msg_id\":%d}",
+                      event.msg_id);
+    }
+    len += snprintf(line + len, sizeof(line) - len, "},\n");
+    out->Add(line, len);
+  }
+
+  const long serial_;
+  const unsigned long capacity_;
+  void* volatile buffers_;
+  volatile long dropped_;
+
+  ChromeTracer(const ChromeTracer&);
+  ChromeTracer& operator=(const ChromeTracer&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_TRACE_H_
@@ -30,17 +30,95 @@
   void swap(T& a, T& b) { T t(a); a = b; b = t; }
 #endif
 
+// All the allocations of the library go through new_impl() and delete_impl(). A build that
+// defines IPC_MEMDET_HOOKS can watch them by setting Hooks, for example to count the
+// allocations and the bytes of each site and message:
+//
+//   memdet::Hooks hooks = { OnNew, OnDelete, &counters };
+//   memdet::SetHooks(&hooks);
+//
+// |site| names the allocated type and is the same pointer for every allocation of that type.
+// |msg_id| is the message that the thread is sending or dispatching, or -1.
 namespace memdet {
 
+#if defined(IPC_MEMDET_HOOKS)
+
+struct Hooks {
+  void (*on_new)(void* context, const void* p, size_t bytes, const char* site, int msg_id);
+  void (*on_delete)(void* context, const void* p, const char* site, int msg_id);
+  void* context;
+};
+
+inline const Hooks*& CurrentHooks() {
+  static const Hooks* hooks = NULL;
+  return hooks;
+}
+
+// Set them, or NULL to stop, while no other thread allocates.
+inline void SetHooks(const Hooks* hooks) {
+  CurrentHooks() = hooks;
+}
+
+// Spelled out because IPC_THREAD_LOCAL, in ipc_sync.h, is not defined yet when this is read.
+inline int& CurrentMsg() {
+#if defined(WIN32)
+  static __declspec(thread) int msg_id = -1;
+#else
+  static __thread int msg_id = -1;
+#endif
+  return msg_id;
+}
+
+template <typename T> const char* SiteOf() {
+#if defined(_MSC_VER)
+  return __FUNCSIG__;
+#else
+  return __PRETTY_FUNCTION__;
+#endif
+}
+
+// Attributes the allocations of the current thread to |msg_id| while it lives.
+class MsgScope {
+public:
+  explicit MsgScope(int msg_id) : previous_(CurrentMsg()) {
+    CurrentMsg() = msg_id;
+  }
+
+  ~MsgScope() {
+    CurrentMsg() = previous_;
+  }
+
+private:
+  int previous_;
+};
+
+#else
+
+class MsgScope {
+public:
+  explicit MsgScope(int) {}
+};
+
+#endif  // IPC_MEMDET_HOOKS
+
 template <typename T> T* new_impl(size_t n) {
-  return new T[n];
+  T* p = new T[n];
+#if defined(IPC_MEMDET_HOOKS)
+  if (const Hooks* hooks = CurrentHooks())
+    hooks->on_new(hooks->context, p, n * sizeof(T), SiteOf<T>(), CurrentMsg());
+#endif
+  return p;
 }
 
 template <typename T> void delete_impl(T* o) {
+#if defined(IPC_MEMDET_HOOKS)
+  const Hooks* hooks = CurrentHooks();
+  if (o && hooks)
+    hooks->on_delete(hooks->context, o, SiteOf<T>(), CurrentMsg());
+#endif
   delete[] o;
 }
 
-
 }  // namespace memdet
 
 namespace ipc {
@@ -70,6 +148,14 @@ public:
     return true;
   }
 
+  // Makes room for one more element, which the caller must then construct in place
+  // with placement new, to avoid the copy of push_back(). Returns NULL when full.
+  void* AddRaw() {
+    if (index_ == N)
+      return NULL;
+    return as_obj(index_++);
+  }
+
   T& operator[](size_t ix) {
     return *as_obj(ix);
   }
@@ -108,16 +194,53 @@ T operator+(const IteratorBegin&, T d) {
   return d;
 }
 
+// The inline storage of PodVector, for the first N elements. With N equal
+// to zero there is none and an empty PodVector holds no memory. It is
+// aligned at least for long long and double, like the heap buffers, so
+// bytes kept in it can be read as numbers.
+template <typename T, size_t N>
+class PodStorage {
+protected:
+  PodStorage() {
+    inline_[0] = T();
+  }
+
+  T* InlineBuf() const { return const_cast<T*>(inline_); }
+
+  void SwapInline(PodStorage<T, N>& other) {
+    for (size_t ix = 0; ix != N; ++ix)
+      swap(inline_[ix], other.inline_[ix]);
+  }
+
+private:
+  union {
+    T inline_[N];
+    long long align_int_;
+    double align_float_;
+  };
+};
+
+template <typename T>
+class PodStorage<T, 0> {
+protected:
+  T* InlineBuf() const { return 0; }
+
+  void SwapInline(PodStorage<T, 0>&) {}
+};
+
 // This container is the backing store of HoldeString and a generic
 // vector of plain-old-data. Caveat: Don't use this if your PoD does
 // not have an aceptable default value of 0 as in all bytes equal to
 // zero.
-template <typename T>
-class PodVector {
+// The first |Inline| elements are stored in the object itself and only
+// more than that go to the heap. The heap buffer is only pointed to when
+// there is one, so a PodVector can be moved with memcpy.
+template <typename T, size_t Inline = 0>
+class PodVector : private PodStorage<T, Inline> {
 public:
   typedef T value_type;
 
-  PodVector() : capa_(0), size_(0), buf_(0) {}
+  PodVector() : capa_(Inline), size_(0), buf_(0) {}
 
   ~PodVector() {
     clear();
@@ -127,24 +250,24 @@ public:
 
   const IteratorEnd end() const { return IteratorEnd(); }
 
-  T* get() const { return buf_; }
+  T* get() const { return buf_ ? buf_ : this->InlineBuf(); }
 
   size_t size() const { return size_; }
 
   size_t capacity() const { return capa_; }
 
   T& operator[](size_t ix) {
-    return buf_[ix];
+    return get()[ix];
   }
 
   const T& operator[](size_t ix) const {
-    return buf_[ix];
+    return get()[ix];
   }
 
   void clear() {
     memdet::delete_impl(buf_);
     size_ = 0;
-    capa_ = 0;
+    capa_ = Inline;
     buf_ = 0;
   }
 
@@ -168,6 +291,12 @@ public:
     Add(&v, 1);
   }
 
+  // Unlike resize(size() - 1) it never grows the vector, even when it is empty.
+  void pop_back() {
+    if (size_)
+      --size_;
+  }
+
   // We only support insertions at the end so here we are
   void insert(const IteratorEnd&, const T* begin, const T* end) {
     size_t d = end - begin;
@@ -187,14 +316,15 @@ public:
     
     T* newb = NewAlloc(n);
     if (newb) {
-      memcpy(newb, buf_, size_ * sizeof(T));
+      memcpy(newb, get(), size_ * sizeof(T));
       memdet::delete_impl(buf_);
       buf_ = newb;
     }
+    T* buf = get();
     if (inp) {
-      memcpy(&buf_[size_], inp, n * sizeof(T));
+      memcpy(&buf[size_], inp, n * sizeof(T));
     } else {
-      memset(&buf_[size_], 0, n * sizeof(T));
+      memset(&buf[size_], 0, n * sizeof(T));
     }
     size_ += n;
   }
@@ -203,7 +333,8 @@ public:
     if ((0 == size_) || (n > size_))
       return;
     size_t newsz = size_ - n;
-    memmove(buf_, &buf_[n], newsz);
+    T* buf = get();
+    memmove(buf, &buf[n], newsz * sizeof(T));
     size_ = newsz;
   }
 
@@ -212,11 +343,12 @@ public:
     Add(inp, n);
   }
 
-  void Set(const PodVector<T>& other) {
-    Set(other.buf_, other.size_);
+  void Set(const PodVector<T, Inline>& other) {
+    Set(other.get(), other.size_);
   }
 
-  void Swap(PodVector<T>& other) {
+  void Swap(PodVector<T, Inline>& other) {
+    this->SwapInline(other);
     swap(buf_, other.buf_);
     swap(size_, other.size_);
     swap(capa_, other.capa_);
@@ -245,10 +377,78 @@ private:
   T* buf_;
 };
 
+// A bump allocator for memory that is only needed until the next Reset(), such as
+// the arguments of the message being handled. Alloc() moves a pointer within one
+// block. What does not fit goes to the heap on its own and at Reset() the block is
+// replaced by one big enough for everything, so after a few rounds nothing is
+// allocated or freed.
+class Arena {
+public:
+  Arena() : block_(0), words_(0), used_(0), overflow_(0), overflow_words_(0) {}
+
+  ~Arena() {
+    FreeOverflow();
+    memdet::delete_impl(block_);
+  }
+
+  // Returns |bytes| of memory aligned to 8 bytes.
+  void* Alloc(size_t bytes) {
+    const size_t words = (bytes + sizeof(long long) - 1) / sizeof(long long);
+    if (words_ - used_ >= words) {
+      long long* p = &block_[used_];
+      used_ += words;
+      return p;
+    }
+    // The first word links the overflow allocations.
+    long long* p = memdet::new_impl<long long>(words + 1);
+    memcpy(p, &overflow_, sizeof(overflow_));
+    overflow_ = p;
+    overflow_words_ += words;
+    return &p[1];
+  }
+
+  // Makes all the memory handed out by Alloc() available again.
+  void Reset() {
+    if (overflow_) {
+      const size_t needed = used_ + overflow_words_;
+      FreeOverflow();
+      memdet::delete_impl(block_);
+      words_ = (needed < kMinWords) ? static_cast<size_t>(kMinWords) : needed;
+      block_ = memdet::new_impl<long long>(words_);
+    }
+    used_ = 0;
+  }
+
+  size_t capacity() const { return words_ * sizeof(long long); }
+
+private:
+  enum { kMinWords = 512 };
+
+  void FreeOverflow() {
+    while (overflow_) {
+      long long* next;
+      memcpy(&next, overflow_, sizeof(next));
+      memdet::delete_impl(overflow_);
+      overflow_ = next;
+    }
+    overflow_words_ = 0;
+  }
+
+  long long* block_;
+  size_t words_;
+  size_t used_;
+  long long* overflow_;
+  size_t overflow_words_;
+
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+};
+
 // Groups common functionality to the specializations of HolderString below.
 // One trick one should be aware on this class is that leverages the fact that
 // PodVector overallocates always. So it is safe to write to str_[size_] for
-// example to null terminate.
+// example to null terminate. Strings of up to kInlineChars - 1 characters,
+// which are most of the strings in messages, are stored without allocating.
 template <typename Ct, typename Derived>
 class StringBase {
 public:
@@ -265,7 +465,7 @@ public:
 
   void assign(const Ct* str, size_t size) {
     str_.Set(str, size);
-    if (size)
+    if (str_.get())
       str_[size] = Ct(0);
   }
 
@@ -296,9 +496,11 @@ public:
   size_t capacity() const { return str_.capacity(); }
 
 protected:
+  enum { kInlineChars = 24 / sizeof(Ct) };
+
   StringBase() {}
 
-  PodVector<Ct> str_;
+  PodVector<Ct, kInlineChars> str_;
 };
 
 template <typename Ct>
@@ -366,6 +568,14 @@ public:
   }
 };
 
+// Returns the call id that follows |*last| and stores it there. Call ids are always positive
+// since 0 means 'no call id', so after the largest int they start again at 1.
+inline int NextCallId(int* last) {
+  const int max_id = static_cast<int>(static_cast<unsigned int>(-1) >> 1);
+  *last = (*last <= 0 || *last == max_id) ? 1 : *last + 1;
+  return *last;
+}
+
 }  // namespace ipc.
 
 #endif // SIMPLE_IPC_UTLIS_H_
@@ -17,6 +17,22 @@
 
 #include "os_includes.h"
 
+// The checked Recover functions of WireType throw, so they are only available
+// when the compiler has exceptions enabled.
+#if defined(__EXCEPTIONS) || defined(_CPPUNWIND) || defined(__cpp_exceptions)
+#define IPC_EXCEPTIONS 1
+#endif
+
+// Variadic templates make messages of any arity possible; see ipc::MsgArgs and
+// Channel::SendArgs(). Without them messages are limited to 10 arguments. The variadic
+// code also needs constexpr, which MSVC only has since Visual Studio 2015.
+#if (__cplusplus >= 201103L) || (defined(_MSC_VER) && (_MSC_VER >= 1900))
+#define IPC_HAS_VARIADIC 1
+#define IPC_CONSTEXPR constexpr
+#else
+#define IPC_CONSTEXPR
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // This header defines the basic c++ types that can be transported via IPC.
 // The main class is WireType which both the channel and the message dispatcher know about.
@@ -26,6 +42,7 @@ namespace ipc {
 
 // These are the types that the IPC knows about. They are divided in four blocks. The first
 // two blocks are 'value'-like types and the second two blocks are 'array' like types.
+// The values go on the wire, so new types are only added at the end.
 enum {
   TYPE_NONE,
   TYPE_INT32,
@@ -40,25 +57,30 @@ enum {
   TYPE_NULLBARRAY,      // like TYPE_BARRAY but its value is NULL.
 
   TYPE_CHAR32,          // not used.
-  TYPE_INT64,           // not used.
-  TYPE_UINT64,          // not used.
-  TYPE_FLOAT32,         // not used.
-  TYPE_FLOAT64,         // not used.
-  TYPE_LONG64,          // not used.
-  TYPE_ULONG64,         // not used.
-  TYPE_NULLINT32ARRAY,  // not used.
-  TYPE_NULLUINT32ARRAY, // not used.
-  TYPE_NULLINT64ARRAY,  // not used.
-  TYPE_NULLUINT64ARRAY, // not used.
+  TYPE_INT64,           // 64-bit signed integer (long long).
+  TYPE_UINT64,          // 64-bit unsigned integer (unsigned long long).
+  TYPE_FLOAT32,         // float.
+  TYPE_FLOAT64,         // double.
+  TYPE_LONG64,          // long on LP64 platforms.
+  TYPE_ULONG64,         // unsigned long on LP64 platforms.
+  TYPE_NULLINT32ARRAY,  // like TYPE_INT32ARRAY but its value is NULL.
+  TYPE_NULLUINT32ARRAY, // like TYPE_UINT32ARRAY but its value is NULL.
+  TYPE_NULLINT64ARRAY,  // like TYPE_INT64ARRAY but its value is NULL.
+  TYPE_NULLUINT64ARRAY, // like TYPE_UINT64ARRAY but its value is NULL.
 
   TYPE_STRING8,         // 8-bit string any encoding.
   TYPE_STRING16,        // 16-bit string any encoding.
   TYPE_BARRAY,          // counted byte array.
 
-  TYPE_INT32ARRAY,      // not used.
-  TYPE_UINT32ARRAY,     // not used.
-  TYPE_INT64ARRAY,      // not used.
-  TYPE_UINT64ARRAY,     // not used.
+  TYPE_INT32ARRAY,      // counted array of int.
+  TYPE_UINT32ARRAY,     // counted array of unsigned int.
+  TYPE_INT64ARRAY,      // counted array of long long.
+  TYPE_UINT64ARRAY,     // counted array of unsigned long long.
+  TYPE_FLT32ARRAY,      // counted array of float.
+  TYPE_FLT64ARRAY,      // counted array of double.
+
+  TYPE_NULLFLT32ARRAY,  // like TYPE_FLT32ARRAY but its value is NULL.
+  TYPE_NULLFLT64ARRAY,  // like TYPE_FLT64ARRAY but its value is NULL.
 
   TYPE_LAST
 };
@@ -70,10 +92,40 @@ struct ByteArray {
   ByteArray(size_t sz, const char* buf) : sz_(sz), buf_(buf) {}
 };
 
+// Wrapper for a counted array of numbers. Unlike ByteArray, |sz_| is the
+// number of elements, not the number of bytes.
+template <typename T>
+struct NumArray {
+  size_t sz_;
+  const T* buf_;
+  NumArray(size_t sz, const T* buf) : sz_(sz), buf_(buf) {}
+};
+
+typedef NumArray<int> Int32Array;
+typedef NumArray<unsigned int> UInt32Array;
+typedef NumArray<long long> Int64Array;
+typedef NumArray<unsigned long long> UInt64Array;
+typedef NumArray<float> Float32Array;
+typedef NumArray<double> Float64Array;
+
 // Variant-like structure without the ownership madness.
 class MultiType {
  public:
-  MultiType(int id) : id_(id) {}
+  MultiType(int id) : ext_data_(NULL), ext_size_(0), id_(id) {}
+
+  // A copy owns its strings and arrays, even when |other| does not.
+  MultiType(const MultiType& other) : ext_data_(NULL), ext_size_(0), id_(other.id_) {
+    CopyFrom(other);
+  }
+
+  MultiType& operator=(const MultiType& other) {
+    if (this != &other) {
+      id_ = other.id_;
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
   int Id() const { return id_; }
 
  protected:
@@ -87,12 +139,34 @@ class MultiType {
     char v_char;
     wchar_t v_wchar;
     void* v_pvoid;
+    long long v_int64;
+    unsigned long long v_uint64;
+    float v_float;
+    double v_double;
   } store;
 
   mutable IPCString store_str8;
   mutable IPCWString store_str16;
 
+  // A string or array that is not owned, in place of the two above.
+  const void* ext_data_;
+  size_t ext_size_;
+
  private:
+  void CopyFrom(const MultiType& other) {
+    store = other.store;
+    ext_data_ = NULL;
+    ext_size_ = 0;
+    if (!other.ext_data_) {
+      store_str8 = other.store_str8;
+      store_str16 = other.store_str16;
+    } else if (id_ == ipc::TYPE_STRING16) {
+      store_str16.assign(static_cast<const wchar_t*>(other.ext_data_), other.ext_size_);
+    } else {
+      store_str8.assign(static_cast<const char*>(other.ext_data_), other.ext_size_);
+    }
+  }
+
   int id_;
 };
 
@@ -104,15 +178,33 @@ class MultiType {
 // 3. Can distinguish between empty strings and NULL strings.
 //
 class WireType : public MultiType {
+ private:
+  friend class WireView;
+
+  enum {
+    kLongType = (sizeof(long) == 8) ? ipc::TYPE_LONG64 : ipc::TYPE_LONG32,
+    kULongType = (sizeof(long) == 8) ? ipc::TYPE_ULONG64 : ipc::TYPE_ULONG32,
+    kSigShift = 8,
+    kSigMask = 0xff
+  };
+
  public:
   // Ctors for supported types
   WireType(int v) : MultiType(ipc::TYPE_INT32) { Set(v); }
 
   WireType(unsigned int v) : MultiType(ipc::TYPE_UINT32) { Set(v); }
 
-  WireType(long v) : MultiType(ipc::TYPE_LONG32) { Set(v); }
+  WireType(long v) : MultiType(kLongType) { Set(v); }
+
+  WireType(unsigned long v) : MultiType(kULongType) { Set(v); }
 
-  WireType(unsigned long v) : MultiType(ipc::TYPE_ULONG32) { Set(v); }
+  WireType(long long v) : MultiType(ipc::TYPE_INT64) { Set(v); }
+
+  WireType(unsigned long long v) : MultiType(ipc::TYPE_UINT64) { Set(v); }
+
+  WireType(float v) : MultiType(ipc::TYPE_FLOAT32) { Set(v); }
+
+  WireType(double v) : MultiType(ipc::TYPE_FLOAT64) { Set(v); }
 
   WireType(char v) : MultiType(ipc::TYPE_CHAR8) { Set(v); }
 
@@ -126,6 +218,40 @@ class WireType : public MultiType {
 
   WireType(const void* vp) : MultiType(ipc::TYPE_VOIDPTR) { Set(vp); }
 
+  WireType(const Int32Array& a) : MultiType(ipc::TYPE_INT32ARRAY) {
+    Set(a, ipc::TYPE_NULLINT32ARRAY);
+  }
+
+  WireType(const UInt32Array& a) : MultiType(ipc::TYPE_UINT32ARRAY) {
+    Set(a, ipc::TYPE_NULLUINT32ARRAY);
+  }
+
+  WireType(const Int64Array& a) : MultiType(ipc::TYPE_INT64ARRAY) {
+    Set(a, ipc::TYPE_NULLINT64ARRAY);
+  }
+
+  WireType(const UInt64Array& a) : MultiType(ipc::TYPE_UINT64ARRAY) {
+    Set(a, ipc::TYPE_NULLUINT64ARRAY);
+  }
+
+  WireType(const Float32Array& a) : MultiType(ipc::TYPE_FLT32ARRAY) {
+    Set(a, ipc::TYPE_NULLFLT32ARRAY);
+  }
+
+  WireType(const Float64Array& a) : MultiType(ipc::TYPE_FLT64ARRAY) {
+    Set(a, ipc::TYPE_NULLFLT64ARRAY);
+  }
+
+  // Ctor for the receiving side, which refers to a string or array of |type| instead of
+  // copying it. |data| holds |size| characters and a null for the strings and |size|
+  // bytes otherwise, aligned for the array elements. It must outlive the WireType but
+  // not its copies, which own the data.
+  WireType(int type, const void* data, size_t size) : MultiType(type) {
+    store.v_uint64 = 0;
+    ext_data_ = data;
+    ext_size_ = size;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Getters: these are used by the sending side of the channel.
   //
@@ -133,12 +259,24 @@ class WireType : public MultiType {
     return store.v_pvoid; 
   }
 
+  // Same as GetAsBits() but for the 64-bit types, which might not fit in a
+  // void pointer. It points to the 8 bytes of the value.
+  const void* GetAs64Bits() const {
+    return &store.v_uint64;
+  }
+
   void GetString8(IPCString* out) const {
-    out->swap(store_str8);
+    if (ext_data_)
+      out->assign(static_cast<const char*>(ext_data_), ext_size_);
+    else
+      out->swap(store_str8);
   }
 
   void GetString16(IPCWString* out) const {
-    out->swap(store_str16);
+    if (ext_data_)
+      out->assign(static_cast<const wchar_t*>(ext_data_), ext_size_);
+    else
+      out->swap(store_str16);
   }
   
   bool IsNullArray() const {
@@ -146,77 +284,313 @@ class WireType : public MultiType {
   }
 
   ///////////////////////////////////////////////////////////////////////////
-  // Recoverers: these are used by the receiving side of the channel.
+  // Signatures: each Load/Recover function below has a signature constant
+  // kSig<name> which encodes the tag it expects and the tag of the NULL
+  // variant, if any. The message dispatcher checks all the arguments against
+  // their signatures before calling any Load function.
   //
-  // These functions throw. Why you ask? well, because the type inference used
-  // elsewhere in the code requires that the error checking to be done at type
-  // conversion time and there is no way to insert a callback there.
-  // This exception does not propagate as it is catched by the callback processor.
+  enum {
+    kSigInt32 = ipc::TYPE_INT32 | (ipc::TYPE_INT32 << kSigShift),
+    kSigUInt32 = ipc::TYPE_UINT32 | (ipc::TYPE_UINT32 << kSigShift),
+    kSigLong32 = ipc::TYPE_LONG32 | (ipc::TYPE_LONG32 << kSigShift),
+    kSigULong32 = ipc::TYPE_ULONG32 | (ipc::TYPE_ULONG32 << kSigShift),
+    kSigLong64 = ipc::TYPE_LONG64 | (ipc::TYPE_LONG64 << kSigShift),
+    kSigULong64 = ipc::TYPE_ULONG64 | (ipc::TYPE_ULONG64 << kSigShift),
+    kSigLong = kLongType | (kLongType << kSigShift),
+    kSigULong = kULongType | (kULongType << kSigShift),
+    kSigInt64 = ipc::TYPE_INT64 | (ipc::TYPE_INT64 << kSigShift),
+    kSigUInt64 = ipc::TYPE_UINT64 | (ipc::TYPE_UINT64 << kSigShift),
+    kSigFloat32 = ipc::TYPE_FLOAT32 | (ipc::TYPE_FLOAT32 << kSigShift),
+    kSigFloat64 = ipc::TYPE_FLOAT64 | (ipc::TYPE_FLOAT64 << kSigShift),
+    kSigChar8 = ipc::TYPE_CHAR8 | (ipc::TYPE_CHAR8 << kSigShift),
+    kSigChar16 = ipc::TYPE_CHAR16 | (ipc::TYPE_CHAR16 << kSigShift),
+    kSigVoidPtr = ipc::TYPE_VOIDPTR | (ipc::TYPE_VOIDPTR << kSigShift),
+    kSigString8 = ipc::TYPE_STRING8 | (ipc::TYPE_NULLSTRING8 << kSigShift),
+    kSigString16 = ipc::TYPE_STRING16 | (ipc::TYPE_NULLSTRING16 << kSigShift),
+    kSigByteArray = ipc::TYPE_BARRAY | (ipc::TYPE_NULLBARRAY << kSigShift),
+    kSigInt32Array = ipc::TYPE_INT32ARRAY | (ipc::TYPE_NULLINT32ARRAY << kSigShift),
+    kSigUInt32Array = ipc::TYPE_UINT32ARRAY | (ipc::TYPE_NULLUINT32ARRAY << kSigShift),
+    kSigInt64Array = ipc::TYPE_INT64ARRAY | (ipc::TYPE_NULLINT64ARRAY << kSigShift),
+    kSigUInt64Array = ipc::TYPE_UINT64ARRAY | (ipc::TYPE_NULLUINT64ARRAY << kSigShift),
+    kSigFloat32Array = ipc::TYPE_FLT32ARRAY | (ipc::TYPE_NULLFLT32ARRAY << kSigShift),
+    kSigFloat64Array = ipc::TYPE_FLT64ARRAY | (ipc::TYPE_NULLFLT64ARRAY << kSigShift)
+  };
+
+  static int SigType(int sig) { return sig & kSigMask; }
+
+  bool MatchesSig(int sig) const {
+    return (Id() == (sig & kSigMask)) || (Id() == (sig >> kSigShift));
+  }
 
-  int RecoverInt32() const {
-    if (Id() != ipc::TYPE_INT32) throw int(ipc::TYPE_INT32);
+  ///////////////////////////////////////////////////////////////////////////
+  // Loaders: these are used by the receiving side of the channel. They do not
+  // check the type so the caller must have called MatchesSig() with the
+  // matching signature first.
+  //
+  int LoadInt32() const {
     return store.v_int;
   }
 
-  unsigned int RecoverUInt32() const {
-    if (Id() != ipc::TYPE_UINT32) throw int(ipc::TYPE_UINT32);
+  unsigned int LoadUInt32() const {
     return store.v_uint;
   }
 
-  unsigned int RecoverLong32() const {
-    if (Id() != ipc::TYPE_LONG32) throw int(ipc::TYPE_LONG32);
+  long LoadLong32() const {
     return store.v_long;
   }
 
-  unsigned int RecoverULong32() const {
-    if (Id() != ipc::TYPE_ULONG32) throw int(ipc::TYPE_ULONG32);
+  unsigned long LoadULong32() const {
     return store.v_ulong;
   }
 
-  char RecoverChar8() const {
-    if (Id() != ipc::TYPE_CHAR8) throw int(ipc::TYPE_CHAR8);
+  long LoadLong64() const {
+    return store.v_long;
+  }
+
+  unsigned long LoadULong64() const {
+    return store.v_ulong;
+  }
+
+  // Use these two for 'long' parameters that must compile on both LP64 and
+  // LLP64 platforms; they expect whatever tag the native 'long' maps to.
+  long LoadLong() const {
+    return store.v_long;
+  }
+
+  unsigned long LoadULong() const {
+    return store.v_ulong;
+  }
+
+  long long LoadInt64() const {
+    return store.v_int64;
+  }
+
+  unsigned long long LoadUInt64() const {
+    return store.v_uint64;
+  }
+
+  float LoadFloat32() const {
+    return store.v_float;
+  }
+
+  double LoadFloat64() const {
+    return store.v_double;
+  }
+
+  char LoadChar8() const {
     return store.v_char;
   }
 
-  wchar_t RecoverChar16() const {
-    if (Id() != ipc::TYPE_CHAR16) throw int(ipc::TYPE_CHAR16);
+  wchar_t LoadChar16() const {
     return store.v_wchar;
   }
 
-  void* RecoverVoidPtr() const {
-    if (Id() != ipc::TYPE_VOIDPTR) throw int (ipc::TYPE_VOIDPTR);
+  void* LoadVoidPtr() const {
     return store.v_pvoid;
   }
 
+  const char* LoadString8() const {
+    if (Id() != ipc::TYPE_STRING8)
+      return NULL;
+    return ext_data_ ? static_cast<const char*>(ext_data_) : store_str8.c_str();
+  }
+
+  const wchar_t* LoadString16() const {
+    if (Id() != ipc::TYPE_STRING16)
+      return NULL;
+    return ext_data_ ? static_cast<const wchar_t*>(ext_data_) : store_str16.c_str();
+  }
+
+  const ByteArray LoadByteArray() const {
+    if (Id() == ipc::TYPE_NULLBARRAY) return ByteArray(0, NULL);
+    return ByteArray(Size8(), Data8());
+  }
+
+  const Int32Array LoadInt32Array() const {
+    return LoadArray<int>(ipc::TYPE_INT32ARRAY);
+  }
+
+  const UInt32Array LoadUInt32Array() const {
+    return LoadArray<unsigned int>(ipc::TYPE_UINT32ARRAY);
+  }
+
+  const Int64Array LoadInt64Array() const {
+    return LoadArray<long long>(ipc::TYPE_INT64ARRAY);
+  }
+
+  const UInt64Array LoadUInt64Array() const {
+    return LoadArray<unsigned long long>(ipc::TYPE_UINT64ARRAY);
+  }
+
+  const Float32Array LoadFloat32Array() const {
+    return LoadArray<float>(ipc::TYPE_FLT32ARRAY);
+  }
+
+  const Float64Array LoadFloat64Array() const {
+    return LoadArray<double>(ipc::TYPE_FLT64ARRAY);
+  }
+
+#if defined(IPC_EXCEPTIONS)
+  ///////////////////////////////////////////////////////////////////////////
+  // Recoverers: checked versions of the loaders, they throw the expected type
+  // id on a mismatch. They are not available when building without exceptions.
+  //
+  int RecoverInt32() const {
+    if (!MatchesSig(kSigInt32)) throw int(SigType(kSigInt32));
+    return LoadInt32();
+  }
+
+  unsigned int RecoverUInt32() const {
+    if (!MatchesSig(kSigUInt32)) throw int(SigType(kSigUInt32));
+    return LoadUInt32();
+  }
+
+  long RecoverLong32() const {
+    if (!MatchesSig(kSigLong32)) throw int(SigType(kSigLong32));
+    return LoadLong32();
+  }
+
+  unsigned long RecoverULong32() const {
+    if (!MatchesSig(kSigULong32)) throw int(SigType(kSigULong32));
+    return LoadULong32();
+  }
+
+  long RecoverLong64() const {
+    if (!MatchesSig(kSigLong64)) throw int(SigType(kSigLong64));
+    return LoadLong64();
+  }
+
+  unsigned long RecoverULong64() const {
+    if (!MatchesSig(kSigULong64)) throw int(SigType(kSigULong64));
+    return LoadULong64();
+  }
+
+  long RecoverLong() const {
+    if (!MatchesSig(kSigLong)) throw int(SigType(kSigLong));
+    return LoadLong();
+  }
+
+  unsigned long RecoverULong() const {
+    if (!MatchesSig(kSigULong)) throw int(SigType(kSigULong));
+    return LoadULong();
+  }
+
+  long long RecoverInt64() const {
+    if (!MatchesSig(kSigInt64)) throw int(SigType(kSigInt64));
+    return LoadInt64();
+  }
+
+  unsigned long long RecoverUInt64() const {
+    if (!MatchesSig(kSigUInt64)) throw int(SigType(kSigUInt64));
+    return LoadUInt64();
+  }
+
+  float RecoverFloat32() const {
+    if (!MatchesSig(kSigFloat32)) throw int(SigType(kSigFloat32));
+    return LoadFloat32();
+  }
+
+  double RecoverFloat64() const {
+    if (!MatchesSig(kSigFloat64)) throw int(SigType(kSigFloat64));
+    return LoadFloat64();
+  }
+
+  char RecoverChar8() const {
+    if (!MatchesSig(kSigChar8)) throw int(SigType(kSigChar8));
+    return LoadChar8();
+  }
+
+  wchar_t RecoverChar16() const {
+    if (!MatchesSig(kSigChar16)) throw int(SigType(kSigChar16));
+    return LoadChar16();
+  }
+
+  void* RecoverVoidPtr() const {
+    if (!MatchesSig(kSigVoidPtr)) throw int(SigType(kSigVoidPtr));
+    return LoadVoidPtr();
+  }
+
   const char* RecoverString8() const {
-    if (Id() == ipc::TYPE_STRING8) return store_str8.c_str(); 
-    else if (Id() == ipc::TYPE_NULLSTRING8) return NULL;
-    else throw int(ipc::TYPE_STRING8);
+    if (!MatchesSig(kSigString8)) throw int(SigType(kSigString8));
+    return LoadString8();
   }
-  
+
   const wchar_t* RecoverString16() const {
-    if (Id() == ipc::TYPE_STRING16) return store_str16.c_str(); 
-    else if (Id() == ipc::TYPE_NULLSTRING16) return NULL;
-    else throw int(ipc::TYPE_STRING16);
+    if (!MatchesSig(kSigString16)) throw int(SigType(kSigString16));
+    return LoadString16();
   }
 
   const ByteArray RecoverByteArray() const {
-    if (Id() == ipc::TYPE_BARRAY) return ByteArray(store_str8.size(), store_str8.c_str());
-    else if (Id() == ipc::TYPE_NULLBARRAY) return ByteArray(0, NULL);
-    else throw int(ipc::TYPE_BARRAY);
+    if (!MatchesSig(kSigByteArray)) throw int(SigType(kSigByteArray));
+    return LoadByteArray();
+  }
+
+  const Int32Array RecoverInt32Array() const {
+    if (!MatchesSig(kSigInt32Array)) throw int(SigType(kSigInt32Array));
+    return LoadInt32Array();
+  }
+
+  const UInt32Array RecoverUInt32Array() const {
+    if (!MatchesSig(kSigUInt32Array)) throw int(SigType(kSigUInt32Array));
+    return LoadUInt32Array();
   }
 
+  const Int64Array RecoverInt64Array() const {
+    if (!MatchesSig(kSigInt64Array)) throw int(SigType(kSigInt64Array));
+    return LoadInt64Array();
+  }
+
+  const UInt64Array RecoverUInt64Array() const {
+    if (!MatchesSig(kSigUInt64Array)) throw int(SigType(kSigUInt64Array));
+    return LoadUInt64Array();
+  }
+
+  const Float32Array RecoverFloat32Array() const {
+    if (!MatchesSig(kSigFloat32Array)) throw int(SigType(kSigFloat32Array));
+    return LoadFloat32Array();
+  }
+
+  const Float64Array RecoverFloat64Array() const {
+    if (!MatchesSig(kSigFloat64Array)) throw int(SigType(kSigFloat64Array));
+    return LoadFloat64Array();
+  }
+#endif  // defined(IPC_EXCEPTIONS)
+
  private:
-  void Set(int v) { store.v_int = v; }
-  void Set(unsigned int v) { store.v_uint = v; }
-  void Set(long v) { store.v_long = v; }
-  void Set(unsigned long v) { store.v_ulong = v; }
-  void Set(char v) { store.v_int = 0; store.v_char = v; }
-  void Set(wchar_t v) { store.v_int = 0; store.v_wchar = v; }
+  // The bytes of the byte and numeric arrays.
+  const char* Data8() const {
+    return ext_data_ ? static_cast<const char*>(ext_data_) : store_str8.c_str();
+  }
+
+  size_t Size8() const {
+    return ext_data_ ? ext_size_ : store_str8.size();
+  }
+
+  // The array elements live in |store_str8|, whose inline and heap storage are both
+  // aligned for long long and double, or in memory that the receiving side aligned,
+  // so the returned pointer is suitably aligned for T.
+  template <typename T>
+  const NumArray<T> LoadArray(int type) const {
+    if (Id() != type)
+      return NumArray<T>(0, NULL);
+    return NumArray<T>(Size8() / sizeof(T), reinterpret_cast<const T*>(Data8()));
+  }
+
+  void Set(int v) { store.v_uint64 = 0; store.v_int = v; }
+  void Set(unsigned int v) { store.v_uint64 = 0; store.v_uint = v; }
+  void Set(long v) { store.v_uint64 = 0; store.v_long = v; }
+  void Set(unsigned long v) { store.v_uint64 = 0; store.v_ulong = v; }
+  void Set(long long v) { store.v_int64 = v; }
+  void Set(unsigned long long v) { store.v_uint64 = v; }
+  void Set(float v) { store.v_uint64 = 0; store.v_float = v; }
+  void Set(double v) { store.v_double = v; }
+  void Set(char v) { store.v_uint64 = 0; store.v_char = v; }
+  void Set(wchar_t v) { store.v_uint64 = 0; store.v_wchar = v; }
   void Set(const void* v) { store.v_pvoid = const_cast<void*>(v); }
   
   void Set(const char* pc) { 
     if (!pc) {
+      store.v_uint64 = 0;
       store.v_int = -1;
       SetId(TYPE_NULLSTRING8);
       return;
@@ -226,6 +600,7 @@ class WireType : public MultiType {
 
   void Set(const wchar_t* pc) {
     if (!pc) {
+      store.v_uint64 = 0;
       store.v_int = -1;
       SetId(TYPE_NULLSTRING16);
       return;
@@ -235,6 +610,7 @@ class WireType : public MultiType {
 
   void Set(const ByteArray& ba) {
     if (!ba.buf_) {
+      store.v_uint64 = 0;
       store.v_int = -1;
       SetId(TYPE_NULLBARRAY);
       return;
@@ -242,8 +618,163 @@ class WireType : public MultiType {
     store_str8.assign(ba.buf_, ba.sz_);
   }
 
+  template <typename T>
+  void Set(const NumArray<T>& na, int null_type) {
+    if (!na.buf_) {
+      store.v_uint64 = 0;
+      store.v_int = -1;
+      SetId(null_type);
+      return;
+    }
+    store_str8.assign(reinterpret_cast<const char*>(na.buf_), na.sz_ * sizeof(T));
+  }
+
+};
+
+// WireView is the sending side counterpart of WireType. It has the same implicit
+// constructors but it does not own anything: strings and arrays are kept as a pointer
+// and a length, so building one never allocates or copies. It is 16 bytes on both 32
+// and 64 bit builds and is meant to be passed by value to Channel::Send().
+//
+// The pointed-to data must outlive the Send() call. Strings and arrays are limited to
+// 4G elements.
+class WireView {
+ public:
+  WireView(int v) : size_(0), id_(ipc::TYPE_INT32) { Set(v); }
+
+  WireView(unsigned int v) : size_(0), id_(ipc::TYPE_UINT32) { Set(v); }
+
+  WireView(long v) : size_(0), id_(WireType::kLongType) { Set(v); }
+
+  WireView(unsigned long v) : size_(0), id_(WireType::kULongType) { Set(v); }
+
+  WireView(long long v) : size_(0), id_(ipc::TYPE_INT64) { Set(v); }
+
+  WireView(unsigned long long v) : size_(0), id_(ipc::TYPE_UINT64) { Set(v); }
+
+  WireView(float v) : size_(0), id_(ipc::TYPE_FLOAT32) { Set(v); }
+
+  WireView(double v) : size_(0), id_(ipc::TYPE_FLOAT64) { Set(v); }
+
+  WireView(char v) : size_(0), id_(ipc::TYPE_CHAR8) { Set(v); }
+
+  WireView(wchar_t v) : size_(0), id_(ipc::TYPE_CHAR16) { Set(v); }
+
+  WireView(const void* vp) : size_(0), id_(ipc::TYPE_VOIDPTR) { Set(vp); }
+
+  WireView(const char* pc) : size_(0), id_(ipc::TYPE_STRING8) {
+    SetData(pc, pc ? strlen(pc) : 0, ipc::TYPE_NULLSTRING8);
+  }
+
+  WireView(const wchar_t* pc) : size_(0), id_(ipc::TYPE_STRING16) {
+    SetData(pc, pc ? wcslen(pc) : 0, ipc::TYPE_NULLSTRING16);
+  }
+
+  WireView(const ByteArray& ba) : size_(0), id_(ipc::TYPE_BARRAY) {
+    SetData(ba.buf_, ba.sz_, ipc::TYPE_NULLBARRAY);
+  }
+
+  WireView(const Int32Array& a) : size_(0), id_(ipc::TYPE_INT32ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(int), ipc::TYPE_NULLINT32ARRAY);
+  }
+
+  WireView(const UInt32Array& a) : size_(0), id_(ipc::TYPE_UINT32ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(unsigned int), ipc::TYPE_NULLUINT32ARRAY);
+  }
+
+  WireView(const Int64Array& a) : size_(0), id_(ipc::TYPE_INT64ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(long long), ipc::TYPE_NULLINT64ARRAY);
+  }
+
+  WireView(const UInt64Array& a) : size_(0), id_(ipc::TYPE_UINT64ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(unsigned long long), ipc::TYPE_NULLUINT64ARRAY);
+  }
+
+  WireView(const Float32Array& a) : size_(0), id_(ipc::TYPE_FLT32ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(float), ipc::TYPE_NULLFLT32ARRAY);
+  }
+
+  WireView(const Float64Array& a) : size_(0), id_(ipc::TYPE_FLT64ARRAY) {
+    SetData(a.buf_, a.sz_ * sizeof(double), ipc::TYPE_NULLFLT64ARRAY);
+  }
+
+  // Views the value held by |wt|, which must outlive the view.
+  WireView(const WireType& wt) : size_(0), id_(wt.Id()) {
+    memcpy(&store_, &wt.store, sizeof(store_));
+    switch (id_) {
+      case ipc::TYPE_STRING16:
+        store_.data = wt.LoadString16();
+        size_ = static_cast<unsigned int>(wt.ext_data_ ? wt.ext_size_ : wt.store_str16.size());
+        break;
+      case ipc::TYPE_STRING8:
+      case ipc::TYPE_BARRAY:
+      case ipc::TYPE_INT32ARRAY:
+      case ipc::TYPE_UINT32ARRAY:
+      case ipc::TYPE_INT64ARRAY:
+      case ipc::TYPE_UINT64ARRAY:
+      case ipc::TYPE_FLT32ARRAY:
+      case ipc::TYPE_FLT64ARRAY:
+        store_.data = wt.Data8();
+        size_ = static_cast<unsigned int>(wt.Size8());
+        break;
+      default:
+        break;
+    }
+  }
+
+  int Id() const { return id_; }
+
+  // Same as the WireType getters.
+  void* GetAsBits() const {
+    return store_.bits;
+  }
+
+  const void* GetAs64Bits() const {
+    return &store_.bits64;
+  }
+
+  // For strings and arrays. Size() is in characters for the strings and in bytes for
+  // everything else.
+  const void* Data() const {
+    return store_.data;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+ private:
+  template <typename T>
+  void Set(T v) {
+    store_.bits64 = 0;
+    memcpy(&store_, &v, sizeof(v));
+  }
+
+  // NULL strings and arrays become the matching NULL type with the same bits as in
+  // WireType.
+  void SetData(const void* data, size_t size, int null_type) {
+    if (!data) {
+      Set(-1);
+      id_ = null_type;
+      return;
+    }
+    store_.bits64 = 0;
+    store_.data = data;
+    size_ = static_cast<unsigned int>(size);
+  }
+
+  union {
+    void* bits;
+    const void* data;
+    unsigned long long bits64;
+  } store_;
+  unsigned int size_;
+  int id_;
 };
 
+// Fails to compile if WireView is not 16 bytes.
+typedef char WireViewSizeCheck[(sizeof(WireView) == 16) ? 1 : -1];
+
 }  // namespace ipc.
 
 #endif  // SIMPLE_IPC_WIRE_TYPES_H_
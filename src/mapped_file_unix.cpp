@@ -0,0 +1,39 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_file_unix.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+bool MappedFile::Create(const char* path, size_t size) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return false;
+  }
+  return Map(fd, size, false);
+}
+
+bool MappedFile::Open(const char* path, bool read_only) {
+  int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+  if (fd == -1) {
+    return false;
+  }
+  return MapAll(fd, read_only);
+}
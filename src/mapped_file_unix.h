@@ -0,0 +1,35 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MAPPED_FILE_UNIX_H_
+#define SIMPLE_IPC_MAPPED_FILE_UNIX_H_
+
+
+#include "os_includes.h"
+#include "mapped_memory_unix.h"
+
+// A file mapped in memory, for ipc::CaptureLog and ipc::CaptureReader. Changes to the memory
+// go to the file.
+class MappedFile : public MappedMemory {
+public:
+  // Creates the file with |size| bytes, all zero, replacing an old one with the same name.
+  bool Create(const char* path, size_t size);
+
+  // Maps a file that already exists, such as a capture that another process wrote. With
+  // |read_only| the file only needs to be readable and the memory must not be written.
+  bool Open(const char* path, bool read_only = false);
+};
+
+
+#endif  // SIMPLE_IPC_MAPPED_FILE_UNIX_H_
@@ -0,0 +1,53 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_memory_unix.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+MappedMemory::MappedMemory() : mem_(NULL), size_(0) {
+}
+
+MappedMemory::~MappedMemory() {
+  if (mem_) {
+    munmap(mem_, size_);
+  }
+}
+
+bool MappedMemory::Map(int fd, size_t size, bool read_only) {
+  const int prot = read_only ? PROT_READ : (PROT_READ | PROT_WRITE);
+  void* mem = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+  if (mem_) {
+    munmap(mem_, size_);
+  }
+  mem_ = mem;
+  size_ = size;
+  return true;
+}
+
+bool MappedMemory::MapAll(int fd, bool read_only) {
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+    close(fd);
+    return false;
+  }
+  return Map(fd, st.st_size, read_only);
+}
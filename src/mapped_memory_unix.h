@@ -0,0 +1,49 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MAPPED_MEMORY_UNIX_H_
+#define SIMPLE_IPC_MAPPED_MEMORY_UNIX_H_
+
+
+#include "os_includes.h"
+
+// The mapping that MappedFile and SharedMemory have in common. It is unmapped when the
+// object goes away.
+class MappedMemory {
+public:
+  void* memory() const { return mem_; }
+  size_t size() const { return size_; }
+
+protected:
+  MappedMemory();
+  ~MappedMemory();
+
+  // Maps |size| bytes of |fd| shared with every other mapping of it, replacing the old
+  // mapping. With |read_only| writing to the memory crashes, so |fd| can be read-only too.
+  // Takes ownership of |fd|, which is not needed once it is mapped.
+  bool Map(int fd, size_t size, bool read_only);
+
+  // Like Map() with the size of what |fd| refers to, which must not be empty.
+  bool MapAll(int fd, bool read_only);
+
+private:
+  void* mem_;
+  size_t size_;
+
+  MappedMemory(const MappedMemory&);
+  MappedMemory& operator=(const MappedMemory&);
+};
+
+
+#endif  // SIMPLE_IPC_MAPPED_MEMORY_UNIX_H_
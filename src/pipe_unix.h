@@ -43,6 +43,8 @@ public:
 
   bool IsConnected() const { return fd_ != -1; }
 
+  int fd() const { return fd_; }
+
 private:
   int fd_;
 };
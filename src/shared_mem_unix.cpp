@@ -0,0 +1,46 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared_mem_unix.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+bool SharedMemory::Create(const char* name, size_t size) {
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return false;
+  }
+  return Map(fd, size, false);
+}
+
+bool SharedMemory::Open(const char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) {
+    return false;
+  }
+  return MapAll(fd, false);
+}
+
+bool SharedMemory::Remove(const char* name) {
+  return (shm_unlink(name) == 0);
+}
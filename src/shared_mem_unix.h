@@ -0,0 +1,37 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SHARED_MEM_UNIX_H_
+#define SIMPLE_IPC_SHARED_MEM_UNIX_H_
+
+
+#include "os_includes.h"
+#include "mapped_memory_unix.h"
+
+// A named region of memory that several processes can map, for ipc::PubSubPublisher and
+// ipc::PubSubSubscriber. The name is like a file name with a single leading slash.
+class SharedMemory : public MappedMemory {
+public:
+  // Creates the region with |size| bytes, all zero, replacing an old one with the same name.
+  bool Create(const char* name, size_t size);
+
+  // Maps a region that another process created.
+  bool Open(const char* name);
+
+  // Removes the name so no one else can open it. The regions already mapped stay valid.
+  static bool Remove(const char* name);
+};
+
+
+#endif  // SIMPLE_IPC_SHARED_MEM_UNIX_H_
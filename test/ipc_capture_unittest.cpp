@@ -0,0 +1,232 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ipc_test_helpers.h"
+#include "ipc_capture.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include <unistd.h>
+#include "pipe_unix.h"
+#include "mapped_file_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the wire capture and replay. The client end of a pipe is captured while it makes a
+// few calls, and then the replies it got are replayed to a new dispatcher.
+
+namespace {
+
+typedef ipc::CaptureTransport<PipeTransport> CapturePipe;
+typedef ipc::Channel<CapturePipe, ipc::Encoder, ipc::Decoder> CaptureChannel;
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+typedef ipc::Channel<ipc::ReplayTransport, ipc::Encoder, ipc::Decoder> ReplayChannel;
+
+const int kNumCalls = 4;
+const int kCallGapMs = 15;
+
+void SleepMs(int ms) {
+#if defined(WIN32)
+  ::Sleep(ms);
+#else
+  usleep(ms * 1000);
+#endif
+}
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(140, 2) {
+  IPC_MSG_P1(int, Int32)                // Value, 0 to stop the server.
+  IPC_MSG_P2(const char*, String8)      // Name.
+};
+
+DEFINE_IPC_MSG_CONV(141, 2) {
+  IPC_MSG_P1(int, Int32)                // Value times three.
+  IPC_MSG_P2(const char*, String8)      // Name, echoed.
+};
+
+namespace {
+
+class TripleMsg : public DispTestMsg,
+                  public ipc::MsgIn<140, TripleMsg, PipeChannel>,
+                  public ipc::MsgOut<PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel* ch, int value, const char* name) {
+    if (!value)
+      return ipc::OnMsgReady;
+    return SendMsg(141, ch, value * 3, name);
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  TripleMsg* MsgHandler(int) {
+    return this;
+  }
+};
+
+// Checks the replies in order. With |stop| it ends Receive() after each one.
+template <class ChannelT>
+class TripledReply : public DispTestMsg,
+                     public ipc::MsgIn<141, TripledReply<ChannelT>, ChannelT> {
+public:
+  explicit TripledReply(bool stop) : stop_(stop), count_(0) {}
+
+  size_t OnMsg(ChannelT*, int value, const char* name) {
+    ++count_;
+    if ((value != count_ * 3) || strcmp(name, "capture"))
+      return ipc::OnMsgAppErrorBase;
+    return stop_ ? ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  TripledReply* MsgHandler(int) {
+    return this;
+  }
+
+  bool stop_;
+  int count_;
+};
+
+}  // namespace.
+
+int TestCaptureReplay() {
+  static long long log_mem[8 * 1024];
+  ipc::CaptureLog log;
+  if (!log.Init(log_mem, sizeof(log_mem)))
+    return 1;
+
+  TripleMsg handler;
+  PipeServer<PipeChannel> server;
+  if (!server.Start(&handler))
+    return 2;
+
+  PipeTransport client_transport;
+  server.Connect(&client_transport);
+  CapturePipe capture(&client_transport, &log);
+  CaptureChannel client_channel(&capture);
+  TripledReply<CaptureChannel> reply(true);
+  for (int ix = 1; ix <= kNumCalls; ++ix) {
+    if (ix != 1)
+      SleepMs(kCallGapMs);
+    const ipc::WireView args[] = { ipc::WireView(ix), ipc::WireView("capture") };
+    if ((client_channel.Send(140, args, 2) != ipc::RcOK) ||
+        (client_channel.Receive(&reply) != ipc::OnMsgReady))
+      return 3;
+  }
+  const ipc::WireView stop[] = { ipc::WireView(0), ipc::WireView("") };
+  if (client_channel.Send(140, stop, 2) != ipc::RcOK)
+    return 4;
+  if ((server.Join() != ipc::OnMsgReady) || (reply.count_ != kNumCalls) || log.Dropped())
+    return 5;
+
+  // Every call is one frame out and, on a pipe, one frame in.
+  ipc::CaptureReader reader;
+  if (!reader.Attach(log_mem, sizeof(log_mem)))
+    return 6;
+  ipc::CaptureReader::Item item;
+  int frames_out = 0;
+  int frames_in = 0;
+  long long first_in = 0;
+  long long last_in = 0;
+  while (reader.Next(&item)) {
+    if (item.direction == ipc::CAPTURE_OUT) {
+      ++frames_out;
+    } else {
+      if (!frames_in++)
+        first_in = item.time;
+      last_in = item.time;
+    }
+  }
+  if ((frames_out != kNumCalls + 1) || (frames_in != kNumCalls))
+    return 7;
+
+  // As fast as possible, and then again with the original gaps.
+  ipc::ReplayTransport replay(&reader, ipc::REPLAY_FAST);
+  ReplayChannel replay_channel(&replay);
+  replay.Restart();
+  TripledReply<ReplayChannel> fast(false);
+  if ((replay_channel.Receive(&fast) != ipc::RcErrTransportRead) || (fast.count_ != kNumCalls))
+    return 8;
+
+  ipc::ReplayTransport paced_replay(&reader, ipc::REPLAY_PACED);
+  ReplayChannel paced_channel(&paced_replay);
+  paced_replay.Restart();
+  TripledReply<ReplayChannel> paced(false);
+  const long long start = ipc::ChannelMetrics::Now();
+  if ((paced_channel.Receive(&paced) != ipc::RcErrTransportRead) || (paced.count_ != kNumCalls))
+    return 9;
+  if (ipc::ChannelMetrics::Now() - start < last_in - first_in)
+    return 10;
+
+#if !defined(WIN32)
+  // A capture in a file can be read by another process.
+  const char kCaptureFile[] = "simple-ipc-test.capture";
+  {
+    MappedFile file;
+    ipc::CaptureLog file_log;
+    if (!file.Create(kCaptureFile, 4096) || !file_log.Init(file.memory(), file.size()))
+      return 11;
+    file_log.Append(ipc::CAPTURE_IN, "frame", 5);
+  }
+  MappedFile file;
+  ipc::CaptureReader file_reader;
+  const bool opened = file.Open(kCaptureFile, true) && file_reader.Attach(file.memory(), file.size());
+  remove(kCaptureFile);
+  if (!opened || !file_reader.Next(&item))
+    return 12;
+  if ((item.size != 5) || memcmp(item.data, "frame", 5) || file_reader.Next(&item))
+    return 13;
+#endif
+  return 0;
+}
+
+int TestCaptureLogFull() {
+  long long log_mem[32];
+  memset(log_mem, 0, sizeof(log_mem));
+  ipc::CaptureLog log;
+  if (!log.Init(log_mem, sizeof(log_mem)))
+    return 1;
+  char frame[40];
+  memset(frame, 'f', sizeof(frame));
+  for (int ix = 0; ix != 10; ++ix)
+    log.Append(ipc::CAPTURE_OUT, frame, sizeof(frame));
+  if (!log.Dropped())
+    return 2;
+
+  ipc::CaptureReader reader;
+  if (!reader.Attach(log_mem, sizeof(log_mem)))
+    return 3;
+  ipc::CaptureReader::Item item;
+  long frames = 0;
+  while (reader.Next(&item)) {
+    if ((item.size != sizeof(frame)) || (item.direction != ipc::CAPTURE_OUT))
+      return 4;
+    ++frames;
+  }
+  if (frames + log.Dropped() != 10)
+    return 5;
+
+  // Memory that was never a log is not read.
+  long long junk[32];
+  memset(junk, 0x5a, sizeof(junk));
+  return reader.Attach(junk, sizeof(junk)) ? 6 : 0;
+}
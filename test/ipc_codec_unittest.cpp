@@ -100,7 +100,7 @@ int TestCodecRaw1() {
     D2V(2),                              // arg count
     D2V(11),                             // data count (44 bytes)
     D2V(ipc::TYPE_INT32),                // first arg type
-    D2V(ipc::TYPE_STRING8 | 
+    D2V(int(ipc::TYPE_STRING8) | 
         ipc::Encoder::ENC_STRN08),       // second arg type
     D2V(ipc::Encoder::ENC_STARTD),       // start of data mark        
     D2V(ix),                             // first arg
@@ -155,7 +155,7 @@ int TestCodecRaw2() {
     D2V(17),                                // data count (wchar_t is 4 bytes).
 #endif
     D2V(ipc::TYPE_NULLSTRING16),            // first arg type
-    D2V(ipc::TYPE_STRING16 |
+    D2V(int(ipc::TYPE_STRING16) |
         ipc::Encoder::ENC_STRN16),          // second arg type
     D2V(ipc::TYPE_UINT32),                  // third arg type
     D2V(ipc::Encoder::ENC_STARTD),          // start of data mark        
@@ -223,7 +223,7 @@ int TestCodecRaw3() {
     D2V(ipc::TYPE_CHAR8),                // first arg type
     D2V(ipc::TYPE_CHAR16),               // second arg type
     D2V(ipc::TYPE_CHAR8),                // third arg type
-    D2V(ipc::TYPE_STRING8 |              // fourth arg type
+    D2V(int(ipc::TYPE_STRING8) |         // fourth arg type
         ipc::Encoder::ENC_STRN08),
     D2V(ipc::Encoder::ENC_STARTD),       // start of data mark        
     D2V(ca),                             // first arg
@@ -284,7 +284,7 @@ int TestCodecRaw4() {
     D2V(12),                             // msg id
     D2V(2),                              // arg count
     D2V(13),                             // data count
-    D2V(ipc::TYPE_BARRAY |               // first arg type
+    D2V(int(ipc::TYPE_BARRAY) |          // first arg type
         ipc::Encoder::ENC_STRN08),
     D2V(ipc::TYPE_INT32),                // second arg type
     D2V(ipc::Encoder::ENC_STARTD),       // start of data mark
@@ -374,7 +374,7 @@ int TestCodecRaw6() {
     D2V(14),                                // msg id
     D2V(1),                                 // arg count
     D2V(8),                                 // data count
-    D2V(ipc::TYPE_STRING16 |
+    D2V(int(ipc::TYPE_STRING16) |
         ipc::Encoder::ENC_STRN16),          // first arg type
     D2V(ipc::Encoder::ENC_STARTD),          // start of data mark
     D2V(0),                                 // string size count
@@ -480,7 +480,7 @@ int TestCodecRaw8() {
     D2V(12),                             // msg id
     D2V(2),                              // arg count
     D2V(11),                             // data count
-    D2V(ipc::TYPE_BARRAY |               // first arg type
+    D2V(int(ipc::TYPE_BARRAY) |          // first arg type
         ipc::Encoder::ENC_STRN08),
     D2V(ipc::TYPE_INT32),                // second arg type
     D2V(ipc::Encoder::ENC_STARTD),       // start of data mark
@@ -505,4 +505,258 @@ int TestCodecRaw8() {
     return -1;
 
   return 0;
-}
\ No newline at end of file
+}
+int TestCodecRaw9() {
+  const long long ll = -1234567890123ll;
+  const unsigned long long ull = 0xfedcba9876543210ull;
+  const float ff = 3.5f;
+  const double dd = -2.0e100;
+
+  const char* cll = reinterpret_cast<const char*>(&ll);
+  const char* cull = reinterpret_cast<const char*>(&ull);
+  const char* cdd = reinterpret_cast<const char*>(&dd);
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage16 msg16;
+  msg16.DoSend(&channel, ll, ull, ff, dd);
+
+  D2V fmt [] = {
+    D2V(ipc::Encoder::ENC_HEADER),          // start of header mark
+    D2V(16),                                // msg id
+    D2V(4),                                 // arg count
+    D2V(17),                                // data count
+    D2V(int(ipc::TYPE_INT64) |
+        ipc::Encoder::ENC_WORD64),          // first arg type
+    D2V(int(ipc::TYPE_UINT64) |
+        ipc::Encoder::ENC_WORD64),          // second arg type
+    D2V(ipc::TYPE_FLOAT32),                 // third arg type
+    D2V(int(ipc::TYPE_FLOAT64) |
+        ipc::Encoder::ENC_WORD64),          // fourth arg type
+    D2V(ipc::Encoder::ENC_STARTD),          // start of data mark
+    D2V(cll),                               // first arg (two words)
+    D2V(cll + 4),
+    D2V(cull),                              // second arg (two words)
+    D2V(cull + 4),
+    D2V(reinterpret_cast<const char*>(&ff)),// third arg
+    D2V(cdd),                               // fourth arg (two words)
+    D2V(cdd + 4),
+    D2V(ipc::Encoder::ENC_ENDDAT)           // end of data mark
+  };
+
+  // The layout above is for 32-bit words. Elsewhere only the decoding is checked.
+  if (sizeof(void*) == 4) {
+    int rv = TestIPCBuffer(&transport, fmt, sizeof(fmt)/sizeof(fmt[0]));
+    if (rv != 0)
+      return rv;
+  }
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+
+  if (!dec.Success())
+    return -1;
+  if (rx.MsgId() != 16)
+    return -2;
+  if (rx.GetArgCount() != 4)
+    return -3;
+  if (rx.GetArg(0).RecoverInt64() != ll)
+    return -4;
+  if (rx.GetArg(1).RecoverUInt64() != ull)
+    return -5;
+  if (rx.GetArg(2).RecoverFloat32() != ff)
+    return -6;
+  if (rx.GetArg(3).RecoverFloat64() != dd)
+    return -7;
+
+  return 0;
+}
+
+int TestCodecRaw10() {
+  const int ia[] = { 7, -8, 9 };
+  const double da[] = { 0.25, -1.0e-10 };
+
+  const char* cia = reinterpret_cast<const char*>(ia);
+  const char* cda = reinterpret_cast<const char*>(da);
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage17 msg17;
+  msg17.DoSend(&channel, ia, countof(ia), da, countof(da));
+
+  D2V fmt [] = {
+    D2V(ipc::Encoder::ENC_HEADER),          // start of header mark
+    D2V(17),                                // msg id
+    D2V(3),                                 // arg count
+    D2V(20),                                // data count
+    D2V(int(ipc::TYPE_INT32ARRAY) |
+        ipc::Encoder::ENC_ARRAY8),          // first arg type
+    D2V(int(ipc::TYPE_FLT64ARRAY) |
+        ipc::Encoder::ENC_ARRAY8),          // second arg type
+    D2V(ipc::TYPE_NULLUINT64ARRAY),         // third arg type
+    D2V(ipc::Encoder::ENC_STARTD),          // start of data mark
+    D2V(int(sizeof(ia))),                   // first arg byte count
+    D2V(0),                                 // padding to 8 bytes
+    D2V(cia),                               // first arg
+    D2V(cia + 4),
+    D2V(cia + 8),
+    D2V(int(sizeof(da))),                   // second arg byte count
+    D2V(cda),                               // second arg
+    D2V(cda + 4),
+    D2V(cda + 8),
+    D2V(cda + 12),
+    D2V(-1),                                // third arg (null array)
+    D2V(ipc::Encoder::ENC_ENDDAT)           // end of data mark
+  };
+
+  // The layout above is for 32-bit words. Elsewhere only the decoding is checked.
+  if (sizeof(void*) == 4) {
+    int rv = TestIPCBuffer(&transport, fmt, sizeof(fmt)/sizeof(fmt[0]));
+    if (rv != 0)
+      return rv;
+  }
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+
+  if (!dec.Success())
+    return -1;
+  if (rx.MsgId() != 17)
+    return -2;
+  if (rx.GetArgCount() != 3)
+    return -3;
+
+  ipc::Int32Array ria = rx.GetArg(0).RecoverInt32Array();
+  if ((ria.sz_ != countof(ia)) || (0 != memcmp(ria.buf_, ia, sizeof(ia))))
+    return -4;
+  ipc::Float64Array rda = rx.GetArg(1).RecoverFloat64Array();
+  if ((rda.sz_ != countof(da)) || (rda.buf_[1] != da[1]))
+    return -5;
+  if (rx.GetArg(2).RecoverUInt64Array().buf_ != NULL)
+    return -6;
+
+  return 0;
+}
+
+int TestCodecRaw11() {
+  const int ix = 4321;
+  const int call_id = 0x1234;
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  ipc::WireType a0(ix);
+  const ipc::WireType* const args[] = { &a0 };
+  channel.Send(18, args, 1, call_id);
+
+  D2V fmt [] = {
+    D2V(ipc::Encoder::ENC_HEADER),          // start of header mark
+    D2V(18),                                // msg id
+    D2V(1 | ipc::Encoder::ENC_HFCALL),      // arg count and header flags
+    D2V(9),                                 // data count
+    D2V(call_id),                           // call id
+    D2V(ipc::TYPE_INT32),                   // first arg type
+    D2V(ipc::Encoder::ENC_STARTD),          // start of data mark
+    D2V(ix),                                // first arg
+    D2V(ipc::Encoder::ENC_ENDDAT)           // end of data mark
+  };
+
+  // The layout above is for 32-bit words. Elsewhere only the decoding is checked.
+  if (sizeof(void*) == 4) {
+    int rv = TestIPCBuffer(&transport, fmt, sizeof(fmt)/sizeof(fmt[0]));
+    if (rv != 0)
+      return rv;
+  }
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+
+  if (!dec.Success())
+    return -1;
+  if (rx.MsgId() != 18)
+    return -2;
+  if (rx.CallId() != call_id)
+    return -3;
+  if (rx.GetArgCount() != 1)
+    return -4;
+  if (rx.GetArg(0).RecoverInt32() != ix)
+    return -5;
+
+  return 0;
+}
+
+// A message sent with WireView arguments must be encoded exactly like the same
+// message sent with WireType arguments.
+int TestCodecWireView() {
+  const int ia[] = { 7, 8, 9 };
+  const char ba[] = { 'a', '\0', 'b' };
+  ipc::WireType ws("held by a WireType");
+
+  ipc::WireType t0(-12);
+  ipc::WireType t1(3000000000LL);
+  ipc::WireType t2(1.5);
+  ipc::WireType t3('x');
+  ipc::WireType t4("view me");
+  ipc::WireType t5(static_cast<const char*>(NULL));
+  ipc::WireType t6(ipc::ByteArray(sizeof(ba), ba));
+  ipc::WireType t7(ipc::Int32Array(countof(ia), ia));
+  ipc::WireType t8(ipc::Float64Array(0, NULL));
+  ipc::WireType t9("held by a WireType");
+  const ipc::WireType* const targs[] = { &t0, &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9 };
+
+  const ipc::WireView vargs[] = {
+    -12, 3000000000LL, 1.5, 'x', "view me", static_cast<const char*>(NULL),
+    ipc::ByteArray(sizeof(ba), ba), ipc::Int32Array(countof(ia), ia),
+    ipc::Float64Array(0, NULL), ws
+  };
+
+  if (sizeof(vargs[0]) != 16)
+    return 1;
+
+  TestTransport ttransport;
+  TestChannel tchannel(&ttransport);
+  tchannel.Send(19, targs, countof(targs), 5);
+
+  TestTransport vtransport;
+  TestChannel vchannel(&vtransport);
+  vchannel.Send(19, vargs, countof(vargs), 5);
+
+  size_t tsize = 0;
+  const char* tdata = ttransport.Receive(&tsize);
+  size_t vsize = 0;
+  const char* vdata = vtransport.Receive(&vsize);
+  if ((tsize != vsize) || (0 != memcmp(tdata, vdata, tsize)))
+    return 2;
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(vdata, vsize);
+  if (!dec.Success())
+    return 3;
+  if ((rx.MsgId() != 19) || (rx.CallId() != 5) || (rx.GetArgCount() != countof(vargs)))
+    return 4;
+  if (rx.GetArg(1).LoadInt64() != 3000000000LL)
+    return 5;
+  if (IPCString(rx.GetArg(4).LoadString8()) != "view me")
+    return 6;
+  if (rx.GetArg(5).LoadString8() != NULL)
+    return 7;
+  ipc::ByteArray rba = rx.GetArg(6).LoadByteArray();
+  if ((rba.sz_ != sizeof(ba)) || (0 != memcmp(rba.buf_, ba, sizeof(ba))))
+    return 8;
+  if (IPCString(rx.GetArg(9).LoadString8()) != "held by a WireType")
+    return 9;
+
+  return 0;
+}
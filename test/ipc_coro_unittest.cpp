@@ -0,0 +1,314 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_coro.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the coroutine calls. Several client conversations run on one thread against a regular
+// server, and a coroutine server handler replies after being suspended. These tests pass
+// trivially when the compiler has no coroutine support, except in the build that exists to
+// run them.
+
+#if defined(IPC_REQUIRE_COROUTINES) && !defined(IPC_HAS_COROUTINES)
+#error "IPC_REQUIRE_COROUTINES is set but the compiler has no C++20 coroutines."
+#endif
+
+#if defined(IPC_HAS_COROUTINES)
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+const int kNumConversations = 20;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(50, 2) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(51, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(52, 1) {
+  IPC_MSG_P1(const char*, String8)
+};
+
+DEFINE_IPC_MSG_CONV(53, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+namespace {
+
+// Server side: 50 is a sum request answered with 51; 53 ends the loop.
+class SumMsg : public DispTestMsg,
+               public ipc::MsgIn<50, SumMsg, PipeChannel>,
+               public ipc::MsgOut<PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel* ch, int a, int b) {
+    return SendMsg(51, ch, a + b);
+  }
+};
+
+class StopMsg : public DispTestMsg,
+                public ipc::MsgIn<53, StopMsg, PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel*, int) {
+    return ipc::OnMsgReady;
+  }
+};
+
+class StopSender : public ipc::MsgOut<PipeChannel> {
+public:
+  size_t Send(PipeChannel* ch) {
+    return SendMsg(53, ch, 0);
+  }
+};
+
+class SumServer {
+public:
+  SumServer* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 53)
+      return stop_.OnMsgIn(msg_id, ch, args, count);
+    return sum_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  SumMsg sum_;
+  StopMsg stop_;
+};
+
+void ServerThread(void* p) {
+  PipeChannel* channel = reinterpret_cast<PipeChannel*>(p);
+  SumServer server;
+  channel->Receive(&server);
+}
+
+// Adds up 1 + 2 + ... + 5 one call at a time.
+ipc::CoTask Conversation(ipc::CoCalls<PipeChannel>* calls, int start, int* result) {
+  int total = start;
+  for (int ix = 1; ix <= 5; ++ix) {
+    auto reply = co_await calls->Call<51>(50, total, ix);
+    if (reply.Error() != ipc::RcOK) {
+      *result = -1;
+      co_return reply.Error();
+    }
+    total = reply.Get<0>();
+  }
+  *result = total;
+  co_return ipc::OnMsgReady;
+}
+
+// Takes everything that is sent and never has anything to receive.
+class DeadTransport {
+public:
+  size_t Send(const void*, size_t) {
+    return ipc::RcOK;
+  }
+
+  char* Receive(size_t*) {
+    return NULL;
+  }
+};
+
+typedef ipc::Channel<DeadTransport, ipc::Encoder, ipc::Decoder> DeadChannel;
+
+// Makes two calls in a row and tells how far it got.
+ipc::CoTask TwoCalls(ipc::CoCalls<DeadChannel>* calls, size_t* first, size_t* second) {
+  auto reply = co_await calls->Call<51>(50, 1, 2);
+  *first = reply.Error();
+  auto next = co_await calls->Call<51>(50, 3, 4);
+  *second = next.Error();
+  co_return ipc::OnMsgReady;
+}
+
+// Awaitable that suspends until the test resumes it by hand.
+struct Gate {
+  void* handle;
+
+  struct Awaiter {
+    Gate* gate;
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) { gate->handle = h.address(); }
+    void await_resume() const {}
+  };
+
+  Awaiter Wait() {
+    Awaiter awaiter = { this };
+    return awaiter;
+  }
+
+  void Open() {
+    std::coroutine_handle<>::from_address(handle).resume();
+  }
+};
+
+class GatedMsg : public DispTestMsg,
+                 public ipc::MsgIn<51, GatedMsg, TestChannel>,
+                 public ipc::MsgOut<TestChannel> {
+public:
+  explicit GatedMsg(Gate* gate) : gate_(gate) {}
+
+  ipc::CoTask OnMsg(TestChannel* ch, int value) {
+    if (value < 0)
+      co_return ipc::OnMsgAppErrorBase;
+    co_await gate_->Wait();
+    co_return SendMsg(52, ch, "late reply");
+  }
+
+private:
+  Gate* gate_;
+};
+
+}  // namespace.
+
+#endif  // defined(IPC_HAS_COROUTINES)
+
+int TestCoCalls() {
+#if defined(IPC_HAS_COROUTINES)
+  PipePair pp;
+  PipeTransport server_transport;
+  server_transport.OpenServer(pp.fd1());
+  PipeChannel server_channel(&server_transport);
+  ipc::Thread server;
+  if (!server.Start(ServerThread, &server_channel))
+    return 1;
+
+  PipeTransport client_transport;
+  client_transport.OpenClient(pp.fd2());
+  PipeChannel client_channel(&client_transport);
+  ipc::CoCalls<PipeChannel> calls(&client_channel);
+
+  int results[kNumConversations];
+  for (int ix = 0; ix != kNumConversations; ++ix)
+    Conversation(&calls, ix * 100, &results[ix]);
+  if (calls.PendingCount() != kNumConversations)
+    return 2;
+
+  size_t rc = calls.WaitAll();
+
+  StopSender stop;
+  stop.Send(&client_channel);
+  server.Join();
+
+  if (rc != ipc::RcOK)
+    return 3;
+  if (calls.PendingCount())
+    return 4;
+  for (int ix = 0; ix != kNumConversations; ++ix) {
+    if (results[ix] != ix * 100 + 15)
+      return 5;
+  }
+#endif
+  return 0;
+}
+
+int TestCoCallsFailure() {
+#if defined(IPC_HAS_COROUTINES)
+  DeadTransport transport;
+  DeadChannel channel(&transport);
+  size_t rc[6] = { 0, 0, 0, 0, 0, 0 };
+  {
+    // A failed WaitAll() resumes the coroutines with the error, and their next calls
+    // fail without suspending so they run to the end.
+    ipc::CoCalls<DeadChannel> calls(&channel);
+    TwoCalls(&calls, &rc[0], &rc[1]);
+    TwoCalls(&calls, &rc[2], &rc[3]);
+    if (calls.PendingCount() != 2)
+      return 1;
+    if (calls.WaitAll() != ipc::RcErrTransportRead)
+      return 2;
+    if (calls.PendingCount())
+      return 3;
+    for (int ix = 0; ix != 4; ++ix) {
+      if (rc[ix] != ipc::RcErrTransportRead)
+        return 4;
+    }
+  }
+
+  // Going away with calls in flight finishes them too.
+  {
+    ipc::CoCalls<DeadChannel> calls(&channel);
+    TwoCalls(&calls, &rc[4], &rc[5]);
+    if (calls.PendingCount() != 1)
+      return 5;
+  }
+  if ((rc[4] == ipc::RcOK) || (rc[5] == ipc::RcOK))
+    return 6;
+#endif
+  return 0;
+}
+
+int TestCoServerHandler() {
+#if defined(IPC_HAS_COROUTINES)
+  Gate gate = { NULL };
+  GatedMsg handler(&gate);
+  TestTransport transport;
+  TestChannel channel(&transport);
+
+  // A handler that finishes without suspending returns its value right away.
+  const ipc::WireType bad(-1);
+  const ipc::WireType* const bad_args[] = { &bad };
+  if (handler.OnMsgIn(51, &channel, bad_args, 1) != ipc::OnMsgAppErrorBase)
+    return 1;
+
+  // One that suspends lets Receive() go on.
+  const ipc::WireType good(7);
+  const ipc::WireType* const good_args[] = { &good };
+  size_t rc;
+  {
+    ipc::DispatchScope scope(&channel, 33);
+    rc = handler.OnMsgIn(51, &channel, good_args, 1);
+  }
+  if (rc != ipc::OnMsgLoopNext)
+    return 2;
+  if (!gate.handle)
+    return 3;
+
+  // The reply is sent from outside the dispatch scope but still carries its call id.
+  gate.Open();
+  if (ipc::CurrentDispatch().channel != NULL)
+    return 4;
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+  if (!dec.Success())
+    return 5;
+  if ((rx.MsgId() != 52) || (rx.CallId() != 33) || (rx.GetArgCount() != 1))
+    return 6;
+  if (IPCString(rx.GetArg(0).LoadString8()) != "late reply")
+    return 7;
+#endif
+  return 0;
+}
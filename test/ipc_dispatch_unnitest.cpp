@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "ipc_test_helpers.h"
+#include "ipc_msg_registry.h"
 
 struct DummyChannel {};
 
@@ -68,6 +69,39 @@ int TestForwardDispatch() {
   return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test that arguments of the wrong type are caught before the dispatch
+
+int TestDispatchConvertError() {
+  DispTestMsg5 disp5;
+  DummyChannel ch;
+
+  ipc::WireType a1(7);
+  ipc::WireType a2(L'a');
+  ipc::WireType a3(L"hello planet!");
+  const ipc::WireType* const args[] = { &a1, &a2, &a3 };
+  if (disp5.OnMsgIn(5, &ch, args, 3))
+    return 1;
+  if (!disp5.HasConvertError() || disp5.HasArgCountError())
+    return 2;
+  if (disp5.CheckArgs(args) != ipc::TYPE_CHAR8)
+    return 3;
+
+  // A NULL string matches a string parameter.
+  ipc::WireType b2('a');
+  ipc::WireType b3(static_cast<const wchar_t*>(NULL));
+  const ipc::WireType* const args_null[] = { &a1, &b2, &b3 };
+  if (disp5.CheckArgs(args_null) != 0)
+    return 4;
+
+  // But not a NULL string of the other width.
+  ipc::WireType c3(static_cast<const char*>(NULL));
+  const ipc::WireType* const args_bad[] = { &a1, &b2, &c3 };
+  if (disp5.CheckArgs(args_bad) != ipc::TYPE_STRING16)
+    return 5;
+  return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Test the roundtrip
 
@@ -92,3 +126,192 @@ int TestDispatchRoundTrip() {
   return 0;
 }
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the message registry, dense and sparse
+
+namespace {
+
+class CountingHandler {
+public:
+  CountingHandler() : count_(0), last_id_(0) {}
+
+  size_t OnMsgIn(int msg_id, DummyChannel*, const ipc::WireType* const[], int) {
+    ++count_;
+    last_id_ = msg_id;
+    return 40;
+  }
+
+  int count_;
+  int last_id_;
+};
+
+class NewTransportHandler {
+public:
+  void* OnNewTransport() { return this; }
+};
+
+}  // namespace.
+
+int TestMsgRegistry() {
+  DispTestMsg5 disp5;
+  CountingHandler counting;
+  CountingHandler fallback;
+
+  ipc::MsgRegistry<DummyChannel> registry;
+  if (registry.OnMsgIn(5, NULL, NULL, 0) != ipc::RcErrBadMessageId)
+    return 1;
+  if (registry.OnNewTransport())
+    return 2;
+
+  if (registry.Register(&disp5) != ipc::RcOK)
+    return 3;
+  if (registry.Register(300, &counting) != ipc::RcOK)
+    return 4;
+  if (registry.Register(302, &counting) != ipc::RcOK)
+    return 5;
+  if (registry.Register(5, &counting) != ipc::RcErrDuplicateMsgId)
+    return 6;
+  if (registry.TableSize() != (302 - 5 + 1))
+    return 7;
+
+  ipc::WireType a1(7);
+  ipc::WireType a2('a');
+  ipc::WireType a3(L"hello planet!");
+  const ipc::WireType* const args[] = { &a1, &a2, &a3 };
+  DummyChannel ch;
+  if (registry.MsgHandler(5)->OnMsgIn(5, &ch, args, 3) != 1)
+    return 8;
+  if (registry.OnMsgIn(302, &ch, args, 3) != 40)
+    return 9;
+  if ((counting.count_ != 1) || (counting.last_id_ != 302))
+    return 10;
+  if (registry.OnMsgIn(301, &ch, args, 3) != ipc::RcErrBadMessageId)
+    return 11;
+  if (registry.OnMsgIn(4, &ch, args, 3) != ipc::RcErrBadMessageId)
+    return 12;
+
+  registry.SetDefault(&fallback);
+  if ((registry.OnMsgIn(301, &ch, args, 3) != 40) || (fallback.last_id_ != 301))
+    return 13;
+
+  NewTransportHandler nt;
+  registry.SetNewTransportHandler(&nt);
+  if (registry.OnNewTransport() != &nt)
+    return 14;
+
+  // Spread the ids so the table has to be hashed.
+  const int sparse_ids[] = { 100000, 7000000, 123456789, -40, 2000000000 };
+  for (int ix = 0; ix != sizeof(sparse_ids) / sizeof(sparse_ids[0]); ++ix) {
+    if (registry.Register(sparse_ids[ix], &counting) != ipc::RcOK)
+      return 15;
+  }
+  if (registry.TableSize() > 1024)
+    return 16;
+  for (int ix = 0; ix != sizeof(sparse_ids) / sizeof(sparse_ids[0]); ++ix) {
+    if (registry.OnMsgIn(sparse_ids[ix], &ch, args, 3) != 40)
+      return 17;
+    if (counting.last_id_ != sparse_ids[ix])
+      return 18;
+  }
+  if (!registry.IsRegistered(300) || !registry.IsRegistered(5))
+    return 19;
+  if (registry.IsRegistered(301) || registry.IsRegistered(100001))
+    return 20;
+  if (registry.OnMsgIn(5, &ch, args, 3) != 1)
+    return 21;
+  return 0;
+}
+
+int TestMsgRegistryRoundTrip() {
+  TestTransport transport;
+  TestChannel channel(&transport);
+
+  TestMessage3 msg3;
+  msg3.DoSend(&channel, 56789, "1234");
+
+  DispTestMsg3 disp3;
+  ipc::MsgRegistry<TestChannel> registry;
+  registry.Register(&disp3);
+  if (channel.Receive(&registry) != 77)
+    return 1;
+  if (disp3.HasConvertError() || disp3.HasArgCountError())
+    return 2;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test a message with more than 10 parameters. The arguments are encoded straight from the
+// C++ values and received by a channel that takes up to 16 arguments.
+
+#if defined(IPC_HAS_VARIADIC)
+
+typedef ipc::Channel<TestTransport, ipc::Encoder, ipc::Decoder, 16> WideTestChannel;
+
+DEFINE_IPC_MSG_ARGS(7, ipc::arg::Int32, ipc::arg::UInt32, ipc::arg::Char8, ipc::arg::Char16,
+                    ipc::arg::String8, ipc::arg::String16, ipc::arg::ByteArray, ipc::arg::Int64,
+                    ipc::arg::Float64, ipc::arg::Int32Array, ipc::arg::String8, ipc::arg::Long,
+                    ipc::arg::VoidPtr);
+
+class WideTestMsgOut : public ipc::MsgOut<WideTestChannel> {
+public:
+  size_t DoSend(WideTestChannel* ch, const int* ia, size_t ia_sz) {
+    return SendMsg(7, ch, -3, 4u, 'c', L'd', "eee", static_cast<const wchar_t*>(NULL),
+                   ipc::ByteArray(3, "ggg"), -5000000000LL, 0.25, ipc::Int32Array(ia_sz, ia),
+                   static_cast<const char*>(NULL), -7L, ch);
+  }
+};
+
+class WideTestMsg7 : public DispTestMsg,
+                     public ipc::MsgIn<7, WideTestMsg7, WideTestChannel> {
+public:
+  size_t OnMsg(WideTestChannel* ch, int a, unsigned int b, char c, wchar_t d, const char* e,
+               const wchar_t* f, ipc::ByteArray g, long long h, double i, ipc::Int32Array j,
+               const char* k, long l, void* m) {
+    if ((a != -3) || (b != 4) || (c != 'c') || (d != L'd'))
+      return 2;
+    if (!(IPCString(e) == "eee") || f)
+      return 3;
+    if ((g.sz_ != 3) || memcmp(g.buf_, "ggg", 3))
+      return 4;
+    if ((h != -5000000000LL) || (i != 0.25))
+      return 5;
+    if ((j.sz_ != 3) || (j.buf_[0] != 10) || (j.buf_[2] != 30))
+      return 6;
+    if (k || (l != -7) || (m != ch))
+      return 7;
+    return 77;
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+#endif  // defined(IPC_HAS_VARIADIC)
+
+int TestWideMsgRoundTrip() {
+#if defined(IPC_HAS_VARIADIC)
+  TestTransport transport;
+  WideTestChannel channel(&transport);
+  const int ia[] = { 10, 20, 30 };
+
+  WideTestMsgOut msg;
+  msg.DoSend(&channel, ia, 3);
+  WideTestMsg7 disp7;
+  if (channel.Receive(&disp7) != 77)
+    return 1;
+  if (disp7.HasConvertError() || disp7.HasArgCountError())
+    return 2;
+
+  // A channel with the default limit rejects it.
+  TestChannel narrow(&transport);
+  DispTestMsg3 disp3;
+  if (narrow.Receive(&disp3) != ipc::RcErrDecoderFormat)
+    return 3;
+  // And it does not send it either.
+  if (narrow.SendArgs(7, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11) != ipc::RcErrEncoderArgs)
+    return 4;
+  if (narrow.SendArgs(7, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10) == ipc::RcErrEncoderArgs)
+    return 5;
+#endif
+  return 0;
+}
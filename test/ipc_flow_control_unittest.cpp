@@ -0,0 +1,243 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include <unistd.h>
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the credit based flow control. The receiving end grants a window and the sending end
+// either fails or blocks when it has used it up.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+const int kWindow = 4;
+const int kStreamMsgs = 300;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(60, 2) {
+  IPC_MSG_P1(int, Int32)                // Sequence number.
+  IPC_MSG_P2(const char*, String8)      // Payload.
+};
+
+namespace {
+
+class StreamMsg : public ipc::MsgOut<PipeChannel> {
+public:
+  size_t Send(PipeChannel* ch, int seq) {
+    return SendMsg(60, ch, seq, "0123456789abcdef0123456789abcdef");
+  }
+};
+
+class StreamConsumer : public DispTestMsg,
+                       public ipc::MsgIn<60, StreamConsumer, PipeChannel> {
+public:
+  StreamConsumer(int expected, volatile long* sent)
+      : expected_(expected), received_(0), max_ahead_(0), sent_(sent) {}
+
+  size_t OnMsg(PipeChannel*, int seq, const char*) {
+    if (seq != received_)
+      return ipc::OnMsgAppErrorBase;
+    ++received_;
+    if (sent_) {
+      long ahead = ipc::AtomicLoad(sent_) - received_;
+      if (ahead > max_ahead_)
+        max_ahead_ = ahead;
+    }
+    return (received_ == expected_) ? ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int Received() const { return received_; }
+  long MaxAhead() const { return max_ahead_; }
+
+private:
+  int expected_;
+  int received_;
+  long max_ahead_;
+  volatile long* sent_;
+};
+
+struct ProducerCtx {
+  PipeChannel* channel;
+  volatile long sent;
+  size_t result;
+};
+
+void ProducerThread(void* p) {
+  ProducerCtx* ctx = reinterpret_cast<ProducerCtx*>(p);
+  StreamMsg msg;
+  for (int ix = 0; ix != kStreamMsgs; ++ix) {
+    ctx->result = msg.Send(ctx->channel, ix);
+    if (ctx->result != ipc::RcOK)
+      return;
+    ipc::AtomicIncrement(&ctx->sent);
+  }
+}
+
+struct CreditCtx {
+  PipeChannel* channel;
+  size_t result;
+};
+
+void CreditWaiterThread(void* p) {
+  CreditCtx* ctx = reinterpret_cast<CreditCtx*>(p);
+  ctx->result = ctx->channel->WaitForCredit();
+}
+
+// Starts a thread that waits for credit while this one is inside Receive(), and gives it
+// time to block before Receive() returns.
+class HandOffConsumer : public DispTestMsg,
+                        public ipc::MsgIn<60, HandOffConsumer, PipeChannel> {
+public:
+  HandOffConsumer(ipc::Thread* waiter, CreditCtx* ctx) : waiter_(waiter), ctx_(ctx) {}
+
+  size_t OnMsg(PipeChannel*, int, const char*) {
+    if (!waiter_->Start(CreditWaiterThread, ctx_))
+      return ipc::OnMsgAppErrorBase;
+#if defined(WIN32)
+    ::Sleep(50);
+#else
+    usleep(50000);
+#endif
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  ipc::Thread* waiter_;
+  CreditCtx* ctx_;
+};
+
+}  // namespace.
+
+int TestFlowControlFail() {
+  PipePair pp;
+  PipeTransport tx_transport;
+  tx_transport.OpenClient(pp.fd2());
+  PipeChannel tx_channel(&tx_transport);
+  tx_channel.SetFlowControl(PipeChannel::FLOW_FAIL);
+
+  PipeTransport rx_transport;
+  rx_transport.OpenServer(pp.fd1());
+  PipeChannel rx_channel(&rx_transport);
+
+  // No credit until the receiver grants some.
+  StreamMsg msg;
+  if (msg.Send(&tx_channel, 0) != ipc::RcErrWouldBlock)
+    return 1;
+
+  if (rx_channel.SetReceiveWindow(2, 0) != ipc::RcOK)
+    return 2;
+  if (tx_channel.WaitForCredit() != ipc::RcOK)
+    return 3;
+  if ((msg.Send(&tx_channel, 0) != ipc::RcOK) || (msg.Send(&tx_channel, 1) != ipc::RcOK))
+    return 4;
+  if (msg.Send(&tx_channel, 2) != ipc::RcErrWouldBlock)
+    return 5;
+
+  // Consuming the messages gives the credit back.
+  StreamConsumer consumer(2, NULL);
+  if (rx_channel.Receive(&consumer) != ipc::OnMsgReady)
+    return 6;
+  if (tx_channel.WaitForCredit() != ipc::RcOK)
+    return 7;
+  if ((msg.Send(&tx_channel, 2) != ipc::RcOK) || (msg.Send(&tx_channel, 3) != ipc::RcOK))
+    return 8;
+  if (msg.Send(&tx_channel, 4) != ipc::RcErrWouldBlock)
+    return 9;
+
+  // The receiving end never gives back the credit of a new transport request, so those
+  // do not take any.
+  const ipc::WireView request[] = { ipc::WireView(static_cast<const void*>(NULL)) };
+  if (tx_channel.Send(ipc::kMessagePrivNewTransport, request, 1) != ipc::RcOK)
+    return 10;
+  return 0;
+}
+
+int TestFlowControlBlock() {
+  PipePair pp;
+  PipeTransport tx_transport;
+  tx_transport.OpenClient(pp.fd2());
+  PipeChannel tx_channel(&tx_transport);
+  tx_channel.SetFlowControl(PipeChannel::FLOW_BLOCK);
+
+  ProducerCtx ctx = { &tx_channel, 0, ipc::RcOK };
+  ipc::Thread producer;
+  if (!producer.Start(ProducerThread, &ctx))
+    return 1;
+
+  PipeTransport rx_transport;
+  rx_transport.OpenServer(pp.fd1());
+  PipeChannel rx_channel(&rx_transport);
+  if (rx_channel.SetReceiveWindow(kWindow, 1024) != ipc::RcOK)
+    return 2;
+
+  StreamConsumer consumer(kStreamMsgs, &ctx.sent);
+  size_t rc = rx_channel.Receive(&consumer);
+  producer.Join();
+
+  if (rc != ipc::OnMsgReady)
+    return 3;
+  if (ctx.result != ipc::RcOK)
+    return 4;
+  if (consumer.HasConvertError() || consumer.HasArgCountError())
+    return 5;
+  // The producer never gets more than a window ahead of the consumer.
+  if (consumer.MaxAhead() > kWindow)
+    return 6;
+  return 0;
+}
+
+int TestFlowControlHandOff() {
+  PipePair pp;
+  PipeTransport tx_transport;
+  tx_transport.OpenClient(pp.fd2());
+  PipeChannel tx_channel(&tx_transport);
+  tx_channel.SetFlowControl(PipeChannel::FLOW_FAIL);
+
+  PipeTransport rx_transport;
+  rx_transport.OpenServer(pp.fd1());
+  PipeChannel rx_channel(&rx_transport);
+
+  StreamMsg msg;
+  if (msg.Send(&rx_channel, 0) != ipc::RcOK)
+    return 1;
+  CreditCtx ctx = { &tx_channel, ipc::RcErrTransportRead };
+  ipc::Thread waiter;
+  HandOffConsumer consumer(&waiter, &ctx);
+  if (tx_channel.Receive(&consumer) != ipc::OnMsgReady)
+    return 2;
+
+  // No one else reads now, so the waiting thread reads the grant itself.
+  if (rx_channel.SetReceiveWindow(1, 0) != ipc::RcOK)
+    return 3;
+  waiter.Join();
+  if (ctx.result != ipc::RcOK)
+    return 4;
+  return 0;
+}
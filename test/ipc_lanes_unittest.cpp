@@ -0,0 +1,332 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_lanes.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include <sched.h>
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the priority lanes. An urgent message sent while a bulk one is being written goes out
+// between the frames of the bulk one, the receiving end hands out complete messages most urgent
+// first, and large messages survive the trip through a channel.
+
+namespace {
+
+const int kBulkMsg = 70;
+const int kPingMsg = 71;
+const int kStopMsg = 72;
+
+void YieldThread() {
+#if defined(WIN32)
+  ::Sleep(0);
+#else
+  sched_yield();
+#endif
+}
+
+typedef ipc::LaneTransport<MemTransport> MemLanes;
+
+// Builds an encoded message with id |msg_id| and a byte array of |size| bytes.
+void EncodeMsg(ipc::Encoder* encoder, int msg_id, size_t size) {
+  ipc::PodVector<char> bytes;
+  bytes.resize(size);
+  for (size_t ix = 0; ix != size; ++ix)
+    bytes[ix] = static_cast<char>(ix * 7);
+  encoder->Open(1);
+  encoder->OnString8(bytes.get(), size, ipc::TYPE_BARRAY);
+  encoder->SetMsgId(msg_id);
+  encoder->Close();
+}
+
+struct SendCtx {
+  MemLanes* lanes;
+  int msg_id;
+  size_t size;
+  size_t rc;
+};
+
+void SendThread(void* p) {
+  SendCtx* ctx = reinterpret_cast<SendCtx*>(p);
+  ipc::Encoder encoder;
+  EncodeMsg(&encoder, ctx->msg_id, ctx->size);
+  size_t size;
+  const void* buf = encoder.GetBuffer(&size);
+  ctx->rc = ctx->lanes->Send(buf, size);
+}
+
+// Receives one message and returns its id after checking that it is intact.
+int ReceiveMsg(MemLanes* lanes) {
+  size_t size = 0;
+  const char* buf = lanes->Receive(&size);
+  if (!buf)
+    return -1;
+  ipc::Encoder expected;
+  const int msg_id = ipc::Encoder::PeekMsgId(buf, size);
+  EncodeMsg(&expected, msg_id, (msg_id == kBulkMsg) ? 10000 : 16);
+  size_t exp_size;
+  const void* exp_buf = expected.GetBuffer(&exp_size);
+  if ((size != exp_size) || memcmp(buf, exp_buf, size))
+    return -1;
+  return msg_id;
+}
+
+typedef ipc::LaneTransport<PipeTransport> PipeLanes;
+typedef ipc::Channel<PipeLanes, ipc::Encoder, ipc::Decoder> LaneChannel;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(70, 2) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(ipc::ByteArray, ByteArray)
+};
+
+DEFINE_IPC_MSG_CONV(71, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(72, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+namespace {
+
+const int kNumBulk = 3;
+const int kNumPings = 50;
+const size_t kBulkSize = 1024 * 1024;
+
+class LaneSender : public ipc::MsgOut<LaneChannel> {
+public:
+  size_t SendBulk(LaneChannel* ch, int seq, const ipc::PodVector<char>& data) {
+    return SendMsg(kBulkMsg, ch, seq, ipc::ByteArray(data.size(), data.get()));
+  }
+
+  size_t SendPing(LaneChannel* ch, int seq) {
+    return SendMsg(kPingMsg, ch, seq);
+  }
+
+  size_t SendStop(LaneChannel* ch) {
+    return SendMsg(kStopMsg, ch, 0);
+  }
+};
+
+struct ChannelCtx {
+  LaneChannel* channel;
+  size_t rc;
+};
+
+void BulkThread(void* p) {
+  ChannelCtx* ctx = reinterpret_cast<ChannelCtx*>(p);
+  ipc::PodVector<char> data;
+  data.resize(kBulkSize);
+  LaneSender sender;
+  for (int ix = 0; ix != kNumBulk; ++ix) {
+    for (size_t jx = 0; jx != kBulkSize; ++jx)
+      data[jx] = static_cast<char>(jx + ix);
+    ctx->rc = sender.SendBulk(ctx->channel, ix, data);
+    if (ctx->rc != ipc::RcOK)
+      return;
+  }
+}
+
+void PingThread(void* p) {
+  ChannelCtx* ctx = reinterpret_cast<ChannelCtx*>(p);
+  LaneSender sender;
+  for (int ix = 0; ix != kNumPings; ++ix) {
+    ctx->rc = sender.SendPing(ctx->channel, ix);
+    if (ctx->rc != ipc::RcOK)
+      return;
+  }
+}
+
+// Runs the bulk and the ping senders at the same time and sends the stop message once
+// both are done.
+void SenderThread(void* p) {
+  ChannelCtx* ctx = reinterpret_cast<ChannelCtx*>(p);
+  ChannelCtx bulk = { ctx->channel, ipc::RcOK };
+  ChannelCtx ping = { ctx->channel, ipc::RcOK };
+  ipc::Thread bulk_thread;
+  ipc::Thread ping_thread;
+  if (!bulk_thread.Start(BulkThread, &bulk) || !ping_thread.Start(PingThread, &ping)) {
+    ctx->rc = ipc::RcErrTransportWrite;
+    return;
+  }
+  bulk_thread.Join();
+  ping_thread.Join();
+  LaneSender sender;
+  size_t rc = sender.SendStop(ctx->channel);
+  ctx->rc = (bulk.rc != ipc::RcOK) ? bulk.rc : ((ping.rc != ipc::RcOK) ? ping.rc : rc);
+}
+
+// The stop message can overtake the last bulk message since it is more urgent, so the
+// receiver finishes when it has seen everything.
+class LaneReceiver {
+public:
+  LaneReceiver() : bulk_(0), pings_(0), errors_(0), stopped_(false) {}
+
+  LaneReceiver* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, LaneChannel*, const ipc::WireType* const args[], int count) {
+    if (msg_id == kStopMsg) {
+      stopped_ = true;
+    } else if (msg_id == kPingMsg) {
+      if (args[0]->LoadInt32() != pings_)
+        ++errors_;
+      ++pings_;
+    } else {
+      CheckBulk(args, count);
+      ++bulk_;
+    }
+    return (stopped_ && (bulk_ == kNumBulk) && (pings_ == kNumPings)) ?
+        ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  int bulk_;
+  int pings_;
+  int errors_;
+
+private:
+  void CheckBulk(const ipc::WireType* const args[], int count) {
+    if ((count != 2) || (args[0]->LoadInt32() != bulk_)) {
+      ++errors_;
+      return;
+    }
+    IPCString data;
+    args[1]->GetString8(&data);
+    if (data.size() != kBulkSize)
+      ++errors_;
+    for (size_t ix = 0; ix != data.size(); ++ix) {
+      if (data[ix] != static_cast<char>(ix + bulk_)) {
+        ++errors_;
+        break;
+      }
+    }
+  }
+
+  bool stopped_;
+};
+
+}  // namespace.
+
+int TestLanesInterleave() {
+  MemTransport transport;
+  transport.GateFirstSend();
+  MemLanes lanes(&transport);
+  if (!lanes.SetMsgLane(kBulkMsg, 1) || !lanes.SetFrameSize(1024))
+    return 1;
+  if (lanes.SetMsgLane(kPingMsg, MemLanes::kNumLanes) || lanes.SetFrameSize(0))
+    return 2;
+
+  // The bulk message gets stuck on its first frame while the urgent one is queued.
+  SendCtx bulk = { &lanes, kBulkMsg, 10000, 1 };
+  ipc::Thread bulk_thread;
+  if (!bulk_thread.Start(SendThread, &bulk))
+    return 3;
+  transport.WaitForFirstSend();
+
+  SendCtx ping = { &lanes, kPingMsg, 16, 1 };
+  ipc::Thread ping_thread;
+  if (!ping_thread.Start(SendThread, &ping))
+    return 4;
+  while (lanes.QueuedCount() != 2)
+    YieldThread();
+  transport.Open();
+  ping_thread.Join();
+  bulk_thread.Join();
+  if ((bulk.rc != ipc::RcOK) || (ping.rc != ipc::RcOK) || lanes.QueuedCount())
+    return 5;
+
+  // Both messages arrive intact and the urgent one was read first.
+  MemLanes rx_lanes(&transport);
+  if (ReceiveMsg(&rx_lanes) != kPingMsg)
+    return 6;
+  if (ReceiveMsg(&rx_lanes) != kBulkMsg)
+    return 7;
+  size_t size = 0;
+  if (rx_lanes.Receive(&size))
+    return 8;
+
+  // The urgent message went right after the first bulk frame.
+  const ipc::PodVector<char>& wire = transport.Data();
+  unsigned int second_frame[3];
+  memcpy(second_frame, &wire[12 + 1024], sizeof(second_frame));
+  if ((second_frame[1] & 0xff) != 0)
+    return 9;
+  return 0;
+}
+
+int TestLanesReceiveOrder() {
+  // Here the bulk message is complete on the wire before the urgent one.
+  MemTransport transport;
+  MemLanes lanes(&transport);
+  lanes.SetMsgLane(kBulkMsg, 3);
+  ipc::Encoder bulk;
+  EncodeMsg(&bulk, kBulkMsg, 10000);
+  ipc::Encoder ping;
+  EncodeMsg(&ping, kPingMsg, 16);
+  size_t size;
+  const void* buf = bulk.GetBuffer(&size);
+  if (lanes.Send(buf, size) != ipc::RcOK)
+    return 1;
+  buf = ping.GetBuffer(&size);
+  if (lanes.Send(buf, size) != ipc::RcOK)
+    return 2;
+
+  MemLanes rx_lanes(&transport);
+  if (ReceiveMsg(&rx_lanes) != kPingMsg)
+    return 3;
+  if (ReceiveMsg(&rx_lanes) != kBulkMsg)
+    return 4;
+  return 0;
+}
+
+int TestLanesChannel() {
+  PipePair pp;
+  PipeTransport tx_pipe;
+  tx_pipe.OpenClient(pp.fd2());
+  PipeLanes tx_lanes(&tx_pipe);
+  tx_lanes.SetMsgLane(kBulkMsg, 1);
+  LaneChannel tx_channel(&tx_lanes);
+
+  ChannelCtx ctx = { &tx_channel, ipc::RcOK };
+  ipc::Thread sender;
+  if (!sender.Start(SenderThread, &ctx))
+    return 1;
+
+  PipeTransport rx_pipe;
+  rx_pipe.OpenServer(pp.fd1());
+  PipeLanes rx_lanes(&rx_pipe);
+  LaneChannel rx_channel(&rx_lanes);
+  LaneReceiver receiver;
+  size_t rc = rx_channel.Receive(&receiver);
+  sender.Join();
+
+  if ((rc != ipc::OnMsgReady) || (ctx.rc != ipc::RcOK))
+    return 2;
+  if ((receiver.bulk_ != kNumBulk) || (receiver.pings_ != kNumPings) || receiver.errors_)
+    return 3;
+  return 0;
+}
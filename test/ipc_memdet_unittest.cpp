@@ -0,0 +1,310 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include <string.h>
+
+#include "ipc_test_helpers.h"
+
+#if !defined(IPC_MEMDET_HOOKS)
+#error "the unit tests are built with IPC_MEMDET_HOOKS"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the allocation hooks. Once the buffers of a channel have grown to the size of the
+// messages, a call and its reply allocate nothing.
+
+namespace {
+
+typedef ipc::Channel<TestTransport, ipc::Encoder, ipc::Decoder> TestChannel;
+
+const int kWarmUpCalls = 3;
+const int kNumCalls = 100;
+
+struct AllocCounts {
+  AllocCounts() : news(0), deletes(0), bytes(0), last_site(NULL), last_msg_id(-1) {}
+  long news;
+  long deletes;
+  size_t bytes;
+  const char* last_site;
+  int last_msg_id;
+};
+
+void OnNew(void* context, const void*, size_t bytes, const char* site, int msg_id) {
+  AllocCounts* counts = reinterpret_cast<AllocCounts*>(context);
+  ++counts->news;
+  counts->bytes += bytes;
+  counts->last_site = site;
+  counts->last_msg_id = msg_id;
+}
+
+void OnDelete(void* context, const void*, const char*, int) {
+  ++reinterpret_cast<AllocCounts*>(context)->deletes;
+}
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(150, 3) {
+  IPC_MSG_P1(int, Int32)                // Value.
+  IPC_MSG_P2(long long, Int64)          // Value.
+  IPC_MSG_P3(double, Float64)           // Value.
+};
+
+DEFINE_IPC_MSG_CONV(151, 1) {
+  IPC_MSG_P1(long long, Int64)          // The sum of the values.
+};
+
+DEFINE_IPC_MSG_CONV(152, 1) {
+  IPC_MSG_P1(int, Int32)                // Bytes that the handler allocates.
+};
+
+DEFINE_IPC_MSG_CONV(153, 1) {
+  IPC_MSG_P1(const char*, String8)      // Name.
+};
+
+DEFINE_IPC_MSG_CONV(154, 2) {
+  IPC_MSG_P1(const char*, String8)      // Path.
+  IPC_MSG_P2(ipc::Int32Array, Int32Array) // Values.
+};
+
+namespace {
+
+class SumMsg : public DispTestMsg,
+               public ipc::MsgIn<150, SumMsg, TestChannel>,
+               public ipc::MsgOut<TestChannel> {
+public:
+  size_t OnMsg(TestChannel* ch, int a, long long b, double c) {
+    SendMsg(151, ch, a + b + static_cast<long long>(c));
+    return ipc::OnMsgReady;
+  }
+};
+
+class AllocMsg : public DispTestMsg,
+                 public ipc::MsgIn<152, AllocMsg, TestChannel> {
+public:
+  size_t OnMsg(TestChannel*, int bytes) {
+    ipc::PodVector<char> buf;
+    buf.resize(bytes);
+    return ipc::OnMsgReady;
+  }
+};
+
+class NameMsg : public DispTestMsg,
+                public ipc::MsgIn<153, NameMsg, TestChannel> {
+public:
+  NameMsg() : count_(0) {}
+
+  size_t OnMsg(TestChannel*, const char* name) {
+    if (strcmp(name, "worker-7"))
+      return ipc::OnMsgAppErrorBase;
+    ++count_;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  NameMsg* MsgHandler(int) {
+    return this;
+  }
+
+  int count_;
+};
+
+class PathMsg : public DispTestMsg,
+                public ipc::MsgIn<154, PathMsg, TestChannel> {
+public:
+  PathMsg() : count_(0) {}
+
+  size_t OnMsg(TestChannel*, const char* path, ipc::Int32Array values) {
+    if (strcmp(path, kPath) || (values.sz_ != kNumValues) || (values.buf_[kNumValues - 1] != 99))
+      return ipc::OnMsgAppErrorBase;
+    ++count_;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  PathMsg* MsgHandler(int) {
+    return this;
+  }
+
+  static const char kPath[];
+  static const size_t kNumValues = 100;
+  int count_;
+};
+
+const char PathMsg::kPath[] = "/usr/local/share/simple-ipc/worker/settings.conf";
+
+class Server {
+public:
+  Server* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, TestChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 150)
+      return sum_.OnMsgIn(msg_id, ch, args, count);
+    return alloc_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  SumMsg sum_;
+  AllocMsg alloc_;
+};
+
+class SumReply : public DispTestMsg,
+                 public ipc::MsgIn<151, SumReply, TestChannel> {
+public:
+  SumReply() : sum_(0) {}
+
+  size_t OnMsg(TestChannel*, long long sum) {
+    sum_ = sum;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  SumReply* MsgHandler(int) {
+    return this;
+  }
+
+  long long sum_;
+};
+
+// Both ends share the transport, which holds the last message sent. Its Send() returns
+// a bool, so what the channel returns for a send is not checked.
+bool Call(TestChannel* client, TestChannel* server, Server* handler, int value) {
+  const ipc::WireView args[] = {
+    ipc::WireView(value), ipc::WireView(2LL * value), ipc::WireView(3.0 * value)
+  };
+  client->Send(150, args, 3);
+  if (server->Receive(handler) != ipc::OnMsgReady)
+    return false;
+  SumReply reply;
+  return (client->Receive(&reply) == ipc::OnMsgReady) && (reply.sum_ == 6LL * value);
+}
+
+}  // namespace.
+
+int TestZeroAllocRoundTrip() {
+  TestTransport transport;
+  TestChannel client(&transport);
+  TestChannel server(&transport);
+  Server handler;
+  for (int ix = 1; ix <= kWarmUpCalls; ++ix) {
+    if (!Call(&client, &server, &handler, ix))
+      return 1;
+  }
+
+  AllocCounts counts;
+  const memdet::Hooks hooks = { OnNew, OnDelete, &counts };
+  memdet::SetHooks(&hooks);
+  bool ok = true;
+  for (int ix = 1; ok && (ix <= kNumCalls); ++ix)
+    ok = Call(&client, &server, &handler, ix);
+  const long steady_news = counts.news;
+  const long steady_deletes = counts.deletes;
+
+  // What a handler allocates is counted against its message.
+  const ipc::WireView alloc[] = { ipc::WireView(100) };
+  client.Send(152, alloc, 1);
+  const bool sent = server.Receive(&handler) == ipc::OnMsgReady;
+  memdet::SetHooks(NULL);
+
+  if (!ok || !sent)
+    return 2;
+  if (steady_news || steady_deletes)
+    return 3;
+  if ((counts.news != 1) || (counts.deletes != 1) || (counts.bytes < 100))
+    return 4;
+  if ((counts.last_msg_id != 152) || !counts.last_site || (memdet::CurrentMsg() != -1))
+    return 5;
+  return 0;
+}
+
+int TestSmallStringNoAlloc() {
+  TestTransport transport;
+  TestChannel client(&transport);
+  TestChannel server(&transport);
+  NameMsg handler;
+  const ipc::WireView args[] = { ipc::WireView("worker-7") };
+  client.Send(153, args, 1);
+  if (server.Receive(&handler) != ipc::OnMsgReady)
+    return 1;
+
+  AllocCounts counts;
+  const memdet::Hooks hooks = { OnNew, OnDelete, &counts };
+  memdet::SetHooks(&hooks);
+  // Messages with short strings, and the strings themselves, do not allocate.
+  bool ok = true;
+  for (int ix = 0; ok && (ix != kNumCalls); ++ix) {
+    client.Send(153, args, 1);
+    ok = server.Receive(&handler) == ipc::OnMsgReady;
+  }
+  IPCString str("twenty-three characters");
+  IPCString copy(str);
+  IPCString other("short");
+  copy.swap(other);
+  const long small_news = counts.news;
+  // A longer one goes to the heap.
+  str.append(".");
+  memdet::SetHooks(NULL);
+
+  if (!ok || (handler.count_ != kNumCalls + 1))
+    return 2;
+  if (small_news || (counts.news != 1))
+    return 3;
+  if ((str != "twenty-three characters.") || (copy != "short") ||
+      (other != "twenty-three characters"))
+    return 4;
+  return 0;
+}
+
+int TestArenaNoAlloc() {
+  TestTransport transport;
+  TestChannel client(&transport);
+  TestChannel server(&transport);
+  PathMsg handler;
+  int values[PathMsg::kNumValues];
+  for (size_t ix = 0; ix != PathMsg::kNumValues; ++ix)
+    values[ix] = static_cast<int>(ix);
+  const ipc::WireView args[] = {
+    ipc::WireView(PathMsg::kPath),
+    ipc::WireView(ipc::Int32Array(PathMsg::kNumValues, values))
+  };
+  for (int ix = 0; ix != kWarmUpCalls; ++ix) {
+    client.Send(154, args, 2);
+    if (server.Receive(&handler) != ipc::OnMsgReady)
+      return 1;
+  }
+
+  // The long string and the array are copied to the arena of the channel.
+  AllocCounts counts;
+  const memdet::Hooks hooks = { OnNew, OnDelete, &counts };
+  memdet::SetHooks(&hooks);
+  bool ok = true;
+  for (int ix = 0; ok && (ix != kNumCalls); ++ix) {
+    client.Send(154, args, 2);
+    ok = server.Receive(&handler) == ipc::OnMsgReady;
+  }
+  memdet::SetHooks(NULL);
+
+  if (!ok || (handler.count_ != kNumCalls + kWarmUpCalls))
+    return 2;
+  if (counts.news || counts.deletes)
+    return 3;
+  return 0;
+}
@@ -0,0 +1,349 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_metrics.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the channel metrics. Both ends of a pipe are metered and the totals of one end have
+// to agree with the other, including for messages sent from several threads. With send
+// timestamps each end also measures how long the messages of the other end took.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChannelMetrics>
+    MeteredChannel;
+typedef ipc::Channel<TestTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChannelMetrics>
+    MeteredTestChannel;
+
+const int kNumCalls = 20;
+const int kNumSenders = 2;
+const int kEventsPerSender = 50;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(120, 1) {
+  IPC_MSG_P1(int, Int32)                // Value.
+};
+
+DEFINE_IPC_MSG_CONV(121, 1) {
+  IPC_MSG_P1(int, Int32)                // Value times two.
+};
+
+DEFINE_IPC_MSG_CONV(122, 1) {
+  IPC_MSG_P1(int, Int32)                // 1 for an event, 0 to stop the server.
+};
+
+namespace {
+
+class DoubleMsg : public DispTestMsg,
+                  public ipc::MsgIn<120, DoubleMsg, MeteredChannel>,
+                  public ipc::MsgOut<MeteredChannel> {
+public:
+  size_t OnMsg(MeteredChannel* ch, int value) {
+    return SendMsg(121, ch, value * 2);
+  }
+};
+
+class EventMsg : public DispTestMsg,
+                 public ipc::MsgIn<122, EventMsg, MeteredChannel> {
+public:
+  EventMsg() : events_(0) {}
+
+  size_t OnMsg(MeteredChannel*, int event) {
+    if (!event)
+      return ipc::OnMsgReady;
+    ++events_;
+    return ipc::OnMsgLoopNext;
+  }
+
+  int events_;
+};
+
+class Server {
+public:
+  Server* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, MeteredChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 120)
+      return double_.OnMsgIn(msg_id, ch, args, count);
+    return events_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  DoubleMsg double_;
+  EventMsg events_;
+};
+
+template <class ChannelT>
+class DoubledReplyT : public DispTestMsg,
+                      public ipc::MsgIn<121, DoubledReplyT<ChannelT>, ChannelT> {
+public:
+  DoubledReplyT() : value_(0) {}
+
+  size_t OnMsg(ChannelT*, int value) {
+    value_ = value;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  DoubledReplyT* MsgHandler(int) {
+    return this;
+  }
+
+  int value_;
+};
+
+typedef DoubledReplyT<MeteredChannel> DoubledReply;
+typedef DoubledReplyT<MeteredTestChannel> TestDoubledReply;
+
+void SenderThread(void* p) {
+  MeteredChannel* channel = reinterpret_cast<MeteredChannel*>(p);
+  const ipc::WireView event[] = { ipc::WireView(1) };
+  for (int ix = 0; ix != kEventsPerSender; ++ix)
+    channel->Send(122, event, 1);
+}
+
+// Records a message that took 100ns to arrive, from a thread of its own.
+void OneWayThread(void* p) {
+  ipc::ChannelMetrics* metrics = reinterpret_cast<ipc::ChannelMetrics*>(p);
+  metrics->OnReceive(123, 0, 8, 1, 1100, 1, 1000);
+}
+
+}  // namespace.
+
+int TestLatencyHistogram() {
+  typedef ipc::LatencyHistogram Histogram;
+  // The buckets are in order and every value is at most 6.25% below the end of its bucket.
+  int last = -1;
+  for (long long v = 0; v < (1LL << 40); v += (v >> 3) + 1) {
+    const int bucket = Histogram::BucketOf(v);
+    if ((bucket < last) || (bucket >= Histogram::kBuckets))
+      return 1;
+    const long long high = Histogram::HighestOf(bucket);
+    if ((high < v) || (high - v > v / 16))
+      return 2;
+    last = bucket;
+  }
+  if (Histogram::BucketOf(1LL << 60) != Histogram::kBuckets - 1)
+    return 3;
+
+  Histogram histogram;
+  histogram.Clear();
+  for (int ix = 1; ix <= 1000; ++ix)
+    histogram.Record(ix);
+  if ((histogram.Count() != 1000) || (histogram.Max() != 1000) || (histogram.Mean() != 500))
+    return 4;
+  const long long median = histogram.ValueAtPercentile(50);
+  if ((median < 500) || (median > 500 + 500 / 16))
+    return 5;
+  if ((histogram.ValueAtPercentile(100) != 1000) || (histogram.ValueAtPercentile(0) != 1))
+    return 6;
+
+  Histogram other;
+  other.Clear();
+  other.Record(5000);
+  histogram.Merge(other);
+  if ((histogram.Count() != 1001) || (histogram.Max() != 5000))
+    return 7;
+  return 0;
+}
+
+int TestChannelMetrics() {
+  Server handler;
+  PipeServer<MeteredChannel> server;
+  if (!server.Start(&handler))
+    return 1;
+
+  PipeTransport client_transport;
+  server.Connect(&client_transport);
+  MeteredChannel client_channel(&client_transport);
+
+  // Calls with a call id measure the round trip.
+  for (int ix = 1; ix <= kNumCalls; ++ix) {
+    const ipc::WireView value[] = { ipc::WireView(ix) };
+    if (client_channel.Send(120, value, 1, ix) != ipc::RcOK)
+      return 2;
+    DoubledReply reply;
+    if ((client_channel.Receive(&reply) != ipc::OnMsgReady) || (reply.value_ != ix * 2))
+      return 3;
+  }
+
+  // Events come from several threads, each with its own counters.
+  client_channel.SetSendMode(MeteredChannel::SEND_COMBINED);
+  ipc::Thread senders[kNumSenders];
+  for (int ix = 0; ix != kNumSenders; ++ix)
+    senders[ix].Start(SenderThread, &client_channel);
+  for (int ix = 0; ix != kNumSenders; ++ix)
+    senders[ix].Join();
+  const ipc::WireView stop[] = { ipc::WireView(0) };
+  if (client_channel.Send(122, stop, 1) != ipc::RcOK)
+    return 4;
+  if ((server.Join() != ipc::OnMsgReady) ||
+      (handler.events_.events_ != kNumSenders * kEventsPerSender))
+    return 5;
+
+  ipc::PodVector<ipc::MsgMetrics> client;
+  ipc::PodVector<ipc::MsgMetrics> server_side;
+  client_channel.metrics()->Collect(&client);
+  server.end()->metrics()->Collect(&server_side);
+  if ((client.size() != 3) || (server_side.size() != 3))
+    return 6;
+
+  const ipc::MsgMetrics* call = ipc::ChannelMetrics::Find(client, 120);
+  const ipc::MsgMetrics* reply = ipc::ChannelMetrics::Find(client, 121);
+  const ipc::MsgMetrics* events = ipc::ChannelMetrics::Find(client, 122);
+  if (!call || !reply || !events)
+    return 7;
+  if ((call->sent != kNumCalls) || call->received || (call->round_trip.Count() != kNumCalls))
+    return 8;
+  if ((call->round_trip.ValueAtPercentile(50) <= 0) ||
+      (call->round_trip.ValueAtPercentile(50) > call->round_trip.Max()))
+    return 9;
+  if ((reply->received != kNumCalls) || (reply->handler.Count() != kNumCalls) ||
+      reply->round_trip.Count())
+    return 10;
+  if (events->sent != kNumSenders * kEventsPerSender + 1)
+    return 11;
+
+  // What one end sent is what the other end received.
+  const ipc::MsgMetrics* server_call = ipc::ChannelMetrics::Find(server_side, 120);
+  const ipc::MsgMetrics* server_reply = ipc::ChannelMetrics::Find(server_side, 121);
+  const ipc::MsgMetrics* server_events = ipc::ChannelMetrics::Find(server_side, 122);
+  if (!server_call || !server_reply || !server_events)
+    return 12;
+  if ((server_call->received != call->sent) ||
+      (server_call->received_bytes != call->sent_bytes) ||
+      (server_call->decode.Count() != kNumCalls) ||
+      server_call->round_trip.Count())
+    return 13;
+  if ((server_reply->sent != reply->received) ||
+      (server_reply->sent_bytes != reply->received_bytes))
+    return 14;
+  if ((server_events->received != events->sent) ||
+      (server_events->received_bytes != events->sent_bytes))
+    return 15;
+
+  // As many calls as there are slots can wait for their reply. Past that the oldest make
+  // room and are counted.
+  const int slots = ipc::ChannelMetrics::kPendingStripes * ipc::ChannelMetrics::kPendingSlots;
+  ipc::ChannelMetrics pending;
+  for (int id = 1; id <= slots; ++id)
+    pending.OnSend(120, id, false, 8);
+  for (int id = slots; id >= 1; --id)
+    pending.OnReceive(121, id, 8, 1, ipc::MonotonicNs(), 1, 0);
+  if (pending.PendingCollisions())
+    return 16;
+  const int extra = ipc::ChannelMetrics::kPendingStripes;
+  for (int id = 1; id <= slots + extra; ++id)
+    pending.OnSend(120, id, false, 8);
+  for (int id = 1; id <= slots + extra; ++id)
+    pending.OnReceive(121, id, 8, 1, ipc::MonotonicNs(), 1, 0);
+  if (pending.PendingCollisions() != extra)
+    return 17;
+  ipc::PodVector<ipc::MsgMetrics> calls;
+  pending.Collect(&calls);
+  const ipc::MsgMetrics* measured = ipc::ChannelMetrics::Find(calls, 120);
+  if (!measured || (measured->round_trip.Count() != 2 * slots))
+    return 18;
+  return 0;
+}
+
+int TestOneWayLatency() {
+  // The timestamp travels in the header along with the call id.
+  TestTransport transport;
+  MeteredTestChannel stamped(&transport);
+  stamped.SetSendTimestamps(true);
+  const ipc::WireView value[] = { ipc::WireView(21) };
+  const long long before = ipc::MonotonicNs();
+  stamped.Send(121, value, 1, 7);
+  const long long after = ipc::MonotonicNs();
+  MeteredTestChannel plain(&transport);
+  TestDoubledReply reply;
+  if ((plain.Receive(&reply) != ipc::OnMsgReady) || (reply.value_ != 21))
+    return 1;
+  if ((plain.LastRecvCallId() != 7) || (plain.LastRecvSendTime() < before) ||
+      (plain.LastRecvSendTime() > after))
+    return 2;
+
+  Server handler;
+  PipeServer<MeteredChannel> server;
+  server.end()->SetSendTimestamps(true);
+  if (!server.Start(&handler))
+    return 3;
+
+  PipeTransport client_transport;
+  server.Connect(&client_transport);
+  MeteredChannel client_channel(&client_transport);
+  client_channel.SetSendTimestamps(true);
+  for (int ix = 1; ix <= kNumCalls; ++ix) {
+    const ipc::WireView value[] = { ipc::WireView(ix) };
+    if (client_channel.Send(120, value, 1, ix) != ipc::RcOK)
+      return 4;
+    DoubledReply reply;
+    if ((client_channel.Receive(&reply) != ipc::OnMsgReady) || (reply.value_ != ix * 2))
+      return 5;
+  }
+  const ipc::WireView stop[] = { ipc::WireView(0) };
+  if (client_channel.Send(122, stop, 1) != ipc::RcOK)
+    return 6;
+  if (server.Join() != ipc::OnMsgReady)
+    return 7;
+
+  // The request leg is measured by the server and the reply leg by the client, and each
+  // is shorter than the round trip.
+  ipc::PodVector<ipc::MsgMetrics> client;
+  ipc::PodVector<ipc::MsgMetrics> server_side;
+  client_channel.metrics()->Collect(&client);
+  server.end()->metrics()->Collect(&server_side);
+  const ipc::MsgMetrics* call = ipc::ChannelMetrics::Find(client, 120);
+  const ipc::MsgMetrics* reply_leg = ipc::ChannelMetrics::Find(client, 121);
+  const ipc::MsgMetrics* request_leg = ipc::ChannelMetrics::Find(server_side, 120);
+  if (!call || !reply_leg || !request_leg)
+    return 8;
+  if ((request_leg->one_way.Count() != kNumCalls) ||
+      (reply_leg->one_way.Count() != kNumCalls) || call->one_way.Count())
+    return 9;
+  if ((request_leg->one_way.Mean() > call->round_trip.Mean()) ||
+      (reply_leg->one_way.Mean() > call->round_trip.Mean()))
+    return 10;
+
+  // Every thread has its own counters and Collect() adds up the legs of all of them.
+  ipc::ChannelMetrics metrics;
+  metrics.OnReceive(123, 0, 8, 1, 1300, 1, 1000);
+  ipc::Thread other;
+  if (!other.Start(OneWayThread, &metrics))
+    return 11;
+  other.Join();
+  ipc::PodVector<ipc::MsgMetrics> merged;
+  metrics.Collect(&merged);
+  const ipc::MsgMetrics* both = ipc::ChannelMetrics::Find(merged, 123);
+  if (!both || (both->received != 2) || (both->one_way.Count() != 2) ||
+      (both->one_way.Mean() != 200) || (both->one_way.Max() != 300))
+    return 12;
+  return 0;
+}
@@ -0,0 +1,355 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_mux.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the stream multiplexing. Many client sessions share one pipe with a server that serves
+// all of them from a single thread, and the streams come and go without any round trips.
+
+namespace {
+
+typedef ipc::MuxTransport<PipeTransport> PipeMux;
+typedef ipc::Channel<PipeMux::Stream, ipc::Encoder, ipc::Decoder> StreamChannel;
+
+const int kNumSessions = 40;
+const int kAddsPerSession = 5;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(80, 1) {
+  IPC_MSG_P1(int, Int32)              // Value to add.
+};
+
+DEFINE_IPC_MSG_CONV(81, 1) {
+  IPC_MSG_P1(int, Int32)              // Ignored.
+};
+
+DEFINE_IPC_MSG_CONV(82, 2) {
+  IPC_MSG_P1(int, Int32)              // Stream id.
+  IPC_MSG_P2(int, Int32)              // Total.
+};
+
+namespace {
+
+// One server session: adds up the values and replies with the total when asked.
+class AddMsg : public DispTestMsg,
+               public ipc::MsgIn<80, AddMsg, StreamChannel> {
+public:
+  AddMsg() : total_(0) {}
+
+  size_t OnMsg(StreamChannel*, int value) {
+    total_ += value;
+    return ipc::OnMsgLoopNext;
+  }
+
+  int total_;
+};
+
+class TotalMsg : public DispTestMsg,
+                 public ipc::MsgIn<81, TotalMsg, StreamChannel>,
+                 public ipc::MsgOut<StreamChannel> {
+public:
+  explicit TotalMsg(const AddMsg* add) : add_(add), stream_id_(0) {}
+
+  size_t OnMsg(StreamChannel* ch, int) {
+    size_t rc = SendMsg(82, ch, stream_id_, add_->total_);
+    return (rc == ipc::RcOK) ? ipc::OnMsgReady : rc;
+  }
+
+  const AddMsg* add_;
+  int stream_id_;
+};
+
+class Session {
+public:
+  explicit Session(PipeMux::Stream* stream) : channel_(stream), total_(&add_) {
+    total_.stream_id_ = stream->Id();
+  }
+
+  Session* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, StreamChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 80)
+      return add_.OnMsgIn(msg_id, ch, args, count);
+    return total_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  StreamChannel channel_;
+  AddMsg add_;
+  TotalMsg total_;
+};
+
+struct ServerCtx {
+  int served;
+  int errors;
+};
+
+// Serves every session from this one thread until all of them are done.
+size_t Serve(PipeMux* mux, void* p) {
+  ServerCtx* ctx = reinterpret_cast<ServerCtx*>(p);
+  Session* sessions[kNumSessions] = { NULL };
+  while (ctx->served != kNumSessions) {
+    PipeMux::Stream* stream = mux->WaitAny();
+    if (!stream)
+      break;
+    const int id = stream->Id();
+    if ((id < 1) || (id > kNumSessions)) {
+      ++ctx->errors;
+      break;
+    }
+    Session*& session = sessions[id - 1];
+    if (!session)
+      session = new Session(stream);
+    size_t rc = ipc::DispatchOne(&session->channel_, session);
+    if (rc == ipc::OnMsgLoopNext)
+      continue;
+    if (rc != ipc::OnMsgReady)
+      ++ctx->errors;
+    if (session->channel_.LastRecvMsgId() != 81)
+      ++ctx->errors;
+    mux->CloseStream(stream);
+    delete session;
+    session = NULL;
+    ++ctx->served;
+  }
+  for (int ix = 0; ix != kNumSessions; ++ix)
+    delete sessions[ix];
+  return ipc::RcOK;
+}
+
+class ClientSender : public ipc::MsgOut<StreamChannel> {
+public:
+  size_t Add(StreamChannel* ch, int value) {
+    return SendMsg(80, ch, value);
+  }
+
+  size_t AskTotal(StreamChannel* ch) {
+    return SendMsg(81, ch, 0);
+  }
+};
+
+class TotalReply : public DispTestMsg,
+                   public ipc::MsgIn<82, TotalReply, StreamChannel> {
+public:
+  TotalReply() : stream_id_(0), total_(0) {}
+
+  size_t OnMsg(StreamChannel*, int stream_id, int total) {
+    stream_id_ = stream_id;
+    total_ = total;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  TotalReply* MsgHandler(int) {
+    return this;
+  }
+
+  int stream_id_;
+  int total_;
+};
+
+// One end of a connection that is moved by hand: what is sent waits until Deliver() hands it
+// to the other end, which then receives it all at once.
+class HandTransport {
+public:
+  HandTransport() : pos_(0) {}
+
+  size_t Send(const void* buf, size_t sz) {
+    out_.Add(static_cast<const char*>(buf), sz);
+    return ipc::RcOK;
+  }
+
+  char* Receive(size_t* size) {
+    if (pos_ == in_.size())
+      return NULL;
+    *size = in_.size() - pos_;
+    char* data = &in_[pos_];
+    pos_ = in_.size();
+    return data;
+  }
+
+  void Deliver(HandTransport* other) {
+    other->in_.Add(out_.get(), out_.size());
+    out_.clear();
+  }
+
+  size_t Sent() const { return out_.size(); }
+
+private:
+  size_t pos_;
+  ipc::PodVector<char> in_;
+  ipc::PodVector<char> out_;
+};
+
+}  // namespace.
+
+int TestMuxSessions() {
+  PipeServer<PipeMux> server;
+  ServerCtx ctx = { 0, 0 };
+  if (!server.Start(Serve, &ctx))
+    return 1;
+
+  PipeTransport client_pipe;
+  server.Connect(&client_pipe);
+  PipeMux client_mux(&client_pipe);
+
+  // All the sessions are open at the same time and their messages are interleaved.
+  StreamChannel* channels[kNumSessions];
+  for (int ix = 0; ix != kNumSessions; ++ix)
+    channels[ix] = new StreamChannel(client_mux.OpenStream(ix + 1));
+  if (client_mux.OpenStream(1))
+    return 2;
+
+  ClientSender sender;
+  for (int round = 1; round <= kAddsPerSession; ++round) {
+    for (int ix = 0; ix != kNumSessions; ++ix) {
+      if (sender.Add(channels[ix], round * (ix + 1)) != ipc::RcOK)
+        return 3;
+    }
+  }
+  for (int ix = 0; ix != kNumSessions; ++ix) {
+    if (sender.AskTotal(channels[ix]) != ipc::RcOK)
+      return 4;
+  }
+
+  // The replies come back in any order; each channel only sees its own.
+  int result = 0;
+  for (int ix = kNumSessions - 1; ix >= 0; --ix) {
+    TotalReply reply;
+    if (channels[ix]->Receive(&reply) != ipc::OnMsgReady)
+      result = 5;
+    else if ((reply.stream_id_ != ix + 1) || (reply.total_ != 15 * (ix + 1)))
+      result = 6;
+    else if (channels[ix]->LastRecvMsgId() != 82)
+      result = 7;
+  }
+  server.Join();
+  for (int ix = 0; ix != kNumSessions; ++ix)
+    delete channels[ix];
+
+  if (result)
+    return result;
+  if ((ctx.served != kNumSessions) || ctx.errors)
+    return 8;
+  return 0;
+}
+
+int TestMuxStreams() {
+  MemTransport transport;
+  ipc::MuxTransport<MemTransport> tx_mux(&transport);
+
+  // Opening streams sends nothing.
+  ipc::MuxTransport<MemTransport>::Stream* one = tx_mux.OpenStream(1);
+  ipc::MuxTransport<MemTransport>::Stream* two = tx_mux.OpenStream(2);
+  if (!one || !two || transport.Data().size())
+    return 1;
+  if ((two->Send("bb", 2) != ipc::RcOK) || (one->Send("a", 1) != ipc::RcOK))
+    return 2;
+  if (tx_mux.CloseStream(one) != ipc::RcOK)
+    return 3;
+
+  // The other end sees stream 2 first, then stream 1 and then that 1 was closed.
+  ipc::MuxTransport<MemTransport> rx_mux(&transport);
+  ipc::MuxTransport<MemTransport>::Stream* stream = rx_mux.WaitAny();
+  if (!stream || (stream->Id() != 2))
+    return 4;
+  size_t size = 0;
+  const char* data = stream->Receive(&size);
+  if (!data || (size != 2) || memcmp(data, "bb", 2))
+    return 5;
+
+  stream = rx_mux.WaitAny();
+  if (!stream || (stream->Id() != 1))
+    return 6;
+  data = stream->Receive(&size);
+  if (!data || (size != 1) || (data[0] != 'a'))
+    return 7;
+  if (rx_mux.WaitAny() != stream)
+    return 8;
+  if (stream->Receive(&size))
+    return 9;
+  if (rx_mux.CloseStream(stream) != ipc::RcOK)
+    return 10;
+
+  // Nothing else is coming.
+  if (rx_mux.WaitAny())
+    return 11;
+  return 0;
+}
+
+int TestMuxClosedStreams() {
+  typedef ipc::MuxTransport<HandTransport> HandMux;
+  HandTransport ta;
+  HandTransport tb;
+  HandMux mux_a(&ta);
+  HandMux mux_b(&tb, 2);
+
+  HandMux::Stream* one = mux_a.OpenStream(1);
+  HandMux::Stream* two = mux_a.OpenStream(2);
+  HandMux::Stream* three = mux_a.OpenStream(3);
+  if (!one || !two || !three)
+    return 1;
+  if ((one->Send("1", 1) != ipc::RcOK) || (two->Send("2", 1) != ipc::RcOK) ||
+      (three->Send("3", 1) != ipc::RcOK))
+    return 2;
+  ta.Deliver(&tb);
+
+  // Only two streams fit on this end, so stream 3 is refused with a close.
+  size_t size = 0;
+  HandMux::Stream* b_one = mux_b.WaitAny();
+  if (!b_one || (b_one->Id() != 1) || !b_one->Receive(&size))
+    return 3;
+  HandMux::Stream* b_two = mux_b.WaitAny();
+  if (!b_two || (b_two->Id() != 2) || !b_two->Receive(&size))
+    return 4;
+  if (mux_b.OpenStream(9))
+    return 5;
+  if (mux_b.CloseStream(b_one) != ipc::RcOK)
+    return 6;
+  tb.Deliver(&ta);
+
+  if (three->Receive(&size))
+    return 7;
+  if (one->Receive(&size))
+    return 8;
+
+  // A late message for stream 1 must not open it again, and the closes from this end answer
+  // the ones from the other end, which then owes nothing more.
+  if (one->Send("late", 4) != ipc::RcOK)
+    return 9;
+  if ((mux_a.CloseStream(one) != ipc::RcOK) || (mux_a.CloseStream(three) != ipc::RcOK))
+    return 10;
+  ta.Deliver(&tb);
+  if (mux_b.WaitAny())
+    return 11;
+  if (tb.Sent())
+    return 12;
+  return 0;
+}
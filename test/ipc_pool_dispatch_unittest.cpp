@@ -0,0 +1,225 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_pool_dispatch.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the worker pool dispatch. A client thread sends requests for several keys and the server
+// handles them on a pool of workers. Requests with the same key must be handled, and their
+// replies sent, in the order they were sent.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+const int kNumKeys = 6;
+const int kMsgsPerKey = 100;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(41, 2) {
+  IPC_MSG_P1(int, Int32)        // Key.
+  IPC_MSG_P2(int, Int32)        // Sequence number.
+};
+
+DEFINE_IPC_MSG_CONV(42, 2) {
+  IPC_MSG_P1(int, Int32)        // Key.
+  IPC_MSG_P2(int, Int32)        // Sequence number.
+};
+
+DEFINE_IPC_MSG_CONV(43, 1) {
+  IPC_MSG_P1(int, Int32)        // Number of requests sent.
+};
+
+namespace {
+
+class KeyedMsg : public ipc::MsgOut<PipeChannel> {
+public:
+  size_t SendRequest(PipeChannel* ch, int key, int seq) {
+    return SendMsg(41, ch, key, seq);
+  }
+  size_t SendReply(PipeChannel* ch, int key, int seq) {
+    return SendMsg(42, ch, key, seq);
+  }
+  size_t SendDone(PipeChannel* ch, int count) {
+    return SendMsg(43, ch, count);
+  }
+};
+
+// Message 43 ends the server Receive() loop so it runs on the receiving thread.
+struct TestKey {
+  static size_t Key(int msg_id, const ipc::WireType* const args[], int count) {
+    return (msg_id == 43) ? ipc::kRunInline : ipc::OrderByFirstArg::Key(msg_id, args, count);
+  }
+};
+
+class RequestMsg : public DispTestMsg,
+                   public ipc::MsgIn<41, RequestMsg, PipeChannel> {
+public:
+  RequestMsg() {
+    for (int ix = 0; ix != kNumKeys; ++ix)
+      next_seq_[ix] = 0;
+  }
+
+  size_t OnMsg(PipeChannel* ch, int key, int seq) {
+    if ((key < 0) || (key >= kNumKeys))
+      return ipc::OnMsgAppErrorBase;
+    // No lock: the pool never runs two messages with the same key at once.
+    if (seq != next_seq_[key])
+      return ipc::OnMsgAppErrorBase + 1;
+    ++next_seq_[key];
+    KeyedMsg reply;
+    return reply.SendReply(ch, key, seq);
+  }
+
+private:
+  int next_seq_[kNumKeys];
+};
+
+class DoneMsg : public DispTestMsg,
+                public ipc::MsgIn<43, DoneMsg, PipeChannel> {
+public:
+  DoneMsg() : count_(0) {}
+
+  size_t OnMsg(PipeChannel*, int count) {
+    count_ = count;
+    return ipc::OnMsgReady;
+  }
+
+  int count_;
+};
+
+class ServerDispatch {
+public:
+  ServerDispatch* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 43)
+      return done_.OnMsgIn(msg_id, ch, args, count);
+    return request_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  RequestMsg request_;
+  DoneMsg done_;
+};
+
+class ReplyMsg : public DispTestMsg,
+                 public ipc::MsgIn<42, ReplyMsg, PipeChannel> {
+public:
+  ReplyMsg() : received_(0) {
+    for (int ix = 0; ix != kNumKeys; ++ix)
+      next_seq_[ix] = 0;
+  }
+
+  size_t OnMsg(PipeChannel*, int key, int seq) {
+    if ((key < 0) || (key >= kNumKeys))
+      return ipc::OnMsgAppErrorBase;
+    if (seq != next_seq_[key])
+      return ipc::OnMsgAppErrorBase + 1;
+    ++next_seq_[key];
+    ++received_;
+    return (received_ == kNumKeys * kMsgsPerKey) ? ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  int next_seq_[kNumKeys];
+  int received_;
+};
+
+struct ClientCtx {
+  PipeChannel* channel;
+  int result;
+};
+
+void ClientThread(void* p) {
+  ClientCtx* ctx = reinterpret_cast<ClientCtx*>(p);
+  KeyedMsg msg;
+  // Interleave the keys so that messages with different keys are queued at the same time.
+  for (int seq = 0; seq != kMsgsPerKey; ++seq) {
+    for (int key = 0; key != kNumKeys; ++key) {
+      if (msg.SendRequest(ctx->channel, key, seq) != ipc::RcOK) {
+        ctx->result = 1;
+        return;
+      }
+    }
+  }
+  if (msg.SendDone(ctx->channel, kNumKeys * kMsgsPerKey) != ipc::RcOK) {
+    ctx->result = 2;
+    return;
+  }
+  ReplyMsg reply;
+  if (ctx->channel->Receive(&reply) != ipc::OnMsgReady) {
+    ctx->result = 3;
+    return;
+  }
+  if (reply.HasConvertError() || reply.HasArgCountError())
+    ctx->result = 4;
+}
+
+}  // namespace.
+
+int TestPoolDispatch() {
+  PipePair pp;
+  PipeTransport client_transport;
+  client_transport.OpenClient(pp.fd2());
+  PipeChannel client_channel(&client_transport);
+
+  ClientCtx ctx = { &client_channel, 0 };
+  ipc::Thread client;
+  if (!client.Start(ClientThread, &ctx))
+    return 1;
+
+  PipeTransport server_transport;
+  server_transport.OpenServer(pp.fd1());
+  PipeChannel server_channel(&server_transport);
+  ServerDispatch server;
+  size_t rc;
+  long errors;
+  {
+    ipc::PoolDispatch<PipeChannel, ServerDispatch, TestKey> pool(&server_channel, &server, 3);
+    rc = server_channel.Receive(&pool);
+    pool.Stop();
+    errors = pool.ErrorCount();
+  }
+  client.Join();
+
+  if (rc != ipc::OnMsgReady)
+    return 2;
+  if (server_channel.GetSendMode() != PipeChannel::SEND_COMBINED)
+    return 3;
+  if (errors)
+    return 4;
+  if (server.done_.count_ != kNumKeys * kMsgsPerKey)
+    return 5;
+  if (server.request_.HasConvertError() || server.request_.HasArgCountError())
+    return 6;
+  if (ctx.result)
+    return 10 + ctx.result;
+  return 0;
+}
@@ -0,0 +1,201 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_pubsub.h"
+#include "ipc_sync.h"
+
+#if !defined(WIN32)
+#include <stdio.h>
+#include "shared_mem_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the shared memory publish/subscribe. Each subscriber maps the memory on its own, as
+// another process would, and the log is small so it wraps around many times.
+
+#if defined(IPC_HAS_PUBSUB)
+
+namespace {
+
+typedef ipc::Channel<ipc::PubSubPublisher, ipc::Encoder, ipc::Decoder> PubChannel;
+typedef ipc::Channel<ipc::PubSubSubscriber, ipc::Encoder, ipc::Decoder> SubChannel;
+
+const int kNumSubscribers = 3;
+const int kNumEvents = 2000;
+const size_t kLogSize = 4096;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(100, 2) {
+  IPC_MSG_P1(int, Int32)                // Sequence number.
+  IPC_MSG_P2(const char*, String8)      // Payload.
+};
+
+namespace {
+
+class EventMsg : public ipc::MsgOut<PubChannel> {
+public:
+  size_t Publish(PubChannel* ch, int seq, const char* payload) {
+    return SendMsg(100, ch, seq, payload);
+  }
+};
+
+class EventHandler : public DispTestMsg,
+                     public ipc::MsgIn<100, EventHandler, SubChannel> {
+public:
+  EventHandler() : next_seq_(0) {}
+
+  size_t OnMsg(SubChannel*, int seq, const char* payload) {
+    if ((seq != next_seq_) || (IPCString(payload) != "event payload"))
+      return ipc::OnMsgAppErrorBase;
+    ++next_seq_;
+    return ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int next_seq_;
+};
+
+struct SubscriberCtx {
+  SharedMemory shm;
+  ipc::PubSubSubscriber subscriber;
+  EventHandler handler;
+  size_t rc;
+};
+
+void SubscriberThread(void* p) {
+  SubscriberCtx* ctx = reinterpret_cast<SubscriberCtx*>(p);
+  SubChannel channel(&ctx->subscriber);
+  ctx->rc = channel.Receive(&ctx->handler);
+}
+
+void ShmName(char* name, size_t size) {
+  snprintf(name, size, "/simple-ipc-test-%d", static_cast<int>(getpid()));
+}
+
+}  // namespace.
+
+int TestPubSubFanOut() {
+  char name[64];
+  ShmName(name, sizeof(name));
+  SharedMemory shm;
+  if (!shm.Create(name, kLogSize))
+    return 1;
+  ipc::PubSubPublisher publisher;
+  if (!publisher.Init(shm.memory(), shm.size(), ipc::SLOW_BACKPRESSURE))
+    return 2;
+
+  SubscriberCtx ctx[kNumSubscribers];
+  ipc::Thread threads[kNumSubscribers];
+  for (int ix = 0; ix != kNumSubscribers; ++ix) {
+    if (!ctx[ix].shm.Open(name))
+      return 3;
+    if (!ctx[ix].subscriber.Attach(ctx[ix].shm.memory(), ctx[ix].shm.size()))
+      return 4;
+    ctx[ix].rc = 0;
+    threads[ix].Start(SubscriberThread, &ctx[ix]);
+  }
+  SharedMemory::Remove(name);
+  if (publisher.SubscriberCount() != kNumSubscribers)
+    return 5;
+
+  // Every event is encoded once no matter how many subscribers there are.
+  PubChannel channel(&publisher);
+  EventMsg event;
+  for (int ix = 0; ix != kNumEvents; ++ix) {
+    if (event.Publish(&channel, ix, "event payload") != ipc::RcOK)
+      return 6;
+  }
+  publisher.Close();
+
+  int result = 0;
+  for (int ix = 0; ix != kNumSubscribers; ++ix) {
+    threads[ix].Join();
+    // The log was closed so Receive() ends with a read error.
+    if (ctx[ix].rc != ipc::RcErrTransportRead)
+      result = 7;
+    else if (ctx[ix].handler.next_seq_ != kNumEvents)
+      result = 8;
+    else if (ctx[ix].subscriber.Lagged() || ctx[ix].subscriber.Skips())
+      result = 9;
+    ctx[ix].subscriber.Detach();
+  }
+  if (result)
+    return result;
+  return publisher.SubscriberCount() ? 10 : 0;
+}
+
+int TestPubSubSlowSubscriber() {
+  char buf[kLogSize];
+  char payload[200];
+  memset(payload, 'x', sizeof(payload));
+
+  // With SLOW_DETECT the subscriber finds out it missed messages.
+  ipc::PubSubPublisher publisher;
+  if (!publisher.Init(buf, sizeof(buf), ipc::SLOW_DETECT))
+    return 1;
+  ipc::PubSubSubscriber subscriber;
+  if (!subscriber.Attach(buf, sizeof(buf)))
+    return 2;
+  if (publisher.Send(payload, sizeof(payload)) != ipc::RcOK)
+    return 3;
+  size_t size = 0;
+  if (!subscriber.Receive(&size) || (size != sizeof(payload)))
+    return 4;
+  for (int ix = 0; ix != 40; ++ix) {
+    payload[0] = static_cast<char>(ix);
+    if (publisher.Send(payload, sizeof(payload)) != ipc::RcOK)
+      return 5;
+  }
+  if (subscriber.Receive(&size) || !subscriber.Lagged())
+    return 6;
+
+  // With SLOW_SKIP it jumps to the newest message instead.
+  if (!publisher.Init(buf, sizeof(buf), ipc::SLOW_SKIP))
+    return 7;
+  if (!subscriber.Attach(buf, sizeof(buf)))
+    return 8;
+  for (int ix = 0; ix != 40; ++ix) {
+    payload[0] = static_cast<char>(ix);
+    if (publisher.Send(payload, sizeof(payload)) != ipc::RcOK)
+      return 9;
+  }
+  payload[0] = 'z';
+  if (publisher.Send(payload, sizeof(payload)) != ipc::RcOK)
+    return 10;
+  const char* data = subscriber.Receive(&size);
+  if (!data || (size != sizeof(payload)) || (data[0] != 'z') || (subscriber.Skips() != 1))
+    return 11;
+
+  // A message can not take more than half the log.
+  if (publisher.Send(buf, sizeof(buf) / 2) != ipc::RcErrTransportWrite)
+    return 12;
+  return 0;
+}
+
+#else
+
+int TestPubSubFanOut() {
+  return 0;
+}
+
+int TestPubSubSlowSubscriber() {
+  return 0;
+}
+
+#endif  // defined(IPC_HAS_PUBSUB)
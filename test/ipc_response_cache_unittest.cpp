@@ -0,0 +1,220 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_response_cache.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include <unistd.h>
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the client response cache. The server answers option queries and counts them, so the
+// test can tell which calls made a round trip.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+typedef ipc::ResponseCache<PipeChannel> Cache;
+
+void SleepMs(int ms) {
+#if defined(WIN32)
+  ::Sleep(ms);
+#else
+  usleep(ms * 1000);
+#endif
+}
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(110, 2) {
+  IPC_MSG_P1(int, Int32)                // Option.
+  IPC_MSG_P2(const char*, String8)      // Scope.
+};
+
+DEFINE_IPC_MSG_CONV(111, 2) {
+  IPC_MSG_P1(int, Int32)                // Value.
+  IPC_MSG_P2(const char*, String8)      // Scope, echoed.
+};
+
+DEFINE_IPC_MSG_CONV(112, 1) {
+  IPC_MSG_P1(int, Int32)                // New version, 0 to stop the server.
+};
+
+DEFINE_IPC_MSG_CONV(113, 1) {
+  IPC_MSG_P1(int, Int32)                // New version.
+};
+
+namespace {
+
+// Replies with option * 100 + version. Changing the version invalidates the cached replies.
+class OptionServer : public DispTestMsg,
+                     public ipc::MsgIn<110, OptionServer, PipeChannel>,
+                     public ipc::MsgOut<PipeChannel> {
+public:
+  OptionServer() : version_(1), queries_(0) {}
+
+  size_t OnMsg(PipeChannel* ch, int option, const char* scope) {
+    ++queries_;
+    return SendMsg(111, ch, option * 100 + version_, scope);
+  }
+
+  int version_;
+  long queries_;
+};
+
+class VersionServer : public DispTestMsg,
+                      public ipc::MsgIn<112, VersionServer, PipeChannel>,
+                      public ipc::MsgOut<PipeChannel> {
+public:
+  explicit VersionServer(OptionServer* options) : options_(options) {}
+
+  size_t OnMsg(PipeChannel* ch, int version) {
+    if (!version)
+      return ipc::OnMsgReady;
+    options_->version_ = version;
+    size_t rc = Cache::SendInvalidate(ch, 110);
+    if (rc != ipc::RcOK)
+      return rc;
+    return SendMsg(113, ch, version);
+  }
+
+  OptionServer* options_;
+};
+
+class Server {
+public:
+  Server() : versions_(&options_) {}
+
+  Server* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 110)
+      return options_.OnMsgIn(msg_id, ch, args, count);
+    return versions_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  OptionServer options_;
+  VersionServer versions_;
+};
+
+class OptionReply : public DispTestMsg,
+                    public ipc::MsgIn<111, OptionReply, PipeChannel>,
+                    public ipc::MsgIn<113, OptionReply, PipeChannel> {
+public:
+  OptionReply() : value_(0) {}
+
+  size_t OnMsg(PipeChannel*, int value, const char* scope) {
+    value_ = value;
+    scope_ = scope;
+    return ipc::OnMsgReady;
+  }
+
+  size_t OnMsg(PipeChannel*, int version) {
+    value_ = version;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  OptionReply* MsgHandler(int) {
+    return this;
+  }
+
+  size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 111)
+      return ipc::MsgIn<111, OptionReply, PipeChannel>::OnMsgIn(msg_id, ch, args, count);
+    return ipc::MsgIn<113, OptionReply, PipeChannel>::OnMsgIn(msg_id, ch, args, count);
+  }
+
+  int value_;
+  IPCString scope_;
+};
+
+// Returns the value of |option| in |scope|, or -1 on error.
+int Query(Cache* cache, int option, const char* scope) {
+  const ipc::WireView args[] = { ipc::WireView(option), ipc::WireView(scope) };
+  OptionReply reply;
+  if (cache->Call(110, args, 2, &reply) != ipc::OnMsgReady)
+    return -1;
+  if (reply.scope_ != scope)
+    return -1;
+  return reply.value_;
+}
+
+}  // namespace.
+
+int TestResponseCache() {
+  Server handler;
+  PipeServer<PipeChannel> server;
+  if (!server.Start(&handler))
+    return 1;
+
+  PipeTransport client_transport;
+  server.Connect(&client_transport);
+  PipeChannel client_channel(&client_transport);
+  Cache cache(&client_channel);
+  cache.SetPolicy(110, 60 * 1000, 2);
+
+  // The same query is answered from the cache. A different argument is another entry.
+  if ((Query(&cache, 7, "user") != 701) || (Query(&cache, 7, "user") != 701))
+    return 2;
+  if ((Query(&cache, 7, "machine") != 701) || (Query(&cache, 7, "user") != 701))
+    return 3;
+  if ((cache.Hits() != 2) || (cache.Misses() != 2))
+    return 4;
+
+  // Only two entries fit, and "machine" was used the longest time ago.
+  if ((Query(&cache, 8, "user") != 801) || (Query(&cache, 7, "machine") != 701))
+    return 5;
+  if (cache.Misses() != 4)
+    return 6;
+
+  // A new version on the server invalidates what the client has.
+  const ipc::WireView version[] = { ipc::WireView(2) };
+  OptionReply ack;
+  if ((client_channel.Send(112, version, 1) != ipc::RcOK) ||
+      (client_channel.Receive(&ack) != ipc::OnMsgReady) || (ack.value_ != 2))
+    return 7;
+  if ((Query(&cache, 7, "machine") != 702) || (cache.Misses() != 5))
+    return 8;
+
+  // Entries expire.
+  cache.SetPolicy(110, 20, 2);
+  cache.Invalidate(0);
+  if ((Query(&cache, 9, "user") != 902) || (Query(&cache, 9, "user") != 902))
+    return 9;
+  SleepMs(40);
+  if ((Query(&cache, 9, "user") != 902) || (cache.Misses() != 7))
+    return 10;
+
+  const ipc::WireView stop[] = { ipc::WireView(0) };
+  if (client_channel.Send(112, stop, 1) != ipc::RcOK)
+    return 11;
+  if (server.Join() != ipc::OnMsgReady)
+    return 12;
+  if (handler.options_.queries_ != cache.Misses())
+    return 13;
+  return 0;
+}
@@ -15,11 +15,13 @@
 #include "os_includes.h"
 
 #include "ipc_test_helpers.h"
+#include "ipc_async_calls.h"
 
 #if defined(WIN32)
 #include "pipe_win.h"
 #else
 #include <pthread.h>
+#include <unistd.h>
 #include "pipe_unix.h"
 #endif
 
@@ -190,6 +192,38 @@ TH_RETURN WINAPI SumMultOddRpcSvcThread(void* ctx) {
   svc.Loop();
   return 0;
 }
+
+// This class models the reply side of an asynchronous RPC. The same server answers it
+// because replies are tagged with the call id of the request automatically.
+class SumMultOddAsyncReply : public DispTestMsg,
+                             public ipc::AsyncCalls<PipeChannel>::Completion,
+                             public ipc::MsgIn<29, SumMultOddAsyncReply, PipeChannel> {
+public:
+  virtual size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[],
+                         int count) {
+    return OnMsgInX(msg_id, ch, args, count);
+  }
+
+  size_t OnMsg(PipeChannel*, const char* ans) {
+    if (!ans)
+      return ipc::OnMsgAppErrorBase;
+    ans_ = ans;
+    return ipc::OnMsgReady;
+  }
+
+  const IPCString& answer() const { return ans_; }
+
+private:
+  IPCString ans_;
+};
+
+size_t StartSumMultOddCall(ipc::AsyncCalls<PipeChannel>* calls, SumMultOddAsyncReply* reply,
+                           int x, int y, int* call_id) {
+  ipc::WireType a0(x);
+  ipc::WireType a1(y);
+  const ipc::WireType* const args[] = { &a0, &a1 };
+  return calls->Call(reply, 28, args, 2, call_id);
+}
   
 }  // namespace.
 
@@ -257,3 +291,110 @@ int TestFullRoundTrip() {
   return 0;
 }
 
+
+int TestPipelinedRoundTrip() {
+  PipePair pp;
+
+#if defined(WIN32)
+  HANDLE thread = ::CreateThread(NULL, 0, SumMultOddRpcSvcThread, &pp, 0, NULL);
+  ::CloseHandle(thread);
+  ::Sleep(60);
+#else
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, SumMultOddRpcSvcThread, &pp)) {
+    return 1;
+  }
+#endif
+  PipeTransport transport;
+  transport.OpenClient(pp.fd2());
+  PipeChannel channel(&transport);
+  ipc::AsyncCalls<PipeChannel> calls(&channel);
+
+  for (int ix = 0; ix != 200; ++ix) {
+    // Three calls in flight at once. Waiting for the last one completes all of them.
+    SumMultOddAsyncReply r1, r2, r3;
+    int id1, id2, id3;
+    if (StartSumMultOddCall(&calls, &r1, 123546, 567890, &id1) != ipc::RcOK)
+      return 2;
+    if (StartSumMultOddCall(&calls, &r2, 1123546, 1567890, &id2) != ipc::RcOK)
+      return 3;
+    if (StartSumMultOddCall(&calls, &r3, 1123546, 1567891, &id3) != ipc::RcOK)
+      return 4;
+    if (calls.PendingCount() != 3)
+      return 5;
+    if (calls.Wait(id3) != ipc::RcOK)
+      return 6;
+    if (calls.IsPending(id1) || calls.IsPending(id2))
+      return 7;
+    if (r1.answer() != "Rpc:70160537940")
+      return 8;
+    if (r2.answer() != "Rpc:1761596537940")
+      return 9;
+    if (r3.answer() != "Rpc:2691437")
+      return 10;
+  }
+
+  SumMultOddAsyncReply r4, r5;
+  int id4, id5;
+  if (StartSumMultOddCall(&calls, &r4, 1, 2, &id4) != ipc::RcOK)
+    return 11;
+  if (StartSumMultOddCall(&calls, &r5, 2, 2, &id5) != ipc::RcOK)
+    return 12;
+  if (calls.WaitAll() != ipc::RcOK)
+    return 13;
+  if (calls.PendingCount() != 0)
+    return 14;
+  if ((r4.answer() != "Rpc:3") || (r5.answer() != "Rpc:4"))
+    return 15;
+
+  return 0;
+}
+
+// The replies to calls made back to back usually arrive in one read. Waiting for each
+// call in turn has to find the replies that the previous waits read.
+int TestPipelinedWaitOrder() {
+  PipePair pp;
+
+#if defined(WIN32)
+  HANDLE thread = ::CreateThread(NULL, 0, SumMultOddRpcSvcThread, &pp, 0, NULL);
+  ::CloseHandle(thread);
+  ::Sleep(60);
+#else
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, SumMultOddRpcSvcThread, &pp)) {
+    return 1;
+  }
+#endif
+  PipeTransport transport;
+  transport.OpenClient(pp.fd2());
+  PipeChannel channel(&transport);
+  ipc::AsyncCalls<PipeChannel> calls(&channel);
+
+  for (int ix = 0; ix != 50; ++ix) {
+    SumMultOddAsyncReply r1, r2, r3;
+    int id[3];
+    if ((StartSumMultOddCall(&calls, &r1, 123546, 567890, &id[0]) != ipc::RcOK) ||
+        (StartSumMultOddCall(&calls, &r2, 1123546, 1567890, &id[1]) != ipc::RcOK) ||
+        (StartSumMultOddCall(&calls, &r3, 1123546, 1567891, &id[2]) != ipc::RcOK))
+      return 2;
+#if defined(WIN32)
+    ::Sleep(2);
+#else
+    usleep(2000);
+#endif
+    // In the order of the calls every other time, else from the last to the first.
+    for (int jx = 0; jx != 3; ++jx) {
+      const int wait_id = (ix % 2) ? id[2 - jx] : id[jx];
+      if (calls.Wait(wait_id) != ipc::RcOK)
+        return 3;
+      if (calls.IsPending(wait_id))
+        return 4;
+    }
+    if (calls.PendingCount() != 0)
+      return 5;
+    if ((r1.answer() != "Rpc:70160537940") || (r2.answer() != "Rpc:1761596537940") ||
+        (r3.answer() != "Rpc:2691437"))
+      return 6;
+  }
+  return 0;
+}
@@ -0,0 +1,330 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_send_queue.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#define TH_RETURN DWORD
+#else
+#include <pthread.h>
+#include "pipe_unix.h"
+#define TH_RETURN void*
+#define WINAPI
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the thread-safe send modes of the channel. Several producer threads share one channel
+// and the main thread checks that every message arrives whole and in per-producer order.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+const int kNumProducers = 4;
+const int kMsgsPerProducer = 500;
+
+struct ProducerCtx {
+  PipeChannel* channel;
+  int producer;
+  int result;
+};
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(40, 3) {
+  IPC_MSG_P1(int, Int32)                // Producer.
+  IPC_MSG_P2(int, Int32)                // Sequence number.
+  IPC_MSG_P3(const char*, String8)      // Padding so messages are not tiny.
+};
+
+DEFINE_IPC_MSG_CONV(44, 1) {
+  IPC_MSG_P1(int, Int32)                // Number of messages posted.
+};
+
+namespace {
+
+class ProducerMsg : public ipc::MsgOut<PipeChannel> {
+public:
+  size_t Send(PipeChannel* ch, int producer, int seq, const char* pad) {
+    return SendMsg(40, ch, producer, seq, pad);
+  }
+};
+
+class ConsumerMsg : public DispTestMsg,
+                    public ipc::MsgIn<40, ConsumerMsg, PipeChannel> {
+public:
+  ConsumerMsg() : received_(0) {
+    for (int ix = 0; ix != kNumProducers; ++ix)
+      next_seq_[ix] = 0;
+  }
+
+  size_t OnMsg(PipeChannel*, int producer, int seq, const char* pad) {
+    if ((producer < 0) || (producer >= kNumProducers))
+      return ipc::OnMsgAppErrorBase;
+    if ((seq != next_seq_[producer]) || (IPCString(pad) != "0123456789abcdef"))
+      return ipc::OnMsgAppErrorBase + 1;
+    ++next_seq_[producer];
+    ++received_;
+    return (received_ == kNumProducers * kMsgsPerProducer) ? ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  int next_seq_[kNumProducers];
+  int received_;
+};
+
+// Receives the posted messages of one producer.
+class PostedMsg : public DispTestMsg,
+                  public ipc::MsgIn<40, PostedMsg, PipeChannel> {
+public:
+  PostedMsg() : next_seq_(0) {}
+
+  size_t OnMsg(PipeChannel*, int producer, int seq, const char*) {
+    if ((producer != 0) || (seq != next_seq_))
+      return ipc::OnMsgAppErrorBase;
+    ++next_seq_;
+    return ipc::OnMsgLoopNext;
+  }
+
+  int next_seq_;
+};
+
+// Receives the message sent after Drain(), which must come after all the posted ones.
+class PostCountMsg : public DispTestMsg,
+                     public ipc::MsgIn<44, PostCountMsg, PipeChannel> {
+public:
+  explicit PostCountMsg(const PostedMsg* posted) : posted_(posted) {}
+
+  size_t OnMsg(PipeChannel*, int count) {
+    return (count == posted_->next_seq_) ? ipc::OnMsgReady : ipc::OnMsgAppErrorBase + 1;
+  }
+
+  const PostedMsg* posted_;
+};
+
+class PostReceiver {
+public:
+  PostReceiver() : count_(&posted_) {}
+
+  PostReceiver* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int msg_id, PipeChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 40)
+      return posted_.OnMsgIn(msg_id, ch, args, count);
+    return count_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  PostedMsg posted_;
+  PostCountMsg count_;
+};
+
+struct ReceiverCtx {
+  PipeChannel* channel;
+  PostReceiver posted;
+  size_t rc;
+};
+
+void ReceiverThread(void* p) {
+  ReceiverCtx* ctx = reinterpret_cast<ReceiverCtx*>(p);
+  ctx->rc = ctx->channel->Receive(&ctx->posted);
+}
+
+TH_RETURN WINAPI ProducerThread(void* p) {
+  ProducerCtx* ctx = reinterpret_cast<ProducerCtx*>(p);
+  ProducerMsg msg;
+  for (int ix = 0; ix != kMsgsPerProducer; ++ix) {
+    if (msg.Send(ctx->channel, ctx->producer, ix, "0123456789abcdef") != ipc::RcOK) {
+      ctx->result = ix + 1;
+      break;
+    }
+  }
+  return 0;
+}
+
+}  // namespace.
+
+int TestSendQueue() {
+  typedef ipc::SendQueue<ipc::Encoder> Queue;
+  Queue queue;
+  if (!queue.IsEmpty())
+    return 1;
+
+  Queue::Node* nodes[3];
+  for (int ix = 0; ix != 3; ++ix) {
+    nodes[ix] = Queue::NewNode();
+    queue.Push(nodes[ix]);
+  }
+  if (queue.IsEmpty())
+    return 2;
+
+  if (!queue.TryAcquireFlush())
+    return 3;
+  if (queue.TryAcquireFlush())
+    return 4;
+
+  Queue::Node* node = queue.PopAll();
+  for (int ix = 0; ix != 3; ++ix) {
+    if (node != nodes[ix])
+      return 5;
+    Queue::Node* next = node->next;
+    Queue::DeleteNode(node);
+    node = next;
+  }
+  if (node || !queue.IsEmpty())
+    return 6;
+
+  queue.ReleaseFlush();
+  if (!queue.TryAcquireFlush())
+    return 7;
+  return 0;
+}
+
+int TestThreadSafeSend() {
+  PipePair pp;
+  PipeTransport tx_transport;
+  tx_transport.OpenClient(pp.fd2());
+  PipeChannel tx_channel(&tx_transport);
+  tx_channel.SetSendMode(PipeChannel::SEND_COMBINED);
+
+  ProducerCtx ctx[kNumProducers];
+  for (int ix = 0; ix != kNumProducers; ++ix) {
+    ctx[ix].channel = &tx_channel;
+    ctx[ix].producer = ix;
+    ctx[ix].result = 0;
+#if defined(WIN32)
+    HANDLE thread = ::CreateThread(NULL, 0, ProducerThread, &ctx[ix], 0, NULL);
+    ::CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ProducerThread, &ctx[ix]))
+      return 1;
+    pthread_detach(thread);
+#endif
+  }
+
+  PipeTransport rx_transport;
+  rx_transport.OpenServer(pp.fd1());
+  PipeChannel rx_channel(&rx_transport);
+  ConsumerMsg consumer;
+  if (rx_channel.Receive(&consumer) != ipc::OnMsgReady)
+    return 2;
+  if (consumer.HasConvertError() || consumer.HasArgCountError())
+    return 3;
+
+  for (int ix = 0; ix != kNumProducers; ++ix) {
+    if (ctx[ix].result)
+      return 4;
+  }
+  return 0;
+}
+
+int TestPostQueue() {
+  typedef ipc::PostQueue<ipc::Encoder> Queue;
+  Queue queue;
+  queue.Configure(2, ipc::POST_DROP_OLDEST);
+
+  Queue::Node* nodes[3];
+  for (int ix = 0; ix != 3; ++ix) {
+    nodes[ix] = ipc::SendQueue<ipc::Encoder>::NewNode();
+    if (!queue.Push(nodes[ix]))
+      return 1;
+  }
+  if (queue.Dropped() != 1)
+    return 2;
+  // The first node was dropped and counts as finished.
+  for (int ix = 1; ix != 3; ++ix) {
+    if (queue.Pop() != nodes[ix])
+      return 3;
+    queue.Finish();
+    ipc::SendQueue<ipc::Encoder>::DeleteNode(nodes[ix]);
+  }
+  queue.WaitFinished();
+
+  queue.Configure(1, ipc::POST_FAIL);
+  Queue::Node* node = ipc::SendQueue<ipc::Encoder>::NewNode();
+  if (!queue.Push(node))
+    return 4;
+  Queue::Node* extra = ipc::SendQueue<ipc::Encoder>::NewNode();
+  if (queue.Push(extra))
+    return 5;
+
+  // Once closed nothing goes in, but what is queued still comes out.
+  queue.Close();
+  if (queue.Push(extra))
+    return 6;
+  ipc::SendQueue<ipc::Encoder>::DeleteNode(extra);
+  if (queue.Pop() != node)
+    return 7;
+  ipc::SendQueue<ipc::Encoder>::DeleteNode(node);
+  if (queue.Pop())
+    return 8;
+  return 0;
+}
+
+int TestChannelPost() {
+  PipePair pp;
+  PipeTransport tx_transport;
+  tx_transport.OpenClient(pp.fd2());
+  PipeChannel tx_channel(&tx_transport);
+  // The queue is much smaller than what is posted so Post() has to wait for the writer.
+  if (!tx_channel.StartPostWriter(8, ipc::POST_BLOCK))
+    return 1;
+  if (tx_channel.GetSendMode() != PipeChannel::SEND_COMBINED)
+    return 2;
+
+  PipeTransport rx_transport;
+  rx_transport.OpenServer(pp.fd1());
+  PipeChannel rx_channel(&rx_transport);
+
+  // The receiver runs in its own thread since the pipe does not hold everything posted.
+  ReceiverCtx receiver;
+  receiver.channel = &rx_channel;
+  receiver.rc = 0;
+  ipc::Thread thread;
+  if (!thread.Start(ReceiverThread, &receiver))
+    return 3;
+
+  for (int ix = 0; ix != kMsgsPerProducer; ++ix) {
+    const ipc::WireView args[] = {
+      ipc::WireView(0), ipc::WireView(ix), ipc::WireView("0123456789abcdef")
+    };
+    if (tx_channel.Post(40, args, 3) != ipc::RcOK)
+      return 4;
+  }
+  // After Drain() a sent message comes after everything posted.
+  if (tx_channel.Drain() != ipc::RcOK)
+    return 5;
+  const ipc::WireView count[] = { ipc::WireView(kMsgsPerProducer) };
+  if (tx_channel.Send(44, count, 1) != ipc::RcOK)
+    return 6;
+
+  thread.Join();
+  if (receiver.rc != ipc::OnMsgReady)
+    return 7;
+  if (receiver.posted.posted_.next_seq_ != kMsgsPerProducer)
+    return 8;
+  if ((tx_channel.StopPostWriter() != ipc::RcOK) || tx_channel.PostDropped())
+    return 9;
+  return 0;
+}
@@ -0,0 +1,301 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_service_pool.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the service pool. Many client connections stay open at the same time and two threads
+// serve all of them, including a connection made with InitNewTransport().
+
+#if defined(IPC_HAS_SERVICE_POOL)
+
+namespace {
+
+class Session;
+typedef ipc::ServicePool<PipeTransport, Session> PipePool;
+typedef PipePool::ChannelT ServerChannel;
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+const int kNumConnections = 30;
+const int kAddsPerRound = 3;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(90, 1) {
+  IPC_MSG_P1(int, Int32)              // Value to add.
+};
+
+DEFINE_IPC_MSG_CONV(91, 1) {
+  IPC_MSG_P1(int, Int32)              // Ignored.
+};
+
+DEFINE_IPC_MSG_CONV(92, 1) {
+  IPC_MSG_P1(int, Int32)              // Total.
+};
+
+namespace {
+
+struct ServerCtx {
+  ServerCtx() : pool(NULL), closed_eof(0), closed_stop(0), closed_other(0) {}
+
+  PipePool* pool;
+  ipc::Semaphore closed;
+  long closed_eof;
+  long closed_stop;
+  long closed_other;
+};
+
+class AddMsg : public DispTestMsg,
+               public ipc::MsgIn<90, AddMsg, ServerChannel> {
+public:
+  AddMsg() : total_(0) {}
+
+  size_t OnMsg(ServerChannel*, int value) {
+    total_ += value;
+    return ipc::OnMsgLoopNext;
+  }
+
+  int total_;
+};
+
+class TotalMsg : public DispTestMsg,
+                 public ipc::MsgIn<91, TotalMsg, ServerChannel>,
+                 public ipc::MsgOut<ServerChannel> {
+public:
+  explicit TotalMsg(const AddMsg* add) : add_(add) {}
+
+  size_t OnMsg(ServerChannel* ch, int) {
+    return SendMsg(92, ch, add_->total_);
+  }
+
+  const AddMsg* add_;
+};
+
+// The server side of one connection. It owns its transport.
+class Session {
+public:
+  Session(ServerCtx* ctx, int fd) : ctx_(ctx), total_(&add_) {
+    transport_.OpenServer(fd);
+  }
+
+  PipeTransport* transport() { return &transport_; }
+
+  Session* MsgHandler(int) {
+    return this;
+  }
+
+  // Serves the new connection from the same pool.
+  void* OnNewTransport() {
+    PipePair pp;
+    Session* session = new Session(ctx_, pp.fd1());
+    if (!ctx_->pool->Add(session->transport(), session)) {
+      delete session;
+      return NULL;
+    }
+    return reinterpret_cast<void*>(pp.fd2());
+  }
+
+  size_t OnMsgIn(int msg_id, ServerChannel* ch, const ipc::WireType* const args[], int count) {
+    if (msg_id == 90)
+      return add_.OnMsgIn(msg_id, ch, args, count);
+    return total_.OnMsgIn(msg_id, ch, args, count);
+  }
+
+  void OnClose(size_t rc) {
+    if (rc == ipc::RcErrTransportRead)
+      ipc::AtomicIncrement(&ctx_->closed_eof);
+    else if (rc == ipc::RcOK)
+      ipc::AtomicIncrement(&ctx_->closed_stop);
+    else
+      ipc::AtomicIncrement(&ctx_->closed_other);
+    ::close(transport_.fd());
+    ServerCtx* ctx = ctx_;
+    delete this;
+    ctx->closed.Post();
+  }
+
+private:
+  ServerCtx* ctx_;
+  PipeTransport transport_;
+  AddMsg add_;
+  TotalMsg total_;
+};
+
+class ClientSender : public ipc::MsgOut<PipeChannel> {
+public:
+  size_t Add(PipeChannel* ch, int value) {
+    return SendMsg(90, ch, value);
+  }
+
+  size_t AskTotal(PipeChannel* ch) {
+    return SendMsg(91, ch, 0);
+  }
+};
+
+class TotalReply : public DispTestMsg,
+                   public ipc::MsgIn<92, TotalReply, PipeChannel> {
+public:
+  TotalReply() : total_(0) {}
+
+  size_t OnMsg(PipeChannel*, int total) {
+    total_ = total;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  TotalReply* MsgHandler(int) {
+    return this;
+  }
+
+  int total_;
+};
+
+typedef PipeClient<PipeChannel> Client;
+
+// Sends a few values and returns the total that the server has for them so far.
+int AddAndAsk(Client* client, int value) {
+  ClientSender sender;
+  for (int ix = 0; ix != kAddsPerRound; ++ix) {
+    if (sender.Add(&client->channel, value) != ipc::RcOK)
+      return -1;
+  }
+  if (sender.AskTotal(&client->channel) != ipc::RcOK)
+    return -1;
+  TotalReply reply;
+  if (client->channel.Receive(&reply) != ipc::OnMsgReady)
+    return -1;
+  return reply.total_;
+}
+
+struct Adder {
+  ServerCtx* ctx;
+  volatile long added;
+};
+
+// Adds connections, closing the client end of each right away, until the pool refuses one.
+void AddUntilStopped(void* ctx) {
+  Adder* adder = reinterpret_cast<Adder*>(ctx);
+  for (;;) {
+    PipePair pp;
+    Session* session = new Session(adder->ctx, pp.fd1());
+    const bool added = adder->ctx->pool->Add(session->transport(), session);
+    ::close(pp.fd2());
+    if (!added) {
+      ::close(pp.fd1());
+      delete session;
+      return;
+    }
+    ipc::AtomicIncrement(&adder->added);
+  }
+}
+
+}  // namespace.
+
+int TestServicePool() {
+  ServerCtx ctx;
+  PipePool pool(2);
+  ctx.pool = &pool;
+
+  Client* clients[kNumConnections];
+  for (int ix = 0; ix != kNumConnections; ++ix) {
+    PipePair pp;
+    Session* session = new Session(&ctx, pp.fd1());
+    if (!pool.Add(session->transport(), session))
+      return 1;
+    clients[ix] = new Client;
+    clients[ix]->transport.OpenClient(pp.fd2());
+  }
+
+  // All the connections are open all the time and every one is used in each round.
+  for (int round = 1; round != 4; ++round) {
+    for (int ix = 0; ix != kNumConnections; ++ix) {
+      if (AddAndAsk(clients[ix], ix) != round * kAddsPerRound * ix)
+        return 2;
+    }
+  }
+
+  // A new connection asked for on an existing one is served by the same pool.
+  void* handle = clients[0]->channel.InitNewTransport();
+  if (!handle)
+    return 3;
+  Client extra;
+  extra.transport.OpenClient(static_cast<int>(reinterpret_cast<size_t>(handle)));
+  if (AddAndAsk(&extra, 5) != 5 * kAddsPerRound)
+    return 4;
+  if (AddAndAsk(clients[0], 1) != kAddsPerRound)
+    return 5;
+
+  // Closing the client end closes the server end. The last connection is left open.
+  for (int ix = 0; ix != kNumConnections - 1; ++ix) {
+    ::close(clients[ix]->transport.fd());
+    delete clients[ix];
+  }
+  ::close(extra.transport.fd());
+  for (int ix = 0; ix != kNumConnections; ++ix)
+    ctx.closed.Wait();
+
+  PipePool::Stats stats = pool.GetStats();
+  if ((stats.connections != kNumConnections + 1) || (stats.open != 1) || (stats.parked != 1))
+    return 6;
+  if (stats.runs < 3 * kNumConnections)
+    return 7;
+  if ((stats.max_queue_delay < 0) || (stats.total_queue_delay < stats.max_queue_delay))
+    return 8;
+
+  // Stopping the pool closes the connections that are left.
+  pool.Stop();
+  ctx.closed.Wait();
+  if (pool.Add(&clients[kNumConnections - 1]->transport, NULL))
+    return 9;
+  ::close(clients[kNumConnections - 1]->transport.fd());
+  delete clients[kNumConnections - 1];
+
+  if ((ctx.closed_eof != kNumConnections) || (ctx.closed_stop != 1) || ctx.closed_other)
+    return 10;
+  if (pool.GetStats().open != 0)
+    return 11;
+
+  // A connection added while another thread stops the pool is either refused or closed.
+  ServerCtx ctx2;
+  PipePool pool2(2);
+  ctx2.pool = &pool2;
+  Adder adder = { &ctx2, 0 };
+  ipc::Thread thread;
+  thread.Start(AddUntilStopped, &adder);
+  while (ipc::AtomicLoad(&adder.added) < kNumConnections) {}
+  pool2.Stop();
+  thread.Join();
+  if ((ctx2.closed_eof + ctx2.closed_stop != adder.added) || ctx2.closed_other)
+    return 12;
+  return 0;
+}
+
+#else
+
+int TestServicePool() {
+  return 0;
+}
+
+#endif  // defined(IPC_HAS_SERVICE_POOL)
@@ -0,0 +1,132 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include "ipc_test_helpers.h"
+#include "ipc_metrics.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the live stats query. A broker handles messages from a peer, which in between asks
+// the broker for its stats. The queries never reach the broker's dispatcher.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChannelMetrics>
+    BrokerChannel;
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PeerChannel;
+
+const int kNumEvents = 5;
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(160, 1) {
+  IPC_MSG_P1(int, Int32)                // 1 for an event, 0 to stop the broker.
+};
+
+namespace {
+
+class EventMsg : public DispTestMsg,
+                 public ipc::MsgIn<160, EventMsg, BrokerChannel> {
+public:
+  EventMsg() : events_(0), others_(0) {}
+
+  size_t OnMsg(BrokerChannel*, int event) {
+    if (!event)
+      return ipc::OnMsgReady;
+    ++events_;
+    return ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  EventMsg* MsgHandler(int msg_id) {
+    if (msg_id != 160)
+      ++others_;
+    return this;
+  }
+
+  int events_;
+  int others_;
+};
+
+struct BrokerCtx {
+  BrokerChannel* channel;
+  EventMsg broker;
+  size_t rc;
+};
+
+void BrokerThread(void* p) {
+  BrokerCtx* ctx = reinterpret_cast<BrokerCtx*>(p);
+  ctx->rc = ctx->channel->Receive(&ctx->broker);
+}
+
+}  // namespace.
+
+int TestStatsQuery() {
+  PipePair pp;
+  PipeTransport broker_transport;
+  broker_transport.OpenServer(pp.fd1());
+  BrokerChannel broker_channel(&broker_transport);
+  BrokerCtx ctx;
+  ctx.channel = &broker_channel;
+  ctx.rc = 0;
+  ipc::Thread broker;
+  if (!broker.Start(BrokerThread, &ctx))
+    return 1;
+
+  PipeTransport peer_transport;
+  peer_transport.OpenClient(pp.fd2());
+  PeerChannel peer(&peer_transport);
+  const ipc::WireView event[] = { ipc::WireView(1) };
+  for (int ix = 0; ix != kNumEvents; ++ix) {
+    if (peer.Send(160, event, 1) != ipc::RcOK)
+      return 2;
+  }
+
+  ipc::ChannelStats stats;
+  if (peer.QueryStats(&stats) != ipc::RcOK)
+    return 3;
+  if ((stats.received != kNumEvents) || !stats.received_bytes || stats.sent)
+    return 4;
+  if ((stats.uptime_ns <= 0) || (stats.time_ns < stats.uptime_ns) ||
+      (stats.decoder_high_water < stats.received_bytes / kNumEvents))
+    return 5;
+  if ((stats.handler_max_ns <= 0) || (stats.handler_p50_ns > stats.handler_p99_ns) ||
+      (stats.handler_p99_ns > stats.handler_max_ns))
+    return 6;
+  if (stats.post_queued || stats.post_dropped || stats.credit_waiters)
+    return 7;
+
+  // The first answer was sent after it was made, so the second one counts it.
+  ipc::ChannelStats later;
+  if ((peer.QueryStats(&later) != ipc::RcOK) || (later.sent != 1) ||
+      (later.received != kNumEvents) || (later.time_ns <= stats.time_ns))
+    return 8;
+
+  const ipc::WireView stop[] = { ipc::WireView(0) };
+  if (peer.Send(160, stop, 1) != ipc::RcOK)
+    return 9;
+  broker.Join();
+  if ((ctx.rc != ipc::OnMsgReady) || (ctx.broker.events_ != kNumEvents) || ctx.broker.others_)
+    return 10;
+  return 0;
+}
@@ -20,6 +20,13 @@
 #include "ipc_channel.h"
 #include "ipc_codec.h"
 #include "ipc_msg_dispatch.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
 
 
 class TestTransport {
@@ -55,6 +62,109 @@ private:
   Store buf_;
 };
 
+// Keeps everything that is sent. The first Send() can be made to wait until the test
+// lets it go, and Receive() hands out all the data in one piece.
+class MemTransport {
+public:
+  MemTransport() : gated_(false), sends_(0), read_(false) {}
+
+  void GateFirstSend() { gated_ = true; }
+  void WaitForFirstSend() { started_.Wait(); }
+  void Open() { go_.Post(); }
+
+  size_t Send(const void* buf, size_t sz) {
+    if (gated_ && (sends_++ == 0)) {
+      started_.Post();
+      go_.Wait();
+    }
+    data_.Add(static_cast<const char*>(buf), sz);
+    return ipc::RcOK;
+  }
+
+  char* Receive(size_t* size) {
+    if (read_)
+      return NULL;
+    read_ = true;
+    *size = data_.size();
+    return data_.get();
+  }
+
+  const ipc::PodVector<char>& Data() const { return data_; }
+
+private:
+  bool gated_;
+  int sends_;
+  bool read_;
+  ipc::Semaphore started_;
+  ipc::Semaphore go_;
+  ipc::PodVector<char> data_;
+};
+
+// The server end of a pipe, served from a thread of its own while the test works the client
+// end. |EndT| is what the server reads the pipe through, like a channel or a MuxTransport.
+template <class EndT>
+class PipeServer {
+public:
+  typedef size_t (*ServeFn)(EndT* end, void* ctx);
+
+  PipeServer() : end_(&transport_), serve_(NULL), ctx_(NULL), rc_(0) {
+    transport_.OpenServer(pipes_.fd1());
+  }
+
+  EndT* end() { return &end_; }
+
+  // Connects |transport| to the other end of the pipe.
+  void Connect(PipeTransport* transport) {
+    transport->OpenClient(pipes_.fd2());
+  }
+
+  // Runs |serve| in the server thread.
+  bool Start(ServeFn serve, void* ctx) {
+    serve_ = serve;
+    ctx_ = ctx;
+    return thread_.Start(Run, this);
+  }
+
+  // Runs end()->Receive(dispatch) in the server thread.
+  template <class DispatchT>
+  bool Start(DispatchT* dispatch) {
+    return Start(&Receive<DispatchT>, dispatch);
+  }
+
+  // Waits for the server thread and returns what it returned.
+  size_t Join() {
+    thread_.Join();
+    return rc_;
+  }
+
+private:
+  template <class DispatchT>
+  static size_t Receive(EndT* end, void* dispatch) {
+    return end->Receive(static_cast<DispatchT*>(dispatch));
+  }
+
+  static void Run(void* p) {
+    PipeServer* server = reinterpret_cast<PipeServer*>(p);
+    server->rc_ = server->serve_(&server->end_, server->ctx_);
+  }
+
+  PipePair pipes_;
+  PipeTransport transport_;
+  EndT end_;
+  ServeFn serve_;
+  void* ctx_;
+  size_t rc_;
+  ipc::Thread thread_;
+};
+
+// The client end of a pipe with a channel on it.
+template <class ChannelT>
+struct PipeClient {
+  PipeClient() : channel(&transport) {}
+  PipeTransport transport;
+  ChannelT channel;
+};
+
 
 class DispTestMsg {
 public:
@@ -133,4 +243,21 @@ public:
   }
 };
 
+class TestMessage16: public ipc::MsgOut<TestChannel> {
+public:
+  size_t DoSend(TestChannel* ch, long long a, unsigned long long b, float c, double d) {
+    return SendMsg(16, ch, a, b, c, d);
+  }
+};
+
+class TestMessage17: public ipc::MsgOut<TestChannel> {
+public:
+  size_t DoSend(TestChannel* ch, const int a[], size_t a_len, const double b[], size_t b_len) {
+    ipc::Int32Array arr_a(a_len, a);
+    ipc::Float64Array arr_b(b_len, b);
+    ipc::UInt64Array arr_c(0, NULL);
+    return SendMsg(17, ch, arr_a, arr_b, arr_c);
+  }
+};
+
 #endif  // SIMPLE_IPC_TEST_HELPERS_H_
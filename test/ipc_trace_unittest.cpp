@@ -0,0 +1,181 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "os_includes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ipc_test_helpers.h"
+#include "ipc_trace.h"
+#include "ipc_sync.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the Chrome trace export. Both ends of a pipe are traced with their own tracer and
+// append to the same file, as a broker and a worker process would.
+
+namespace {
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChromeTracer>
+    TracedChannel;
+
+const int kNumCalls = 5;
+const char kTraceFile[] = "simple-ipc-test.trace";
+
+}  // namespace.
+
+DEFINE_IPC_MSG_CONV(130, 1) {
+  IPC_MSG_P1(int, Int32)                // Value, 0 to stop the server.
+};
+
+DEFINE_IPC_MSG_CONV(131, 1) {
+  IPC_MSG_P1(int, Int32)                // Value plus one.
+};
+
+namespace {
+
+class IncrementMsg : public DispTestMsg,
+                     public ipc::MsgIn<130, IncrementMsg, TracedChannel>,
+                     public ipc::MsgOut<TracedChannel> {
+public:
+  size_t OnMsg(TracedChannel* ch, int value) {
+    if (!value)
+      return ipc::OnMsgReady;
+    return SendMsg(131, ch, value + 1);
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  IncrementMsg* MsgHandler(int) {
+    return this;
+  }
+};
+
+class IncrementReply : public DispTestMsg,
+                       public ipc::MsgIn<131, IncrementReply, TracedChannel> {
+public:
+  IncrementReply() : value_(0) {}
+
+  size_t OnMsg(TracedChannel*, int value) {
+    value_ = value;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  IncrementReply* MsgHandler(int) {
+    return this;
+  }
+
+  int value_;
+};
+
+// Returns how many times |what| is in |text|.
+int CountOf(const char* text, const char* what) {
+  int count = 0;
+  for (const char* pos = strstr(text, what); pos; pos = strstr(pos + 1, what))
+    ++count;
+  return count;
+}
+
+}  // namespace.
+
+int TestChromeTrace() {
+  IncrementMsg handler;
+  PipeServer<TracedChannel> server;
+  if (!server.Start(&handler))
+    return 1;
+
+  PipeTransport client_transport;
+  server.Connect(&client_transport);
+  TracedChannel client_channel(&client_transport);
+  for (int ix = 1; ix <= kNumCalls; ++ix) {
+    const ipc::WireView value[] = { ipc::WireView(ix) };
+    if (client_channel.Send(130, value, 1) != ipc::RcOK)
+      return 2;
+    IncrementReply reply;
+    if ((client_channel.Receive(&reply) != ipc::OnMsgReady) || (reply.value_ != ix + 1))
+      return 3;
+  }
+  const ipc::WireView stop[] = { ipc::WireView(0) };
+  if (client_channel.Send(130, stop, 1) != ipc::RcOK)
+    return 4;
+  if (server.Join() != ipc::OnMsgReady)
+    return 5;
+
+  if (!ipc::ChromeTracer::StartFile(kTraceFile))
+    return 6;
+  if (!client_channel.metrics()->AppendTo(kTraceFile) ||
+      !server.end()->metrics()->AppendTo(kTraceFile))
+    return 7;
+  // What was written is not written again.
+  if (!client_channel.metrics()->AppendTo(kTraceFile))
+    return 8;
+
+  char text[64 * 1024];
+  FILE* file = fopen(kTraceFile, "rb");
+  if (!file)
+    return 9;
+  const size_t size = fread(text, 1, sizeof(text) - 1, file);
+  fclose(file);
+  remove(kTraceFile);
+  text[size] = 0;
+
+  if (strncmp(text, "[\n", 2) != 0)
+    return 10;
+  // The client sends kNumCalls + 1 requests and the server handles them and sends
+  // kNumCalls replies.
+  const int messages = 2 * kNumCalls + 1;
+  if ((CountOf(text, "\"name\":\"encode\"") != messages) ||
+      (CountOf(text, "\"name\":\"transport send\"") != messages) ||
+      (CountOf(text, "\"name\":\"dispatch\"") != messages))
+    return 11;
+  if ((CountOf(text, "\"name\":\"decode\"") < messages) ||
+      (CountOf(text, "\"name\":\"transport receive\"") < messages))
+    return 12;
+  if ((CountOf(text, "\"msg_id\":130}") < 3 * (kNumCalls + 1)) ||
+      (CountOf(text, "\"ph\":\"X\"") != CountOf(text, "\n") - 1))
+    return 13;
+  if (client_channel.metrics()->Dropped() || server.end()->metrics()->Dropped())
+    return 14;
+
+  // A full buffer drops the new spans until they are written out.
+  ipc::ChromeTracer small(4);
+  for (int ix = 0; ix != 10; ++ix)
+    small.OnSpan(ipc::SPAN_DISPATCH, 1, ix, ix + 1);
+  if (small.Dropped() != 6)
+    return 15;
+  if (!ipc::ChromeTracer::StartFile(kTraceFile) || !small.AppendTo(kTraceFile))
+    return 16;
+  for (int ix = 0; ix != 3; ++ix)
+    small.OnSpan(ipc::SPAN_DISPATCH, 2, ix, ix + 1);
+  if ((small.Dropped() != 6) || !small.AppendTo(kTraceFile))
+    return 17;
+  file = fopen(kTraceFile, "rb");
+  if (!file)
+    return 18;
+  const size_t small_size = fread(text, 1, sizeof(text) - 1, file);
+  fclose(file);
+  remove(kTraceFile);
+  text[small_size] = 0;
+  if ((CountOf(text, "\"msg_id\":1}") != 4) || (CountOf(text, "\"msg_id\":2}") != 3))
+    return 19;
+  return 0;
+}
@@ -16,8 +16,8 @@
 
 namespace {
 
-template <typename T, size_t N>
-bool ArrEqual(const T (&arr)[N], ipc::PodVector<T>& vec) {
+template <typename T, size_t N, size_t I>
+bool ArrEqual(const T (&arr)[N], ipc::PodVector<T, I>& vec) {
   if (vec.size() != N)
     return false;
   if (vec.capacity() <= N)
@@ -236,6 +236,56 @@ int TestPodVector() {
       return 28;
   }
 
+  {
+    ipc::PodVector<int, 4> vec;
+    if ((vec.get() == 0) || (vec.capacity() != 4))
+      return 29;
+    int* inline_buf = vec.get();
+    int b[] = {1, 2, 3};
+    vec.Add(b, countof(b));
+    if (!ArrEqual(b, vec) || (vec.get() != inline_buf))
+      return 30;
+
+    int c[] = {1, 2, 3, 4, 5, 6};
+    vec.Add(&c[3], 3);
+    if (!ArrEqual(c, vec) || (vec.get() == inline_buf))
+      return 31;
+
+    ipc::PodVector<int, 4> vec2;
+    vec2.Set(b, countof(b));
+    vec2.Swap(vec);
+    if (!ArrEqual(c, vec2) || !ArrEqual(b, vec) || (vec.get() != inline_buf))
+      return 32;
+
+    vec2.clear();
+    if ((vec2.size() != 0) || (vec2.capacity() != 4))
+      return 33;
+  }
+
+  {
+    // Bytes kept inline can hold numeric arrays.
+    struct Packed {
+      char c;
+      ipc::PodVector<char, 5> vec;
+    } packed;
+    if (reinterpret_cast<size_t>(packed.vec.get()) % sizeof(double))
+      return 34;
+  }
+
+  {
+    ipc::PodVector<int> vec;
+    int b[] = {1, 2, 3};
+    vec.Set(b, countof(b));
+    vec.pop_back();
+    if ((vec.size() != 2) || (vec[1] != 2))
+      return 35;
+    vec.pop_back();
+    vec.pop_back();
+    vec.pop_back();
+    if (vec.size() != 0)
+      return 36;
+  }
+
   return 0;
 }
 
@@ -344,6 +394,49 @@ int TestStringImpl(const ChT (&txt)[N1], const ChT (&tzt)[N2], const ChT (&non)[
   return 0;
 }
 
+int TestArena() {
+  ipc::Arena arena;
+  if (arena.capacity() != 0)
+    return 1;
+
+  char* small = static_cast<char*>(arena.Alloc(3));
+  char* large = static_cast<char*>(arena.Alloc(5000));
+  if (!small || !large || (reinterpret_cast<size_t>(large) % 8))
+    return 2;
+  memset(small, 1, 3);
+  memset(large, 2, 5000);
+
+  // Then it all fits in one block, which is reused.
+  arena.Reset();
+  const size_t capacity = arena.capacity();
+  if (capacity < 5008)
+    return 3;
+  char* first = static_cast<char*>(arena.Alloc(3));
+  char* second = static_cast<char*>(arena.Alloc(5000));
+  if (second != first + 8)
+    return 4;
+  arena.Reset();
+  if ((arena.Alloc(1) != first) || (arena.capacity() != capacity))
+    return 5;
+  return 0;
+}
+
+int TestNextCallId() {
+  int last = 0;
+  if ((ipc::NextCallId(&last) != 1) || (ipc::NextCallId(&last) != 2) || (last != 2))
+    return 1;
+  // The largest int is followed by 1, not by a negative id.
+  last = 0x7ffffffe;
+  if (ipc::NextCallId(&last) != 0x7fffffff)
+    return 2;
+  if ((ipc::NextCallId(&last) != 1) || (last != 1))
+    return 3;
+  last = -5;
+  if (ipc::NextCallId(&last) != 1)
+    return 4;
+  return 0;
+}
+
 int TestHolderString() {
   int rv1 = TestStringImpl("All the world I've seen before me passing by", "We the people", "");
   int rv2 = TestStringImpl(L"We the people", L"All the world I've seen before me passing by", L"");
@@ -47,6 +47,8 @@ void TestRunner(const char* test, int result) {
 int TestFixedArray();
 int TestPodVector();
 int TestHolderString();
+int TestArena();
+int TestNextCallId();
 int TestCodecRaw1();
 int TestCodecRaw2();
 int TestCodecRaw3();
@@ -55,10 +57,51 @@ int TestCodecRaw5();
 int TestCodecRaw6();
 int TestCodecRaw7();
 int TestCodecRaw8();
+int TestCodecRaw9();
+int TestCodecRaw10();
+int TestCodecRaw11();
+int TestCodecWireView();
 int TestForwardDispatch();
+int TestDispatchConvertError();
 int TestDispatchRoundTrip();
+int TestMsgRegistry();
+int TestMsgRegistryRoundTrip();
+int TestWideMsgRoundTrip();
 int TestRawPipeTransport();
 int TestFullRoundTrip();
+int TestPipelinedRoundTrip();
+int TestPipelinedWaitOrder();
+int TestSendQueue();
+int TestThreadSafeSend();
+int TestPostQueue();
+int TestChannelPost();
+int TestPoolDispatch();
+int TestCoCalls();
+int TestCoCallsFailure();
+int TestCoServerHandler();
+int TestFlowControlFail();
+int TestFlowControlBlock();
+int TestFlowControlHandOff();
+int TestLanesInterleave();
+int TestLanesReceiveOrder();
+int TestLanesChannel();
+int TestMuxSessions();
+int TestMuxStreams();
+int TestMuxClosedStreams();
+int TestServicePool();
+int TestPubSubFanOut();
+int TestPubSubSlowSubscriber();
+int TestResponseCache();
+int TestLatencyHistogram();
+int TestChannelMetrics();
+int TestOneWayLatency();
+int TestChromeTrace();
+int TestCaptureReplay();
+int TestCaptureLogFull();
+int TestZeroAllocRoundTrip();
+int TestSmallStringNoAlloc();
+int TestArenaNoAlloc();
+int TestStatsQuery();
 
 #if defined(WIN32)
 int wmain(int argc, wchar_t* argv[]) {
@@ -69,6 +112,8 @@ int main(int argc, char* const argv[]) {
   TEST_FN(TestFixedArray());
   TEST_FN(TestPodVector());
   TEST_FN(TestHolderString());
+  TEST_FN(TestArena());
+  TEST_FN(TestNextCallId());
   TEST_FN(TestCodecRaw1());
   TEST_FN(TestCodecRaw2());
   TEST_FN(TestCodecRaw3());
@@ -77,10 +122,51 @@ int main(int argc, char* const argv[]) {
   TEST_FN(TestCodecRaw6());
   TEST_FN(TestCodecRaw7());
   TEST_FN(TestCodecRaw8());
+  TEST_FN(TestCodecRaw9());
+  TEST_FN(TestCodecRaw10());
+  TEST_FN(TestCodecRaw11());
+  TEST_FN(TestCodecWireView());
   TEST_FN(TestForwardDispatch());
+  TEST_FN(TestDispatchConvertError());
   TEST_FN(TestDispatchRoundTrip());
+  TEST_FN(TestMsgRegistry());
+  TEST_FN(TestMsgRegistryRoundTrip());
+  TEST_FN(TestWideMsgRoundTrip());
   TEST_FN(TestRawPipeTransport());
   TEST_FN(TestFullRoundTrip());
+  TEST_FN(TestPipelinedRoundTrip());
+  TEST_FN(TestPipelinedWaitOrder());
+  TEST_FN(TestSendQueue());
+  TEST_FN(TestThreadSafeSend());
+  TEST_FN(TestPostQueue());
+  TEST_FN(TestChannelPost());
+  TEST_FN(TestPoolDispatch());
+  TEST_FN(TestCoCalls());
+  TEST_FN(TestCoCallsFailure());
+  TEST_FN(TestCoServerHandler());
+  TEST_FN(TestFlowControlFail());
+  TEST_FN(TestFlowControlBlock());
+  TEST_FN(TestFlowControlHandOff());
+  TEST_FN(TestLanesInterleave());
+  TEST_FN(TestLanesReceiveOrder());
+  TEST_FN(TestLanesChannel());
+  TEST_FN(TestMuxSessions());
+  TEST_FN(TestMuxStreams());
+  TEST_FN(TestMuxClosedStreams());
+  TEST_FN(TestServicePool());
+  TEST_FN(TestPubSubFanOut());
+  TEST_FN(TestPubSubSlowSubscriber());
+  TEST_FN(TestResponseCache());
+  TEST_FN(TestLatencyHistogram());
+  TEST_FN(TestChannelMetrics());
+  TEST_FN(TestOneWayLatency());
+  TEST_FN(TestChromeTrace());
+  TEST_FN(TestCaptureReplay());
+  TEST_FN(TestCaptureLogFull());
+  TEST_FN(TestZeroAllocRoundTrip());
+  TEST_FN(TestSmallStringNoAlloc());
+  TEST_FN(TestArenaNoAlloc());
+  TEST_FN(TestStatsQuery());
   printf("Test succeeded\n");
 	return 0;
 }
@@ -0,0 +1,120 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os_includes.h"
+#include "ipc_capture.h"
+#include "ipc_channel.h"
+#include "ipc_codec.h"
+#include "ipc_metrics.h"
+#include "mapped_file_unix.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Replays the received side of a wire capture through the decoder and prints, per message
+// id, how many messages there were and how long decoding them took. Use it to compare codec
+// changes on a real mix of messages:
+//
+//   ipc_replay [--paced] [--repeat N] capture_file
+//
+// The messages go to a handler that does nothing, so only the channel and the decoder are
+// measured. To measure real handlers, run ipc::ReplayTransport with their dispatcher.
+
+namespace {
+
+typedef ipc::Channel<ipc::ReplayTransport, ipc::Encoder, ipc::Decoder, 10, ipc::ChannelMetrics>
+    ReplayChannel;
+
+class NullDispatch {
+public:
+  NullDispatch* MsgHandler(int) {
+    return this;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  size_t OnMsgIn(int, ReplayChannel*, const ipc::WireType* const[], int) {
+    return ipc::OnMsgLoopNext;
+  }
+};
+
+int Usage() {
+  fprintf(stderr, "usage: ipc_replay [--paced] [--repeat N] capture_file\n");
+  return 2;
+}
+
+}  // namespace.
+
+int main(int argc, char* argv[]) {
+  ipc::ReplayPacing pacing = ipc::REPLAY_FAST;
+  int repeat = 1;
+  const char* path = NULL;
+  for (int ix = 1; ix != argc; ++ix) {
+    if (!strcmp(argv[ix], "--paced"))
+      pacing = ipc::REPLAY_PACED;
+    else if (!strcmp(argv[ix], "--repeat") && (ix + 1 != argc))
+      repeat = atoi(argv[++ix]);
+    else if (!path && (argv[ix][0] != '-'))
+      path = argv[ix];
+    else
+      return Usage();
+  }
+  if (!path || (repeat < 1))
+    return Usage();
+
+  MappedFile file;
+  ipc::CaptureReader reader;
+  if (!file.Open(path, true) || !reader.Attach(file.memory(), file.size())) {
+    fprintf(stderr, "ipc_replay: %s is not a capture\n", path);
+    return 1;
+  }
+  if (reader.Dropped())
+    fprintf(stderr, "ipc_replay: the capture is missing %ld frames\n", reader.Dropped());
+
+  ipc::ReplayTransport replay(&reader, pacing);
+  ReplayChannel channel(&replay);
+  NullDispatch dispatch;
+  long long elapsed = 0;
+  for (int run = 0; run != repeat; ++run) {
+    replay.Restart();
+    const long long start = ipc::ChannelMetrics::Now();
+    const size_t rc = channel.Receive(&dispatch);
+    elapsed += ipc::ChannelMetrics::Now() - start;
+    // The end of the capture is a read error.
+    if (rc != ipc::RcErrTransportRead) {
+      fprintf(stderr, "ipc_replay: replay failed with %d\n", static_cast<int>(rc));
+      return 1;
+    }
+  }
+
+  ipc::PodVector<ipc::MsgMetrics> report;
+  channel.metrics()->Collect(&report);
+  long long messages = 0;
+  printf("%8s %10s %12s %12s %12s\n", "msg id", "count", "bytes", "decode p50", "decode p99");
+  for (size_t ix = 0; ix != report.size(); ++ix) {
+    const ipc::MsgMetrics& metrics = report[ix];
+    messages += metrics.received;
+    printf("%8d %10lld %12lld %10lldns %10lldns\n", metrics.msg_id, metrics.received,
+           metrics.received_bytes, metrics.decode.ValueAtPercentile(50),
+           metrics.decode.ValueAtPercentile(99));
+  }
+  const double seconds = elapsed / 1e9;
+  printf("%lld messages in %.3f s", messages, seconds);
+  if (seconds > 0)
+    printf(", %.0f messages/s", messages / seconds);
+  printf("\n");
+  return 0;
+}